@@ -0,0 +1,249 @@
+/*
+ * clock_if.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "clock_if.h"
+
+static const clock_sample_t *_clock_at(const clock_disc_t *c, int i);
+static int64_t _clock_line(const clock_disc_t *c, int64_t mono_us);
+static int64_t _clock_corr(const clock_disc_t *c, int64_t mono_us);
+static int64_t _clock_out(const clock_disc_t *c, int64_t mono_us);
+static void _clock_fit(clock_disc_t *c);
+
+
+/*
+* @brief	i-th sample in the window, 0 is the oldest
+*/
+static const clock_sample_t *_clock_at(const clock_disc_t *c, int i)
+{
+	return &c->s[(c->head + CLOCK_WINDOW - c->count + i) % CLOCK_WINDOW];
+}
+
+/*
+* @brief	utc - mono on the line at mono_us
+*/
+static int64_t _clock_line(const clock_disc_t *c, int64_t mono_us)
+{
+	return c->off_us + (mono_us - c->t0_us) * c->rate_ppb / 1000000000LL;
+}
+
+/*
+* @brief	What's left of the correction being slewed out
+*/
+static int64_t _clock_corr(const clock_disc_t *c, int64_t mono_us)
+{
+	int64_t left = llabs(c->corr_us) - (mono_us - c->corr_mono_us) * CLOCK_SLEW_PPM / 1000000;
+
+	if (left <= 0) {
+		return 0;
+	}
+	return (c->corr_us < 0) ? -left : left;
+}
+
+static int64_t _clock_out(const clock_disc_t *c, int64_t mono_us)
+{
+	int64_t out = mono_us + _clock_line(c, mono_us) + _clock_corr(c, mono_us);
+
+	return (out < c->last_out_us) ? c->last_out_us : out;
+}
+
+/*
+* @brief	Least squares line through the window. The drift is only
+* 			re-estimated once the window spans CLOCK_MIN_SPAN_S, until
+* 			then the last estimate (or 0) is kept and only the offset moves.
+*/
+static void _clock_fit(clock_disc_t *c)
+{
+	const clock_sample_t *s0 = _clock_at(c, 0);
+	const clock_sample_t *sn = _clock_at(c, c->count - 1);
+	double mx = 0, my = 0, sxx = 0, sxy = 0, ss = 0, x, y, r, ppm;
+	bool rated = false;
+	int i;
+
+	// Relative to the oldest sample, so doubles keep the microseconds
+	for (i = 0; i < c->count; i++) {
+		mx += (_clock_at(c, i)->mono_us - s0->mono_us) / 1e6;
+		my += _clock_at(c, i)->off_us - s0->off_us;
+	}
+	mx /= c->count;
+	my /= c->count;
+
+	for (i = 0; i < c->count; i++) {
+		x = (_clock_at(c, i)->mono_us - s0->mono_us) / 1e6 - mx;
+		y = _clock_at(c, i)->off_us - s0->off_us - my;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	if (c->count >= 3 && sn->mono_us - s0->mono_us >= CLOCK_MIN_SPAN_S * 1000000LL) {
+		ppm = sxy / sxx;
+		if (ppm > CLOCK_MAX_PPM) ppm = CLOCK_MAX_PPM;
+		if (ppm < -CLOCK_MAX_PPM) ppm = -CLOCK_MAX_PPM;
+		c->rate_ppb = lround(ppm * 1000);
+		c->rated = true;
+		rated = true;
+	}
+
+	// Through the centroid
+	c->t0_us = s0->mono_us + (int64_t) llround(mx * 1e6);
+	c->off_us = s0->off_us + (int64_t) llround(my);
+
+	for (i = 0; i < c->count; i++) {
+		x = (_clock_at(c, i)->mono_us - s0->mono_us) / 1e6 - mx;
+		y = _clock_at(c, i)->off_us - s0->off_us - my;
+		r = y - x * c->rate_ppb / 1000.0;
+		ss += r * r;
+	}
+	c->rms_us = lround(sqrt(ss / c->count));
+	if (rated) {
+		c->rate_err_ppb = lround(2000 * sqrt(ss / (c->count - 2) / sxx));
+	}
+}
+
+void CLOCK_Reset(clock_disc_t *c)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+bool CLOCK_Sample(clock_disc_t *c, clock_src_t src, int64_t mono_us, int64_t utc_us)
+{
+	int64_t off = utc_us - mono_us, before = 0, d;
+	bool was_set = c->set, was_coarse = c->src == CLOCK_SRC_GPS_RTC;
+	bool fresh;
+
+	if (src >= CLOCK_SOURCES) {
+		return false;
+	}
+
+	// A worse source waits until the current one has gone quiet
+	fresh = c->set && mono_us - _clock_at(c, c->count - 1)->mono_us < CLOCK_HOLDOVER_S * 1000000LL;
+	if (fresh && src < c->src) {
+		return false;
+	}
+	if (c->seen[src] && mono_us - c->seen_us[src] < CLOCK_SPACING_S * 1000000LL) {
+		return false;
+	}
+	c->seen[src] = true;
+	c->seen_us[src] = mono_us;
+
+	if (c->set) {
+		before = _clock_out(c, mono_us);
+	}
+
+	if (!c->set || src != c->src) {
+		c->count = c->head = c->pending = 0;
+	}
+	else if (llabs(off - _clock_line(c, mono_us)) > CLOCK_GATE_US) {
+		if (c->pending == 0 || llabs(off - c->pend_off_us) > CLOCK_GATE_US) {
+			c->pending = 0;
+			c->pend_off_us = off;
+		}
+		if (++c->pending < CLOCK_GATE_N) {
+			c->rejected++;
+			return false;
+		}
+		// They agree with each other, not with us: start over from here
+		c->count = c->head = c->pending = 0;
+	}
+	else {
+		c->pending = 0;
+	}
+
+	c->s[c->head].mono_us = mono_us;
+	c->s[c->head].off_us = off;
+	c->head = (c->head + 1) % CLOCK_WINDOW;
+	if (c->count < CLOCK_WINDOW) {
+		c->count++;
+	}
+	c->src = src;
+	c->set = true;
+	c->accepted++;
+	_clock_fit(c);
+
+	// Slew from where we were to the new line, or step
+	c->corr_us = 0;
+	c->corr_mono_us = mono_us;
+	if (!was_set) {
+		c->last_out_us = 0;
+		return true;
+	}
+	d = before - (mono_us + _clock_line(c, mono_us));
+	if (llabs(d) > CLOCK_STEP_US) {
+		c->steps++;
+		if (was_coarse && src != CLOCK_SRC_GPS_RTC) {
+			c->last_out_us = 0;		/* The RTC was wrong, don't hold for it */
+		}
+	}
+	else {
+		c->corr_us = d;
+	}
+	return true;
+}
+
+clock_quality_t CLOCK_Now(clock_disc_t *c, int64_t mono_us, int64_t *utc_us, uint32_t *err_us)
+{
+	static const clock_quality_t quality[CLOCK_SOURCES] = {
+		[CLOCK_SRC_GPS_RTC] = CLOCK_Q_COARSE,
+		[CLOCK_SRC_SNTP] = CLOCK_Q_SNTP,
+		[CLOCK_SRC_GPS] = CLOCK_Q_GPS,
+	};
+	static const int64_t sample_err[CLOCK_SOURCES] = {
+		[CLOCK_SRC_GPS_RTC] = CLOCK_RTC_ERR_US,
+		[CLOCK_SRC_SNTP] = CLOCK_SNTP_ERR_US,
+		[CLOCK_SRC_GPS] = CLOCK_GPS_ERR_US,
+	};
+	clock_quality_t q;
+	int64_t out, age, err;
+
+	if (!c->set) {
+		*utc_us = 0;
+		if (err_us) {
+			*err_us = UINT32_MAX;
+		}
+		return CLOCK_Q_NONE;
+	}
+
+	out = _clock_out(c, mono_us);
+	c->last_out_us = out;
+
+	age = mono_us - _clock_at(c, c->count - 1)->mono_us;
+	if (age < 0) {
+		age = 0;
+	}
+	q = quality[c->src];
+	if (q != CLOCK_Q_COARSE && age > CLOCK_HOLDOVER_S * 1000000LL) {
+		q = CLOCK_Q_HOLDOVER;
+	}
+
+	if (err_us) {
+		// Source, scatter, distance from the line (slew or hold), drift since the last sample
+		err = sample_err[c->src] + 2LL * c->rms_us + llabs(out - mono_us - _clock_line(c, mono_us))
+			+ age * (c->rated ? CLOCK_WANDER_PPM * 1000LL + c->rate_err_ppb : CLOCK_MAX_PPM * 1000LL) / 1000000000;
+		*err_us = (err > UINT32_MAX) ? UINT32_MAX : err;
+	}
+
+	*utc_us = out;
+	return q;
+}
+
+int64_t CLOCK_FromCivil(int year, int month, int day, int hour, int min, int sec)
+{
+	int64_t era, yoe, doy, doe;
+
+	// Days since 1970-01-01 in the proleptic Gregorian calendar, years starting in March
+	year -= month <= 2;
+	era = ((year >= 0) ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (era * 146097 + doe - 719468) * 86400 + hour * 3600 + min * 60 + sec;
+}
@@ -0,0 +1,218 @@
+/*
+ * cmd_if.c
+ *
+ * Notes:
+ * 		The MQTT event handler only copies the payload into a job and
+ * 		queues it. Parsing, lookup and the handler itself run on cmd_task,
+ * 		so a slow command (HTTP, flash) never stalls the MQTT client.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "app_utils.h"
+#include "mqtt_if.h"
+#include "cmd_if.h"
+
+#define CMD_MAX_COMMANDS	16
+#define CMD_TASK_STACK		4096
+#define CMD_TASK_PRIO		2
+#define CMD_REPLY_LEN		(CMD_REQ_ID_LEN + 64)
+
+typedef struct {
+	int64_t arrived_us;
+	int len;
+	char data[];
+} cmd_job_t;
+
+static const char *TAG = "CMD";
+static QueueHandle_t cmd_queue = NULL;
+static cmd_t commands[CMD_MAX_COMMANDS];
+static int command_count = 0;
+static cmd_stats_t cmd_stats;	/* Updated from the MQTT client task and cmd_task */
+static portMUX_TYPE cmd_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void cmd_task(void *pvParameters);
+static void _cmd_dispatch(cmd_job_t *job);
+static void _cmd_count(uint32_t *counter);
+static void _cmd_max(uint32_t *max, uint32_t val);
+
+
+static void _cmd_count(uint32_t *counter)
+{
+	portENTER_CRITICAL(&cmd_mux);
+	(*counter)++;
+	portEXIT_CRITICAL(&cmd_mux);
+}
+
+static void _cmd_max(uint32_t *max, uint32_t val)
+{
+	portENTER_CRITICAL(&cmd_mux);
+	if (val > *max) {
+		*max = val;
+	}
+	portEXIT_CRITICAL(&cmd_mux);
+}
+
+esp_err_t CMD_Register(const cmd_t *cmd)
+{
+	if (command_count >= CMD_MAX_COMMANDS) {
+		return ESP_ERR_NO_MEM;
+	}
+	commands[command_count++] = *cmd;
+	return ESP_OK;
+}
+
+esp_err_t CMD_Submit(const char *data, int len)
+{
+	int64_t start = esp_timer_get_time();
+	cmd_job_t *job;
+	uint32_t took;
+
+	_cmd_count(&cmd_stats.received);
+	if (cmd_queue == NULL || len <= 0 || len >= CMD_MAX_LEN) {
+		_cmd_count(&cmd_stats.dropped);
+		return ESP_FAIL;
+	}
+
+	if ((job = malloc(sizeof(cmd_job_t) + len + 1)) == NULL) {
+		_cmd_count(&cmd_stats.dropped);
+		return ESP_FAIL;
+	}
+	job->arrived_us = start;
+	job->len = len;
+	memcpy(job->data, data, len);
+	job->data[len] = '\0';
+
+	if (xQueueSend(cmd_queue, &job, 0) != pdTRUE) {
+		ESP_LOGW(TAG, "Queue full, dropping: %s", job->data);
+		free(job);
+		_cmd_count(&cmd_stats.dropped);
+		return ESP_FAIL;
+	}
+
+	took = esp_timer_get_time() - start;
+	_cmd_max(&cmd_stats.max_submit_us, took);
+	return ESP_OK;
+}
+
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg)
+{
+	char topic[64];
+	char reply[CMD_REPLY_LEN];
+
+	sprintf(topic, MQTT_ACK_TOPIC_TMPLT, DEVICE_MAC);
+	if (ctx != NULL && ctx->req_id[0] != '\0') {
+		snprintf(reply, sizeof(reply), "@%s %s", ctx->req_id, msg);
+		msg = reply;
+	}
+	return MQTT_Publish_General(topic, msg, qos);
+}
+
+void CMD_Progress(const cmd_ctx_t *ctx, const char *name, int pct)
+{
+	char msg[48];
+
+	snprintf(msg, sizeof(msg), "%s progress %d", name, pct);
+	CMD_Reply(ctx, 0, msg);
+}
+
+void CMD_GetStats(cmd_stats_t *stats)
+{
+	portENTER_CRITICAL(&cmd_mux);
+	*stats = cmd_stats;
+	portEXIT_CRITICAL(&cmd_mux);
+}
+
+/*
+* @brief	Split, look up and run one command
+*/
+static void _cmd_dispatch(cmd_job_t *job)
+{
+	cmd_ctx_t ctx = { .req_id = "" };
+	char *argv[CMD_MAX_ARGS];
+	char *save = NULL;
+	char *tok;
+	char err_msg[48];
+	int argc = 0;
+	int64_t start;
+	uint32_t took;
+	esp_err_t err;
+	const cmd_t *cmd = NULL;
+
+	for (tok = strtok_r(job->data, " \r\n", &save); tok != NULL && argc < CMD_MAX_ARGS;
+		 tok = strtok_r(NULL, " \r\n", &save)) {
+		// Leading "@id" is the request id, not part of the command
+		if (argc == 0 && tok[0] == '@' && ctx.req_id[0] == '\0') {
+			strlcpy(ctx.req_id, tok + 1, CMD_REQ_ID_LEN);
+			continue;
+		}
+		argv[argc++] = tok;
+	}
+	if (argc == 0) {
+		return;
+	}
+
+	for (int i = 0; i < command_count; i++) {
+		if (strcmp(argv[0], commands[i].name) == 0) {
+			cmd = &commands[i];
+			break;
+		}
+	}
+	// tok is left set if there were more than CMD_MAX_ARGS tokens
+	if (cmd == NULL || tok != NULL || argc - 1 < cmd->min_args || argc - 1 > cmd->max_args) {
+		ESP_LOGW(TAG, "Unknown command or bad arguments: %s (%d args)", argv[0], argc - 1);
+		_cmd_count(&cmd_stats.unknown);
+		if (ctx.req_id[0] != '\0') {
+			snprintf(err_msg, sizeof(err_msg), "%.20s err invalid", argv[0]);
+			CMD_Reply(&ctx, CONFIG_MQTT_ACK_QOS, err_msg);
+		}
+		return;
+	}
+
+	start = esp_timer_get_time();
+	took = start - job->arrived_us;
+	_cmd_max(&cmd_stats.max_queue_us, took);
+
+	err = cmd->handler(&ctx, argc, argv);
+
+	took = esp_timer_get_time() - start;
+	_cmd_max(&cmd_stats.max_handler_us, took);
+	_cmd_count(&cmd_stats.handled);
+	ESP_LOGI(TAG, "%s handled in %u us [%s]", cmd->name, took, esp_err_to_name(err));
+
+	if (err != ESP_OK) {
+		snprintf(err_msg, sizeof(err_msg), "%s err %d", cmd->name, err);
+		CMD_Reply(&ctx, CONFIG_MQTT_ACK_QOS, err_msg);
+	}
+}
+
+static void cmd_task(void *pvParameters)
+{
+	cmd_job_t *job;
+
+	for (;;) {
+		if (xQueueReceive(cmd_queue, &job, portMAX_DELAY) == pdTRUE) {
+			ESP_LOGI(TAG, "Command: %s", job->data);
+			_cmd_dispatch(job);
+			free(job);
+		}
+	}
+}
+
+void CMD_Initialize(void)
+{
+	if (cmd_queue != NULL) {
+		return;
+	}
+	cmd_queue = xQueueCreate(CMD_QUEUE_LEN, sizeof(cmd_job_t *));
+	xTaskCreate(&cmd_task, "cmd_task", CMD_TASK_STACK, NULL, CMD_TASK_PRIO, NULL);
+}
@@ -0,0 +1,259 @@
+/*
+ * delta_if.c
+ *
+ * Notes:
+ * 		Applies a binary diff (see delta_if.h) while it downloads. The new
+ * 		image is rebuilt from the old one, which is read back from flash a
+ * 		DELTA_BUF_LEN chunk at a time, so RAM use doesn't depend on the
+ * 		image or patch size.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <string.h>
+#include "mbedtls/sha256.h"
+#include "esp_log.h"
+#include "delta_if.h"
+
+static const char *TAG = "DELTA";
+
+static esp_err_t _delta_emit(delta_t *d, const uint8_t *data, size_t len);
+static esp_err_t _delta_old(delta_t *d, const uint8_t *add, size_t len);
+static esp_err_t _delta_header(delta_t *d);
+static esp_err_t _delta_ctrl(delta_t *d);
+
+
+static uint32_t _le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+* @brief	Batch output into DELTA_BUF_LEN writes
+*/
+static esp_err_t _delta_emit(delta_t *d, const uint8_t *data, size_t len)
+{
+	esp_err_t err;
+	size_t n;
+
+	if (d->out_len + len > d->new_size) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	while (len > 0) {
+		n = DELTA_BUF_LEN - d->out_fill;
+		n = (len < n) ? len : n;
+		memcpy(d->out + d->out_fill, data, n);
+		d->out_fill += n;
+		d->out_len += n;
+		data += n;
+		len -= n;
+		if (d->out_fill == DELTA_BUF_LEN) {
+			if ((err = d->write(d->arg, d->out, d->out_fill)) != ESP_OK) {
+				return err;
+			}
+			d->out_fill = 0;
+		}
+	}
+	return ESP_OK;
+}
+
+/*
+* @brief	Emit len bytes of the old image at old_pos, plus add[] if given
+*/
+static esp_err_t _delta_old(delta_t *d, const uint8_t *add, size_t len)
+{
+	esp_err_t err;
+
+	if (d->old_pos + len > d->old_size) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if ((err = esp_partition_read(d->src, d->old_pos, d->old, len)) != ESP_OK) {
+		return err;
+	}
+	if (add != NULL) {
+		for (size_t i = 0; i < len; i++) {
+			d->old[i] += add[i];
+		}
+	}
+	d->old_pos += len;
+	d->diff_left -= len;
+	return _delta_emit(d, d->old, len);
+}
+
+/*
+* @brief	Parse the header and make sure we hold the image it was made for
+*/
+static esp_err_t _delta_header(delta_t *d)
+{
+	mbedtls_sha256_context ctx;
+	uint8_t sha[SHA256_HASH_LEN];
+	uint32_t off, n;
+	esp_err_t err = ESP_OK;
+
+	if (memcmp(d->hdr, DELTA_MAGIC, 4) != 0) {
+		ESP_LOGE(TAG, "Not a patch");
+		return ESP_ERR_INVALID_STATE;
+	}
+	d->new_size = _le32(d->hdr + 4);
+	d->old_size = _le32(d->hdr + 8);
+	if (d->old_size > d->src->size) {
+		return ESP_ERR_INVALID_VERSION;
+	}
+
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	for (off = 0; off < d->old_size && err == ESP_OK; off += n) {
+		n = (d->old_size - off > DELTA_BUF_LEN) ? DELTA_BUF_LEN : d->old_size - off;
+		err = esp_partition_read(d->src, off, d->old, n);
+		mbedtls_sha256_update_ret(&ctx, d->old, n);
+	}
+	mbedtls_sha256_finish_ret(&ctx, sha);
+	mbedtls_sha256_free(&ctx);
+
+	if (err != ESP_OK || memcmp(sha, d->hdr + 12, SHA256_HASH_LEN) != 0) {
+		print_sha256(sha, "Running image SHA-256");
+		ESP_LOGE(TAG, "Patch was made against a different image");
+		return ESP_ERR_INVALID_VERSION;
+	}
+	ESP_LOGI(TAG, "Patch %u -> %u bytes", d->old_size, d->new_size);
+	return ESP_OK;
+}
+
+static esp_err_t _delta_ctrl(delta_t *d)
+{
+	d->diff_left = _le32(d->hdr);
+	d->extra_left = _le32(d->hdr + 4);
+	d->seek = (int32_t) _le32(d->hdr + 8);
+	if (d->out_len + d->diff_left + d->extra_left > d->new_size) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	return ESP_OK;
+}
+
+esp_err_t DELTA_Begin(delta_t *d, const esp_partition_t *src, delta_write_fn_t write, void *arg)
+{
+	memset(d, 0, sizeof(delta_t));
+	d->state = DELTA_STATE_HEADER;
+	d->src = src;
+	d->write = write;
+	d->arg = arg;
+	return ESP_OK;
+}
+
+esp_err_t DELTA_Feed(delta_t *d, const uint8_t *data, size_t len)
+{
+	esp_err_t err = ESP_OK;
+	size_t n, want;
+	uint8_t tok;
+
+	while (err == ESP_OK && (len > 0 || d->state == DELTA_STATE_TOKEN)) {
+		switch (d->state) {
+		case DELTA_STATE_HEADER:
+		case DELTA_STATE_CTRL:
+			want = (d->state == DELTA_STATE_HEADER) ? DELTA_HEADER_LEN : DELTA_CTRL_LEN;
+			n = want - d->hdr_len;
+			n = (len < n) ? len : n;
+			memcpy(d->hdr + d->hdr_len, data, n);
+			d->hdr_len += n;
+			data += n;
+			len -= n;
+			if (d->hdr_len < want) {
+				break;
+			}
+			d->hdr_len = 0;
+			if (d->state == DELTA_STATE_HEADER) {
+				err = _delta_header(d);
+				d->state = DELTA_STATE_CTRL;
+			}
+			else {
+				err = _delta_ctrl(d);
+				d->state = DELTA_STATE_TOKEN;
+			}
+			break;
+
+		case DELTA_STATE_TOKEN:
+			// Diff block finished (or empty): move on to the extra bytes
+			if (d->diff_left == 0) {
+				d->state = (d->extra_left > 0) ? DELTA_STATE_EXTRA : DELTA_STATE_DONE;
+				if (d->state == DELTA_STATE_DONE) {
+					d->old_pos += d->seek;
+				}
+				break;
+			}
+			if (len == 0) {
+				return ESP_OK;
+			}
+			tok = *data++;
+			len--;
+			n = (tok & 0x7f) + 1;
+			if (n > d->diff_left) {
+				return ESP_ERR_INVALID_STATE;
+			}
+			if (tok & 0x80) {
+				// Run of unchanged bytes, no patch data needed
+				while (err == ESP_OK && n > 0) {
+					want = (n > DELTA_BUF_LEN) ? DELTA_BUF_LEN : n;
+					err = _delta_old(d, NULL, want);
+					n -= want;
+				}
+			}
+			else {
+				d->lit_left = n;
+				d->state = DELTA_STATE_DIFF;
+			}
+			break;
+
+		case DELTA_STATE_DIFF:
+			n = (len < d->lit_left) ? len : d->lit_left;
+			n = (n > DELTA_BUF_LEN) ? DELTA_BUF_LEN : n;
+			err = _delta_old(d, data, n);
+			d->lit_left -= n;
+			data += n;
+			len -= n;
+			if (d->lit_left == 0) {
+				d->state = DELTA_STATE_TOKEN;
+			}
+			break;
+
+		case DELTA_STATE_EXTRA:
+			n = (len < d->extra_left) ? len : d->extra_left;
+			err = _delta_emit(d, data, n);
+			d->extra_left -= n;
+			data += n;
+			len -= n;
+			if (d->extra_left == 0) {
+				d->old_pos += d->seek;
+				d->state = DELTA_STATE_DONE;
+			}
+			break;
+
+		case DELTA_STATE_DONE:
+			// Record applied: either the image is complete or another follows
+			if (d->out_len == d->new_size) {
+				ESP_LOGW(TAG, "%u trailing bytes ignored", (unsigned) len);
+				return ESP_OK;
+			}
+			d->state = DELTA_STATE_CTRL;
+			break;
+		}
+	}
+	return err;
+}
+
+esp_err_t DELTA_Finish(delta_t *d)
+{
+	esp_err_t err;
+
+	if (d->out_fill > 0) {
+		if ((err = d->write(d->arg, d->out, d->out_fill)) != ESP_OK) {
+			return err;
+		}
+		d->out_fill = 0;
+	}
+	if (d->state == DELTA_STATE_HEADER || d->out_len != d->new_size) {
+		ESP_LOGE(TAG, "Patch truncated (%u of %u bytes)", d->out_len, d->new_size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	return ESP_OK;
+}
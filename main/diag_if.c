@@ -0,0 +1,171 @@
+/*
+ * diag_if.c
+ *
+ * Notes:
+ * 		Reset diagnostics. The record lives in RTC slow memory, which keeps
+ * 		its contents through panics, watchdog and software resets and
+ * 		brownouts, and is checked with a CRC on the way back. A power cycle
+ * 		clears it, so it's also copied to NVS ("diag"/"rec") now and then.
+ *
+ * 		After boot the previous run's record is published on the ack topic
+ * 		as "diag <reset reason> <hex>"; main/diagdecode.py turns that back
+ * 		into breadcrumbs.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "rom/crc.h"
+#include "nvs.h"
+#include "cmd_if.h"
+#include "mqtt_if.h"
+#include "diag_if.h"
+
+#define DIAG_FLUSH_MIN_S	300		/* Rate limit for NVS writes */
+
+static const char *TAG = "DIAG";
+static const char diag_nvs_namespace[] = "diag";
+
+static RTC_NOINIT_ATTR diag_rtc_t diag_rtc;
+static diag_rtc_t diag_prev;
+static bool have_prev = false;
+static bool published = false;
+static bool dirty = false;
+static int64_t last_flush_us = 0;
+static esp_reset_reason_t boot_reason;
+static portMUX_TYPE diag_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t _diag_crc(const diag_rtc_t *rec);
+static bool _diag_valid(const diag_rtc_t *rec);
+
+
+static uint32_t _diag_crc(const diag_rtc_t *rec)
+{
+	return crc32_le(0, (const uint8_t *) rec, offsetof(diag_rtc_t, crc));
+}
+
+static bool _diag_valid(const diag_rtc_t *rec)
+{
+	return rec->magic == DIAG_MAGIC && rec->crc == _diag_crc(rec);
+}
+
+void DIAG_Crumb(diag_kind_t kind, int32_t code)
+{
+	diag_crumb_t *c;
+	uint32_t heap = esp_get_minimum_free_heap_size();
+	uint32_t uptime = esp_timer_get_time() / 1000000;
+
+	portENTER_CRITICAL(&diag_mux);
+	c = &diag_rtc.ring[diag_rtc.head % DIAG_RING_LEN];
+	c->uptime_s = uptime;
+	c->kind = kind;
+	c->code = code;
+	diag_rtc.head++;
+	diag_rtc.min_heap = heap;
+	diag_rtc.crc = _diag_crc(&diag_rtc);
+	dirty = true;
+	portEXIT_CRITICAL(&diag_mux);
+}
+
+void DIAG_SetError(diag_src_t src, int32_t code)
+{
+	portENTER_CRITICAL(&diag_mux);
+	diag_rtc.last_err[src] = code;
+	portEXIT_CRITICAL(&diag_mux);
+
+	DIAG_Crumb(DIAG_ERR_MQTT + src, code);
+}
+
+void DIAG_TaskRun(const char *name)
+{
+	portENTER_CRITICAL(&diag_mux);
+	strlcpy(diag_rtc.last_task, name, DIAG_TASK_LEN);
+	diag_rtc.crc = _diag_crc(&diag_rtc);
+	portEXIT_CRITICAL(&diag_mux);
+}
+
+void DIAG_Flush(bool force)
+{
+	diag_rtc_t rec;
+	nvs_handle handle;
+	int64_t now = esp_timer_get_time();
+
+	if (!dirty || (!force && last_flush_us != 0 && now - last_flush_us < DIAG_FLUSH_MIN_S * 1000000LL)) {
+		return;
+	}
+	portENTER_CRITICAL(&diag_mux);
+	rec = diag_rtc;
+	dirty = false;
+	portEXIT_CRITICAL(&diag_mux);
+
+	if (nvs_open(diag_nvs_namespace, NVS_READWRITE, &handle) == ESP_OK) {
+		nvs_set_blob(handle, "rec", &rec, sizeof(rec));
+		nvs_commit(handle);
+		nvs_close(handle);
+	}
+	last_flush_us = now;
+}
+
+void DIAG_Publish(void)
+{
+	char *msg;
+	const uint8_t *p = (const uint8_t *) &diag_prev;
+	int len, err;
+
+	if (!have_prev || published) {
+		return;
+	}
+	if ((msg = malloc(2 * sizeof(diag_rtc_t) + 32)) == NULL) {
+		return;
+	}
+	len = sprintf(msg, "diag %d ", boot_reason);
+	for (int i = 0; i < sizeof(diag_rtc_t); i++) {
+		len += sprintf(msg + len, "%02x", p[i]);
+	}
+	err = CMD_Reply(NULL, CONFIG_MQTT_ACK_QOS, msg);
+	if (err >= 0 || err == MQTT_PUB_QUEUED) {
+		published = true;
+	}
+	free(msg);
+}
+
+void DIAG_Initialize(void)
+{
+	nvs_handle handle;
+	size_t sz = sizeof(diag_prev);
+
+	boot_reason = esp_reset_reason();
+
+	if (_diag_valid(&diag_rtc)) {
+		diag_prev = diag_rtc;
+		have_prev = true;
+	}
+	else if (nvs_open(diag_nvs_namespace, NVS_READONLY, &handle) == ESP_OK) {
+		// Power cycle: fall back to the last copy that made it to flash
+		have_prev = (nvs_get_blob(handle, "rec", &diag_prev, &sz) == ESP_OK &&
+					 sz == sizeof(diag_prev) && _diag_valid(&diag_prev));
+		nvs_close(handle);
+	}
+
+	if (have_prev) {
+		ESP_LOGW(TAG, "Reset reason %d after boot %u, last task %.*s, min heap %u, errors mqtt %d sd %d wifi %d",
+				 boot_reason, diag_prev.boots, DIAG_TASK_LEN, diag_prev.last_task, diag_prev.min_heap,
+				 diag_prev.last_err[DIAG_SRC_MQTT], diag_prev.last_err[DIAG_SRC_SD],
+				 diag_prev.last_err[DIAG_SRC_WIFI]);
+	}
+
+	memset(&diag_rtc, 0, sizeof(diag_rtc));
+	diag_rtc.magic = DIAG_MAGIC;
+	diag_rtc.boots = have_prev ? diag_prev.boots + 1 : 1;
+	DIAG_Crumb(DIAG_BOOT, boot_reason);
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# diagdecode.py
+#
+# Decode the "diag <reset reason> <hex>" message a device publishes on its
+# ack topic after boot (see include/diag_if.h for the record layout).
+#
+#   python3 diagdecode.py "diag 4 47414944..."
+#
+#  Created on: Oct 19, 2026
+#      Author: tombo
+#
+
+import struct
+import sys
+import zlib
+
+MAGIC = 0x44494147
+RING_LEN = 16
+TASK_LEN = 12
+HEADER = struct.Struct("<IIII%dsiii" % TASK_LEN)
+CRUMB = struct.Struct("<IB3xi")
+
+# esp_reset_reason_t
+REASONS = ["unknown", "power on", "external", "software", "panic", "interrupt wdt",
+           "task wdt", "other wdt", "deep sleep", "brownout", "sdio"]
+# diag_kind_t
+KINDS = ["boot", "mqtt error", "sd error", "wifi error", "watchdog", "ota"]
+WDT_COMPONENTS = ["data", "pm", "gps", "mqtt", "wifi"]
+
+
+def decode(raw):
+    size = HEADER.size + RING_LEN * CRUMB.size + 4
+    if len(raw) != size:
+        raise ValueError("record is %d bytes, expected %d" % (len(raw), size))
+    magic, boots, head, min_heap, task, e_mqtt, e_sd, e_wifi = HEADER.unpack_from(raw)
+    crc, = struct.unpack_from("<I", raw, size - 4)
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%08x" % magic)
+    if crc != zlib.crc32(raw[:size - 4]):
+        raise ValueError("bad CRC")
+
+    # Oldest first: once the ring has wrapped, it starts at head
+    count = min(head, RING_LEN)
+    crumbs = []
+    for i in range(head - count, head):
+        uptime, kind, code = CRUMB.unpack_from(raw, HEADER.size + (i % RING_LEN) * CRUMB.size)
+        crumbs.append((uptime, kind, code))
+
+    return {
+        "boots": boots,
+        "min_heap": min_heap,
+        "last_task": task.split(b"\0")[0].decode(errors="replace"),
+        "last_err": {"mqtt": e_mqtt, "sd": e_sd, "wifi": e_wifi},
+        "dropped": head - count,
+        "crumbs": crumbs,
+    }
+
+
+def _describe(kind, code):
+    name = KINDS[kind] if kind < len(KINDS) else "kind %d" % kind
+    if kind == 0 and code < len(REASONS):
+        return "%s (%s)" % (name, REASONS[code])
+    if kind == 4 and code < len(WDT_COMPONENTS):
+        return "%s (%s)" % (name, WDT_COMPONENTS[code])
+    return "%s %d" % (name, code)
+
+
+def main():
+    words = " ".join(sys.argv[1:]).split()
+    if len(words) != 3 or words[0] != "diag":
+        print('usage: diagdecode.py "diag <reason> <hex>"')
+        return 1
+    reason = int(words[1])
+    rec = decode(bytes.fromhex(words[2]))
+
+    print("reset:     %s" % (REASONS[reason] if reason < len(REASONS) else reason))
+    print("boot:      %d" % rec["boots"])
+    print("last task: %s" % rec["last_task"])
+    print("min heap:  %d" % rec["min_heap"])
+    print("errors:    mqtt %(mqtt)d  sd %(sd)d  wifi %(wifi)d" % rec["last_err"])
+    if rec["dropped"]:
+        print("(%d older breadcrumbs dropped)" % rec["dropped"])
+    for uptime, kind, code in rec["crumbs"]:
+        print("  %8ds  %s" % (uptime, _describe(kind, code)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
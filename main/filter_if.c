@@ -0,0 +1,97 @@
+/*
+ * filter_if.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "filter_if.h"
+
+
+int32_t FILT_Median3(filt_median3_t *f, int32_t x)
+{
+	int32_t a, b, c;
+
+	f->x[0] = f->x[1];
+	f->x[1] = f->x[2];
+	f->x[2] = x;
+	if (f->n < 2) {
+		f->n++;
+		return x;
+	}
+
+	a = f->x[0];
+	b = f->x[1];
+	c = f->x[2];
+	if (a > b) {
+		int32_t t = a; a = b; b = t;
+	}
+	// a <= b: the median is b unless c is below it
+	return (c >= b) ? b : (c > a ? c : a);
+}
+
+bool FILT_CIC_Push(filt_cic_t *f, int32_t x, int32_t *out)
+{
+	uint64_t v = (uint64_t) (int64_t) x;
+	uint64_t prev;
+	int64_t sum;
+	int i;
+
+	if (f->gain == 0) {
+		f->gain = 1;
+		for (i = 0; i < FILT_CIC_ORDER; i++) {
+			f->gain *= f->decim;
+		}
+	}
+
+	for (i = 0; i < FILT_CIC_ORDER; i++) {
+		f->integ[i] += v;
+		v = f->integ[i];
+	}
+	if (++f->phase < f->decim) {
+		return false;
+	}
+	f->phase = 0;
+
+	for (i = 0; i < FILT_CIC_ORDER; i++) {
+		prev = f->comb[i];
+		f->comb[i] = v;
+		v -= prev;
+	}
+	if (f->warm < FILT_CIC_ORDER - 1) {
+		f->warm++;
+		return false;
+	}
+
+	// v is the windowed sum, gain times the input level. Round half away
+	// from zero: division truncates, so negative levels need -gain / 2
+	sum = (int64_t) v;
+	sum += (sum >= 0) ? (int64_t) (f->gain / 2) : -(int64_t) (f->gain / 2);
+	*out = (int32_t) (sum / (int64_t) f->gain);
+	return true;
+}
+
+int32_t FILT_EMA(filt_ema_t *f, int32_t x)
+{
+	if (!f->primed) {
+		f->y = x * (1 << f->shift);		/* x may be negative, can't shift it left */
+		f->primed = true;
+	}
+	else {
+		f->y += x - (f->y >> f->shift);
+	}
+	return (f->y + ((1 << f->shift) >> 1)) >> f->shift;
+}
+
+bool FILT_Chain_Push(filt_chain_t *f, int32_t x, int32_t *out)
+{
+	int32_t y;
+
+	if (!FILT_CIC_Push(&f->cic, FILT_Median3(&f->median, x), &y)) {
+		return false;
+	}
+	*out = FILT_EMA(&f->ema, y);
+	return true;
+}
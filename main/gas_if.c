@@ -0,0 +1,315 @@
+/*
+ * gas_if.c
+ *
+ * Notes:
+ * 		MICS4514 readings to concentrations, see gas_if.h for the model.
+ *
+ * 		powf is only called when a table is (re)built: at start-up and on
+ * 		"gascal". A conversion is integer math on Rs / R0 in Q16, with the
+ * 		table spaced evenly in log2(Rs / R0) so the error of the linear
+ * 		step stays about the same across the whole range (under 0.5%
+ * 		for the default curves).
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include "cmd_if.h"
+#include "hdc1080_if.h"
+#include "gas_if.h"
+
+#define GAS_Q					16				/* Rs / R0 fraction bits */
+#define GAS_COMP_ONE			1000000			/* Compensation factor of 1 */
+#define GAS_COMP_MIN			(GAS_COMP_ONE / 10)
+#define GAS_REF_TEMP			(20 * HDC1080_SCALE)
+#define GAS_REF_HUM				(50 * HDC1080_SCALE)
+#define GAS_REPLY_LEN			128
+
+typedef struct {
+	uint32_t ratio[GAS_LUT_LEN];	/* Rs / R0 in Q16, ascending */
+	uint32_t ppb[GAS_LUT_LEN];
+} gas_lut_t;
+
+static const char *TAG = "GAS";
+static const char *gas_nvs_namespace = "gas";
+static const char *gas_names[GAS_CHANNELS] = { "red", "ox" };
+static const gas_cal_t gas_defaults[GAS_CHANNELS] = {
+	[GAS_RED] = { .r0 = GAS_RED_R0_DEFAULT, .rl = GAS_RED_RL_DEFAULT, .vc_mv = GAS_VC_DEFAULT,
+				  .a_micro = GAS_RED_A_DEFAULT, .b_milli = GAS_RED_B_DEFAULT },
+	[GAS_OX]  = { .r0 = GAS_OX_R0_DEFAULT, .rl = GAS_OX_RL_DEFAULT, .vc_mv = GAS_VC_DEFAULT,
+				  .a_micro = GAS_OX_A_DEFAULT, .b_milli = GAS_OX_B_DEFAULT },
+};
+
+static portMUX_TYPE gas_mux = portMUX_INITIALIZER_UNLOCKED;
+static gas_cal_t gas_cal[GAS_CHANNELS];
+static gas_lut_t gas_lut[GAS_CHANNELS];
+static int64_t gas_rs_ref[GAS_CHANNELS];	/* Last Rs at 20 C / 50 %RH, for "r0 auto" */
+
+static void _gas_build(const gas_cal_t *cal, gas_lut_t *lut);
+static uint32_t _gas_lookup(const gas_lut_t *lut, uint32_t ratio);
+static bool _gas_valid(const gas_cal_t *cal);
+static void _gas_nvs_load(void);
+static void _gas_nvs_save(void);
+static int _gas_format(char *buf, size_t len, gas_channel_t ch);
+static int32_t *_gas_field(gas_cal_t *cal, const char *name);
+static esp_err_t _cmd_gascal(const cmd_ctx_t *ctx, int argc, char **argv);
+
+
+/*
+* @brief	Tabulate ppb = 1000 * a * x^b at x = 2^(GAS_LUT_MIN_LOG2 + i / GAS_LUT_PER_OCTAVE)
+*/
+static void _gas_build(const gas_cal_t *cal, gas_lut_t *lut)
+{
+	float x, ppb;
+
+	for (int i = 0; i < GAS_LUT_LEN; i++) {
+		x = exp2f(GAS_LUT_MIN_LOG2 + (float) i / GAS_LUT_PER_OCTAVE);
+		ppb = (cal->a_micro / 1000.0f) * powf(x, cal->b_milli / 1000.0f);
+		lut->ratio[i] = lroundf(x * (1 << GAS_Q));
+		lut->ppb[i] = (ppb >= GAS_PPB_MAX) ? GAS_PPB_MAX : lroundf(ppb);
+	}
+}
+
+static uint32_t _gas_lookup(const gas_lut_t *lut, uint32_t ratio)
+{
+	int lo = 0, hi = GAS_LUT_LEN - 1, mid;
+
+	if (ratio <= lut->ratio[lo]) {
+		return lut->ppb[lo];
+	}
+	if (ratio >= lut->ratio[hi]) {
+		return lut->ppb[hi];
+	}
+
+	// ratio[lo] <= ratio < ratio[hi]
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (ratio < lut->ratio[mid]) {
+			hi = mid;
+		}
+		else {
+			lo = mid;
+		}
+	}
+	return lut->ppb[lo] + ((int64_t) lut->ppb[hi] - lut->ppb[lo]) *
+						  (ratio - lut->ratio[lo]) / (lut->ratio[hi] - lut->ratio[lo]);
+}
+
+esp_err_t GAS_Convert(gas_channel_t ch, int mv, int32_t temp, int32_t hum, uint32_t *ppb)
+{
+	int64_t rs, comp, ratio;
+
+	if (ch >= GAS_CHANNELS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	portENTER_CRITICAL(&gas_mux);
+	if (mv <= 0 || mv > gas_cal[ch].vc_mv) {
+		portEXIT_CRITICAL(&gas_mux);
+		return ESP_ERR_INVALID_ARG;
+	}
+	rs = (int64_t) gas_cal[ch].rl * (gas_cal[ch].vc_mv - mv) / mv;
+
+	// Back to what Rs would be at 20 C / 50 %RH
+	comp = GAS_COMP_ONE + (int64_t) gas_cal[ch].kt * (temp - GAS_REF_TEMP) / HDC1080_SCALE
+						+ (int64_t) gas_cal[ch].kh * (hum - GAS_REF_HUM) / HDC1080_SCALE;
+	if (comp < GAS_COMP_MIN) {
+		comp = GAS_COMP_MIN;
+	}
+	rs = rs * GAS_COMP_ONE / comp;
+	gas_rs_ref[ch] = rs;
+
+	ratio = (rs << GAS_Q) / gas_cal[ch].r0;
+	*ppb = _gas_lookup(&gas_lut[ch], (ratio > UINT32_MAX) ? UINT32_MAX : ratio);
+	portEXIT_CRITICAL(&gas_mux);
+	return ESP_OK;
+}
+
+void GAS_GetCal(gas_channel_t ch, gas_cal_t *cal)
+{
+	portENTER_CRITICAL(&gas_mux);
+	*cal = gas_cal[ch];
+	portEXIT_CRITICAL(&gas_mux);
+}
+
+static bool _gas_valid(const gas_cal_t *cal)
+{
+	return cal->r0 > 0 && cal->rl > 0 &&
+		   cal->vc_mv > 0 && cal->vc_mv <= 5000 &&
+		   cal->a_micro > 0 &&
+		   cal->b_milli != 0 && abs(cal->b_milli) <= 5000 &&
+		   abs(cal->kt) <= GAS_COMP_ONE / 10 && abs(cal->kh) <= GAS_COMP_ONE / 10;
+}
+
+esp_err_t GAS_SetCal(gas_channel_t ch, const gas_cal_t *cal)
+{
+	gas_lut_t *lut;
+
+	if (ch >= GAS_CHANNELS || !_gas_valid(cal)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if ((lut = malloc(sizeof(gas_lut_t))) == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	// Build outside the lock, swap in under it
+	_gas_build(cal, lut);
+	portENTER_CRITICAL(&gas_mux);
+	gas_cal[ch] = *cal;
+	gas_lut[ch] = *lut;
+	portEXIT_CRITICAL(&gas_mux);
+	free(lut);
+
+	_gas_nvs_save();
+	return ESP_OK;
+}
+
+static void _gas_nvs_load(void)
+{
+	nvs_handle handle;
+	size_t sz = sizeof(gas_cal);
+	bool ok = false;
+
+	if (nvs_open(gas_nvs_namespace, NVS_READONLY, &handle) == ESP_OK) {
+		ok = (nvs_get_blob(handle, "cal", gas_cal, &sz) == ESP_OK && sz == sizeof(gas_cal));
+		nvs_close(handle);
+	}
+	for (int ch = 0; ch < GAS_CHANNELS; ch++) {
+		if (!ok || !_gas_valid(&gas_cal[ch])) {
+			gas_cal[ch] = gas_defaults[ch];
+		}
+	}
+	ESP_LOGI(TAG, "%s calibration", ok ? "Stored" : "Default");
+}
+
+static void _gas_nvs_save(void)
+{
+	nvs_handle handle;
+	gas_cal_t cal[GAS_CHANNELS];
+
+	portENTER_CRITICAL(&gas_mux);
+	memcpy(cal, gas_cal, sizeof(cal));
+	portEXIT_CRITICAL(&gas_mux);
+
+	if (nvs_open(gas_nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+		ESP_LOGE(TAG, "Can't open NVS, calibration not saved");
+		return;
+	}
+	nvs_set_blob(handle, "cal", cal, sizeof(cal));
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+static int _gas_format(char *buf, size_t len, gas_channel_t ch)
+{
+	gas_cal_t cal;
+
+	GAS_GetCal(ch, &cal);
+	return snprintf(buf, len, "gascal %s r0=%d rl=%d vc=%d a=%d b=%d kt=%d kh=%d",
+					gas_names[ch], cal.r0, cal.rl, cal.vc_mv, cal.a_micro, cal.b_milli, cal.kt, cal.kh);
+}
+
+/*
+* @brief	Calibration field by its "gascal" name, NULL if there's none
+*/
+static int32_t *_gas_field(gas_cal_t *cal, const char *name)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} fields[] = {
+		{ "r0", offsetof(gas_cal_t, r0) },
+		{ "rl", offsetof(gas_cal_t, rl) },
+		{ "vc", offsetof(gas_cal_t, vc_mv) },
+		{ "a",  offsetof(gas_cal_t, a_micro) },
+		{ "b",  offsetof(gas_cal_t, b_milli) },
+		{ "kt", offsetof(gas_cal_t, kt) },
+		{ "kh", offsetof(gas_cal_t, kh) },
+	};
+
+	for (int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (strcmp(name, fields[i].name) == 0) {
+			return (int32_t *) ((char *) cal + fields[i].offset);
+		}
+	}
+	return NULL;
+}
+
+/*
+* @brief	"gascal <red|ox> [<field> <value> | reset]", see gas_if.h
+*/
+static esp_err_t _cmd_gascal(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	char reply[GAS_REPLY_LEN];
+	gas_channel_t ch;
+	gas_cal_t cal;
+	int32_t *field;
+	int64_t rs;
+	char *end;
+	esp_err_t err;
+
+	for (ch = 0; ch < GAS_CHANNELS && strcmp(argv[1], gas_names[ch]) != 0; ch++);
+	if (ch == GAS_CHANNELS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	GAS_GetCal(ch, &cal);
+	if (argc == 3) {
+		if (strcmp(argv[2], "reset") != 0) {
+			return ESP_ERR_INVALID_ARG;
+		}
+		cal = gas_defaults[ch];
+	}
+	else if (argc == 4) {
+		if ((field = _gas_field(&cal, argv[2])) == NULL) {
+			return ESP_ERR_INVALID_ARG;
+		}
+		if (field == &cal.r0 && strcmp(argv[3], "auto") == 0) {
+			// Only meaningful in clean air, once the heater has settled
+			portENTER_CRITICAL(&gas_mux);
+			rs = gas_rs_ref[ch];
+			portEXIT_CRITICAL(&gas_mux);
+			if (rs <= 0 || rs > INT32_MAX) {
+				return ESP_ERR_INVALID_STATE;
+			}
+			*field = rs;
+		}
+		else {
+			*field = strtol(argv[3], &end, 10);
+			if (*end != '\0') {
+				return ESP_ERR_INVALID_ARG;
+			}
+		}
+	}
+
+	if (argc > 2 && (err = GAS_SetCal(ch, &cal)) != ESP_OK) {
+		return err;
+	}
+	_gas_format(reply, sizeof(reply), ch);
+	ESP_LOGI(TAG, "%s", reply);
+	CMD_Reply(ctx, CONFIG_MQTT_ACK_QOS, reply);
+	return ESP_OK;
+}
+
+static const cmd_t gas_command = { .name = "gascal", .handler = _cmd_gascal, .min_args = 1, .max_args = 3 };
+
+void GAS_Initialize(void)
+{
+	char msg[GAS_REPLY_LEN];
+
+	_gas_nvs_load();
+	for (int ch = 0; ch < GAS_CHANNELS; ch++) {
+		_gas_build(&gas_cal[ch], &gas_lut[ch]);
+		_gas_format(msg, sizeof(msg), ch);
+		ESP_LOGI(TAG, "%s", msg);
+	}
+	CMD_Register(&gas_command);
+}
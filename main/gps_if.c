@@ -9,14 +9,20 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "gps_if.h"
 #include "led_if.h"
+#include "wdt_if.h"
+#include "metrics_if.h"
+#include "gpsfix_if.h"
+#include "time_if.h"
 #include "math.h"
 
 #define GPS_UART_NUM 		UART_NUM_1
@@ -24,14 +30,58 @@
 #define GPS_RX_GPIO 		23
 #define MAX_SENTENCE_LEN 	1024
 #define NMEA_RDY_BIT		BIT0
+#define GPS_TASK_STACK		3072	/* The fix aggregator sorts on it */
+#define GPS_FIX_TICKS		pdMS_TO_TICKS(CONFIG_GPS_FIX_INTERVAL_S * 1000)
+#define GPS_PWR_CHECK_MS	10000	/* Power manager timer period */
+#define GPS_PWR_TRIES		3		/* Sends of a low power command without an ack */
+#define GPS_PMTK_ACK_OK		3		/* PMTK001 flag: command succeeded */
+
+#ifdef CONFIG_GPS_STANDBY
+#define GPS_PMTK_LOW		PMTK_STANDBY
+#define GPS_PMTK_LOW_CMD	161
+#define GPS_PMTK_FULL		PMTK_AWAKE
+#else
+#define GPS_PMTK_LOW		PMTK_PERIODIC
+#define GPS_PMTK_LOW_CMD	225
+#define GPS_PMTK_FULL		PMTK_NORMAL
+#endif
+
+typedef enum {
+	GPS_PWR_FULL = 0,		/* Tracking continuously */
+	GPS_PWR_LOW_REQ,		/* Low power command sent, waiting for the ack */
+	GPS_PWR_LOW,			/* Standby or periodic mode */
+} gps_pwr_state_t;
 
 static uint8_t nmea[MAX_SENTENCE_LEN];
+static metric_t *m_uart_ovf = NULL;
 //static EventGroupHandle_t gps_event_group;
 static QueueHandle_t gps_event_queue;
 
 static const char* TAG = "GPS";
 static esp_err_t parse(char *nmea);
 static uint8_t parseHex(char c);
+static void _gps_add_fix(const gpsfix_t *fix);
+
+static gpsfix_agg_t gps_agg;				/* Only touched by the UART task */
+static gpsfix_pos_t gps_pos;				/* Its result, for everyone else */
+static portMUX_TYPE gps_agg_mux = portMUX_INITIALIZER_UNLOCKED;
+static TickType_t gps_fix_tick = 0;
+static bool gps_fix_first = true;
+static volatile uint32_t gps_fix_count = 0;	/* Fixes pushed into gps_agg */
+static volatile uint32_t gps_rmc_count = 0;	/* RMC sentences with a valid fix */
+static volatile int gps_ack_cmd = -1;		/* Last PMTK001 acknowledgement */
+static volatile int gps_ack_flag = -1;
+static int64_t gps_line_us;					/* esp_timer when the sentence being parsed came in */
+
+#ifdef CONFIG_GPS_POWER_SAVE
+static TimerHandle_t gps_pwr_timer;
+static gps_pwr_state_t gps_pwr_state = GPS_PWR_FULL;
+static TickType_t gps_pwr_since;			/* When the state was entered */
+static uint32_t gps_pwr_fixes, gps_pwr_rmc;	/* Counts when tracking (re)started */
+static uint8_t gps_pwr_tries;
+static metric_t *m_low_power = NULL;
+static void _gps_pwr_cb(TimerHandle_t xTimer);
+#endif
 
 static esp_gps_t esp_gps = {
 		.lat 	= -1,
@@ -51,6 +101,7 @@ static void uart_gps_event_mgr(void *pvParameters)
     esp_err_t err;
     size_t buffered_size;
 
+    METRICS_WatchTask(NULL);
     for(;;) {
         //Waiting for UART event.
         if(xQueueReceive(gps_event_queue, (void * )&event, (portTickType)portMAX_DELAY)) {
@@ -62,12 +113,14 @@ static void uart_gps_event_mgr(void *pvParameters)
 
                 case UART_FIFO_OVF:
                     ESP_LOGW(TAG, "hw fifo overflow");
+                    METRICS_Inc(m_uart_ovf);
                     uart_flush_input(GPS_UART_NUM);
                     xQueueReset(gps_event_queue);
                     break;
 
                 case UART_BUFFER_FULL:
                     ESP_LOGW(TAG, "ring buffer full");
+                    METRICS_Inc(m_uart_ovf);
                     uart_flush_input(GPS_UART_NUM);
                     xQueueReset(gps_event_queue);
                     break;
@@ -87,10 +140,14 @@ static void uart_gps_event_mgr(void *pvParameters)
 				case UART_PATTERN_DET:
 					uart_get_buffered_data_len(GPS_UART_NUM, &buffered_size);
 					int pos = uart_pattern_pop_pos(GPS_UART_NUM);
+					gps_line_us = esp_timer_get_time();
 					if (pos != -1) {
 						int read_len = uart_read_bytes(GPS_UART_NUM, nmea, pos + 1, 100 / portTICK_PERIOD_MS);
 						nmea[read_len] = '\0';
-						parse((char*)nmea);
+						// Only a sentence we could decode counts, not line noise
+						if (parse((char*)nmea) == ESP_OK) {
+							WDT_Progress(WDT_GPS);
+						}
 					}
 					else {
 						uart_flush_input(GPS_UART_NUM);
@@ -137,7 +194,9 @@ esp_err_t GPS_Initialize()
     uart_pattern_queue_reset(GPS_UART_NUM, 20);
     uart_flush(GPS_UART_NUM);
 
-	xTaskCreate(uart_gps_event_mgr, "uart_pms_event_task", 2048, NULL, 12, NULL);
+	m_uart_ovf = METRICS_Register("gps_uart_ovf", METRIC_COUNTER);
+	GPSFIX_Reset(&gps_agg);
+	xTaskCreate(uart_gps_event_mgr, "uart_pms_event_task", GPS_TASK_STACK, NULL, 12, NULL);
 
 	ESP_LOGE(TAG, "Setting GPS NOT SET Bit...");
 	LED_SetEventBit(LED_EVENT_GPS_RTC_NOT_SET_BIT);
@@ -145,6 +204,16 @@ esp_err_t GPS_Initialize()
 //	GPS_Tx(PMTK_SET_NMEA_OUTPUT_ALLDATA);
 //	GPS_Tx(PMTK_SET_NMEA_UPDATE_1HZ);
 
+	// GGA and RMC are all we parse, drop the rest (GSA, GSV, VTG) at the source
+	GPS_Tx(PMTK_SET_NMEA_OUTPUT_RMCGGA);
+
+#ifdef CONFIG_GPS_POWER_SAVE
+	m_low_power = METRICS_Register("gps_low_power", METRIC_COUNTER);
+	gps_pwr_since = xTaskGetTickCount();
+	gps_pwr_timer = xTimerCreate("gps_pwr", pdMS_TO_TICKS(GPS_PWR_CHECK_MS), pdTRUE, NULL, _gps_pwr_cb);
+	xTimerStart(gps_pwr_timer, 0);
+#endif
+
 	return err;
 }
 
@@ -163,15 +232,16 @@ esp_err_t parse(char *nmea) {
 	uint8_t day = 0;
 	uint16_t milliseconds;
 	float latitude, longitude;
-	int32_t latitude_fixed, longitude_fixed;
+	int32_t latitude_fixed = 0, longitude_fixed = 0;
 	float latitudeDegrees = 0;
 	float longitudeDegrees = 0;
 	float altitude = 0;
 	float geoidheight;
-	float speed, angle, magvariation, HDOP;
+	float speed, angle, magvariation, HDOP = 0;
 	char lat, lon, mag;
 	bool fix;
-	uint8_t fixquality, satellites;
+	uint8_t fixquality = 0, satellites = 0;
+	gpsfix_t gga_fix;
 
 	// first look if we even have one
 	if (nmea[strlen(nmea)-4] == '*') {
@@ -184,7 +254,7 @@ esp_err_t parse(char *nmea) {
 		}
 		if (sum != 0) {
 		  // bad checksum :(
-		  return false;
+		  return ESP_FAIL;
 		}
 	}
 	int32_t degree;
@@ -223,6 +293,7 @@ esp_err_t parse(char *nmea) {
 		p = strchr(p, ',')+1;
 		if (',' != *p) {
 			if (p[0] == 'S') latitudeDegrees *= -1.0;
+			if (p[0] == 'S') latitude_fixed = -latitude_fixed;
 			if (p[0] == 'N') lat = 'N';
 			else if (p[0] == 'S') lat = 'S';
 			else if (p[0] == ',') lat = 0;
@@ -250,6 +321,7 @@ esp_err_t parse(char *nmea) {
 		p = strchr(p, ',')+1;
 		if (',' != *p) {
 			if (p[0] == 'W') longitudeDegrees *= -1.0;
+			if (p[0] == 'W') longitude_fixed = -longitude_fixed;
 			if (p[0] == 'W') lon = 'W';
 			else if (p[0] == 'E') lon = 'E';
 			else if (p[0] == ',') lon = 0;
@@ -275,6 +347,15 @@ esp_err_t parse(char *nmea) {
 		esp_gps.min 	= minute;
 		esp_gps.sec 	= seconds;
 
+		if (fixquality > 0) {
+			gga_fix.lat = latitude_fixed;
+			gga_fix.lon = longitude_fixed;
+			gga_fix.alt_dm = lroundf(altitude * 10);
+			gga_fix.hdop = (HDOP > 99) ? 9900 : lroundf(HDOP * 100);
+			gga_fix.sats = satellites;
+			_gps_add_fix(&gga_fix);
+		}
+
 		return ESP_OK;
 	}
 
@@ -292,7 +373,10 @@ esp_err_t parse(char *nmea) {
 		milliseconds = fmod(timef, 1.0) * 1000;
 
 		p = strchr(p, ',')+1;
-		if (p[0] == 'A') fix = true;
+		if (p[0] == 'A') {
+			fix = true;
+			gps_rmc_count++;
+		}
 		else if (p[0] == 'V') fix = false;
 		else return ESP_FAIL;
 
@@ -376,6 +460,28 @@ esp_err_t parse(char *nmea) {
 			LED_SetEventBit(LED_EVENT_GPS_RTC_SET_BIT);
 		}
 
+		// Without a fix this is the receiver's RTC, if it kept time at all
+		if (year > 18 && year < 80 && month >= 1 && month <= 12 && day >= 1) {
+			TIME_GPS(gps_line_us - CONFIG_GPS_TIME_LATENCY_MS * 1000LL,
+					 (CLOCK_FromCivil(2000 + year, month, day, hour, minute, seconds) * 1000 + milliseconds) * 1000,
+					 fix);
+		}
+
+		return ESP_OK;
+	}
+
+	// $PMTK001,<cmd>,<flag>: 0 invalid, 1 unsupported, 2 failed, 3 succeeded
+	if (strstr(nmea, "$PMTK001,")) {
+		char *p = strchr(nmea, ',') + 1;
+		int cmd = atoi(p);
+
+		p = strchr(p, ',');
+		if (p == NULL) {
+			return ESP_FAIL;
+		}
+		gps_ack_flag = atoi(p + 1);
+		gps_ack_cmd = cmd;
+		ESP_LOGI(TAG, "PMTK%03d ack %d", cmd, gps_ack_flag);
 		return ESP_OK;
 	}
 
@@ -401,11 +507,121 @@ void GPS_Tx(const char *pmtk)
 	ESP_LOGI(TAG, "Wrote packet to GPS");
 }
 
+/*
+ * @brief	One GGA fix every CONFIG_GPS_FIX_INTERVAL_S into the aggregator.
+ * 			Consecutive 1 Hz fixes share most of their error, so taking
+ * 			them all would only shorten the window.
+ */
+static void _gps_add_fix(const gpsfix_t *fix)
+{
+	TickType_t now = xTaskGetTickCount();
+
+	if (!gps_fix_first && now - gps_fix_tick < GPS_FIX_TICKS) {
+		return;
+	}
+	gps_fix_first = false;
+	gps_fix_tick = now;
+
+	if (GPSFIX_Push(&gps_agg, fix)) {
+		gps_fix_count++;
+		portENTER_CRITICAL(&gps_agg_mux);
+		gps_pos = gps_agg.pos;
+		portEXIT_CRITICAL(&gps_agg_mux);
+	}
+}
+
+#ifdef CONFIG_GPS_POWER_SAVE
+static void _gps_pwr_set(gps_pwr_state_t state)
+{
+	gps_pwr_state = state;
+	gps_pwr_since = xTaskGetTickCount();
+	if (state == GPS_PWR_FULL) {
+		gps_pwr_fixes = gps_fix_count;
+		gps_pwr_rmc = gps_rmc_count;
+	}
+}
+
+/*
+ * @brief	Power manager, every GPS_PWR_CHECK_MS on the timer task:
+ *
+ * 			FULL     -> LOW_REQ  CONFIG_GPS_REVALIDATE_FIXES new fixes, a valid
+ * 								 RMC and a converged position since tracking started
+ * 			LOW_REQ  -> LOW      low power command acknowledged
+ * 			LOW_REQ  -> FULL     no ack after GPS_PWR_TRIES sends
+ * 			LOW      -> FULL     CONFIG_GPS_REVALIDATE_S later, to check
+ * 								 position and time again
+ */
+static void _gps_pwr_cb(TimerHandle_t xTimer)
+{
+	TickType_t elapsed = xTaskGetTickCount() - gps_pwr_since;
+	gpsfix_pos_t pos;
+
+	switch (gps_pwr_state) {
+	case GPS_PWR_FULL:
+		GPS_GetPosition(&pos);
+		if (pos.converged &&
+			gps_fix_count - gps_pwr_fixes >= CONFIG_GPS_REVALIDATE_FIXES &&
+			gps_rmc_count != gps_pwr_rmc) {
+			ESP_LOGI(TAG, "Position settled (%.1f m over %u fixes), going low power", pos.sigma_m, pos.used);
+			gps_pwr_tries = 0;
+			gps_ack_cmd = -1;
+			_gps_pwr_set(GPS_PWR_LOW_REQ);
+			GPS_Tx(GPS_PMTK_LOW);
+		}
+		break;
+
+	case GPS_PWR_LOW_REQ:
+		if (gps_ack_cmd == GPS_PMTK_LOW_CMD && gps_ack_flag == GPS_PMTK_ACK_OK) {
+#ifdef CONFIG_GPS_STANDBY
+			// Silent on purpose until we wake it, the check after CONFIG_GPS_REVALIDATE_S
+			WDT_Expect(WDT_GPS, CONFIG_GPS_REVALIDATE_S + GPS_PWR_CHECK_MS / 1000 + 1);
+#endif
+			METRICS_Inc(m_low_power);
+			_gps_pwr_set(GPS_PWR_LOW);
+		}
+		else if (++gps_pwr_tries < GPS_PWR_TRIES) {
+			GPS_Tx(GPS_PMTK_LOW);
+		}
+		else {
+			ESP_LOGW(TAG, "No ack for low power mode, staying on");
+			GPS_Tx(GPS_PMTK_FULL);
+			_gps_pwr_set(GPS_PWR_FULL);
+		}
+		break;
+
+	case GPS_PWR_LOW:
+		if (elapsed >= pdMS_TO_TICKS(CONFIG_GPS_REVALIDATE_S * 1000)) {
+			ESP_LOGI(TAG, "Waking to revalidate");
+			GPS_Tx(GPS_PMTK_FULL);
+			_gps_pwr_set(GPS_PWR_FULL);
+		}
+		break;
+	}
+}
+#endif
+
+void GPS_GetPosition(gpsfix_pos_t *pos)
+{
+	portENTER_CRITICAL(&gps_agg_mux);
+	*pos = gps_pos;
+	portEXIT_CRITICAL(&gps_agg_mux);
+}
+
 void GPS_Poll(esp_gps_t* gps)
 {
-	gps->alt   = esp_gps.alt;
-	gps->lat   = esp_gps.lat;
-	gps->lon   = esp_gps.lon;
+	gpsfix_pos_t pos;
+
+	GPS_GetPosition(&pos);
+	if (pos.valid) {
+		gps->alt = pos.alt_dm / 10.0f;
+		gps->lat = pos.lat / 1e7f;
+		gps->lon = pos.lon / 1e7f;
+	}
+	else {
+		gps->alt = esp_gps.alt;
+		gps->lat = esp_gps.lat;
+		gps->lon = esp_gps.lon;
+	}
 	gps->year  = esp_gps.year;
 	gps->month = esp_gps.month;
 	gps->day   = esp_gps.day;
@@ -0,0 +1,153 @@
+/*
+ * gpsfix_if.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gpsfix_if.h"
+
+#define GPSFIX_M_PER_UNIT	0.0111319f		/* Metres per 1e-7 deg of latitude */
+#define GPSFIX_HDOP_MIN		50				/* Some receivers report 0 */
+
+static int _gpsfix_cmp_i32(const void *a, const void *b);
+static int _gpsfix_cmp_f(const void *a, const void *b);
+static int32_t _gpsfix_quantize(int32_t cur, int32_t x, int32_t q, bool have);
+static float _gpsfix_offset(const gpsfix_t *f, int32_t mlat, int32_t mlon, float kx, float *dx, float *dy);
+static float _gpsfix_weight(const gpsfix_t *f);
+static void _gpsfix_update(gpsfix_agg_t *a);
+
+
+static int _gpsfix_cmp_i32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int _gpsfix_cmp_f(const void *a, const void *b)
+{
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+* @brief	x to the nearest multiple of q, unless cur (the last result)
+* 			is still close enough
+*/
+static int32_t _gpsfix_quantize(int32_t cur, int32_t x, int32_t q, bool have)
+{
+	if (have && abs(x - cur) <= q * GPSFIX_HYST_PCT / 100) {
+		return cur;
+	}
+	return ((x >= 0) ? (x + q / 2) / q : -((q / 2 - x) / q)) * q;
+}
+
+void GPSFIX_Reset(gpsfix_agg_t *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+bool GPSFIX_Push(gpsfix_agg_t *a, const gpsfix_t *f)
+{
+	if (f->sats < GPSFIX_MIN_SATS || f->hdop > GPSFIX_HDOP_MAX) {
+		a->refused++;
+		return false;
+	}
+	a->fix[a->head] = *f;
+	a->head = (a->head + 1) % GPSFIX_WINDOW;
+	if (a->count < GPSFIX_WINDOW) {
+		a->count++;
+	}
+	_gpsfix_update(a);
+	return true;
+}
+
+/*
+* @brief	Fix i's offset from (mlat, mlon) in metres east and north
+*
+* @return	Distance in metres
+*/
+static float _gpsfix_offset(const gpsfix_t *f, int32_t mlat, int32_t mlon, float kx, float *dx, float *dy)
+{
+	*dx = (f->lon - mlon) * kx;
+	*dy = (f->lat - mlat) * GPSFIX_M_PER_UNIT;
+	return sqrtf(*dx * *dx + *dy * *dy);
+}
+
+static float _gpsfix_weight(const gpsfix_t *f)
+{
+	uint16_t hdop = (f->hdop < GPSFIX_HDOP_MIN) ? GPSFIX_HDOP_MIN : f->hdop;
+
+	return f->sats * 10000.0f / ((float) hdop * hdop);
+}
+
+static void _gpsfix_update(gpsfix_agg_t *a)
+{
+	int32_t v[GPSFIX_WINDOW];
+	float dist[GPSFIX_WINDOW];
+	int32_t mlat, mlon;
+	float kx, gate, dx, dy, w, sw = 0, sx = 0, sy = 0, sa = 0, ss = 0, mx, my;
+	uint16_t used = 0;
+	int n = a->count;
+	gpsfix_pos_t *pos = &a->pos;
+
+	// Per-axis median: half the window can be bad before it moves
+	for (int i = 0; i < n; i++) {
+		v[i] = a->fix[i].lat;
+	}
+	qsort(v, n, sizeof(v[0]), _gpsfix_cmp_i32);
+	mlat = v[n / 2];
+	for (int i = 0; i < n; i++) {
+		v[i] = a->fix[i].lon;
+	}
+	qsort(v, n, sizeof(v[0]), _gpsfix_cmp_i32);
+	mlon = v[n / 2];
+
+	// Gate on the median distance from it
+	kx = GPSFIX_M_PER_UNIT * cosf(mlat * 1e-7f * (float) M_PI / 180);
+	for (int i = 0; i < n; i++) {
+		dist[i] = _gpsfix_offset(&a->fix[i], mlat, mlon, kx, &dx, &dy);
+	}
+	qsort(dist, n, sizeof(dist[0]), _gpsfix_cmp_f);
+	gate = 3 * dist[n / 2];
+	if (gate < GPSFIX_GATE_MIN_M) {
+		gate = GPSFIX_GATE_MIN_M;
+	}
+
+	// Weighted mean of the fixes inside the gate
+	for (int i = 0; i < n; i++) {
+		if (_gpsfix_offset(&a->fix[i], mlat, mlon, kx, &dx, &dy) > gate) {
+			continue;
+		}
+		w = _gpsfix_weight(&a->fix[i]);
+		sw += w;
+		sx += w * dx;
+		sy += w * dy;
+		sa += w * a->fix[i].alt_dm;
+		used++;
+	}
+	mx = sx / sw;
+	my = sy / sw;
+	for (int i = 0; i < n; i++) {
+		if (_gpsfix_offset(&a->fix[i], mlat, mlon, kx, &dx, &dy) > gate) {
+			continue;
+		}
+		ss += _gpsfix_weight(&a->fix[i]) * ((dx - mx) * (dx - mx) + (dy - my) * (dy - my));
+	}
+
+	pos->lat = _gpsfix_quantize(pos->lat, mlat + lroundf(my / GPSFIX_M_PER_UNIT), GPSFIX_QUANT, pos->valid);
+	pos->lon = _gpsfix_quantize(pos->lon, mlon + lroundf(mx / kx), GPSFIX_QUANT, pos->valid);
+	pos->alt_dm = _gpsfix_quantize(pos->alt_dm, lroundf(sa / sw), GPSFIX_ALT_QUANT, pos->valid);
+	pos->sigma_m = sqrtf(ss / sw);
+	pos->used = used;
+	pos->outliers = n - used;
+	pos->valid = true;
+	pos->converged = (used >= GPSFIX_MIN_FIXES && pos->sigma_m < GPSFIX_CONVERGED_M);
+}
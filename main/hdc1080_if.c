@@ -1,25 +1,110 @@
 /*
  * hdc1080_if.c
  *
+ * Notes:
+ * 		hdc1080_task owns the bus. Every CONFIG_HDC1080_SAMPLE_PERIOD_S it
+ * 		runs a conversion and caches the result in fixed point, so
+ * 		data_task never waits on the sensor.
+ *
+ * 		After HDC1080_MAX_ERRORS failed transactions in a row (NACK or
+ * 		timeout) the bus is cleared by hand: up to nine SCL pulses until a
+ * 		stuck slave lets go of SDA, then a STOP. The driver is reinstalled
+ * 		and the sensor soft reset and reconfigured.
+ *
+ * 		Condensation: once humidity reaches CONFIG_HDC1080_HEATER_RH, the
+ * 		on-chip heater is switched on (it only heats while converting) and
+ * 		the sensor converts back to back for CONFIG_HDC1080_HEATER_BURST_S.
+ * 		Readings are held until HDC1080_COOL_S after the burst, and bursts
+ * 		are at least CONFIG_HDC1080_HEATER_INTERVAL_S apart.
+ *
  *  Created on: Nov 13, 2018
  *      Author: Thomas Becnel
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "rom/ets_sys.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "hdc1080_if.h"
+#include "metrics_if.h"
+#include "driver/gpio.h"
 #include "driver/i2c.h"
 
+#define HDC1080_TASK_STACK		2048
+#define HDC1080_TASK_PRIO		3
+#define HDC1080_I2C_TIMEOUT		(100 / portTICK_RATE_MS)
+#define HDC1080_READ_RETRIES	3			/* The sensor NACKs reads until the conversion is done */
+#define HDC1080_MAX_ERRORS		3			/* Failed transactions in a row before a bus clear */
+#define HDC1080_COOL_S			60			/* Hold readings this long after a heater burst */
+#define HDC1080_TICK_US			(portTICK_RATE_MS * 1000)
+#define HDC1080_US_PER_S		1000000LL
+#define HDC1080_PERIOD_US		(CONFIG_HDC1080_SAMPLE_PERIOD_S * HDC1080_US_PER_S)
+#define HDC1080_CLEAR_HALF_US	5			/* Half an SCL period at 100 kHz */
+
+#ifdef CONFIG_HDC1080_RES_11BIT
+#define HDC1080_CONF_RES		(HDC1080_CONF_TRES_11 | HDC1080_CONF_HRES_11)
+#else
+#define HDC1080_CONF_RES		0
+#endif
+
+typedef enum {
+	HEATER_OFF = 0,
+	HEATER_ON,		/* Converting back to back with the heater on */
+	HEATER_COOL,	/* Heater off, readings still skewed */
+} hdc1080_heater_t;
+
 static const char *TAG = "HDC1080";
+static const uint16_t hdc1080_conf = HDC1080_CONF_COMB | HDC1080_CONF_RES;	// Read both T&H in one go
+static hdc1080_sample_t latest;
+static hdc1080_stats_t stats;		/* Updated by hdc1080_task, read by anyone */
+static portMUX_TYPE hdc1080_mux = portMUX_INITIALIZER_UNLOCKED;
+static metric_t *m_errors = NULL;
+static metric_t *m_recoveries = NULL;
+
+static void _hdc1080_count(uint32_t *counter);
+static uint32_t _hdc1080_conv_us(uint16_t conf);
+static esp_err_t _hdc1080_bus_init(void);
+static void _hdc1080_bus_clear(void);
+static esp_err_t _hdc1080_write_conf(uint16_t conf);
+static esp_err_t _hdc1080_configure(void);
+static esp_err_t _hdc1080_trigger(void);
+static esp_err_t _hdc1080_read(uint8_t *data);
+static esp_err_t _hdc1080_measure(TickType_t conv, int32_t *temp, int32_t *hum);
+static void _hdc1080_recover(void);
+static void hdc1080_task(void *pvParameters);
+
+static void _hdc1080_count(uint32_t *counter)
+{
+	portENTER_CRITICAL(&hdc1080_mux);
+	(*counter)++;
+	portEXIT_CRITICAL(&hdc1080_mux);
+}
 
 /*
- *
+ * Temperature then humidity conversion time for the configured resolution
  */
-esp_err_t HDC1080_Initialize(void)
+static uint32_t _hdc1080_conv_us(uint16_t conf)
+{
+	uint32_t us = (conf & HDC1080_CONF_TRES_11) ? HDC1080_CONV_T11_US : HDC1080_CONV_T14_US;
+
+	if (conf & HDC1080_CONF_HRES_8) {
+		us += HDC1080_CONV_H8_US;
+	}
+	else if (conf & HDC1080_CONF_HRES_11) {
+		us += HDC1080_CONV_H11_US;
+	}
+	else {
+		us += HDC1080_CONV_H14_US;
+	}
+	return us;
+}
+
+static esp_err_t _hdc1080_bus_init(void)
 {
 	esp_err_t ret;
-	uint16_t hdc1080_conf = 0;
 
 	i2c_config_t conf;
     conf.mode = I2C_MODE_MASTER;
@@ -28,70 +113,293 @@ esp_err_t HDC1080_Initialize(void)
     conf.scl_io_num = I2C_MASTER_SCL_GPIO;
     conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
     conf.master.clk_speed = I2C_MASTER_FREQ_HZ;
-    hdc1080_conf |= HDC1080_CONF_COMB;				// Configure HDC1080 to read both T&H in one go
 
-    i2c_param_config(I2C_NUM_1, &conf);
-    i2c_driver_install(I2C_NUM_1, conf.mode, 0, 0, 0);
+    if ((ret = i2c_param_config(I2C_NUM_1, &conf)) != ESP_OK) {
+    	return ret;
+    }
+    return i2c_driver_install(I2C_NUM_1, conf.mode, 0, 0, 0);
+}
+
+/*
+ * Free a slave stuck mid-byte holding SDA low: clock SCL until it lets go,
+ * then send a STOP. The driver must not be installed.
+ */
+static void _hdc1080_bus_clear(void)
+{
+	gpio_set_direction(I2C_MASTER_SDA_GPIO, GPIO_MODE_INPUT_OUTPUT_OD);
+	gpio_set_direction(I2C_MASTER_SCL_GPIO, GPIO_MODE_INPUT_OUTPUT_OD);
+	gpio_set_pull_mode(I2C_MASTER_SDA_GPIO, GPIO_PULLUP_ONLY);
+	gpio_set_pull_mode(I2C_MASTER_SCL_GPIO, GPIO_PULLUP_ONLY);
+	gpio_set_level(I2C_MASTER_SDA_GPIO, 1);
+	gpio_set_level(I2C_MASTER_SCL_GPIO, 1);
+	ets_delay_us(HDC1080_CLEAR_HALF_US);
+
+	for (int i = 0; i < 9 && gpio_get_level(I2C_MASTER_SDA_GPIO) == 0; i++) {
+		gpio_set_level(I2C_MASTER_SCL_GPIO, 0);
+		ets_delay_us(HDC1080_CLEAR_HALF_US);
+		gpio_set_level(I2C_MASTER_SCL_GPIO, 1);
+		ets_delay_us(HDC1080_CLEAR_HALF_US);
+	}
+
+	// STOP: SDA low to high while SCL is high
+	gpio_set_level(I2C_MASTER_SCL_GPIO, 0);
+	gpio_set_level(I2C_MASTER_SDA_GPIO, 0);
+	ets_delay_us(HDC1080_CLEAR_HALF_US);
+	gpio_set_level(I2C_MASTER_SCL_GPIO, 1);
+	ets_delay_us(HDC1080_CLEAR_HALF_US);
+	gpio_set_level(I2C_MASTER_SDA_GPIO, 1);
+	ets_delay_us(HDC1080_CLEAR_HALF_US);
+}
+
+static esp_err_t _hdc1080_write_conf(uint16_t conf)
+{
+	esp_err_t ret;
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 
-    // Write the initial configuration
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 	i2c_master_start(cmd);
 	i2c_master_write_byte(cmd, (HDC1080_DEV_ADDR << 1) | I2C_MASTER_WRITE, ACK_CHECK_EN);
 	i2c_master_write_byte(cmd, HDC1080_CONF_ADDR, ACK_CHECK_EN);
-	i2c_master_write_byte(cmd, (hdc1080_conf >> 8), ACK_CHECK_EN);		// Send MSB
-	i2c_master_write_byte(cmd, (hdc1080_conf & 0xff), ACK_CHECK_EN);	// Send LSB
+	i2c_master_write_byte(cmd, (conf >> 8), ACK_CHECK_EN);		// Send MSB
+	i2c_master_write_byte(cmd, (conf & 0xff), ACK_CHECK_EN);	// Send LSB
 	i2c_master_stop(cmd);
-	ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, 1000 / portTICK_RATE_MS);
+	ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, HDC1080_I2C_TIMEOUT);
 	i2c_cmd_link_delete(cmd);
-	if (ret != ESP_OK) {
-		ESP_LOGI(TAG, "Couldn't configure HDC1080");
-	}else {
-		ESP_LOGI(TAG, "HDC1080 was properly configured");
+	return ret;
+}
+
+/*
+ * Soft reset, then the configuration. The reset also clears the heater.
+ */
+static esp_err_t _hdc1080_configure(void)
+{
+	esp_err_t ret;
+
+	if ((ret = _hdc1080_write_conf(HDC1080_CONF_RST)) != ESP_OK) {
+		return ret;
 	}
+	vTaskDelay(HDC1080_STARTUP_MS / portTICK_RATE_MS + 1);
+	return _hdc1080_write_conf(hdc1080_conf);
+}
+
+/*
+ * Start a measurement by writing Temperature Address (0x00) into Pointer Register (0x02)
+ */
+static esp_err_t _hdc1080_trigger(void)
+{
+	esp_err_t ret;
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, HDC1080_DEV_ADDR << 1 | I2C_MASTER_WRITE, ACK_CHECK_EN); 	// 7-bit Serial Bus Address Byte (0x40) + WRITE BIT (0)
+	i2c_master_write_byte(cmd, HDC1080_TEMP_REG, ACK_CHECK_EN);					 			// Send Temp Addr to Pointer Register Byte
+	i2c_master_stop(cmd);																	// Send the Stop Bit
+	ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, HDC1080_I2C_TIMEOUT);
+	i2c_cmd_link_delete(cmd);
 	return ret;
 }
 
 /*
- *
+ * Read the data from Temperature (0x00) then Humidity (0x01)
  */
-esp_err_t HDC1080_Poll(double *temp, double *hum)
+static esp_err_t _hdc1080_read(uint8_t *data)
+{
+	esp_err_t ret;
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, (HDC1080_DEV_ADDR << 1) | I2C_MASTER_READ, ACK_CHECK_EN);	// 7-bit Serial Bus Address Byte (0x40) + READ BIT (1)
+	i2c_master_read_byte(cmd, &data[0], ACK_VAL);	// Read Temperature MSB and Master ACK
+	i2c_master_read_byte(cmd, &data[1], ACK_VAL);	// Read Temperature LSB and Master ACK
+	i2c_master_read_byte(cmd, &data[2], ACK_VAL);	// Read Humidity MSB and Master ACK
+	i2c_master_read_byte(cmd, &data[3], NACK_VAL);	// Read Humidity LSB and Master NACK
+	i2c_master_stop(cmd);							// Send the Stop Bit
+	ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, HDC1080_I2C_TIMEOUT);
+	i2c_cmd_link_delete(cmd);
+	return ret;
+}
+
+/*
+ * One conversion. Outputs are 0.01 C and 0.01 %RH:
+ * 		T  = raw / 2^16 * 165 - 40
+ * 		RH = raw / 2^16 * 100
+ */
+static esp_err_t _hdc1080_measure(TickType_t conv, int32_t *temp, int32_t *hum)
 {
 	uint8_t data[4];
-    esp_err_t ret;
-
-    // 1. Start measurement by writing Temperature Address (0x00) into Pointer Register (0x02)
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, HDC1080_DEV_ADDR << 1 | I2C_MASTER_WRITE, ACK_CHECK_EN); 	// 7-bit Serial Bus Address Byte (0x40) + WRITE BIT (0)
-    i2c_master_write_byte(cmd, HDC1080_TEMP_REG, ACK_CHECK_EN);					 			// Send Temp Addr to Pointer Register Byte
-    i2c_master_stop(cmd);																	// Send the Stop Bit
-    ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, 1000 / portTICK_RATE_MS);
-    if (ret != ESP_OK) {
-		ESP_LOGW(TAG, "Couldn't start measurement");
+	esp_err_t ret;
+
+	if ((ret = _hdc1080_trigger()) != ESP_OK) {
 		return ret;
 	}
-    i2c_cmd_link_delete(cmd);
-
-    // 2. Wait for the measurement to complete
-    vTaskDelay(100 / portTICK_RATE_MS);
-
-    // 3. Read the data from Temperature (0x00) then Humidity (0x01)
-    cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (HDC1080_DEV_ADDR << 1) | I2C_MASTER_READ, ACK_CHECK_EN);	// 7-bit Serial Bus Address Byte (0x40) + READ BIT (1)
-    i2c_master_read_byte(cmd, &data[0], ACK_VAL);	// Read Temperature MSB and Master ACK
-    i2c_master_read_byte(cmd, &data[1], ACK_VAL);	// Read Temperature LSB and Master ACK
-    i2c_master_read_byte(cmd, &data[2], ACK_VAL);	// Read Humidity MSB and Master ACK
-    i2c_master_read_byte(cmd, &data[3], NACK_VAL);	// Read Humidity LSB and Master NACK
-    i2c_master_stop(cmd);							// Send the Stop Bit
-    ret = i2c_master_cmd_begin(I2C_NUM_1, cmd, 1000 / portTICK_RATE_MS); // Send the commands
-    i2c_cmd_link_delete(cmd);
-    if (ret != ESP_OK) {
-		ESP_LOGW(TAG, "Couldn't read measurement");
+	vTaskDelay(conv);
+	for (int i = 0; i < HDC1080_READ_RETRIES; i++) {
+		if ((ret = _hdc1080_read(data)) == ESP_OK) {
+			break;
+		}
+		vTaskDelay(1);
+	}
+	if (ret != ESP_OK) {
 		return ret;
 	}
-    *temp = ((double)(data[0] * 256 + data[1]) / 0x10000) * 165 - 40;
-    *hum  = ((double)(data[2] * 256 + data[3]) / 0x10000) * 100;
 
-    return ret;
+	*temp = ((int32_t) ((data[0] << 8) | data[1]) * 165 * HDC1080_SCALE >> 16) - 40 * HDC1080_SCALE;
+	*hum  = (int32_t) ((data[2] << 8) | data[3]) * 100 * HDC1080_SCALE >> 16;
+	return ESP_OK;
+}
+
+/*
+ * Bus clear, driver reinstall and sensor reset (which also turns the heater off)
+ */
+static void _hdc1080_recover(void)
+{
+	ESP_LOGW(TAG, "Clearing the bus");
+	i2c_driver_delete(I2C_NUM_1);
+	_hdc1080_bus_clear();
+	if (_hdc1080_bus_init() == ESP_OK) {
+		_hdc1080_configure();
+	}
+	_hdc1080_count(&stats.recoveries);
+	METRICS_Inc(m_recoveries);
+}
+
+static void hdc1080_task(void *pvParameters)
+{
+	int32_t temp = 0, hum = 0;
+	esp_err_t ret;
+	int errors = 0;
+	hdc1080_heater_t heater = HEATER_OFF;
+	int64_t now, heater_until = 0, last_heat = 0;
+	TickType_t wake = xTaskGetTickCount();
+	// Round up, plus one: the first tick of a delay can be partial
+	TickType_t conv = (_hdc1080_conv_us(hdc1080_conf) + HDC1080_TICK_US - 1) / HDC1080_TICK_US + 1;
+
+	for (;;) {
+		portENTER_CRITICAL(&hdc1080_mux);
+		latest.heating = (heater != HEATER_OFF);
+		portEXIT_CRITICAL(&hdc1080_mux);
+
+		ret = _hdc1080_measure(conv, &temp, &hum);
+		now = esp_timer_get_time();
+
+		if (ret != ESP_OK) {
+			ESP_LOGW(TAG, "Couldn't read measurement: %s", esp_err_to_name(ret));
+			_hdc1080_count(&stats.errors);
+			METRICS_Inc(m_errors);
+			if (++errors >= HDC1080_MAX_ERRORS) {
+				_hdc1080_recover();
+				if (heater == HEATER_ON) {
+					heater = HEATER_COOL;
+					heater_until = now + HDC1080_COOL_S * HDC1080_US_PER_S;
+				}
+				errors = 0;
+			}
+		}
+		else {
+			errors = 0;
+		}
+
+		switch (heater) {
+		case HEATER_OFF:
+			if (ret == ESP_OK) {
+				portENTER_CRITICAL(&hdc1080_mux);
+				latest.temp = temp;
+				latest.hum = hum;
+				latest.time_us = now;
+				portEXIT_CRITICAL(&hdc1080_mux);
+			}
+#if CONFIG_HDC1080_HEATER_RH > 0
+			if (ret == ESP_OK && hum >= CONFIG_HDC1080_HEATER_RH * HDC1080_SCALE &&
+				(last_heat == 0 || now - last_heat >= CONFIG_HDC1080_HEATER_INTERVAL_S * HDC1080_US_PER_S) &&
+				_hdc1080_write_conf(hdc1080_conf | HDC1080_CONF_HEAT) == ESP_OK) {
+				ESP_LOGI(TAG, "Saturated (%d.%02d %%RH), heating", hum / HDC1080_SCALE, hum % HDC1080_SCALE);
+				heater = HEATER_ON;
+				heater_until = now + CONFIG_HDC1080_HEATER_BURST_S * HDC1080_US_PER_S;
+				last_heat = now;
+				_hdc1080_count(&stats.heats);
+				continue;
+			}
+#endif
+			break;
+
+		case HEATER_ON:
+			if (now < heater_until) {
+				continue;	// Back to back conversions, that's what heats
+			}
+			if (_hdc1080_write_conf(hdc1080_conf) != ESP_OK) {
+				_hdc1080_recover();		// Never leave the heater on
+			}
+			heater = HEATER_COOL;
+			heater_until = now + HDC1080_COOL_S * HDC1080_US_PER_S;
+			break;
+
+		case HEATER_COOL:
+			if (now >= heater_until) {
+				heater = HEATER_OFF;
+			}
+			break;
+		}
+
+		// A burst overran the period: start the schedule over rather than catch up
+		if (xTaskGetTickCount() - wake > CONFIG_HDC1080_SAMPLE_PERIOD_S * 1000 / portTICK_RATE_MS) {
+			wake = xTaskGetTickCount();
+		}
+		vTaskDelayUntil(&wake, CONFIG_HDC1080_SAMPLE_PERIOD_S * 1000 / portTICK_RATE_MS);
+	}
+}
+
+/*
+ *
+ */
+esp_err_t HDC1080_Initialize(void)
+{
+	esp_err_t ret;
+
+	m_errors = METRICS_Register("hdc_i2c_err", METRIC_COUNTER);
+	m_recoveries = METRICS_Register("hdc_bus_clear", METRIC_COUNTER);
+
+	if ((ret = _hdc1080_bus_init()) == ESP_OK) {
+		ret = _hdc1080_configure();
+	}
+	if (ret != ESP_OK) {
+		ESP_LOGI(TAG, "Couldn't configure HDC1080");
+	}else {
+		ESP_LOGI(TAG, "HDC1080 was properly configured, %d-bit", (hdc1080_conf & HDC1080_CONF_TRES_11) ? 11 : 14);
+	}
+
+	// Sample even if the configuration failed: the error path retries it
+	xTaskCreate(&hdc1080_task, "hdc1080_task", HDC1080_TASK_STACK, NULL, HDC1080_TASK_PRIO, NULL);
+	return ret;
+}
+
+void HDC1080_GetSample(hdc1080_sample_t *sample)
+{
+	portENTER_CRITICAL(&hdc1080_mux);
+	*sample = latest;
+	portEXIT_CRITICAL(&hdc1080_mux);
+}
+
+void HDC1080_GetStats(hdc1080_stats_t *s)
+{
+	portENTER_CRITICAL(&hdc1080_mux);
+	*s = stats;
+	portEXIT_CRITICAL(&hdc1080_mux);
+}
+
+/*
+ *
+ */
+esp_err_t HDC1080_Poll(int32_t *temp, int32_t *hum)
+{
+	hdc1080_sample_t s;
+
+	HDC1080_GetSample(&s);
+	if (s.time_us == 0) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	*temp = s.temp;
+	*hum = s.hum;
+	if (esp_timer_get_time() - s.time_us > 3 * HDC1080_PERIOD_US) {
+		return ESP_ERR_TIMEOUT;
+	}
+	return ESP_OK;
 }
@@ -59,6 +59,8 @@ function to process requests, decode URLs, serve files, etc. etc.
 
 #include "http_server_if.h"
 #include "wifi_manager.h"
+#include "trace_if.h"
+#include "time_if.h"
 
 
 EventGroupHandle_t http_server_event_group;
@@ -141,6 +143,13 @@ char* http_server_get_header(char *request, char *header_name, int *len) {
 }
 
 
+#ifdef CONFIG_TRACE_ENABLE
+/* TRACE_Dump writer. The pieces are on its stack, so they have to be copied */
+static int http_server_trace_write(const char *buf, size_t len, void *arg) {
+	return netconn_write((struct netconn *) arg, buf, len, NETCONN_COPY) == ERR_OK ? 0 : -1;
+}
+#endif
+
 void http_server_netconn_serve(struct netconn *conn) {
 
 	struct netbuf *inbuf;
@@ -214,6 +223,14 @@ void http_server_netconn_serve(struct netconn *conn) {
 
 				}
 			}
+#ifdef CONFIG_TRACE_ENABLE
+			else if(strstr(line, "GET /trace.json ")) {
+				netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
+				if (TRACE_Dump(http_server_trace_write, conn) != ESP_OK) {
+					ESP_LOGI(TAG, "http_server_netconn_serve: GET /trace.json aborted\n");
+				}
+			}
+#endif
 			else if(strstr(line, "GET /register.json ")) {
 				if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
 					wifi_manager_fetch_reg_config();
@@ -478,9 +495,9 @@ esp_err_t http_get_isp_info(char *json_buf, size_t len)
 	close(s);
 
 	// Add timestamp cause I like having it
-	time_t now;
-	time(&now);
-	snprintf(&json_buf[ii - 1], len - strlen(json_buf), ",\"utc\":\"%lu\"}", now);
+	struct timeval now;
+	TIME_Now(&now, NULL);
+	snprintf(&json_buf[ii - 1], len - strlen(json_buf), ",\"utc\":\"%lu\"}", now.tv_sec);
 
 	return ESP_OK;
 }
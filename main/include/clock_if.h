@@ -0,0 +1,126 @@
+/*
+ * clock_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_CLOCK_IF_H_
+#define MAIN_INCLUDE_CLOCK_IF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * UTC from the monotonic timer, disciplined by occasional time samples
+ * (GPS RMC, SNTP). No PPS, so each sample carries tens of ms of jitter;
+ * the crystal's drift comes from a least squares line through a window
+ * of them instead:
+ *
+ * 		utc = mono + off + (mono - t0) * rate_ppb / 10^9
+ *
+ * 		- only the best source with a recent sample is used, a worse one
+ * 		  only takes over once the better one has gone CLOCK_HOLDOVER_S
+ * 		  without a sample (mixing them would fit their latency difference
+ * 		  as drift)
+ * 		- samples of a source are taken at most every CLOCK_SPACING_S:
+ * 		  the window spans hours, not the last minute of a 1 Hz stream
+ * 		- a sample more than CLOCK_GATE_US off the line is dropped, unless
+ * 		  CLOCK_GATE_N in a row agree on the new time; then the line starts
+ * 		  over from them
+ * 		- a new line is slewed in at CLOCK_SLEW_PPM, or stepped if it's
+ * 		  more than CLOCK_STEP_US away
+ *
+ * CLOCK_Now never goes backwards: after a backward step it holds until
+ * the line catches up. The one exception is leaving the GPS receiver's
+ * RTC (CLOCK_Q_COARSE), which may be hours out.
+ *
+ * Microseconds throughout. No heap, no ESP-IDF. Builds on the host.
+ */
+#define CLOCK_WINDOW			32
+#define CLOCK_SPACING_S			300
+#define CLOCK_MIN_SPAN_S		1800		/* Before the drift is estimated */
+#define CLOCK_MAX_PPM			100			/* Estimate clamp, error growth without one */
+#define CLOCK_GATE_US			500000
+#define CLOCK_GATE_N			3
+#define CLOCK_STEP_US			1000000
+#define CLOCK_SLEW_PPM			500
+#define CLOCK_HOLDOVER_S		10800
+#define CLOCK_WANDER_PPM		1			/* Error growth on top of the estimate's own */
+#define CLOCK_RTC_ERR_US		1000000		/* Error of a single sample, per source */
+#define CLOCK_SNTP_ERR_US		100000
+#define CLOCK_GPS_ERR_US		50000		/* NMEA timing, without PPS */
+
+typedef enum {
+	CLOCK_SRC_GPS_RTC = 0,		/* RMC time without a fix */
+	CLOCK_SRC_SNTP,
+	CLOCK_SRC_GPS,				/* RMC time with a fix */
+	CLOCK_SOURCES,
+} clock_src_t;
+
+typedef enum {
+	CLOCK_Q_NONE = 0,			/* Never set, only uptime is known */
+	CLOCK_Q_COARSE,				/* From the GPS receiver's RTC */
+	CLOCK_Q_HOLDOVER,			/* Was disciplined, no sample for CLOCK_HOLDOVER_S */
+	CLOCK_Q_SNTP,
+	CLOCK_Q_GPS,
+} clock_quality_t;
+
+typedef struct {
+	int64_t mono_us;
+	int64_t off_us;				/* utc - mono */
+} clock_sample_t;
+
+typedef struct {
+	clock_sample_t s[CLOCK_WINDOW];	/* Of source src only */
+	uint8_t head;					/* Next slot */
+	uint8_t count;
+	uint8_t src;					/* Source the line is fitted to */
+	bool set;
+	bool rated;						/* rate_ppb is an estimate, not a guess */
+	int64_t t0_us, off_us;			/* The line */
+	int32_t rate_ppb;				/* Change of utc - mono, i.e. minus the timer's drift */
+	int32_t rate_err_ppb;			/* 2 sigma of the estimate */
+	int64_t corr_us;				/* Being slewed out, as of corr_mono_us */
+	int64_t corr_mono_us;
+	int64_t last_out_us;			/* CLOCK_Now never reports less */
+	int64_t seen_us[CLOCK_SOURCES];	/* Last sample looked at, per source */
+	bool seen[CLOCK_SOURCES];
+	int64_t pend_off_us;			/* First of the outliers in a row */
+	uint8_t pending;
+	uint32_t rms_us;				/* Residual of the line */
+	uint32_t accepted;
+	uint32_t rejected;				/* Outliers dropped */
+	uint32_t steps;
+} clock_disc_t;
+
+/*
+* @brief	Forget all samples: CLOCK_Q_NONE until the next one
+*/
+void CLOCK_Reset(clock_disc_t *c);
+
+/*
+* @brief	Feed one time sample
+*
+* @param	mono_us: monotonic time the sample was valid at
+* @param	utc_us:  UTC it gave, since the UNIX Epoch
+*
+* @return	true if it moved the line, false if it was too soon after the
+* 			last one, from a worse source or an outlier
+*/
+bool CLOCK_Sample(clock_disc_t *c, clock_src_t src, int64_t mono_us, int64_t utc_us);
+
+/*
+* @brief	UTC at mono_us (which must not go backwards between calls)
+*
+* @param	utc_us: set to 0 with CLOCK_Q_NONE
+* @param	err_us: estimated error bound, may be NULL
+*/
+clock_quality_t CLOCK_Now(clock_disc_t *c, int64_t mono_us, int64_t *utc_us, uint32_t *err_us);
+
+/*
+* @brief	Seconds since the UNIX Epoch for a UTC calendar date, full year
+*/
+int64_t CLOCK_FromCivil(int year, int month, int day, int hour, int min, int sec);
+
+#endif /* MAIN_INCLUDE_CLOCK_IF_H_ */
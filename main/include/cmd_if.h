@@ -0,0 +1,101 @@
+/*
+ * cmd_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_CMD_IF_H_
+#define MAIN_INCLUDE_CMD_IF_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define CMD_MAX_LEN			512		/* Longest command payload accepted */
+#define CMD_MAX_ARGS		8		/* Including the command name */
+#define CMD_REQ_ID_LEN		16
+#define CMD_QUEUE_LEN		8
+
+/*
+ * Commands arrive on the device and "all" topics as space separated words:
+ *
+ * 		[@<request id>] <name> [args...]
+ *
+ * e.g. "ping" or "@42 ota airu-v2.bin". If a request id is given, every
+ * reply and progress report for that command starts with "@<request id> ".
+ */
+typedef struct {
+	char req_id[CMD_REQ_ID_LEN];	/* Empty if the sender didn't give one */
+} cmd_ctx_t;
+
+/*
+* @brief	Command handler. Runs on the command worker task, never on the
+* 			MQTT event task, so it may block and publish.
+*
+* @param	ctx: 	request context for CMD_Reply / CMD_Progress
+* @param	argc:	number of words, argv[0] is the command name
+* @param	argv:	the words
+*
+* @return	ESP_OK or an error, reported back as "<name> err <code>"
+*/
+typedef esp_err_t (*cmd_handler_t)(const cmd_ctx_t *ctx, int argc, char **argv);
+
+typedef struct {
+	const char *name;
+	cmd_handler_t handler;
+	uint8_t min_args;		/* Arguments after the name */
+	uint8_t max_args;
+} cmd_t;
+
+typedef struct {
+	uint32_t received;
+	uint32_t dropped;			/* Queue full, too long or fragmented */
+	uint32_t unknown;			/* No such command or bad argument count */
+	uint32_t handled;
+	uint32_t max_queue_us;		/* Longest wait between arrival and handler start */
+	uint32_t max_handler_us;	/* Longest handler run */
+	uint32_t max_submit_us;		/* Longest time CMD_Submit held up the event task */
+} cmd_stats_t;
+
+/*
+* @brief	Create the work queue and the worker task
+*/
+void CMD_Initialize(void);
+
+/*
+* @brief	Add a command to the registry
+*
+* @return	ESP_OK, or ESP_ERR_NO_MEM if the registry is full
+*/
+esp_err_t CMD_Register(const cmd_t *cmd);
+
+/*
+* @brief	Queue a raw command payload for the worker. Never blocks, safe to
+* 			call from the MQTT event handler.
+*
+* @param	data: payload (need not be NUL terminated)
+* @param	len:  payload length
+*
+* @return	ESP_OK, or ESP_FAIL if the command was dropped
+*/
+esp_err_t CMD_Submit(const char *data, int len);
+
+/*
+* @brief	Publish a reply on the ack topic, prefixed with the request id
+*
+* @param	ctx: request context
+* @param	qos: MQTT QoS for the reply
+* @param	msg: reply text
+*
+* @return	msg_id from MQTT_Publish_General
+*/
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg);
+
+/*
+* @brief	Publish "<name> progress <pct>" for a long running command
+*/
+void CMD_Progress(const cmd_ctx_t *ctx, const char *name, int pct);
+
+void CMD_GetStats(cmd_stats_t *stats);
+
+#endif /* MAIN_INCLUDE_CMD_IF_H_ */
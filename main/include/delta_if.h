@@ -0,0 +1,97 @@
+/*
+ * delta_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_DELTA_IF_H_
+#define MAIN_INCLUDE_DELTA_IF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "app_utils.h"
+
+#define DELTA_MAGIC			"AUD1"
+#define DELTA_HEADER_LEN	(4 + 4 + 4 + SHA256_HASH_LEN)
+#define DELTA_CTRL_LEN		12
+#define DELTA_BUF_LEN		512		/* Old-image read and output batch size */
+
+/*
+ * Patch layout (little endian, made by main/mkpatch.py):
+ *
+ * 		"AUD1" | new_size u32 | old_size u32 | sha256(old image) [32]
+ * 		then records until new_size bytes are produced:
+ * 			diff_len u32 | extra_len u32 | seek i32
+ * 			diff data:	tokens, 0x00-0x7f = (n+1) bytes to add to the old
+ * 						image, 0x80-0xff = (n&0x7f)+1 unchanged bytes
+ * 			extra data:	extra_len literal bytes
+ * 			old position += diff_len + seek
+ *
+ * This is bsdiff's control/diff/extra split, interleaved so it can be
+ * applied front to back, with the mostly-zero diff bytes run-length coded.
+ */
+
+typedef esp_err_t (*delta_write_fn_t)(void *arg, const uint8_t *data, size_t len);
+
+typedef enum {
+	DELTA_STATE_HEADER = 0,
+	DELTA_STATE_CTRL,
+	DELTA_STATE_TOKEN,
+	DELTA_STATE_DIFF,
+	DELTA_STATE_EXTRA,
+	DELTA_STATE_DONE,
+} delta_state_t;
+
+typedef struct {
+	delta_state_t state;
+	const esp_partition_t *src;		/* Old image, normally the running partition */
+	delta_write_fn_t write;
+	void *arg;
+	uint32_t new_size;
+	uint32_t old_size;
+	uint32_t old_pos;
+	uint32_t out_len;				/* Bytes produced so far */
+	uint32_t diff_left;				/* Bytes of the current diff block still to produce */
+	uint32_t extra_left;
+	uint32_t lit_left;				/* Bytes left in the current literal token */
+	int32_t seek;
+	uint8_t hdr[DELTA_HEADER_LEN];	/* Header or control record being collected */
+	uint32_t hdr_len;
+	uint8_t old[DELTA_BUF_LEN];
+	uint8_t out[DELTA_BUF_LEN];
+	uint32_t out_fill;
+} delta_t;
+
+/*
+* @brief	Start applying a patch
+*
+* @param	d: 		decoder state (about 1.2 KB, allocate it on the heap)
+* @param	src:	partition holding the image the patch was made against
+* @param	write:	called with the reconstructed image, in order
+* @param	arg:	passed to write
+*
+* @return	ESP_OK
+*/
+esp_err_t DELTA_Begin(delta_t *d, const esp_partition_t *src, delta_write_fn_t write, void *arg);
+
+/*
+* @brief	Feed the next piece of the patch, any size. Checks the old image
+* 			hash once the header is complete.
+*
+* @return	ESP_OK, ESP_ERR_INVALID_VERSION if the patch wasn't made
+* 			against src, ESP_ERR_INVALID_SIZE / ESP_ERR_INVALID_STATE for a
+* 			corrupt patch, or the write callback's error
+*/
+esp_err_t DELTA_Feed(delta_t *d, const uint8_t *data, size_t len);
+
+/*
+* @brief	Flush the output and check the whole image was produced
+*
+* @return	ESP_OK, or ESP_ERR_INVALID_SIZE if the patch was truncated
+*/
+esp_err_t DELTA_Finish(delta_t *d);
+
+#endif /* MAIN_INCLUDE_DELTA_IF_H_ */
@@ -0,0 +1,98 @@
+/*
+ * diag_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_DIAG_IF_H_
+#define MAIN_INCLUDE_DIAG_IF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define DIAG_MAGIC			0x44494147	/* "DIAG" */
+#define DIAG_RING_LEN		16			/* Breadcrumbs kept, oldest dropped */
+#define DIAG_TASK_LEN		12
+
+/*
+ * Breadcrumb kinds. Keep in step with KINDS in main/diagdecode.py.
+ */
+typedef enum {
+	DIAG_BOOT = 0,		/* code: esp_reset_reason() of this boot */
+	DIAG_ERR_MQTT,		/* code: MQTT event id */
+	DIAG_ERR_SD,		/* code: esp_err_t */
+	DIAG_ERR_WIFI,		/* code: disconnect reason */
+	DIAG_WDT,			/* code: wdt_component_t that stalled */
+	DIAG_OTA,			/* code: 0 reboot into update, 1 rollback */
+	DIAG_KIND_COUNT,
+} diag_kind_t;
+
+/* Sources with a "last error" slot */
+typedef enum {
+	DIAG_SRC_MQTT = 0,
+	DIAG_SRC_SD,
+	DIAG_SRC_WIFI,
+	DIAG_SRC_COUNT,
+} diag_src_t;
+
+typedef struct {
+	uint32_t uptime_s;
+	uint8_t kind;
+	uint8_t reserved[3];
+	int32_t code;
+} diag_crumb_t;
+
+/*
+ * Lives in RTC slow memory, so it survives everything but a power cycle.
+ * crc covers everything before it.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t boots;
+	uint32_t head;						/* Crumbs written, ring[head % DIAG_RING_LEN] is next */
+	uint32_t min_heap;
+	char last_task[DIAG_TASK_LEN];		/* Last task to call DIAG_TaskRun */
+	int32_t last_err[DIAG_SRC_COUNT];
+	diag_crumb_t ring[DIAG_RING_LEN];
+	uint32_t crc;
+} diag_rtc_t;
+
+/*
+* @brief	Pick up what the previous run left in RTC memory (or the NVS copy
+* 			after a power cycle), keep it for DIAG_Publish and start a
+* 			fresh record. Call early, after APP_Initialize.
+*
+* @return	N/A
+*/
+void DIAG_Initialize(void);
+
+/*
+* @brief	Add a breadcrumb
+*/
+void DIAG_Crumb(diag_kind_t kind, int32_t code);
+
+/*
+* @brief	Remember the last error of a source, and add a breadcrumb for it
+*/
+void DIAG_SetError(diag_src_t src, int32_t code);
+
+/*
+* @brief	Note which task ran last. Cheap, no breadcrumb.
+*/
+void DIAG_TaskRun(const char *name);
+
+/*
+* @brief	Copy the record to NVS if it changed. Without force, at most
+* 			every 5 minutes; force before an intentional reset.
+*/
+void DIAG_Flush(bool force);
+
+/*
+* @brief	Publish the previous run's record on the ack topic (once per
+* 			boot). Decode with main/diagdecode.py.
+*/
+void DIAG_Publish(void);
+
+#endif /* MAIN_INCLUDE_DIAG_IF_H_ */
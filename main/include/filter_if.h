@@ -0,0 +1,87 @@
+/*
+ * filter_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_FILTER_IF_H_
+#define MAIN_INCLUDE_FILTER_IF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fixed-point decimation chain for slow sensor signals:
+ *
+ * 		median of 3  ->  CIC, order FILT_CIC_ORDER, decimate by R  ->  EMA
+ *
+ * The median drops single-sample spikes, the CIC is a cheap low-pass
+ * (adds and subtracts only, one divide per output) and the EMA smooths
+ * the decimated stream. Integer only, no heap. Builds on the host.
+ *
+ * Sizes are fixed at compile time, e.g. for a channel at
+ * CONFIG_MICS4514_SAMPLE_HZ decimated by CONFIG_MICS4514_DECIMATION:
+ *
+ * 		static filt_chain_t ox = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, 2);
+ */
+#define FILT_CIC_ORDER		3
+
+typedef struct {
+	int32_t x[3];
+	uint8_t n;					/* Samples seen, up to 2 */
+} filt_median3_t;
+
+typedef struct {
+	uint64_t integ[FILT_CIC_ORDER];	/* Wrap around on purpose: the combs undo it */
+	uint64_t comb[FILT_CIC_ORDER];	/* Previous comb inputs */
+	uint64_t gain;					/* R^FILT_CIC_ORDER, set on first use */
+	uint16_t decim;					/* R */
+	uint16_t phase;
+	uint8_t warm;					/* Outputs so far, the first ORDER - 1 are partial */
+} filt_cic_t;
+
+typedef struct {
+	int32_t y;					/* Output << shift, for resolution */
+	uint8_t shift;				/* alpha = 1 / 2^shift, 0 passes through */
+	bool primed;
+} filt_ema_t;
+
+typedef struct {
+	filt_median3_t median;
+	filt_cic_t cic;
+	filt_ema_t ema;
+} filt_chain_t;
+
+#define FILT_CIC_INIT(r)			{ .decim = (r) }
+#define FILT_EMA_INIT(s)			{ .shift = (s) }
+#define FILT_CHAIN_INIT(r, s)		{ .cic = FILT_CIC_INIT(r), .ema = FILT_EMA_INIT(s) }
+
+/*
+* @brief	Median of the last three inputs (passes the first two through)
+*/
+int32_t FILT_Median3(filt_median3_t *f, int32_t x);
+
+/*
+* @brief	Push one input into the CIC decimator
+*
+* @param	out: set to the filtered value once every R inputs, after the
+* 				 first FILT_CIC_ORDER - 1 (filter still filling) are dropped
+*
+* @return	true when out was set
+*/
+bool FILT_CIC_Push(filt_cic_t *f, int32_t x, int32_t *out);
+
+/*
+* @brief	y += (x - y) / 2^shift, seeded with the first input
+*/
+int32_t FILT_EMA(filt_ema_t *f, int32_t x);
+
+/*
+* @brief	Median, CIC and EMA in one go
+*
+* @return	true when out was set (every R inputs)
+*/
+bool FILT_Chain_Push(filt_chain_t *f, int32_t x, int32_t *out);
+
+#endif /* MAIN_INCLUDE_FILTER_IF_H_ */
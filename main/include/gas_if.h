@@ -0,0 +1,98 @@
+/*
+ * gas_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_GAS_IF_H_
+#define MAIN_INCLUDE_GAS_IF_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * MICS4514 mV to ppb. Each channel sits in a divider with a load resistor,
+ * so its resistance is
+ *
+ * 		Rs = RL * (Vc - Vout) / Vout
+ *
+ * and the concentration follows the datasheet curve for Rs / R0, R0 being
+ * the unit's resistance in clean air:
+ *
+ * 		ppm = a * (Rs / R0)^b
+ *
+ * Rs / R0 is first corrected for temperature and humidity away from 20 C
+ * and 50 %RH. The curve is tabulated once per calibration, so a
+ * conversion is a binary search and one linear interpolation.
+ *
+ * Calibration is per unit, kept in NVS and changed over MQTT:
+ *
+ * 		gascal <red|ox>							reply with the current values
+ * 		gascal <red|ox> <field> <value>			set one, field is one of below
+ * 		gascal <red|ox> r0 auto					R0 from the current reading (clean air)
+ * 		gascal <red|ox> reset					back to the defaults
+ */
+#define GAS_LUT_PER_OCTAVE	8
+#define GAS_LUT_MIN_LOG2	-7				/* Rs / R0 from 1/128 ... */
+#define GAS_LUT_MAX_LOG2	6				/* ... to 64 */
+#define GAS_LUT_LEN			((GAS_LUT_MAX_LOG2 - GAS_LUT_MIN_LOG2) * GAS_LUT_PER_OCTAVE + 1)
+#define GAS_PPB_MAX			100000000		/* 100000 ppm, tables are clamped here */
+
+/* Placeholders until a unit is calibrated: nominal dividers, typical datasheet curves */
+#define GAS_RED_RL_DEFAULT		47000
+#define GAS_RED_R0_DEFAULT		250000
+#define GAS_RED_A_DEFAULT		4463800		/* CO: 4.4638 * ratio^-1.177 */
+#define GAS_RED_B_DEFAULT		-1177
+#define GAS_OX_RL_DEFAULT		22000
+#define GAS_OX_R0_DEFAULT		5000
+#define GAS_OX_A_DEFAULT		151600		/* NO2: 0.1516 * ratio^0.9979 */
+#define GAS_OX_B_DEFAULT		998
+#define GAS_VC_DEFAULT			3300
+
+typedef enum {
+	GAS_RED = 0,			/* CO */
+	GAS_OX,					/* NO2 */
+	GAS_CHANNELS,
+} gas_channel_t;
+
+typedef struct {
+	int32_t r0;				/* "r0": Rs in clean air (ohm) */
+	int32_t rl;				/* "rl": load resistor (ohm) */
+	int32_t vc_mv;			/* "vc": voltage across sensor and load (mV) */
+	int32_t a_micro;		/* "a":  curve coefficient x 10^6 */
+	int32_t b_milli;		/* "b":  curve exponent x 1000 */
+	int32_t kt;				/* "kt": Rs / R0 change per C above 20 C, x 10^6 */
+	int32_t kh;				/* "kh": Rs / R0 change per %RH above 50 %RH, x 10^6 */
+} gas_cal_t;
+
+/*
+* @brief	Load the calibration from NVS (or the defaults), build the
+* 			tables and register the "gascal" command
+*
+* @return	N/A
+*/
+void GAS_Initialize(void);
+
+/*
+* @brief	Channel mV to ppb
+*
+* @param	mv:   MICS4514_Poll output for the channel
+* @param	temp: HDC1080_Poll temperature, in 1/HDC1080_SCALE C
+* @param	hum:  HDC1080_Poll humidity, in 1/HDC1080_SCALE %RH
+* @param	ppb:  result, clamped to the table
+*
+* @return	ESP_OK, or ESP_ERR_INVALID_ARG when mv is out of range
+*/
+esp_err_t GAS_Convert(gas_channel_t ch, int mv, int32_t temp, int32_t hum, uint32_t *ppb);
+
+void GAS_GetCal(gas_channel_t ch, gas_cal_t *cal);
+
+/*
+* @brief	Check, apply and save a channel's calibration
+*
+* @return	ESP_OK, or ESP_ERR_INVALID_ARG if a value makes no sense
+*/
+esp_err_t GAS_SetCal(gas_channel_t ch, const gas_cal_t *cal);
+
+#endif /* MAIN_INCLUDE_GAS_IF_H_ */
@@ -8,6 +8,8 @@
 #ifndef MAIN_INCLUDE_GPS_IF_H_
 #define MAIN_INCLUDE_GPS_IF_H_
 
+#include "gpsfix_if.h"
+
 /**************************************************************************/
 /**
  Different commands to set the update rate from once a second (1 Hz) to 10 times a second (10Hz)
@@ -52,6 +54,7 @@
 #define PMTK_STANDBY "$PMTK161,0*28\r\n"              	  ///< standby command & boot successful message
 #define PMTK_STANDBY_SUCCESS "$PMTK001,161,3*36\r\n"  	  ///< Not needed currently
 #define PMTK_AWAKE "$PMTK010,002*2D\r\n"              	  ///< Wake up
+#define PMTK_NORMAL "$PMTK225,0*2B\r\n"              	  ///< Back to full power from periodic mode
 
 #define PMTK_Q_RELEASE "$PMTK605*31\r\n"              	  ///< ask for the release and version
 
@@ -74,7 +77,19 @@ typedef struct {
 } esp_gps_t;
 
 esp_err_t GPS_Initialize(void);
+
+/*
+* @brief	Latest date and time, and the aggregated position (see
+* 			gpsfix_if.h) once there is one: stable to 4 decimals, so it
+* 			can be an InfluxDB tag. Before the first fix, the last
+* 			sentence's values.
+*/
 void GPS_Poll(esp_gps_t* gps);
+
+/*
+* @brief	The aggregated position with its scatter and fix counts
+*/
+void GPS_GetPosition(gpsfix_pos_t *pos);
 void GPS_Tx(const char*);
 
 
@@ -0,0 +1,79 @@
+/*
+ * gpsfix_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_GPSFIX_IF_H_
+#define MAIN_INCLUDE_GPSFIX_IF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Position of a sensor that doesn't move, from a window of GGA fixes:
+ *
+ * 		- fixes without a 3D-capable solution (no fix, < 4 satellites,
+ * 		  HDOP over GPSFIX_HDOP_MAX) are refused on the way in
+ * 		- fixes further than 3x the median distance from the per-axis
+ * 		  median (at least GPSFIX_GATE_MIN_M) are left out
+ * 		- the rest are averaged with weight satellites / HDOP^2
+ * 		- the average is quantized to GPSFIX_QUANT (1e-4 deg, the InfluxDB
+ * 		  tag resolution) with hysteresis: the reported cell only changes
+ * 		  once the average is GPSFIX_HYST_PCT of a cell from its centre,
+ * 		  so a position near a cell edge doesn't flip between two tags
+ *
+ * Integer degrees x 10^7 throughout, like the NMEA parser. No heap, no
+ * ESP-IDF. Builds on the host.
+ */
+#define GPSFIX_WINDOW			64
+#define GPSFIX_QUANT			1000		/* 1e-4 deg, in 1e-7 deg */
+#define GPSFIX_ALT_QUANT		10			/* 1 m, in dm */
+#define GPSFIX_HYST_PCT			75			/* Of a cell, from its centre */
+#define GPSFIX_HDOP_MAX			500			/* x100 */
+#define GPSFIX_MIN_SATS			4
+#define GPSFIX_GATE_MIN_M		5.0f
+#define GPSFIX_MIN_FIXES		12			/* Before the position can converge */
+#define GPSFIX_CONVERGED_M		15.0f		/* ... and scatter below this */
+
+typedef struct {
+	int32_t lat;				/* Degrees x 10^7 */
+	int32_t lon;
+	int32_t alt_dm;				/* Above mean sea level */
+	uint16_t hdop;				/* x100 */
+	uint8_t sats;
+} gpsfix_t;
+
+typedef struct {
+	int32_t lat;				/* Quantized, degrees x 10^7 */
+	int32_t lon;
+	int32_t alt_dm;				/* Quantized */
+	float sigma_m;				/* Weighted RMS scatter of the fixes used */
+	uint16_t used;				/* Fixes in the average */
+	uint16_t outliers;			/* Fixes in the window left out */
+	bool valid;					/* Any fix at all */
+	bool converged;				/* GPSFIX_MIN_FIXES used, sigma_m under GPSFIX_CONVERGED_M */
+} gpsfix_pos_t;
+
+typedef struct {
+	gpsfix_t fix[GPSFIX_WINDOW];
+	uint16_t head;				/* Next slot */
+	uint16_t count;
+	uint32_t refused;			/* Fixes turned away by GPSFIX_Push */
+	gpsfix_pos_t pos;
+} gpsfix_agg_t;
+
+/*
+* @brief	Empty the window and forget the reported cell
+*/
+void GPSFIX_Reset(gpsfix_agg_t *a);
+
+/*
+* @brief	Add a fix, oldest one drops out, and recompute a->pos
+*
+* @return	false if the fix was refused (a->pos unchanged)
+*/
+bool GPSFIX_Push(gpsfix_agg_t *a, const gpsfix_t *f);
+
+#endif /* MAIN_INCLUDE_GPSFIX_IF_H_ */
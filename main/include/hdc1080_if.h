@@ -8,12 +8,19 @@
 #ifndef MAIN_HDC1080_IF_H_
 #define MAIN_HDC1080_IF_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_system.h"
 
 #define I2C_MASTER_SCL_GPIO		27			/*!< gpio number for I2C master clock */
 #define I2C_MASTER_SDA_GPIO		26			/*!< gpio number for I2C master data  */
 #define I2C_MASTER_FREQ_HZ		100000		/*!< I2C master clock frequency */
+#define HDC1080_CONF_RST		(1<<15)		/*!< HDC Software reset */
+#define HDC1080_CONF_HEAT		(1<<13)		/*!< HDC Heater on while converting */
 #define HDC1080_CONF_COMB		(1<<12)		/*!< HDC Configure Read Temp & Hum in one shot */
+#define HDC1080_CONF_TRES_11	(1<<10)		/*!< 11-bit temperature (default 14) */
+#define HDC1080_CONF_HRES_11	(1<<8)		/*!< 11-bit humidity (default 14) */
+#define HDC1080_CONF_HRES_8		(1<<9)		/*!< 8-bit humidity */
 #define HDC1080_DEV_ADDR		0x40        /*!< slave address for HDC1080 sensor */
 #define HDC1080_CONF_ADDR		0x02        /*!< HDC1080 configuration register */
 #define HDC1080_TEMP_REG		0x00		/*!< HDC1080 Temperature Register */
@@ -23,7 +30,52 @@
 #define ACK_VAL					0x0			/*!< I2C ack value */
 #define NACK_VAL				0x1			/*!< I2C nack value */
 
+/* Datasheet conversion times (us) */
+#define HDC1080_CONV_T14_US		6350
+#define HDC1080_CONV_T11_US		3650
+#define HDC1080_CONV_H14_US		6500
+#define HDC1080_CONV_H11_US		3850
+#define HDC1080_CONV_H8_US		2500
+#define HDC1080_STARTUP_MS		15
+
+#define HDC1080_SCALE			100			/*!< Readings are in 0.01 C and 0.01 %RH */
+
+typedef struct {
+	int32_t temp;			/* 0.01 C */
+	int32_t hum;			/* 0.01 %RH */
+	int64_t time_us;		/* esp_timer time of the reading, 0 if none yet */
+	bool heating;			/* Heater burst running, reading held until it's over */
+} hdc1080_sample_t;
+
+typedef struct {
+	uint32_t errors;		/* Failed I2C transactions */
+	uint32_t recoveries;	/* Bus clears and sensor re-inits */
+	uint32_t heats;			/* Heater bursts */
+} hdc1080_stats_t;
+
+/*
+* @brief	Configure the sensor and start the sampling task, which runs a
+* 			conversion every CONFIG_HDC1080_SAMPLE_PERIOD_S and caches it
+*/
 esp_err_t HDC1080_Initialize(void);
-esp_err_t HDC1080_Poll(double *temp, double *hum);
+
+/*
+* @brief	Latest cached reading. Never touches the bus, so never blocks.
+*
+* @param	temp: 0.01 C
+* @param	hum:  0.01 %RH
+*
+* @return	ESP_OK, ESP_ERR_NOT_FOUND if there's no reading yet, or
+* 			ESP_ERR_TIMEOUT if the last one is older than three periods,
+* 			e.g. during a heater burst (temp and hum are still filled in)
+*/
+esp_err_t HDC1080_Poll(int32_t *temp, int32_t *hum);
+
+/*
+* @brief	Latest cached reading with its timestamp
+*/
+void HDC1080_GetSample(hdc1080_sample_t *sample);
+
+void HDC1080_GetStats(hdc1080_stats_t *stats);
 
 #endif /* MAIN_HDC1080_IF_H_ */
@@ -0,0 +1,85 @@
+/*
+ * metrics_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_METRICS_IF_H_
+#define MAIN_INCLUDE_METRICS_IF_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define METRICS_MAX			16		/* Registered metrics */
+#define METRICS_MAX_TASKS	16		/* Tasks reported without the trace facility */
+#define METRICS_BUCKETS		8		/* Histogram buckets: <=1, 4, 16, 64, 256, 1024, 4096, more */
+#define METRICS_PKT_LEN		1536
+#define METRICS_TOPIC_TMPLT	CONFIG_MQTT_ROOT_TOPIC "/metrics/%s"
+
+typedef enum {
+	METRIC_COUNTER = 0,		/* Only goes up, never reset */
+	METRIC_GAUGE,			/* Last value set */
+	METRIC_HISTOGRAM,		/* Observations since the last publish */
+} metric_type_t;
+
+typedef struct {
+	const char *name;
+	metric_type_t type;
+	int32_t value;						/* Counter or gauge */
+	uint32_t count;						/* Histogram */
+	uint32_t sum;
+	uint32_t max;
+	uint32_t buckets[METRICS_BUCKETS];
+} metric_t;
+
+/*
+* @brief	Start the task that samples heap and task stats and publishes
+* 			everything every CONFIG_METRICS_PERIOD_S. Metrics can be
+* 			registered and updated before this is called.
+*
+* @return	N/A
+*/
+void METRICS_Initialize(void);
+
+/*
+* @brief	Add a metric, or find the one already registered under name
+*
+* @param	name: static string, used as the field name
+* @param	type: counter, gauge or histogram
+*
+* @return	the metric, or NULL if the registry is full. The update
+* 			functions accept NULL and do nothing.
+*/
+metric_t *METRICS_Register(const char *name, metric_type_t type);
+
+/*
+* @brief	Add n to a counter
+*/
+void METRICS_Add(metric_t *m, int32_t n);
+
+#define METRICS_Inc(m)		METRICS_Add((m), 1)
+
+/*
+* @brief	Set a gauge
+*/
+void METRICS_Set(metric_t *m, int32_t value);
+
+/*
+* @brief	Record one histogram observation, e.g. a latency in ms
+*/
+void METRICS_Observe(metric_t *m, uint32_t value);
+
+/*
+* @brief	Report a task's stack high water mark. Only needed when the
+* 			FreeRTOS trace facility is off; with it on every task is
+* 			reported, along with its CPU share.
+*
+* @param	task: task handle, NULL for the calling task
+*
+* @return	N/A
+*/
+void METRICS_WatchTask(TaskHandle_t task);
+
+#endif /* MAIN_INCLUDE_METRICS_IF_H_ */
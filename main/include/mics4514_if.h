@@ -8,9 +8,59 @@
 #ifndef MAIN_INCLUDE_MICS4514_IF_H_
 #define MAIN_INCLUDE_MICS4514_IF_H_
 
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Heater schedule. After power-up the sensor warms for
+ * CONFIG_MICS4514_WARMUP_S. With CONFIG_MICS4514_HEATER_OFF_S > 0 it then
+ * cycles: stable for CONFIG_MICS4514_HEATER_ON_S, off for
+ * CONFIG_MICS4514_HEATER_OFF_S, re-warm for CONFIG_MICS4514_REWARM_S.
+ * The ADC is only sampled while stable.
+ */
+typedef enum {
+	MICS4514_WARMUP = 0,	/* Heater on, readings not valid yet */
+	MICS4514_STABLE,		/* Heater on and settled, sampling */
+	MICS4514_OFF,			/* Heater off to save power */
+} mics4514_phase_t;
+
+typedef struct {
+	int ox_mv;				/* OX (NOx) channel, calibrated mV */
+	int red_mv;				/* RED (CO) channel, calibrated mV */
+	int64_t time_us;		/* esp_timer time at the middle of the window, 0 if none yet */
+} mics4514_sample_t;
+
+typedef struct {
+	uint32_t samples;			/* ADC sample pairs taken */
+	uint32_t outputs;			/* Decimated values produced */
+	uint32_t cpu_us;			/* CPU time behind the last output */
+	uint32_t busy_loop_us;		/* What the old 64 x 2 blocking reads cost, measured at start-up */
+} mics4514_stats_t;
+
 void MICS4514_GPIOEnable(void);
+
+/*
+* @brief	Set up the ADC, power the sensor and start the sampler task,
+* 			which runs the heater schedule and, while stable, reads both
+* 			channels at CONFIG_MICS4514_SAMPLE_HZ and filters every
+* 			CONFIG_MICS4514_DECIMATION samples down to one output
+*/
 void MICS4514_Initialize(void);
-void MICS4514_Poll(int *ox_val, int *red_val);
+
+/*
+* @brief	Latest output in mV. Doesn't touch the ADC, so never blocks.
+*
+* @return	ESP_OK, ESP_ERR_NOT_FOUND before the first stable output,
+* 			ESP_ERR_INVALID_STATE while the heater isn't in its stable
+* 			phase, or ESP_ERR_TIMEOUT if the output is more than a couple
+* 			of output periods overdue, e.g. early in a stable phase while
+* 			the filters fill again (ox_val and red_val are still filled in)
+*/
+esp_err_t MICS4514_Poll(int *ox_val, int *red_val);
+
+void MICS4514_GetSample(mics4514_sample_t *sample);
+mics4514_phase_t MICS4514_GetPhase(void);
+void MICS4514_GetStats(mics4514_stats_t *stats);
 void MICS4514_Enable(void);
 void MICS4514_Disable(void);
 void MICS4514_HeaterEnable(void);
@@ -8,7 +8,9 @@
 #ifndef MAIN_INCLUDE_MQTT_IF_H_
 #define MAIN_INCLUDE_MQTT_IF_H_
 
-#define MQTT_PKT_LEN 			256
+#include <stdint.h>
+
+#define MQTT_PKT_LEN 			320
 #define DATA_WRITE_PERIOD_SEC	60
 
 #define MQTT_DATA_PUB_TOPIC 	CONFIG_MQTT_ROOT_TOPIC "/" CONFIG_MQTT_DATA_PUB_TOPIC	/* I don't know how to concatonate these in kconfig file" */
@@ -17,7 +19,35 @@
 
 #define MQTT_PKT CONFIG_INFLUX_MEASUREMENT_NAME "\,ID\=%s\,SensorModel\=H2+%s\ SecActive\=%llu\,"\
 				 "Altitude\=%.2f\,Latitude\=%.4f\,Longitude\=%.4f\,PM1\=%.2f\,"\
-				 "PM2.5\=%.2f\,PM10\=%.2f\,Temperature\=%.2f\,Humidity\=%.2f\,CO\=%zu\,NO\=%zu"
+				 "PM2.5\=%.2f\,PM10\=%.2f"
+
+/*
+ * Fields appended to MQTT_PKT only with a valid, fresh reading. A missing
+ * field is left out of the point, never sent as a placeholder value.
+ */
+#define MQTT_PKT_TH				",Temperature=%.2f,Humidity=%.2f"
+#define MQTT_PKT_CO				",CO=%u"
+#define MQTT_PKT_NO				",NO=%u"
+
+/*
+ * Line protocol timestamp (ns) appended to MQTT_PKT once the clock is set.
+ * InfluxDB keeps one point per series and timestamp, so a QoS 1 duplicate
+ * overwrites itself and the database still sees each sample exactly once.
+ */
+#define MQTT_PKT_TS				" %ld000000000"
+#define MQTT_PKT_TS_MIN			1514764800		/* Jan 1 2018. Anything earlier means the clock isn't set */
+
+#define MQTT_PUB_QUEUED			(-2)			/* Not sent, waits in the in-flight window for a connection */
+
+typedef struct {
+	uint32_t handshakes;		/* Full TLS handshakes (every MQTT_EVENT_CONNECTED) */
+	uint32_t last_connect_ms;	/* Connect start (or disconnect) to MQTT_EVENT_CONNECTED */
+	uint32_t reconnects;		/* MQTT_EVENT_CONNECTED after a disconnect */
+	uint32_t last_reconnect_ms;	/* Time from the last disconnect to connected */
+	uint32_t inflight;			/* QoS 1/2 messages not yet acked */
+	uint32_t requeued;			/* Sent again after the broker lost our session */
+	uint32_t dropped;			/* Evicted from a full in-flight window */
+} mqtt_session_stats_t;
 
 /*
 * @brief
@@ -50,23 +80,29 @@ void MQTT_wifi_connected(void);
 void MQTT_wifi_disconnected(void);
 
 /*
-* @brief
-*
-* @param
+* @brief	Publish, through the in-flight window for QoS 1/2
 *
-* @return
+* @return	msg_id, MQTT_PUB_QUEUED if it waits in the window for a
+* 			connection, or ESP_FAIL
 */
 int MQTT_Publish_General(const char* topic, const char* msg, int qos);
 
 /*
-* @brief
+* @brief	Publish a data packet at CONFIG_MQTT_DATA_QOS
 *
-* @param
-*
-* @return
+* @return	as MQTT_Publish_General
 */
 int MQTT_Publish_Data(const char* msg);
 
+/*
+* @brief	Copy the session manager's counters
+*
+* @param	stats: filled with reconnect, retry and drop counts
+*
+* @return	N/A
+*/
+void MQTT_GetSessionStats(mqtt_session_stats_t *stats);
+
 /*
 * @brief: Prepare data in MQTT format
 *
@@ -8,17 +8,48 @@
 #ifndef MAIN_INCLUDE_OTA_IF_H_
 #define MAIN_INCLUDE_OTA_IF_H_
 
+#include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "cmd_if.h"
 
 #define OTA_TRIGGER_OTA_BIT BIT0
+#define OTA_HEALTH_MQTT_BIT	BIT1	/* A QoS 1/2 publish was acked */
+#define OTA_HEALTH_PM_BIT	BIT2	/* PM sensor frames are being decoded */
+#define OTA_HEALTH_BITS		(OTA_HEALTH_MQTT_BIT | OTA_HEALTH_PM_BIT)
 #define OTA_FILE_BN_LEN		64
 
 
+/*
+* @brief	First thing in app_main, once NVS is up: count this boot if
+* 			the running image is a pending update, roll it back after
+* 			CONFIG_OTA_HEALTH_MAX_BOOTS, and start the health check task.
+* 			Call before ota_task starts.
+*/
+void ota_boot_check(void);
+
 void ota_task(void *pvParameters);
 void ota_trigger( void );
 void ota_set_filename(char *fn);
+void ota_set_request(const cmd_ctx_t *ctx, const char *fn);
+
+/*
+* @brief	Report a health signal. After an update, the new image is only
+* 			kept if every OTA_HEALTH_BITS signal arrives within
+* 			CONFIG_OTA_HEALTH_BUDGET_S and the heap stays above
+* 			CONFIG_OTA_HEALTH_MIN_HEAP. Otherwise the previous image is
+* 			booted again. Cheap, call it every time.
+*
+* @param	bit: OTA_HEALTH_MQTT_BIT or OTA_HEALTH_PM_BIT
+*/
+void ota_health_report(EventBits_t bit);
+
+/*
+* @brief	Is this device in the first pct percent of the fleet? Buckets
+* 			are fixed per MAC, so raising pct only adds devices.
+*/
+bool ota_in_rollout(int pct);
 
 
 #endif /* MAIN_INCLUDE_OTA_IF_H_ */
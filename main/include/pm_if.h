@@ -8,23 +8,21 @@
 #ifndef _PM_IF_H
 #define _PM_IF_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "freertos/queue.h"
 #include "esp_err.h"
+#include "pmsframe_if.h"
 
 #define PM_UART_CH   UART_NUM_2
 #define PM_RXD_PIN   16
 #define PM_TXD_PIN   17
 #define BUF_SIZE     144 // NOTE: Rx_buffer_size should be greater than UART_FIFO_LEN (128 bytes)
-#define PM_PKT_LEN   24
 #define MAX_PKTS_IN_BUFFER 6
 #define MAX_NUM_PKT  5
 #define TIMEOUT      50
-#define PKT_PM1_HIGH 4
-#define PKT_PM1_LOW  5
-#define PKT_PM2_5_HIGH  6
-#define PKT_PM2_5_LOW   7
-#define PKT_PM10_HIGH   8
-#define PKT_PM10_LOW    9
+
 //#define PM_SET_PIN    X
 //#define PM_RESET_PIN  X
 
@@ -36,14 +34,17 @@
 * represensted as PM1, PM2.5, PM10 in the documentaion.
 * PM sensor data packets are defined as follows:
 *
-* PM Data is transmitted over UART in 24 byte packets. The first two 
-* bytes are the packet header [0x42 0x4D] or [“BM”] in ASCII. Each piece 
-* of the packet is 2 bytes, with the Most Significant Byte transmitted 
-* first. The final two bytes are the packet checksum and represent a 16 
-* bit (2 byte) number. This number should equal the sum of the first 22 
-* bytes in the packet.
+* PM Data is transmitted over UART in 24 byte (PMS3003) or 32 byte 
+* (PMS5003/7003) packets. The first two bytes are the packet header 
+* [0x42 0x4D] or [“BM”] in ASCII, the next two the length of the rest. 
+* Each piece of the packet is 2 bytes, with the Most Significant Byte 
+* transmitted first. The final two bytes are the packet checksum and 
+* represent a 16 bit (2 byte) number. This number should equal the sum 
+* of all the bytes before it.
+*
+* pm1, pm2_5 and pm10 are the CF=1 values, see pms_frame_t for the rest.
 *
-* Refer to PMS3003 documentation for more details.
+* Refer to PMS3003 and PMS5003 documentation for more details.
 */
 typedef struct 
 {
@@ -54,6 +55,16 @@ typedef struct
 } pm_data_t;
 
 
+/*
+* @brief Sensor power state, see CONFIG_PMS_SLEEP
+*/
+typedef enum {
+  PMS_ASLEEP = 0,     // Fan off between sampling windows
+  PMS_WARMUP,         // Fan settling, frames discarded
+  PMS_SAMPLING,       // Frames averaged into the next PMS_Poll
+} pms_state_t;
+
+
 /*
 * @brief
 *
@@ -74,8 +85,32 @@ esp_err_t PMS_Initialize();
 */
 //esp_err_t PM_get_data();
 
+/*
+* @brief Average of the frames since the last call. With CONFIG_PMS_SLEEP
+*        this also puts the sensor to sleep until the next window, so call
+*        it once every CONFIG_DATA_UPLOAD_PERIOD.
+*
+* @return ESP_OK, or ESP_FAIL (values set to -1) if there were no frames
+*/
 esp_err_t PMS_Poll(pm_data_t *dat);
 
+pms_state_t PMS_GetState(void);
+
+/*
+* @brief Latest good frame
+*
+* @return false before the first one
+*/
+bool PMS_GetFrame(pms_frame_t *frame);
+
+/*
+* @brief Switch the sensor between active (a frame every second or so) 
+*        and passive mode (a frame per PMS_RequestRead). Needs the 
+*        sensor's RX wired to PM_TXD_PIN.
+*/
+esp_err_t PMS_SetPassive(bool passive);
+esp_err_t PMS_RequestRead(void);
+
 void PMS_RESET(uint32_t level);
 void PMS_GPIOEnable();
 void PMS_SET(uint32_t level);
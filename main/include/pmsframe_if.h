@@ -0,0 +1,79 @@
+/*
+ * pmsframe_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_PMSFRAME_IF_H_
+#define MAIN_INCLUDE_PMSFRAME_IF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Plantower PMS frames, as pm_if.c gets them from the UART. No ESP-IDF
+ * beyond esp_err_t, builds on the host.
+ *
+ * A frame is "BM", the length of the rest, then 16 bit words, most
+ * significant byte first. The last word is the sum of every byte before
+ * it. Data frames are 24 bytes (PMS3003) or 32 bytes (PMS5003/7003);
+ * a command is answered with an 8 byte frame.
+ */
+#define PMS_HDR_LEN         4     // "BM" and the length of the rest
+#define PMS3003_FRAME_LEN   24
+#define PMS5003_FRAME_LEN   32    // PMS5003, PMS7003
+#define PMS_ACK_FRAME_LEN   8     // Reply to a command
+#define PMS_FRAME_MAX       PMS5003_FRAME_LEN
+#define PMS_CMD_LEN         7
+#define PMS_CMD_READ        0xE2  // Passive mode: send one frame
+#define PMS_CMD_MODE        0xE1  // Data 0: passive, 1: active
+#define PMS_CMD_SLEEP       0xE4  // Data 0: sleep, 1: wake
+
+
+/*
+* @brief Everything in one frame, in frame order
+*
+* Both models send the CF=1 and atmospheric values. Only 32 byte frames
+* carry the particle counts, version and error code; they're 0 in 24
+* byte ones, whose last three words are reserved.
+*/
+typedef struct __attribute__((packed))
+{
+  uint16_t pm1_cf1;         // ug/m3, CF=1 (standard particle)
+  uint16_t pm2_5_cf1;
+  uint16_t pm10_cf1;
+  uint16_t pm1_atm;         // ug/m3, atmospheric environment
+  uint16_t pm2_5_atm;
+  uint16_t pm10_atm;
+  uint16_t cnt_0_3;         // Particles over 0.3 um in 0.1 L of air
+  uint16_t cnt_0_5;
+  uint16_t cnt_1_0;
+  uint16_t cnt_2_5;
+  uint16_t cnt_5_0;
+  uint16_t cnt_10;
+  uint8_t version;          // Firmware version
+  uint8_t error;            // Error code
+  uint8_t len;              // PMS3003_FRAME_LEN or PMS5003_FRAME_LEN
+} pms_frame_t;
+
+
+/*
+* @brief Decode one frame
+*
+* @param buf: starts with "BM"
+* @param len: bytes in buf, at least the frame's own length
+*
+* @return ESP_OK, ESP_ERR_INVALID_SIZE if it isn't a 24 or 32 byte data
+*         frame, or ESP_ERR_INVALID_CRC
+*/
+esp_err_t PMS_ParseFrame(const uint8_t *buf, size_t len, pms_frame_t *frame);
+
+/*
+* @brief The frame checksum: sum of len bytes
+*/
+uint16_t PMS_Sum(const uint8_t *buf, size_t len);
+
+#endif /* MAIN_INCLUDE_PMSFRAME_IF_H_ */
@@ -0,0 +1,74 @@
+/*
+ * probe_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_PROBE_IF_H_
+#define MAIN_INCLUDE_PROBE_IF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define PROBE_MAX_PROBES	8		/* One OK bit and one DONE bit per probe in a 24-bit event group */
+
+/*
+* @brief	A reachability probe. Must return ESP_OK only if it got an
+* 			answer from a host beyond the access point within timeout_ms.
+*/
+typedef esp_err_t (*probe_fn_t)(uint32_t timeout_ms);
+
+typedef struct {
+	const char *name;
+	probe_fn_t fn;
+	uint32_t successes;			/* Number of runs this probe answered */
+	uint32_t failures;			/* Number of runs this probe failed or timed out */
+	uint32_t last_latency_ms;	/* Latency of the last completed run */
+} probe_t;
+
+/*
+* @brief	Register the default probes (TCP connect to the MQTT broker,
+* 			DNS query, HTTP 204). Call once from app_main, before the
+* 			wifi manager starts; the other calls fail until then.
+*
+* @return	N/A
+*/
+void PROBE_Initialize(void);
+
+/*
+* @brief	Add a probe to the set that PROBE_Check runs in parallel
+*
+* @param	name: 	probe name used for logging
+* @param	fn: 	probe function
+*
+* @return	ESP_OK, ESP_ERR_NO_MEM if PROBE_MAX_PROBES are registered, or
+* 			ESP_ERR_INVALID_STATE before PROBE_Initialize
+*/
+esp_err_t PROBE_Register(const char *name, probe_fn_t fn);
+
+/*
+* @brief	Is the internet reachable? Returns the cached answer if a probe
+* 			succeeded within CONFIG_PROBE_CACHE_TTL_S, otherwise runs every
+* 			registered probe in parallel and returns as soon as the first
+* 			one succeeds (or when all have failed or timed out).
+*
+* @return	true if any probe succeeded, false at once before PROBE_Initialize
+*/
+bool PROBE_Check(void);
+
+/*
+* @brief	Drop the cached result so the next PROBE_Check runs the probes.
+* 			Call when the station loses its IP.
+*/
+void PROBE_Invalidate(void);
+
+/*
+* @brief	Copy of a registered probe's stats
+*
+* @return	false if idx is out of range
+*/
+bool PROBE_GetStats(int idx, probe_t *stats);
+
+#endif /* MAIN_INCLUDE_PROBE_IF_H_ */
@@ -4,12 +4,65 @@
  *  Created on: Oct 8, 2018
  *      Author: tombo
  */
+#include <stdbool.h>
 #include <time.h>
 #include <sys/time.h>
+#include "clock_if.h"
 
 #ifndef MAIN_INCLUDE_TIME_IF_H_
 #define MAIN_INCLUDE_TIME_IF_H_
 
+/*
+ * One UTC clock for every module: esp_timer disciplined by GPS RMC time
+ * and SNTP (see clock_if.h). It never goes backwards and says how good
+ * it is, so data from before the first fix or sync can be told apart.
+ *
+ * lwIP's SNTP keeps setting the system clock as before. Its updates are
+ * picked up from there: the system clock and esp_timer run off the same
+ * crystal, so between updates their difference stays put. If GPS gets a
+ * fix first, the system clock is set from it, for TLS and the logs.
+ *
+ * 		time									reply with time, quality, error and drift
+ */
+typedef struct {
+	clock_quality_t quality;
+	uint32_t err_ms;
+	int32_t drift_ppb;			/* Of esp_timer, once estimated */
+	bool drift_known;
+	uint8_t samples;			/* In the current fit */
+	uint32_t rejected;
+	uint32_t steps;
+} time_status_t;
+
+/*
+* @brief	Start watching the system clock for SNTP updates and register
+* 			the "time" command
+*/
+void TIME_Initialize(void);
+
+/*
+* @brief	Current UTC
+*
+* @param	tv:     set to 0 with CLOCK_Q_NONE
+* @param	err_ms: estimated error bound, may be NULL
+*
+* @return	How the time was obtained
+*/
+clock_quality_t TIME_Now(struct timeval *tv, uint32_t *err_ms);
+
+/*
+* @brief	Feed a GPS time (from the RMC parser)
+*
+* @param	mono_us: esp_timer when the second started
+* @param	utc_us:  that second, since the UNIX Epoch
+* @param	fix:     RMC status A. Without it the time is the receiver's RTC.
+*/
+void TIME_GPS(int64_t mono_us, int64_t utc_us, bool fix);
+
+void TIME_GetStatus(time_status_t *st);
+
+const char *TIME_QualityName(clock_quality_t q);
+
 
 /*
 * @brief
@@ -0,0 +1,110 @@
+/*
+ * trace_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_TRACE_IF_H_
+#define MAIN_INCLUDE_TRACE_IF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#else
+/* Host build: cc -DCONFIG_TRACE_ENABLE -DCONFIG_TRACE_RING_LEN=256 -Imain/include main/trace_if.c ... */
+#include <time.h>
+typedef int esp_err_t;
+#define ESP_OK			0
+#define ESP_FAIL		-1
+#define ESP_ERR_NO_MEM	0x101
+#endif
+
+#define TRACE_JSON_PATH		"/sdcard/trace.json"
+
+/*
+ * Latency spans, e.g.
+ *
+ * 		TRACE_BEGIN(t);
+ * 		PMS_Poll(&pm_dat);
+ * 		TRACE_END(t, "pms_poll");
+ *
+ * A span costs two cycle counter reads and one ring write, and nothing at
+ * all without CONFIG_TRACE_ENABLE. name must be a string literal: only the
+ * pointer is kept.
+ */
+#ifdef CONFIG_TRACE_ENABLE
+#define TRACE_BEGIN(span)		trace_span_t span = TRACE_Now()
+#define TRACE_END(span, name)	TRACE_Record((name), (span))
+#else
+#define TRACE_BEGIN(span)
+#define TRACE_END(span, name)
+#endif
+
+/* Core id in the upper word, cycle count in the lower */
+typedef uint64_t trace_span_t;
+
+/*
+* @brief	Called by TRACE_Dump with each piece of JSON
+*
+* @return	0 to carry on, anything else stops the dump
+*/
+typedef int (*trace_write_fn_t)(const char *buf, size_t len, void *arg);
+
+/*
+* @brief	Current core and cycle count. On the host, nanoseconds from
+* 			clock_gettime stand in for cycles.
+*/
+static inline trace_span_t TRACE_Now(void)
+{
+#ifdef ESP_PLATFORM
+	uint32_t ccount;
+
+	__asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+	return ((uint64_t) xPortGetCoreID() << 32) | ccount;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+/*
+* @brief	Line the cores' cycle counters up with esp_timer, measure the
+* 			cost of a span and register the "trace" command. Call early.
+*
+* @return	N/A
+*/
+void TRACE_Initialize(void);
+
+/*
+* @brief	Close a span opened at begin. Use TRACE_END rather than calling
+* 			this directly.
+*/
+void TRACE_Record(const char *name, trace_span_t begin);
+
+/*
+* @brief	Write the ring as Chrome trace-event JSON (chrome://tracing,
+* 			ui.perfetto.dev), oldest span first
+*
+* @param	fn:  writer, called with each piece
+* @param	arg: passed to fn
+*
+* @return	ESP_OK, ESP_ERR_NO_MEM, or ESP_FAIL if fn stopped the dump
+*/
+esp_err_t TRACE_Dump(trace_write_fn_t fn, void *arg);
+
+/*
+* @brief	TRACE_Dump into a file, e.g. TRACE_JSON_PATH on the SD card
+*/
+esp_err_t TRACE_DumpFile(const char *path);
+
+/*
+* @brief	Measured cost of one span (begin, end and ring write) in cycles
+*/
+uint32_t TRACE_Overhead(void);
+
+#endif /* MAIN_INCLUDE_TRACE_IF_H_ */
@@ -0,0 +1,92 @@
+/*
+ * unpack_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_UNPACK_IF_H_
+#define MAIN_INCLUDE_UNPACK_IF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define UNPACK_MAGIC		"AUH1"
+#define UNPACK_HEADER_LEN	12
+#define UNPACK_OUT_LEN		256		/* Output batch size */
+
+/*
+ * Compressed file layout (made by main/mkpack.py):
+ *
+ * 		"AUH1" | window_sz2 u8 | lookahead_sz2 u8 | 0 u16 | size u32 (LE)
+ * 		then a heatshrink (LZSS) bit stream, MSB first:
+ * 			1 + 8 bits:					literal byte
+ * 			0 + window_sz2 bits (d-1)
+ * 			  + lookahead_sz2 bits (n-1):	copy n bytes from d back
+ *
+ * The decoder only keeps the last 2^window_sz2 bytes of output.
+ */
+
+typedef esp_err_t (*unpack_write_fn_t)(void *arg, const uint8_t *data, size_t len);
+
+typedef enum {
+	UNPACK_STATE_HEADER = 0,
+	UNPACK_STATE_TAG,
+	UNPACK_STATE_LITERAL,
+	UNPACK_STATE_BACKREF,
+	UNPACK_STATE_DONE,
+} unpack_state_t;
+
+typedef struct {
+	unpack_state_t state;
+	unpack_write_fn_t write;
+	void *arg;
+	uint8_t hdr[UNPACK_HEADER_LEN];
+	uint32_t hdr_len;
+	uint8_t window_sz2;
+	uint8_t lookahead_sz2;
+	uint32_t size;					/* Unpacked size from the header */
+	uint32_t out_len;				/* Bytes produced so far */
+	uint32_t bits;					/* Bit accumulator, MSB first */
+	uint32_t bit_cnt;
+	uint8_t *window;				/* 2^window_sz2 bytes, from the heap */
+	uint32_t head;
+	uint8_t out[UNPACK_OUT_LEN];
+	uint32_t out_fill;
+} unpack_t;
+
+/*
+* @brief	Start unpacking a compressed file. Call UNPACK_End first if u
+* 			was used before.
+*
+* @param	u: 		decoder state
+* @param	write:	called with the unpacked data, in order
+* @param	arg:	passed to write
+*
+* @return	ESP_OK
+*/
+esp_err_t UNPACK_Begin(unpack_t *u, unpack_write_fn_t write, void *arg);
+
+/*
+* @brief	Feed the next piece of the compressed file, any size. The
+* 			window is allocated once the header is in.
+*
+* @return	ESP_OK, ESP_ERR_INVALID_STATE / ESP_ERR_INVALID_SIZE for a bad
+* 			file, ESP_ERR_NO_MEM, or the write callback's error
+*/
+esp_err_t UNPACK_Feed(unpack_t *u, const uint8_t *data, size_t len);
+
+/*
+* @brief	Flush the output and check the whole file was unpacked
+*
+* @return	ESP_OK, or ESP_ERR_INVALID_SIZE if it was truncated
+*/
+esp_err_t UNPACK_Finish(unpack_t *u);
+
+/*
+* @brief	Free the window. Call after Finish or to abandon a file.
+*/
+void UNPACK_End(unpack_t *u);
+
+#endif /* MAIN_INCLUDE_UNPACK_IF_H_ */
@@ -0,0 +1,91 @@
+/*
+ * wdt_if.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef MAIN_INCLUDE_WDT_IF_H_
+#define MAIN_INCLUDE_WDT_IF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define WDT_REASON_LEN		48
+
+/*
+ * Components the health watchdog tracks. Each one reports two things:
+ *
+ * 		alive:		its loop is still turning (WDT_Alive)
+ * 		progress:	it did useful work, e.g. decoded a frame (WDT_Progress)
+ *
+ * A component is only judged once it has reported at least once, so a
+ * sensor that isn't fitted never resets the device.
+ */
+typedef enum {
+	WDT_DATA = 0,
+	WDT_PM,
+	WDT_GPS,
+	WDT_MQTT,
+	WDT_WIFI,
+	WDT_COMPONENT_COUNT,
+} wdt_component_t;
+
+typedef struct {
+	const char *name;
+	uint32_t alive_timeout_s;		/* 0: liveness not checked */
+	uint32_t progress_timeout_s;	/* 0: progress not checked */
+	bool armed;						/* Reported at least once */
+	uint32_t alive;					/* Check-ins since boot */
+	uint32_t progress;
+	int64_t last_alive_us;
+	int64_t last_progress_us;
+	int64_t quiet_until_us;			/* Not judged before, see WDT_Expect */
+} wdt_entry_t;
+
+/*
+* @brief	Log why we last reset (if it was us) and start the monitor task.
+* 			Needs NVS, call after APP_Initialize.
+*
+* @return	N/A
+*/
+void WDT_Initialize(void);
+
+/*
+* @brief	Loop check-in. Cheap, call every iteration.
+*/
+void WDT_Alive(wdt_component_t c);
+
+/*
+* @brief	The component did useful work. Also counts as a check-in.
+*/
+void WDT_Progress(wdt_component_t c);
+
+/*
+* @brief	Stop judging a component that goes quiet on purpose (e.g. a
+* 			sensor put in standby). Its next report arms it again.
+*/
+void WDT_Disarm(wdt_component_t c);
+
+/*
+* @brief	The component goes quiet on purpose for up to quiet_s (e.g. a
+* 			sensor asleep until a timer wakes it). It isn't judged until
+* 			then, and its timeouts run from there, so a wake-up that never
+* 			comes still resets the device.
+*/
+void WDT_Expect(wdt_component_t c, uint32_t quiet_s);
+
+/*
+* @brief	Snapshot of a component's counters
+*/
+void WDT_GetEntry(wdt_component_t c, wdt_entry_t *entry);
+
+/*
+* @brief	Reason the watchdog gave for the last reset, e.g. "pm progress
+* 			312s", or false if the last reset wasn't ours
+*/
+bool WDT_GetLastReason(char *reason, size_t len);
+
+#endif /* MAIN_INCLUDE_WDT_IF_H_ */
@@ -326,19 +326,24 @@ esp_err_t wifi_manager_save_wifi_settings();
 bool wifi_manager_connected_to_access_point();
 
 /**
- * @brief Ping www.google.com. If successful, we have Internet.
+ * @brief Run the reachability probes. If any succeeds, we have Internet.
+ * @return 1 with internet, 0 without, ERR_WIFI_DISCONECTED if not associated.
  */
 int wifi_manager_check_connection();
 
 /**
- * @brief set bit to check internet connection with ping test
+ * @brief set bit to check internet connection with the reachability probes
  */
 void wifi_manager_check_connection_async();
 
+/**
+ * @brief Did the last reachability check find the internet?
+ */
+bool wifi_manager_have_internet();
+
 EventBits_t wifi_manager_wait_connect();
 EventBits_t wifi_manager_wait_disconnect();
 EventBits_t wifi_manager_wait_internet_access();
-//void wifi_manager_ping_test(void);
 #ifdef __cplusplus
 }
 #endif
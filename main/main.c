@@ -61,6 +61,7 @@ Notes:
 #endif
 #include "hdc1080_if.h"
 #include "mics4514_if.h"
+#include "gas_if.h"
 #include "gps_if.h"
 
 // Internet necessary
@@ -77,6 +78,11 @@ Notes:
 #include "mqtt_if.h"
 #include "time_if.h"
 #include "ota_if.h"
+#include "wdt_if.h"
+#include "diag_if.h"
+#include "metrics_if.h"
+#include "probe_if.h"
+#include "trace_if.h"
 
 
 /* GPIO */
@@ -120,25 +126,6 @@ time_t last_publish = 0;
 //	}
 //}
 
-void panic_task(void *pvParameters)
-{
-	uint64_t free_stack;
-	time_t now = 0;
-	while(1) {
-		vTaskDelay(60 * 60 * 1000 / portTICK_PERIOD_MS);
-		ESP_LOGI(TAG, "Rebooting...");
-		abort();
-//		now = esp_timer_get_time() / 1000000;
-//		ESP_LOGI(TAG, "now: %li, last: %li, diff: %li", now, last_publish, (now - last_publish));
-//		if(last_publish != 0 && now - last_publish > 3600){
-//			ESP_LOGE(TAG, "No pub in 1 hr. Rebooting.");
-//			abort();
-//		}
-//		free_stack = uxTaskGetStackHighWaterMark(NULL);
-//		ESP_LOGI(TAG, "%s free stack: %llu", __func__, free_stack);
-	}
-}
-
 /*
  * Data gather task
  */
@@ -146,16 +133,27 @@ void data_task()
 {
 	esp_err_t err;
 	pm_data_t pm_dat;
-	double temp, hum;
-	int co, nox;
+	int32_t temp_fx = 20 * HDC1080_SCALE, hum_fx = 50 * HDC1080_SCALE;	/* Gas compensation until the first reading */
+	bool have_th;
+	int ox_mv, red_mv;
+	uint32_t co, nox;					/* ppb */
+	bool have_co, have_nox;
 	esp_gps_t gps;
 	char *pkt;
 	uint64_t uptime = 0;
 	uint64_t hr, rm;
 	time_t now;
+	struct timeval tv;
+	clock_quality_t tq;
+	uint32_t terr_ms;
 	struct tm tm;
 	char strftime_buf[64];
 	uint8_t min, sec, system_time;
+#ifdef CONFIG_SD_DATA_STORE
+	char temp_str[12], hum_str[12], co_str[12], nox_str[12];
+	int64_t sd_start_us;
+	metric_t *m_sd_write_ms = METRICS_Register("sd_write_ms", METRIC_HISTOGRAM);
+#endif
 
 	// only need to get it once
 	esp_app_desc_t *app_desc = esp_ota_get_app_description();
@@ -163,19 +161,45 @@ void data_task()
 	while (1) {
 
         vTaskDelay(CONFIG_DATA_UPLOAD_PERIOD * 1000 / portTICK_PERIOD_MS);
-		PMS_Poll(&pm_dat);
-		HDC1080_Poll(&temp, &hum);
-		MICS4514_Poll(&nox, &co);
+		WDT_Alive(WDT_DATA);
+		DIAG_TaskRun("data");
+		TRACE_BEGIN(t_period);
+		TRACE_BEGIN(t_pms);
+		if (PMS_Poll(&pm_dat) == ESP_OK) {
+			ota_health_report(OTA_HEALTH_PM_BIT);
+		}
+		TRACE_END(t_pms, "pms_poll");
+		TRACE_BEGIN(t_hdc);
+		// Stale (heater burst) or no reading: still good enough to compensate the gas
+		// readings with, but not to publish
+		err = HDC1080_Poll(&temp_fx, &hum_fx);
+		have_th = (err == ESP_OK);
+		if (!have_th) {
+			ESP_LOGW(TAG, "No fresh temperature/humidity (%s)", esp_err_to_name(err));
+		}
+		TRACE_END(t_hdc, "hdc1080_poll");
+		TRACE_BEGIN(t_mics);
+		have_co = have_nox = false;
+		if (MICS4514_Poll(&ox_mv, &red_mv) == ESP_OK) {
+			have_co = (GAS_Convert(GAS_RED, red_mv, temp_fx, hum_fx, &co) == ESP_OK);
+			have_nox = (GAS_Convert(GAS_OX, ox_mv, temp_fx, hum_fx, &nox) == ESP_OK);
+		}
+		TRACE_END(t_mics, "mics4514_poll");
+		TRACE_BEGIN(t_gps);
 		GPS_Poll(&gps);
+		TRACE_END(t_gps, "gps_poll");
 
 		uptime = esp_timer_get_time() / 1000000;
+		tq = TIME_Now(&tv, &terr_ms);
+		now = tv.tv_sec;
 
 		pkt = malloc(MQTT_PKT_LEN);
 
 		//
 		// Send data over MQTT
 		//
-		sprintf(pkt, MQTT_PKT, DEVICE_MAC,			/* ID 			*/
+		TRACE_BEGIN(t_fmt);
+		int len = snprintf(pkt, MQTT_PKT_LEN, MQTT_PKT, DEVICE_MAC,			/* ID 			*/
 							   app_desc->version,	/* SensorModel 	*/
 							   uptime, 				/* secActive 	*/
 							   gps.alt,				/* Altitude 	*/
@@ -183,18 +207,41 @@ void data_task()
 							   gps.lon, 			/* Longitude 	*/
 							   pm_dat.pm1,			/* PM1 			*/
 							   pm_dat.pm2_5,		/* PM2.5 		*/
-							   pm_dat.pm10, 		/* PM10 		*/
-							   temp,				/* Temperature 	*/
-							   hum,					/* Humidity 	*/
-							   co,					/* CO 			*/
-							   nox);				/* NOx 			*/
+							   pm_dat.pm10);		/* PM10 		*/
+
+		if (have_th && len > 0 && len < MQTT_PKT_LEN) {
+			len += snprintf(pkt + len, MQTT_PKT_LEN - len, MQTT_PKT_TH,
+							(double) temp_fx / HDC1080_SCALE, (double) hum_fx / HDC1080_SCALE);
+		}
+
+		// No gas reading (sensor warming up, or out of the calibrated range): leave it out
+		if (have_co && len > 0 && len < MQTT_PKT_LEN) {
+			len += snprintf(pkt + len, MQTT_PKT_LEN - len, MQTT_PKT_CO, co);
+		}
+		if (have_nox && len > 0 && len < MQTT_PKT_LEN) {
+			len += snprintf(pkt + len, MQTT_PKT_LEN - len, MQTT_PKT_NO, nox);
+		}
+
+		// Sample timestamp doubles as the idempotency key for QoS 1 re-sends.
+		// The GPS receiver's RTC alone may be off by hours: leave those to the server.
+		if (tq >= CLOCK_Q_HOLDOVER && now > MQTT_PKT_TS_MIN && len > 0 && len < MQTT_PKT_LEN) {
+			snprintf(pkt + len, MQTT_PKT_LEN - len, MQTT_PKT_TS, (long) now);
+		}
+
+		TRACE_END(t_fmt, "format");
 
 		ESP_LOGI(TAG, "MQTT PACKET:\n\r%s", pkt);
+		TRACE_BEGIN(t_pub);
 		err = MQTT_Publish_Data(pkt);
+		TRACE_END(t_pub, "publish");
 		if(err >= ESP_OK){
 			ESP_LOGI(TAG, "MQTT publish success %d", err);
 			last_publish = uptime;
 		}
+		else if (err == MQTT_PUB_QUEUED){
+			ESP_LOGW(TAG, "MQTT offline, packet queued");
+			wifi_manager_check_connection_async();
+		}
 		else{
 			ESP_LOGI(TAG, "MQTT publish fail %d", err);
 			wifi_manager_check_connection_async();
@@ -204,12 +251,11 @@ void data_task()
 		/************************************
 		 * Save to SD Card
 		 *************************************/
-		time(&now);
-		localtime_r(&now, &tm);
+		gmtime_r(&now, &tm);
 		strftime(strftime_buf, sizeof(strftime_buf), "%c", &tm);
-		ESP_LOGI(TAG, "SD card datetime: %s", strftime_buf);
+		ESP_LOGI(TAG, "SD card datetime: %s (%s, %u ms)", strftime_buf, TIME_QualityName(tq), terr_ms);
 
-		if (gps.year <= 18 || gps.year >= 80){
+		if (tq == CLOCK_Q_NONE){
 			hr = uptime / 3600;
 			rm = uptime % 3600;
 			min = rm / 60;
@@ -219,10 +265,21 @@ void data_task()
 			system_time = 1;	// Using system time
 		}
 		else {
-			sprintf(strftime_buf, "%02d:%02d:%02d", gps.hour, gps.min, gps.sec);
-			system_time = 0;	// Using GPS time
+			strftime(strftime_buf, sizeof(strftime_buf), "%H:%M:%S", &tm);
+			system_time = 0;	// Using UTC
 		}
 
+		temp_str[0] = hum_str[0] = co_str[0] = nox_str[0] = '\0';
+		if (have_th) {
+			snprintf(temp_str, sizeof(temp_str), "%.2f", (double) temp_fx / HDC1080_SCALE);
+			snprintf(hum_str, sizeof(hum_str), "%.2f", (double) hum_fx / HDC1080_SCALE);
+		}
+		if (have_co) {
+			snprintf(co_str, sizeof(co_str), "%u", co);
+		}
+		if (have_nox) {
+			snprintf(nox_str, sizeof(nox_str), "%u", nox);
+		}
 		sprintf(pkt, SD_PKT, strftime_buf,
 							 DEVICE_MAC,
 							 MQTT_DATA_PUB_TOPIC,
@@ -233,16 +290,30 @@ void data_task()
 							 pm_dat.pm1,
 							 pm_dat.pm2_5,
 							 pm_dat.pm10,
-							 temp,
-							 hum,
-							 co,
-							 nox);
-
-		sd_write_data(pkt, gps.year, gps.month, gps.day);
+							 temp_str,
+							 hum_str,
+							 co_str,
+							 nox_str);
+
+		sd_start_us = esp_timer_get_time();
+		TRACE_BEGIN(t_sd);
+		if (system_time) {
+			err = sd_write_data(pkt, 0, 0, 0);
+		}
+		else {
+			err = sd_write_data(pkt, tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday);
+		}
+		TRACE_END(t_sd, "sd_write");
+		METRICS_Observe(m_sd_write_ms, (esp_timer_get_time() - sd_start_us) / 1000);
+		if (err != ESP_OK) {
+			DIAG_SetError(DIAG_SRC_SD, err);
+		}
 		periodic_timer_callback(NULL);
 #endif
 
 		free(pkt);
+		TRACE_END(t_period, "data_period");
+		DIAG_Flush(false);
 
 		/* this is a good place to do a ping test */
 //		wifi_manager_check_connection_async();
@@ -257,9 +328,27 @@ void app_main()
 	APP_Initialize();
 	printf("\nMAC Address: %s\n\n", DEVICE_MAC);
 
+	/* Pick up the previous run's reset diagnostics */
+	DIAG_Initialize();
+
+	/* Count this boot of a pending update before any driver can crash */
+	ota_boot_check();
+
+	/* Latency tracing, if enabled in menuconfig */
+	TRACE_Initialize();
+
+	/* Start the health watchdog (resets only when a task stalls) */
+	WDT_Initialize();
+
+	/* Start publishing heap, stack and latency metrics */
+	METRICS_Initialize();
+
 	/* Initialize the LED Driver */
 	LED_Initialize();
 
+	/* One UTC clock from GPS and SNTP, and the "time" command */
+	TIME_Initialize();
+
 	/* Initialize the GPS Driver */
 	GPS_Initialize();
 
@@ -272,9 +361,15 @@ void app_main()
 	/* Initialize the MICS Driver */
 	MICS4514_Initialize();
 
+	/* Gas calibration, and the "gascal" command */
+	GAS_Initialize();
+
 	/* Initialize the SD Card Driver */
 	SD_Initialize();
 
+	/* Internet reachability probes, used by the wifi manager */
+	PROBE_Initialize();
+
 	/* start the led task */
 	xTaskCreate(&led_task, "led_task", 2048, NULL, 3, &task_led);
 
@@ -290,8 +385,12 @@ void app_main()
 	/* start the ota task */
 	xTaskCreate(&ota_task, "ota_task", 4096, NULL, 10, &task_ota);
 
-	/* Panic task */
-	xTaskCreate(&panic_task, "panic", 2096, NULL, 10, NULL);
+	/* Stack high water marks for the tasks started here */
+	METRICS_WatchTask(task_led);
+	METRICS_WatchTask(data_task_handle);
+	METRICS_WatchTask(task_http_server);
+	METRICS_WatchTask(task_wifi_manager);
+	METRICS_WatchTask(task_ota);
 
 	vTaskDelay(1000 / portTICK_PERIOD_MS); /* the initialization functions below need to wait until the event groups are created in the above tasks */
 
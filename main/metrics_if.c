@@ -0,0 +1,316 @@
+/*
+ * metrics_if.c
+ *
+ * Notes:
+ * 		Counters, gauges and histograms that other modules register into,
+ * 		plus heap and per-task stack stats sampled here. Everything goes
+ * 		out every CONFIG_METRICS_PERIOD_S on the metrics topic as InfluxDB
+ * 		line protocol at QoS 0, one "metrics" line and one "tasks" line
+ * 		per task:
+ *
+ * 			metrics,ID=<mac> uptime=..i,heap_free=..i,..,mqtt_pub_ms_n=..i,mqtt_pub_ms_h="0,3,1,0,0,0,0,0"
+ * 			tasks,ID=<mac>,task=Data_task stack=..i,cpu=..i
+ *
+ * 		stack is the high water mark in bytes (the least free stack seen).
+ * 		Every task and its CPU share (% of one core) need
+ * 		CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ * 		CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS; without them only tasks
+ * 		passed to METRICS_WatchTask are reported, without cpu.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "app_utils.h"
+#include "mqtt_if.h"
+#include "metrics_if.h"
+
+#define METRICS_TASK_STACK	3072
+#define METRICS_TASK_PRIO	2
+#define METRICS_TOPIC_LEN	64
+#define METRICS_TAG_LEN		(configMAX_TASK_NAME_LEN + 1)
+
+static const char *TAG = "METRICS";
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+static metric_t metrics[METRICS_MAX];
+static int metrics_count = 0;
+static TaskHandle_t watched[METRICS_MAX_TASKS];
+static int watched_count = 0;
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+typedef struct {
+	UBaseType_t num;
+	uint32_t run_time;
+} metrics_run_t;
+
+static metrics_run_t *prev_run = NULL;	/* One per task in the last snapshot */
+static int prev_run_count = 0;
+static uint32_t prev_total = 0;
+#endif
+
+static void metrics_task(void *pvParameters);
+static void _metrics_append(char *pkt, int *len, const char *fmt, ...);
+static void _metrics_task_line(char *pkt, int *len, const char *name, uint32_t hwm, int cpu);
+static void _metrics_tasks(char *pkt, int *len);
+
+
+metric_t *METRICS_Register(const char *name, metric_type_t type)
+{
+	metric_t *m = NULL;
+
+	portENTER_CRITICAL(&metrics_mux);
+	for (int i = 0; i < metrics_count; i++) {
+		if (strcmp(metrics[i].name, name) == 0) {
+			m = &metrics[i];
+			break;
+		}
+	}
+	if (m == NULL && metrics_count < METRICS_MAX) {
+		m = &metrics[metrics_count++];
+		m->name = name;
+		m->type = type;
+	}
+	portEXIT_CRITICAL(&metrics_mux);
+
+	if (m == NULL) {
+		ESP_LOGE(TAG, "Registry full, dropping %s", name);
+	}
+	return m;
+}
+
+void METRICS_Add(metric_t *m, int32_t n)
+{
+	if (m == NULL) {
+		return;
+	}
+	portENTER_CRITICAL(&metrics_mux);
+	m->value += n;
+	portEXIT_CRITICAL(&metrics_mux);
+}
+
+void METRICS_Set(metric_t *m, int32_t value)
+{
+	if (m == NULL) {
+		return;
+	}
+	portENTER_CRITICAL(&metrics_mux);
+	m->value = value;
+	portEXIT_CRITICAL(&metrics_mux);
+}
+
+void METRICS_Observe(metric_t *m, uint32_t value)
+{
+	int b = 0;
+	uint32_t edge = 1;
+
+	if (m == NULL) {
+		return;
+	}
+	while (b < METRICS_BUCKETS - 1 && value > edge) {
+		edge <<= 2;
+		b++;
+	}
+
+	portENTER_CRITICAL(&metrics_mux);
+	m->count++;
+	m->sum += value;
+	if (value > m->max) {
+		m->max = value;
+	}
+	m->buckets[b]++;
+	portEXIT_CRITICAL(&metrics_mux);
+}
+
+void METRICS_WatchTask(TaskHandle_t task)
+{
+	if (task == NULL) {
+		task = xTaskGetCurrentTaskHandle();
+	}
+	portENTER_CRITICAL(&metrics_mux);
+	if (watched_count < METRICS_MAX_TASKS) {
+		watched[watched_count++] = task;
+	}
+	portEXIT_CRITICAL(&metrics_mux);
+}
+
+/*
+* @brief	snprintf onto the end of pkt. Once it's full, len stays
+* 			>= METRICS_PKT_LEN and further appends are dropped.
+*/
+static void _metrics_append(char *pkt, int *len, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	if (*len >= METRICS_PKT_LEN) {
+		return;
+	}
+	va_start(args, fmt);
+	n = vsnprintf(pkt + *len, METRICS_PKT_LEN - *len, fmt, args);
+	va_end(args);
+	*len = (n < 0) ? METRICS_PKT_LEN : *len + n;
+}
+
+/*
+* @brief	One "tasks" line. cpu < 0 leaves the field out.
+*/
+static void _metrics_task_line(char *pkt, int *len, const char *name, uint32_t hwm, int cpu)
+{
+	char tag[METRICS_TAG_LEN];
+
+	// Tag values can't hold spaces, commas or '=' unescaped ("Tmr Svc")
+	strlcpy(tag, name, sizeof(tag));
+	for (char *c = tag; *c; c++) {
+		if (*c == ' ' || *c == ',' || *c == '=') {
+			*c = '_';
+		}
+	}
+
+	_metrics_append(pkt, len, "\ntasks,ID=%s,task=%s stack=%ui", DEVICE_MAC, tag, hwm);
+	if (cpu >= 0) {
+		_metrics_append(pkt, len, ",cpu=%di", cpu);
+	}
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+static void _metrics_tasks(char *pkt, int *len)
+{
+	TaskStatus_t *st;
+	UBaseType_t n = uxTaskGetNumberOfTasks() + 2;	/* Room for tasks created meanwhile */
+	uint32_t total;
+	int cpu;
+
+	if ((st = malloc(n * sizeof(TaskStatus_t))) == NULL) {
+		return;
+	}
+	n = uxTaskGetSystemState(st, n, &total);
+
+	for (int i = 0; i < n; i++) {
+		cpu = -1;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		for (int j = 0; j < prev_run_count; j++) {
+			if (prev_run[j].num == st[i].xTaskNumber && total != prev_total) {
+				cpu = (uint64_t) (st[i].ulRunTimeCounter - prev_run[j].run_time) * 100 / (total - prev_total);
+				break;
+			}
+		}
+#endif
+		_metrics_task_line(pkt, len, st[i].pcTaskName, st[i].usStackHighWaterMark, cpu);
+	}
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	// Sized from this snapshot, so every task gets a CPU figure next time
+	if (n > prev_run_count) {
+		free(prev_run);
+		prev_run = malloc(n * sizeof(metrics_run_t));
+	}
+	prev_run_count = (prev_run != NULL) ? n : 0;
+	for (int i = 0; i < prev_run_count; i++) {
+		prev_run[i].num = st[i].xTaskNumber;
+		prev_run[i].run_time = st[i].ulRunTimeCounter;
+	}
+	prev_total = total;
+#endif
+	free(st);
+}
+#else
+static void _metrics_tasks(char *pkt, int *len)
+{
+	for (int i = 0; i < watched_count; i++) {
+		_metrics_task_line(pkt, len, pcTaskGetTaskName(watched[i]),
+						   uxTaskGetStackHighWaterMark(watched[i]), -1);
+	}
+}
+#endif
+
+static void metrics_task(void *pvParameters)
+{
+	metric_t *snap;
+	char topic[METRICS_TOPIC_LEN];
+	char *pkt, *nl;
+	int count, len, b;
+
+	METRICS_WatchTask(NULL);
+	snprintf(topic, sizeof(topic), METRICS_TOPIC_TMPLT, DEVICE_MAC);
+
+	for (;;) {
+		vTaskDelay(CONFIG_METRICS_PERIOD_S * ONE_SECOND_DELAY);
+
+		pkt = malloc(METRICS_PKT_LEN);
+		snap = malloc(sizeof(metrics));
+		if (pkt == NULL || snap == NULL) {
+			ESP_LOGW(TAG, "No memory for a report");
+			free(pkt);
+			free(snap);
+			continue;
+		}
+
+		// Histograms cover one period: copy them out and start over
+		portENTER_CRITICAL(&metrics_mux);
+		count = metrics_count;
+		memcpy(snap, metrics, sizeof(metrics));
+		for (int i = 0; i < count; i++) {
+			if (metrics[i].type == METRIC_HISTOGRAM) {
+				metrics[i].count = metrics[i].sum = metrics[i].max = 0;
+				memset(metrics[i].buckets, 0, sizeof(metrics[i].buckets));
+			}
+		}
+		portEXIT_CRITICAL(&metrics_mux);
+
+		len = 0;
+		_metrics_append(pkt, &len, "metrics,ID=%s uptime=%lldi,heap_free=%ui,heap_min=%ui,heap_big=%ui",
+						DEVICE_MAC, esp_timer_get_time() / 1000000,
+						heap_caps_get_free_size(MALLOC_CAP_8BIT),
+						esp_get_minimum_free_heap_size(),
+						heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+		for (int i = 0; i < count; i++) {
+			if (snap[i].type != METRIC_HISTOGRAM) {
+				_metrics_append(pkt, &len, ",%s=%di", snap[i].name, snap[i].value);
+				continue;
+			}
+			_metrics_append(pkt, &len, ",%s_n=%ui", snap[i].name, snap[i].count);
+			if (snap[i].count == 0) {
+				continue;
+			}
+			_metrics_append(pkt, &len, ",%s_sum=%ui,%s_max=%ui,%s_h=\"",
+							snap[i].name, snap[i].sum, snap[i].name, snap[i].max, snap[i].name);
+			for (b = 0; b < METRICS_BUCKETS; b++) {
+				_metrics_append(pkt, &len, b ? ",%u" : "%u", snap[i].buckets[b]);
+			}
+			_metrics_append(pkt, &len, "\"");
+		}
+
+		_metrics_tasks(pkt, &len);
+
+		// Out of room: drop the cut-off line rather than send half of it
+		if (len >= METRICS_PKT_LEN) {
+			ESP_LOGW(TAG, "Report truncated");
+			if ((nl = strrchr(pkt, '\n')) != NULL) {
+				*nl = '\0';
+			}
+		}
+
+		ESP_LOGI(TAG, "%s", pkt);
+		if (MQTT_Publish_General(topic, pkt, 0) < 0) {
+			ESP_LOGD(TAG, "Not connected, report dropped");
+		}
+		free(pkt);
+		free(snap);
+	}
+}
+
+void METRICS_Initialize(void)
+{
+	xTaskCreate(&metrics_task, "metrics_task", METRICS_TASK_STACK, NULL, METRICS_TASK_PRIO, NULL);
+}
@@ -1,28 +1,66 @@
 /*
  * mics4514_if.c
  *
+ * Notes:
+ * 		mics_task samples both channels at CONFIG_MICS4514_SAMPLE_HZ and
+ * 		runs each through a decimation chain (see filter_if.h): every
+ * 		CONFIG_MICS4514_DECIMATION samples give one calibrated, timestamped
+ * 		output, so MICS4514_Poll just returns the latest one.
+ *
+ * 		The same task runs the heater schedule (see mics4514_if.h). The
+ * 		phase is a pure function of the time since power-up, and the
+ * 		filters restart at the beginning of every stable phase, so no
+ * 		output mixes warm-up samples in.
+ *
+ * 		Gas sensor signals move over seconds, so a paced task is enough;
+ * 		I2S-ADC DMA can't go this slow and can't alternate channels in
+ * 		this IDF.
+ *
  *  Created on: Nov 13, 2018
  *      Author: tombo
  */
 
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/gpio.h"
 #include "driver/adc.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 #include "esp_adc_cal.h"
 #include "mics4514_if.h"
+#include "filter_if.h"
 
 #define GPIO_MICS_ENABLE	33
 #define GPIO_MICS_HEATER	32
 #define GPIO_OUTPUT_PIN_SEL ((1ULL << GPIO_MICS_ENABLE) | (1ULL << GPIO_MICS_HEATER))
 #define NO_OF_SAMPLES		64
 #define DEFAULT_VREF		1100 	// Use adc2_vref_to_gpio() to obtain a better estimate
+#define MICS_TASK_STACK		2048
+#define MICS_TASK_PRIO		4
+#define MICS_PERIOD			(1000 / CONFIG_MICS4514_SAMPLE_HZ / portTICK_PERIOD_MS)
+#define MICS_PERIOD_US		(1000000LL / CONFIG_MICS4514_SAMPLE_HZ)
+/* CIC group delay, to stamp outputs with the time they represent */
+#define MICS_DELAY_US		(FILT_CIC_ORDER * (CONFIG_MICS4514_DECIMATION - 1) * MICS_PERIOD_US / 2)
+#define MICS_WINDOW_US		(CONFIG_MICS4514_DECIMATION * MICS_PERIOD_US)
+/* An output is this old just before the next one; allow two more missed */
+#define MICS_STALE_US		(MICS_DELAY_US + 3 * MICS_WINDOW_US)
 
 static const char* TAG = "MICS4514";
 static esp_adc_cal_characteristics_t *adc_chars;
+static filt_chain_t ox_filter = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, CONFIG_MICS4514_EMA_SHIFT);
+static filt_chain_t red_filter = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, CONFIG_MICS4514_EMA_SHIFT);
+static mics4514_sample_t latest;
+static mics4514_stats_t stats;
+static portMUX_TYPE mics_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile mics4514_phase_t phase = MICS4514_WARMUP;
 
 static void check_efuse(void);
 static void print_char_val_type(esp_adc_cal_value_t val_type);
+static void _mics_busy_loop_bench(void);
+static mics4514_phase_t _mics_phase(uint32_t t);
+static void mics_task(void *pvParameters);
 
 /*
  *
@@ -58,6 +96,108 @@ static void print_char_val_type(esp_adc_cal_value_t val_type)
     }
 }
 
+/*
+ * Time what MICS4514_Poll used to do in data_task, for comparison with
+ * stats.cpu_us
+ */
+static void _mics_busy_loop_bench(void)
+{
+	int64_t ch6 = 0, ch7 = 0;
+	int64_t start = esp_timer_get_time();
+
+	for (int i = 0; i < NO_OF_SAMPLES; i++) {
+		ch6 += adc1_get_raw(ADC_CHANNEL_6);
+		ch7 += adc1_get_raw(ADC_CHANNEL_7);
+	}
+	stats.busy_loop_us = esp_timer_get_time() - start;
+	ESP_LOGD(TAG, "Busy loop averages %lld %lld", (long long) (ch6 / NO_OF_SAMPLES), (long long) (ch7 / NO_OF_SAMPLES));
+}
+
+/*
+ * Where the heater schedule is t seconds after power-up
+ */
+static mics4514_phase_t _mics_phase(uint32_t t)
+{
+	const uint32_t cycle = CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_HEATER_OFF_S + CONFIG_MICS4514_REWARM_S;
+
+	if (t < CONFIG_MICS4514_WARMUP_S) {
+		return MICS4514_WARMUP;
+	}
+	if (CONFIG_MICS4514_HEATER_OFF_S == 0) {
+		return MICS4514_STABLE;
+	}
+
+	// Each cycle starts hot: stable, off, then warm back up
+	t = (t - CONFIG_MICS4514_WARMUP_S) % cycle;
+	if (t < CONFIG_MICS4514_HEATER_ON_S) {
+		return MICS4514_STABLE;
+	}
+	if (t < CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_HEATER_OFF_S) {
+		return MICS4514_OFF;
+	}
+	return MICS4514_WARMUP;
+}
+
+static void mics_task(void *pvParameters)
+{
+	TickType_t wake = xTaskGetTickCount();
+	int64_t start;
+	int64_t powered_us = esp_timer_get_time();
+	uint32_t cpu_us = 0;
+	int32_t ox, red;
+	bool have_ox, have_red;
+	mics4514_phase_t next;
+	const filt_chain_t fresh = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, CONFIG_MICS4514_EMA_SHIFT);
+
+	for (;;) {
+		vTaskDelayUntil(&wake, MICS_PERIOD);
+		start = esp_timer_get_time();
+
+		next = _mics_phase((start - powered_us) / 1000000);
+		if (next != phase) {
+			ESP_LOGI(TAG, "Heater phase %d -> %d", phase, next);
+			if (next == MICS4514_OFF) {
+				MICS4514_HeaterDisable();
+				MICS4514_Disable();
+			}
+			else if (phase == MICS4514_OFF) {
+				MICS4514_Enable();
+				MICS4514_HeaterEnable();
+			}
+			if (next == MICS4514_STABLE) {
+				ox_filter = fresh;
+				red_filter = fresh;
+				cpu_us = 0;
+			}
+			phase = next;
+		}
+		if (phase != MICS4514_STABLE) {
+			continue;
+		}
+
+		have_ox = FILT_Chain_Push(&ox_filter, adc1_get_raw(ADC_CHANNEL_6), &ox);
+		have_red = FILT_Chain_Push(&red_filter, adc1_get_raw(ADC_CHANNEL_7), &red);
+		stats.samples++;
+
+		// Both chains decimate in step
+		if (have_ox && have_red) {
+			ox = esp_adc_cal_raw_to_voltage(ox, adc_chars);
+			red = esp_adc_cal_raw_to_voltage(red, adc_chars);
+			portENTER_CRITICAL(&mics_mux);
+			latest.ox_mv = ox;
+			latest.red_mv = red;
+			latest.time_us = start - MICS_DELAY_US;
+			portEXIT_CRITICAL(&mics_mux);
+			stats.outputs++;
+			stats.cpu_us = cpu_us + (esp_timer_get_time() - start);
+			cpu_us = 0;
+		}
+		else {
+			cpu_us += esp_timer_get_time() - start;
+		}
+	}
+}
+
 void MICS4514_GPIOEnable()
 {
 	// SET and RESET GPIOs
@@ -95,32 +235,55 @@ void MICS4514_Initialize(void)
 
 	MICS4514_GPIOEnable();
 
-	MICS4514_Disable();
+	// Powered from here on; mics_task runs the heater schedule
+	MICS4514_Enable();
+	MICS4514_HeaterEnable();
 
+	_mics_busy_loop_bench();
+	xTaskCreate(&mics_task, "mics_task", MICS_TASK_STACK, NULL, MICS_TASK_PRIO, NULL);
+	ESP_LOGI(TAG, "Sampling at %d Hz, 1 output per %d samples (blocking poll took %u us), heater %d/%d s",
+			 CONFIG_MICS4514_SAMPLE_HZ, CONFIG_MICS4514_DECIMATION, stats.busy_loop_us,
+			 CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_REWARM_S, CONFIG_MICS4514_HEATER_OFF_S);
 	return;
 }
 
+void MICS4514_GetSample(mics4514_sample_t *sample)
+{
+	portENTER_CRITICAL(&mics_mux);
+	*sample = latest;
+	portEXIT_CRITICAL(&mics_mux);
+}
+
+mics4514_phase_t MICS4514_GetPhase(void)
+{
+	return phase;
+}
+
+void MICS4514_GetStats(mics4514_stats_t *s)
+{
+	*s = stats;
+}
+
 /*
  *
  */
-void MICS4514_Poll(int *ox_val, int *red_val)
+esp_err_t MICS4514_Poll(int *ox_val, int *red_val)
 {
-	int64_t ch6 = 0;
-	int64_t ch7 = 0;
+	mics4514_sample_t s;
 
-	for (int i = 0; i < NO_OF_SAMPLES; i++) {
-		ch6 += adc1_get_raw(ADC_CHANNEL_6);
-		ch7 += adc1_get_raw(ADC_CHANNEL_7);
+	MICS4514_GetSample(&s);
+	if (s.time_us == 0) {
+		return ESP_ERR_NOT_FOUND;
 	}
-	ch6 /= NO_OF_SAMPLES;
-	ch7 /= NO_OF_SAMPLES;
-
-	//Convert adc_reading to voltage in mV
-	*ox_val  = (int) ch6;
-	*red_val = (int) ch7;
-//	*ox_val  = esp_adc_cal_raw_to_voltage(ch6, adc_chars);
-//	*red_val = esp_adc_cal_raw_to_voltage(ch7, adc_chars);
-	return;
+	*ox_val  = s.ox_mv;
+	*red_val = s.red_mv;
+	if (phase != MICS4514_STABLE) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (esp_timer_get_time() - s.time_us > MICS_STALE_US) {
+		return ESP_ERR_TIMEOUT;
+	}
+	return ESP_OK;
 }
 
 //#define GPIO_MICS_ENABLE	33
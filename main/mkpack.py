@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# mkpack.py
+#
+# Compress a firmware image or delta patch for OTA (see include/unpack_if.h
+# for the format). The device unpacks it while it downloads.
+#
+#   python3 mkpack.py build/airu-v2.bin airu-v2.bin.hs
+#   python3 mkpack.py airu-v2-new.patch airu-v2-new.patch.hs
+#
+# Writes <out>.sha256 as well. It holds the hash of the image the device ends
+# up with, taken from <in>.sha256 if there is one (patches), otherwise of <in>.
+#
+#  Created on: Oct 19, 2026
+#      Author: tombo
+#
+
+import hashlib
+import os
+import struct
+import sys
+
+MAGIC = b"AUH1"
+WINDOW_SZ2 = 11         # 2 KB window on the device, keep <= CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2
+LOOKAHEAD_SZ2 = 4       # Longest copy 16 bytes
+CHAIN = 32              # Candidates tried per position
+
+
+class _Bits:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.n = 0
+
+    def push(self, count, value):
+        self.acc = (self.acc << count) | value
+        self.n += count
+        while self.n >= 8:
+            self.n -= 8
+            self.out.append((self.acc >> self.n) & 0xff)
+        self.acc &= (1 << self.n) - 1
+
+    def finish(self):
+        if self.n:
+            self.out.append((self.acc << (8 - self.n)) & 0xff)
+        return bytes(self.out)
+
+
+def pack(data, window_sz2=WINDOW_SZ2, lookahead_sz2=LOOKAHEAD_SZ2):
+    window = 1 << window_sz2
+    max_len = 1 << lookahead_sz2
+    # A copy only pays off if it's shorter than the literals it replaces
+    min_len = (1 + window_sz2 + lookahead_sz2) // 9 + 1
+    bits = _Bits()
+    heads = {}
+    i = 0
+    while i < len(data):
+        best_len, best_dist = 0, 0
+        key = data[i:i + 3]
+        for j in reversed(heads.get(key, ())):
+            if i - j > window:
+                break
+            n = 0
+            while n < max_len and i + n < len(data) and data[j + n] == data[i + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, i - j
+                if n == max_len:
+                    break
+        step = best_len if best_len >= min_len else 1
+        if step > 1:
+            bits.push(1, 0)
+            bits.push(window_sz2, best_dist - 1)
+            bits.push(lookahead_sz2, best_len - 1)
+        else:
+            bits.push(1, 1)
+            bits.push(8, data[i])
+        for k in range(i, i + step):
+            chain = heads.setdefault(data[k:k + 3], [])
+            chain.append(k)
+            if len(chain) > CHAIN:
+                del chain[0]
+        i += step
+    return MAGIC + struct.pack("<BBHI", window_sz2, lookahead_sz2, 0, len(data)) + bits.finish()
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: mkpack.py in out")
+        return 1
+    data = open(sys.argv[1], "rb").read()
+    packed = pack(data)
+    open(sys.argv[2], "wb").write(packed)
+
+    if os.path.exists(sys.argv[1] + ".sha256"):
+        digest = open(sys.argv[1] + ".sha256").read().split()[0]
+    else:
+        digest = hashlib.sha256(data).hexdigest()
+    open(sys.argv[2] + ".sha256", "w").write("%s  %s\n" % (digest, sys.argv[2]))
+
+    saved = 100.0 - 100.0 * len(packed) / len(data) if data else 0.0
+    print("%d -> %d bytes (%.1f%% smaller), %d byte window on the device"
+          % (len(data), len(packed), saved, 1 << WINDOW_SZ2))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
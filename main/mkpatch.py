@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# mkpatch.py
+#
+# Make a delta OTA patch (see include/delta_if.h for the format) that turns
+# the firmware a device is running into a new one.
+#
+#   python3 mkpatch.py old.bin new.bin airu-v2-new.patch
+#
+# Upload the patch and the .sha256 file written next to it to the OTA
+# directory, then send "ota airu-v2-new.patch". Devices not running old.bin
+# refuse the patch; send them the full .bin instead.
+#
+#  Created on: Oct 19, 2026
+#      Author: tombo
+#
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"AUD1"
+BLOCK = 16          # Exact match needed to start a copy
+STRIDE = 4          # Old image is indexed every STRIDE bytes
+GIVE_UP = 64        # Stop extending a match once it scores this far below its best
+
+
+def _index(old):
+    idx = {}
+    for i in range(0, len(old) - BLOCK + 1, STRIDE):
+        idx.setdefault(old[i:i + BLOCK], i)
+    return idx
+
+
+def _extend(old, new, op, np, limit):
+    """Grow a match forward while it's mostly matching, bsdiff style."""
+    best_len, best_score, score, i = 0, 0, 0, 0
+    while np + i < limit and op + i < len(old):
+        score += 1 if old[op + i] == new[np + i] else -1
+        i += 1
+        if score > best_score:
+            best_score, best_len = score, i
+        elif best_score - score > GIVE_UP:
+            break
+    return best_len
+
+
+def _matches(old, new):
+    """(new_pos, old_pos, length) for each copy, in new image order."""
+    idx = _index(old)
+    out = []
+    p = 0
+    last_end = 0
+    while p + BLOCK <= len(new):
+        op = idx.get(new[p:p + BLOCK])
+        if op is None:
+            p += 1
+            continue
+        np = p
+        # Exact backward extension into the unmatched gap
+        while np > last_end and op > 0 and old[op - 1] == new[np - 1]:
+            np -= 1
+            op -= 1
+        ln = _extend(old, new, op, np, len(new))
+        out.append((np, op, ln))
+        last_end = p = np + ln
+    return out
+
+
+def _tokens(diff):
+    """Run-length code the diff bytes: zero runs and literal runs."""
+    out = bytearray()
+    i = 0
+    while i < len(diff):
+        run = 0
+        while i + run < len(diff) and diff[i + run] == 0 and run < 128:
+            run += 1
+        if run >= 2 or (run == 1 and i + 1 == len(diff)):
+            out.append(0x80 | (run - 1))
+            i += run
+            continue
+        start = i
+        while i < len(diff) and i - start < 128:
+            if diff[i] == 0 and i + 1 < len(diff) and diff[i + 1] == 0:
+                break
+            i += 1
+        out.append(i - start - 1)
+        out += diff[start:i]
+    return out
+
+
+def make_patch(old, new):
+    patch = bytearray(MAGIC)
+    patch += struct.pack("<II", len(new), len(old))
+    patch += hashlib.sha256(old).digest()
+
+    matches = _matches(old, new)
+    # Leading record: nothing to diff, literal bytes up to the first copy
+    first_np, first_op = (matches[0][0], matches[0][1]) if matches else (len(new), 0)
+    patch += struct.pack("<IIi", 0, first_np, first_op)
+    patch += new[:first_np]
+
+    for k, (np, op, ln) in enumerate(matches):
+        nxt_np, nxt_op = (matches[k + 1][0], matches[k + 1][1]) if k + 1 < len(matches) else (len(new), op + ln)
+        diff = bytes((new[np + i] - old[op + i]) & 0xff for i in range(ln))
+        extra = new[np + ln:nxt_np]
+        patch += struct.pack("<IIi", ln, len(extra), nxt_op - (op + ln))
+        patch += _tokens(diff)
+        patch += extra
+    return bytes(patch)
+
+
+def main():
+    if len(sys.argv) != 4:
+        print("usage: mkpatch.py old.bin new.bin out.patch")
+        return 1
+    old = open(sys.argv[1], "rb").read()
+    new = open(sys.argv[2], "rb").read()
+
+    patch = make_patch(old, new)
+    open(sys.argv[3], "wb").write(patch)
+    # The device checks the rebuilt image, not the patch, against this
+    open(sys.argv[3] + ".sha256", "w").write("%s  %s\n" % (hashlib.sha256(new).hexdigest(), sys.argv[3]))
+
+    print("old %d, new %d, patch %d bytes (%.1f%% of the full image)"
+          % (len(old), len(new), len(patch), 100.0 * len(patch) / len(new)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,13 +5,22 @@
  *      Author: tombo
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "mqtt_client.h"
 #include "ota_if.h"
 #include "mqtt_if.h"
+#include "cmd_if.h"
+#include "wdt_if.h"
+#include "diag_if.h"
+#include "metrics_if.h"
 
 #include "app_utils.h"
 #include "http_server_if.h"
@@ -29,6 +38,8 @@
 #define WIFI_CONNECTED_BIT 		BIT0
 #define THIRTY_SECONDS_COUNT 30
 #define THIRTY_SECONDS_DELAY THIRTY_SECONDS_COUNT*ONE_SECOND_DELAY
+#define INFLIGHT_CHECK_PERIOD	(5 * ONE_SECOND_DELAY)
+#define RECENT_ACKS_LEN			4
 
 extern const uint8_t ca_pem_start[] asm("_binary_ca_airu_pem_start");
 extern int WIFI_MANAGER_STA_DISCONNECT_BIT;
@@ -38,12 +49,62 @@ static volatile bool client_connected;
 static esp_mqtt_client_handle_t client = NULL;
 static TaskHandle_t task_mqtt = NULL;
 
+/*
+ * In-flight window. Every QoS 1/2 publish is kept here until the client
+ * reports MQTT_EVENT_PUBLISHED (PUBACK for QoS 1, PUBCOMP for QoS 2) for its
+ * msg_id. Messages published while disconnected wait here with msg_id -1.
+ *
+ * Once the client has a message it owns the retries: esp-mqtt retransmits
+ * from its outbox under the same msg_id and the broker keeps our session.
+ * A second esp_mqtt_client_publish would be a new message with a new id,
+ * a duplicate for QoS 1 and a broken handshake for QoS 2. So a sent message
+ * is only handed over again when the broker lost our session
+ * (session_present 0), since then neither side will finish it.
+ *
+ * Only mqtt_task and publishers touch the slots, serialized by inflight_mutex.
+ * The event handler runs inside the client's task and may not block on that
+ * mutex (a publisher holding it can be waiting on the client), so it only
+ * flags slots as acked under inflight_mux and leaves the freeing to us.
+ * Every write to a slot or to session_stats is also made under inflight_mux,
+ * which is all MQTT_GetSessionStats takes to read them.
+ */
+typedef struct {
+	char *topic;
+	char *payload;
+	int qos;
+	int msg_id;			/* -1 until handed to the client */
+	bool acked;
+	int64_t sent_us;
+} mqtt_inflight_t;
+
+static mqtt_inflight_t inflight[CONFIG_MQTT_INFLIGHT_WINDOW];
+static int recent_acks[RECENT_ACKS_LEN] = { -1, -1, -1, -1 };
+static int recent_ack_idx = 0;
+static SemaphoreHandle_t inflight_mutex = NULL;
+static portMUX_TYPE inflight_mux = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_session_stats_t session_stats;
+static int64_t disconnected_us = 0;
+static int64_t connect_start_us = 0;
+static volatile bool announce_pending = false;
+static volatile bool requeue_pending = false;	/* Broker lost our session */
+static metric_t *m_pub_ms = NULL;	/* Publish to PUBACK/PUBCOMP */
+
 
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event);
+static void _inflight_ack(int msg_id);
+static void _inflight_reclaim(void);
+static void _inflight_send(mqtt_inflight_t *slot);
+static void _inflight_flush(void);
+static int _publish_direct(const char *topic, const char *msg, int qos);
  /*
  * This exact configuration was what works. Won't work
  * without the "transport" parameter set.
  *
+ * Every connect costs a full TLS handshake: neither esp-mqtt nor esp-tls in
+ * this IDF lets us hand a cached session ticket back to the SSL transport.
+ * So we keep handshakes rare instead: one client for the life of the app
+ * (see MQTT_Connect), and a long keepalive so an idle link isn't dropped.
+ *
  * Copy and paste ca.pem into project->main
  *
  * Define the start and end pointers in .rodata with:
@@ -62,6 +123,8 @@ esp_mqtt_client_config_t getMQTT_Config(){
 			.transport = MQTT_TRANSPORT_OVER_SSL,
 			.event_handle = mqtt_event_handler,
 			.cert_pem = (const char *)ca_pem_start,
+			.disable_clean_session = true,		/* Broker keeps our session and QoS 1/2 state across reconnects */
+			.keepalive = CONFIG_MQTT_KEEPALIVE_S,
 	};
 
 	return mqtt_cfg;
@@ -77,11 +140,10 @@ esp_mqtt_client_config_t getMQTT_Config(){
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
 	esp_mqtt_client_handle_t this_client = event->client;
+	mqtt_session_stats_t stats;
+	int64_t now;
 	int msg_id = 0;
 	char tmp[64] = {0};
-	char tpc[64] = {0};
-	char *json_buf;
-	char pld[MQTT_BUFFER_SIZE_BYTE] = {0};
 
 	ESP_LOGI(TAG, "EVENT ID: %d", event->event_id);
 
@@ -90,6 +152,23 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 		   ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
 		   client_connected = true;
 
+		   now = esp_timer_get_time();
+		   portENTER_CRITICAL(&inflight_mux);
+		   session_stats.handshakes++;
+		   session_stats.last_connect_ms = (now - connect_start_us) / 1000;
+		   if (disconnected_us != 0) {
+			   session_stats.reconnects++;
+			   session_stats.last_reconnect_ms = (now - disconnected_us) / 1000;
+		   }
+		   stats = session_stats;
+		   portEXIT_CRITICAL(&inflight_mux);
+		   ESP_LOGI(TAG, "TLS session %u up in %u ms", stats.handshakes, stats.last_connect_ms);
+
+		   if (disconnected_us != 0) {
+			   ESP_LOGI(TAG, "Reconnected in %u ms", stats.last_reconnect_ms);
+			   disconnected_us = 0;
+		   }
+
 		   // Subscribe to "all" topic
 		   msg_id = esp_mqtt_client_subscribe(this_client, MQTT_SUB_ALL_TOPIC, 2);
 		   ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
@@ -101,20 +180,28 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 		   msg_id = esp_mqtt_client_subscribe(this_client, (const char*) tmp, 2);
 		   ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
 
-		   // Respond to "ack" topic that we're online
-		   sprintf(tpc, MQTT_ACK_TOPIC_TMPLT, DEVICE_MAC);
+		   // mqtt_task announces us on the "ack" topic (needs an HTTP request)
+		   announce_pending = true;
 
-		   json_buf = malloc(512);
-		   json_buf[0] = '\0';
-		   esp_err_t err = http_get_isp_info(json_buf, 512);
-		   MQTT_Publish_General((const char*) tpc, json_buf, 2);
-		   free(json_buf);
+		   // Nobody will finish what was in flight: mqtt_task sends it again
+		   if (!event->session_present) {
+			   requeue_pending = true;
+		   }
+
+		   // Let mqtt_task flush whatever queued up while we were offline
+		   xTaskNotifyGive(task_mqtt);
 		   break;
 
 	   case MQTT_EVENT_DISCONNECTED:
 		   ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
 		   client_connected = false;
-		   esp_mqtt_client_destroy(client);
+		   DIAG_SetError(DIAG_SRC_MQTT, MQTT_EVENT_DISCONNECTED);
+		   if (disconnected_us == 0) {
+			   disconnected_us = esp_timer_get_time();
+		   }
+		   connect_start_us = esp_timer_get_time();
+
+		   // The client reconnects on its own. Never destroy it from its own callback.
 
 		   // Set the WIFI_MANAGER_HAVE_INTERNET_BIT: is it MQTT or internet problem?
 		   wifi_manager_check_connection_async();
@@ -131,49 +218,26 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
 	   case MQTT_EVENT_PUBLISHED:
 		   ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+		   _inflight_ack(event->msg_id);
+		   ota_health_report(OTA_HEALTH_MQTT_BIT);
+		   WDT_Progress(WDT_MQTT);
 		   break;
 
 	   case MQTT_EVENT_DATA:
-		   strncpy(tpc, event->topic, event->topic_len);
-		   strncpy(pld, event->data, event->data_len);
-		   ESP_LOGI(TAG, "MQTT_EVENT_DATA: %s", pld);
-
-		   const char s[2] = " ";
-		   char *tok;
-
-		   /* get the first token */
-		   tok = strtok(pld, s);
-		   if(tok == NULL)
+		   // Only whole messages. Commands are short; a fragmented payload isn't one.
+		   if (event->current_data_offset != 0 || event->data_len != event->total_data_len) {
+			   ESP_LOGW(TAG, "Ignoring fragmented MQTT_EVENT_DATA (%d of %d)", event->data_len, event->total_data_len);
 			   break;
-
-		   if(strcmp(tok, "ota") == 0){
-		        tok = strtok(NULL, s);
-		        if(tok != NULL && strstr(tok, ".bin")){
-
-		        	// Notify ota starting over MQTT
-		        	sprintf(tmp, MQTT_ACK_TOPIC_TMPLT, DEVICE_MAC);
-		        	MQTT_Publish_General(tmp, "ota", 2);
-
-		        	ota_set_filename(tok);
-		        	ota_trigger();
-		        }
-		        else{
-		        	ESP_LOGI(TAG,"No binary file");
-		        }
-		   }
-
-		   else if (strcmp(tok, "ping") == 0){
-
-			   sprintf(tmp, MQTT_ACK_TOPIC_TMPLT, DEVICE_MAC);
-			   MQTT_Publish_General(tmp, "pong", 2);
-
-			   ESP_LOGI(TAG, "response: \"pong\" on \"%s\"", tmp);
 		   }
+		   ESP_LOGI(TAG, "MQTT_EVENT_DATA: %.*s", event->data_len, event->data);
 
+		   // Hand off to the command worker. Nothing runs on the event task.
+		   CMD_Submit(event->data, event->data_len);
 		   break;
 
 	   case MQTT_EVENT_ERROR:
 		   ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+		   DIAG_SetError(DIAG_SRC_MQTT, MQTT_EVENT_ERROR);
 //		   abort();
 		   wifi_manager_check_connection_async();
 		   break;
@@ -185,6 +249,167 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 	return ESP_OK;
 }
 
+/*
+* @brief	Mark the slot holding msg_id as acked. Called from the event handler.
+*
+* @param	msg_id: id from MQTT_EVENT_PUBLISHED
+*
+* @return	N/A
+*/
+static void _inflight_ack(int msg_id)
+{
+	int i;
+	int64_t sent_us = 0;
+
+	portENTER_CRITICAL(&inflight_mux);
+	for (i = 0; i < CONFIG_MQTT_INFLIGHT_WINDOW; i++) {
+		if (inflight[i].topic != NULL && inflight[i].msg_id == msg_id) {
+			inflight[i].acked = true;
+			sent_us = inflight[i].sent_us;
+			break;
+		}
+	}
+	// Ack beat the publisher to recording the msg_id
+	if (i == CONFIG_MQTT_INFLIGHT_WINDOW) {
+		recent_acks[recent_ack_idx] = msg_id;
+		recent_ack_idx = (recent_ack_idx + 1) % RECENT_ACKS_LEN;
+	}
+	portEXIT_CRITICAL(&inflight_mux);
+
+	if (sent_us != 0) {
+		METRICS_Observe(m_pub_ms, (esp_timer_get_time() - sent_us) / 1000);
+	}
+}
+
+/*
+* @brief	Free acked slots. Caller holds inflight_mutex.
+*/
+static void _inflight_reclaim(void)
+{
+	for (int i = 0; i < CONFIG_MQTT_INFLIGHT_WINDOW; i++) {
+		if (inflight[i].topic != NULL && inflight[i].acked) {
+			free(inflight[i].topic);
+			free(inflight[i].payload);
+			portENTER_CRITICAL(&inflight_mux);
+			memset(&inflight[i], 0, sizeof(mqtt_inflight_t));
+			portEXIT_CRITICAL(&inflight_mux);
+		}
+	}
+}
+
+/*
+* @brief	Hand a slot to the client. Caller holds inflight_mutex.
+*/
+static void _inflight_send(mqtt_inflight_t *slot)
+{
+	int msg_id = esp_mqtt_client_publish(client, slot->topic, slot->payload, 0, slot->qos, 0);
+
+	portENTER_CRITICAL(&inflight_mux);
+	slot->msg_id = msg_id;
+	slot->sent_us = esp_timer_get_time();
+	for (int i = 0; i < RECENT_ACKS_LEN; i++) {
+		if (msg_id >= 0 && recent_acks[i] == msg_id) {
+			slot->acked = true;
+			recent_acks[i] = -1;
+		}
+	}
+	portEXIT_CRITICAL(&inflight_mux);
+
+	ESP_LOGI(TAG, "Topic: %s, Msg: %s", slot->topic, slot->payload);
+	ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+}
+
+/*
+* @brief	Send the slots queued while offline. After a clean session, slots
+* 			the client had but never got acked are queued again first.
+*/
+static void _inflight_flush(void)
+{
+	bool requeue;
+
+	xSemaphoreTake(inflight_mutex, portMAX_DELAY);
+	_inflight_reclaim();
+
+	requeue = requeue_pending;
+	requeue_pending = false;
+	for (int i = 0; i < CONFIG_MQTT_INFLIGHT_WINDOW; i++) {
+		if (inflight[i].topic == NULL || inflight[i].acked) {
+			continue;
+		}
+		if (requeue && inflight[i].msg_id >= 0) {
+			portENTER_CRITICAL(&inflight_mux);
+			inflight[i].msg_id = -1;
+			session_stats.requeued++;
+			portEXIT_CRITICAL(&inflight_mux);
+		}
+		if (inflight[i].msg_id < 0 && client_connected) {
+			_inflight_send(&inflight[i]);
+		}
+	}
+	xSemaphoreGive(inflight_mutex);
+}
+
+/*
+* @brief	Respond to the "ack" topic that we're online, with our ISP info
+*/
+static void _mqtt_announce(void)
+{
+	char tpc[64];
+	char *json_buf;
+
+	sprintf(tpc, MQTT_ACK_TOPIC_TMPLT, DEVICE_MAC);
+	if ((json_buf = malloc(512)) == NULL) {
+		return;
+	}
+	json_buf[0] = '\0';
+	http_get_isp_info(json_buf, 512);
+	MQTT_Publish_General((const char*) tpc, json_buf, CONFIG_MQTT_ACK_QOS);
+	free(json_buf);
+
+	// Why the last run ended, once per boot
+	DIAG_Publish();
+}
+
+/*
+* @brief	"ping": answer "pong" on the ack topic
+*/
+static esp_err_t _cmd_ping(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	CMD_Reply(ctx, CONFIG_MQTT_PONG_QOS, "pong");
+	return ESP_OK;
+}
+
+/*
+* @brief	"ota <file>.bin [pct]": hand the file to ota_task. Progress and
+* 			the result are reported by ota_task against the same request id.
+* 			With pct, only that percentage of the fleet takes the update
+* 			(send it to the "all" topic and raise pct as it proves itself).
+*/
+static esp_err_t _cmd_ota(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	if ((strstr(argv[1], ".bin") == NULL && strstr(argv[1], ".patch") == NULL) ||
+		strlen(argv[1]) >= OTA_FILE_BN_LEN) {
+		ESP_LOGI(TAG,"No binary file");
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (argc > 2 && !ota_in_rollout(atoi(argv[2]))) {
+		CMD_Reply(ctx, CONFIG_MQTT_ACK_QOS, "ota skip");
+		return ESP_OK;
+	}
+
+	// Notify ota starting over MQTT
+	CMD_Reply(ctx, CONFIG_MQTT_ACK_QOS, "ota");
+
+	ota_set_request(ctx, argv[1]);
+	ota_trigger();
+	return ESP_OK;
+}
+
+static const cmd_t mqtt_commands[] = {
+	{ .name = "ping",	.handler = _cmd_ping,	.min_args = 0, .max_args = 0 },
+	{ .name = "ota",	.handler = _cmd_ota,	.min_args = 1, .max_args = 2 },
+};
+
 void mqtt_task(void* pvParameters){
 	ESP_LOGI(TAG, "Starting mqtt_task ...");
 
@@ -197,14 +422,23 @@ void mqtt_task(void* pvParameters){
 
 	while(1) {
 
-		// Wait for a disconnect event
-		wifi_manager_wait_disconnect();
-		ESP_LOGI(TAG, "WIFI disconnected");
-
-		// Wait for a reconnect event and internet access
-		wifi_manager_wait_internet_access();
-		ESP_LOGI(TAG, "WIFI reconnected");
-		MQTT_Connect();
+		// Woken early by MQTT_EVENT_CONNECTED. The client handles reconnects itself.
+		ulTaskNotifyTake(pdTRUE, INFLIGHT_CHECK_PERIOD);
+
+		DIAG_TaskRun("mqtt");
+
+		// Not delivering is only a stall if the internet is there to deliver to
+		if (wifi_manager_have_internet()) {
+			WDT_Alive(WDT_MQTT);
+		}
+		else {
+			WDT_Progress(WDT_MQTT);
+		}
+		if (announce_pending && client_connected) {
+			announce_pending = false;
+			_mqtt_announce();
+		}
+		_inflight_flush();
 	}
 }
 
@@ -222,35 +456,123 @@ void MQTT_Initialize(void)
 	if (task_mqtt != NULL){
 		vTaskDelete(task_mqtt);
 	}
-	xTaskCreate(&mqtt_task, "task_mqtt", 4096, NULL, 1, task_mqtt);
+	if (inflight_mutex == NULL){
+		inflight_mutex = xSemaphoreCreateMutex();
+		m_pub_ms = METRICS_Register("mqtt_pub_ms", METRIC_HISTOGRAM);
+
+		CMD_Initialize();
+		for (int i = 0; i < sizeof(mqtt_commands) / sizeof(cmd_t); i++) {
+			CMD_Register(&mqtt_commands[i]);
+		}
+	}
+	xTaskCreate(&mqtt_task, "task_mqtt", 4096, NULL, 1, &task_mqtt);
 }
 
 void MQTT_Connect()
 {
 	ESP_LOGI(TAG, "%s enter", __func__);
 
+	// One client for the life of the app
+	if (client != NULL) {
+		return;
+	}
+
 	esp_mqtt_client_config_t mqtt_cfg = getMQTT_Config();
 	client = esp_mqtt_client_init(&mqtt_cfg);
-	ESP_LOGI(TAG, "%s esp_mqtt_client_start [%s]", __func__, esp_err_to_name(esp_mqtt_client_start(client)));
 	client_connected = false;
+	connect_start_us = esp_timer_get_time();
+	ESP_LOGI(TAG, "%s esp_mqtt_client_start [%s]", __func__, esp_err_to_name(esp_mqtt_client_start(client)));
 }
 
 /*
-* @brief
-*
-* @param
+* @brief	Publish, through the in-flight window for QoS 1/2
 *
-* @return
+* @return	msg_id, MQTT_PUB_QUEUED if it waits in the window for a
+* 			connection, or ESP_FAIL
 */
 int MQTT_Publish_General(const char* topic, const char* msg, int qos)
 {
 	int msg_id;
+	int slot = -1;
+	int64_t oldest = INT64_MAX;
+	char *t, *p;
 	ESP_LOGI(TAG, "%s ENTERRED client_connected %d", __func__, client_connected);
 
+	// QoS 0 has nothing to track
+	if (qos == 0 || inflight_mutex == NULL) {
+		return _publish_direct(topic, msg, qos);
+	}
+
+	t = strdup(topic);
+	p = strdup(msg);
+	if (t == NULL || p == NULL) {
+		free(t);
+		free(p);
+		return ESP_FAIL;
+	}
+
+	xSemaphoreTake(inflight_mutex, portMAX_DELAY);
+	_inflight_reclaim();
+
+	// Take a free slot, else evict the oldest message
+	for (int i = 0; i < CONFIG_MQTT_INFLIGHT_WINDOW; i++) {
+		if (inflight[i].topic == NULL) {
+			slot = i;
+			break;
+		}
+		if (inflight[i].sent_us < oldest) {
+			oldest = inflight[i].sent_us;
+			slot = i;
+		}
+	}
+	if (inflight[slot].topic != NULL) {
+		ESP_LOGW(TAG, "In-flight window full, dropping msg_id=%d", inflight[slot].msg_id);
+		free(inflight[slot].topic);
+		free(inflight[slot].payload);
+	}
+
+	portENTER_CRITICAL(&inflight_mux);
+	if (inflight[slot].topic != NULL) {
+		session_stats.dropped++;
+	}
+	inflight[slot].topic = t;
+	inflight[slot].payload = p;
+	inflight[slot].qos = qos;
+	inflight[slot].msg_id = -1;
+	inflight[slot].acked = false;
+	inflight[slot].sent_us = esp_timer_get_time();
+	portEXIT_CRITICAL(&inflight_mux);
+
+	// Offline messages stay queued until mqtt_task flushes them on reconnect
+	msg_id = -1;
+	if (client_connected) {
+		_inflight_send(&inflight[slot]);
+		msg_id = inflight[slot].msg_id;
+	}
+	xSemaphoreGive(inflight_mutex);
+
+	return (msg_id >= 0) ? msg_id : MQTT_PUB_QUEUED;
+}
+
+/*
+* @brief	Publish without going through the in-flight window. The event
+* 			handler must use this: it runs in the client's task and can't
+* 			wait on inflight_mutex.
+*
+* @return	msg_id, or ESP_FAIL if not connected
+*/
+static int _publish_direct(const char* topic, const char* msg, int qos)
+{
+	int msg_id;
+
 	if(client_connected){
 		msg_id = esp_mqtt_client_publish(client, topic, msg, 0, qos, 0);
 		ESP_LOGI(TAG, "Topic: %s, Msg: %s", topic, msg);
 		ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+		// QoS 0 never gets MQTT_EVENT_PUBLISHED, the client taking it is all we'll know
+		if (qos == 0 && msg_id >= 0) {
+			WDT_Progress(WDT_MQTT);
+		}
 		return msg_id;
 	}
 	else {
@@ -258,6 +580,26 @@ int MQTT_Publish_General(const char* topic, const char* msg, int qos)
 	}
 }
 
+/*
+* @brief	Copy the session manager's counters
+*
+* @param	stats: filled with reconnect, retry and drop counts
+*
+* @return	N/A
+*/
+void MQTT_GetSessionStats(mqtt_session_stats_t *stats)
+{
+	portENTER_CRITICAL(&inflight_mux);
+	*stats = session_stats;
+	stats->inflight = 0;
+	for (int i = 0; i < CONFIG_MQTT_INFLIGHT_WINDOW; i++) {
+		if (inflight[i].topic != NULL && !inflight[i].acked) {
+			stats->inflight++;
+		}
+	}
+	portEXIT_CRITICAL(&inflight_mux);
+}
+
 /*
 * @brief
 *
@@ -267,6 +609,6 @@ int MQTT_Publish_General(const char* topic, const char* msg, int qos)
 */
 int MQTT_Publish_Data(const char* msg)
 {
-	return MQTT_Publish_General(MQTT_DATA_PUB_TOPIC, msg, 2);
+	return MQTT_Publish_General(MQTT_DATA_PUB_TOPIC, msg, CONFIG_MQTT_DATA_QOS);
 }
 
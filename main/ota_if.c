@@ -7,39 +7,130 @@
  *
  * 		Change flash size to 4MB in menuconfig flash options
  *
+ * 		Images are written straight to the update partition with
+ * 		esp_partition_write, so a download can pick up where it left off
+ * 		(HTTP Range) after a dropped connection or a reboot. The written
+ * 		offset is checkpointed to NVS every sector. Before switching the
+ * 		boot partition, the flash contents are hashed and compared against
+ * 		the "<file>.sha256" manifest next to the image on the server.
+ *
+ * 		A "<file>.patch" is a binary diff against the running image
+ * 		(main/mkpatch.py). It's applied while it downloads, the manifest
+ * 		holds the hash of the rebuilt image. Patches resume with Range
+ * 		within one attempt but not across a reboot.
+ *
+ * 		"<file>.bin.hs" / "<file>.patch.hs" are compressed with
+ * 		main/mkpack.py and unpacked in front of the patch / flash stage:
+ * 		download -> [unpack] -> [delta] -> update partition.
+ *
  *  Created on: Oct 10, 2018
  *      Author: tombo
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "mbedtls/sha256.h"
 #include "ota_if.h"
+#include "delta_if.h"
+#include "unpack_if.h"
+#include "diag_if.h"
 #include "app_utils.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_ota_ops.h"
 #include "esp_http_client.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_spi_flash.h"
 
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "app_utils.h"
 
-#define BUFFSIZE 1024
+#define OTA_PROGRESS_STEP 	10					/* Percent between progress reports */
+#define OTA_SECTOR_SIZE		SPI_FLASH_SEC_SIZE	/* Erase (and checkpoint) granularity */
+#define OTA_URL_LEN			(sizeof(CONFIG_OTA_URL_BASE) + OTA_FILE_BN_LEN + 8)
+#define OTA_MANIFEST_LEN	128
+#define OTA_RETRY_DELAY		(5 * ONE_SECOND_DELAY)
+
+/*
+ * Where an interrupted download got to. Only valid for the same file, the
+ * same manifest digest and the same update partition.
+ */
+typedef struct {
+	char file[OTA_FILE_BN_LEN];
+	uint8_t sha[SHA256_HASH_LEN];
+	uint32_t part_addr;
+	uint32_t offset;		/* Sector aligned, everything below is in flash */
+} ota_checkpoint_t;
+
+/*
+ * Sequential writer into the update partition. Erases a sector just before
+ * the first write into it.
+ */
+typedef struct {
+	const esp_partition_t *part;
+	uint32_t written;
+	uint32_t erased;
+} ota_sink_t;
+
+/*
+ * An update that hasn't proven itself yet. Written just before the reboot
+ * into the new image, cleared once it passes the health gate.
+ */
+typedef struct {
+	uint32_t prev_addr;					/* Partition to go back to */
+	uint32_t boots;						/* Boots of the new image so far */
+	char req_id[CMD_REQ_ID_LEN];
+	char file[OTA_FILE_BN_LEN];
+} ota_pending_t;
+
+/*
+ * Outcome to report on the ack topic after the next boot
+ */
+typedef struct {
+	char req_id[CMD_REQ_ID_LEN];
+	char msg[48];
+} ota_result_t;
 
 static EventGroupHandle_t ota_event_group;
+static volatile bool ota_health_running = false;	/* This image is still on trial */
 static char ota_file_basename[OTA_FILE_BN_LEN] = {0};
+static cmd_ctx_t ota_ctx = { .req_id = "" };
+
+/*
+ * Set by cmd_task, taken by ota_task when it's triggered. ota_task only
+ * works on its own copy (ota_file_basename, ota_ctx) so a command that
+ * arrives mid-update can't change them under it.
+ */
+static portMUX_TYPE ota_mux = portMUX_INITIALIZER_UNLOCKED;
+static char ota_req_file[OTA_FILE_BN_LEN] = {0};
+static cmd_ctx_t ota_req_ctx = { .req_id = "" };
 
 static const char *TAG = "OTA";
-static char ota_write_data[BUFFSIZE + 1] = { 0 };
+static const char ota_nvs_namespace[] = "ota";
 //extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 //extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
 static void _http_cleanup(esp_http_client_handle_t client);
 static esp_err_t _ota_commence( void );
+static esp_err_t _ota_fetch_manifest(const char *url, uint8_t *sha);
+static esp_err_t _ota_sink_write(ota_sink_t *sink, const uint8_t *data, size_t len);
+static esp_err_t _ota_sink_cb(void *arg, const uint8_t *data, size_t len);
+static esp_err_t _ota_delta_cb(void *arg, const uint8_t *data, size_t len);
+static bool _ota_has_ext(const char *name, size_t len, const char *ext);
+static esp_err_t _ota_sha256_flash(const esp_partition_t *part, uint32_t len, uint8_t *sha);
+static bool _ota_nvs_load(const char *key, void *blob, size_t len);
+static void _ota_nvs_save(const char *key, const void *blob, size_t len);
+static void _ota_nvs_erase(const char *key);
+static void _ota_health_gate(void);
+static void _ota_health_task(void *pvParameters);
+static void _ota_rollback(ota_pending_t *pending, const char *reason);
 
 
 static void _http_cleanup(esp_http_client_handle_t client)
@@ -55,43 +146,389 @@ void ota_trigger()
 }
 
 void ota_set_filename(char *fn){
-	strcpy(ota_file_basename, fn);
-	ESP_LOGI(TAG, "File copy: %s", ota_file_basename);
+	portENTER_CRITICAL(&ota_mux);
+	strlcpy(ota_req_file, fn, OTA_FILE_BN_LEN);
+	portEXIT_CRITICAL(&ota_mux);
+	ESP_LOGI(TAG, "File copy: %s", fn);
+}
+
+/*
+ * File and request the next OTA answers to. Progress goes out as
+ * "ota progress <pct>".
+ */
+void ota_set_request(const cmd_ctx_t *ctx, const char *fn){
+	portENTER_CRITICAL(&ota_mux);
+	ota_req_ctx = *ctx;
+	strlcpy(ota_req_file, fn, OTA_FILE_BN_LEN);
+	portEXIT_CRITICAL(&ota_mux);
+	ESP_LOGI(TAG, "File copy: %s", fn);
 }
 
 
 void ota_task(void *pvParameters)
 {
 	esp_err_t err;
-	ota_event_group = xEventGroupCreate();
 	bzero(ota_file_basename, OTA_FILE_BN_LEN);
 	xEventGroupClearBits(ota_event_group, OTA_TRIGGER_OTA_BIT);
+
 	ESP_LOGI(TAG, "Waiting for MQTT to trigger OTA...");
 
 	for(;;) {
 
 		xEventGroupWaitBits(ota_event_group, OTA_TRIGGER_OTA_BIT, pdTRUE, pdTRUE, portMAX_DELAY );
 		ESP_LOGI(TAG, "MQTT triggered OTA...");
+
+		portENTER_CRITICAL(&ota_mux);
+		strlcpy(ota_file_basename, ota_req_file, OTA_FILE_BN_LEN);
+		ota_ctx = ota_req_ctx;
+		portEXIT_CRITICAL(&ota_mux);
+
 		err = _ota_commence();
+		if (err != ESP_OK) {
+			ESP_LOGW(TAG, "OTA of %s failed (%s)", ota_file_basename, esp_err_to_name(err));
+		}
+	}
 
+}
+
+
+/*
+ * Count this boot of a pending update before any driver can crash, so an
+ * image that resets during init still runs out of boots and is rolled
+ * back. The wait for its health signals runs in ota_health_task.
+ */
+void ota_boot_check(void)
+{
+	ota_pending_t pending;
+	ota_result_t result;
+	const esp_partition_t *running = esp_ota_get_running_partition();
+
+	ota_event_group = xEventGroupCreate();
+
+	if (_ota_nvs_load("pending", &pending, sizeof(pending))) {
+		if (running->address == pending.prev_addr) {
+			// The new image never got this far, the bootloader went back
+			strlcpy(result.req_id, pending.req_id, CMD_REQ_ID_LEN);
+			strlcpy(result.msg, "ota rollback boot", sizeof(result.msg));
+			_ota_nvs_save("result", &result, sizeof(result));
+			_ota_nvs_erase("pending");
+		}
+		else if (++pending.boots > CONFIG_OTA_HEALTH_MAX_BOOTS) {
+			_ota_rollback(&pending, "reboots");
+		}
+		else {
+			_ota_nvs_save("pending", &pending, sizeof(pending));
+			ESP_LOGI(TAG, "Checking health of %s (boot %u)", pending.file, pending.boots);
+			ota_health_running = true;
+		}
+	}
+
+	if (ota_health_running || _ota_nvs_load("result", &result, sizeof(result))) {
+		xTaskCreate(&_ota_health_task, "ota_health", 3072, NULL, 5, NULL);
 	}
+}
 
+void ota_health_report(EventBits_t bit)
+{
+	if (ota_event_group != NULL) {
+		xEventGroupSetBits(ota_event_group, bit);
+	}
 }
 
+bool ota_in_rollout(int pct)
+{
+	uint32_t h = 2166136261u;	/* FNV-1a of the MAC */
+
+	for (const char *p = DEVICE_MAC; *p; p++) {
+		h = (h ^ (uint8_t) *p) * 16777619u;
+	}
+	return (int) (h % 100) < pct;
+}
 
 /*
- * Trigger OTA using file defined by 'ota_file_basename'
+ * Boot the image we updated from and tell the server why (after that
+ * image comes up).
  */
-static esp_err_t _ota_commence()
+static void _ota_rollback(ota_pending_t *pending, const char *reason)
+{
+	ota_result_t result;
+	const esp_partition_t *prev = NULL;
+	esp_partition_iterator_t it;
+
+	it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+	for (; it != NULL && prev == NULL; it = esp_partition_next(it)) {
+		if (esp_partition_get(it)->address == pending->prev_addr) {
+			prev = esp_partition_get(it);
+		}
+	}
+	esp_partition_iterator_release(it);
+
+	ESP_LOGE(TAG, "%s failed health check (%s), rolling back", pending->file, reason);
+	strlcpy(result.req_id, pending->req_id, CMD_REQ_ID_LEN);
+	snprintf(result.msg, sizeof(result.msg), "ota rollback %s", reason);
+	_ota_nvs_save("result", &result, sizeof(result));
+	_ota_nvs_erase("pending");
+
+	if (prev == NULL || esp_ota_set_boot_partition(prev) != ESP_OK) {
+		ESP_LOGE(TAG, "Can't boot the previous image, keeping this one");
+		return;
+	}
+	DIAG_Crumb(DIAG_OTA, 1);
+	DIAG_Flush(true);
+	esp_restart();
+}
+
+/*
+ * Decide whether the image ota_boot_check put on trial stays, then report
+ * the last outcome once MQTT can deliver it.
+ */
+static void _ota_health_gate(void)
+{
+	ota_pending_t pending;
+	ota_result_t result;
+	cmd_ctx_t ctx;
+	EventBits_t bits;
+	uint32_t min_heap;
+	const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+
+	if (ota_health_running && _ota_nvs_load("pending", &pending, sizeof(pending))) {
+		bits = xEventGroupWaitBits(ota_event_group, OTA_HEALTH_BITS, pdFALSE, pdTRUE,
+								   CONFIG_OTA_HEALTH_BUDGET_S * ONE_SECOND_DELAY);
+		min_heap = esp_get_minimum_free_heap_size();
+
+		if (!(bits & OTA_HEALTH_MQTT_BIT)) {
+			_ota_rollback(&pending, "mqtt");
+		}
+		else if (!(bits & OTA_HEALTH_PM_BIT)) {
+			_ota_rollback(&pending, "sensor");
+		}
+		else if (min_heap < CONFIG_OTA_HEALTH_MIN_HEAP) {
+			_ota_rollback(&pending, "heap");
+		}
+		else {
+#ifdef CONFIG_APP_ROLLBACK_ENABLE
+			esp_ota_mark_app_valid_cancel_rollback();
+#endif
+			strlcpy(result.req_id, pending.req_id, CMD_REQ_ID_LEN);
+			snprintf(result.msg, sizeof(result.msg), "ota valid %.24s", app_desc->version);
+			_ota_nvs_save("result", &result, sizeof(result));
+			_ota_nvs_erase("pending");
+			ESP_LOGI(TAG, "Update healthy (min free heap %u)", min_heap);
+		}
+	}
+	ota_health_running = false;
+
+	// Report once MQTT has shown it can deliver, or give up after the budget
+	if (_ota_nvs_load("result", &result, sizeof(result))) {
+		xEventGroupWaitBits(ota_event_group, OTA_HEALTH_MQTT_BIT, pdFALSE, pdTRUE,
+							CONFIG_OTA_HEALTH_BUDGET_S * ONE_SECOND_DELAY);
+		strlcpy(ctx.req_id, result.req_id, CMD_REQ_ID_LEN);
+		CMD_Reply(&ctx, CONFIG_MQTT_ACK_QOS, result.msg);
+		_ota_nvs_erase("result");
+	}
+}
+
+static void _ota_health_task(void *pvParameters)
+{
+	_ota_health_gate();
+	vTaskDelete(NULL);
+}
+
+/*
+ * Parse one hex digit, -1 if it isn't one
+ */
+static int _hex(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * GET <url>.sha256 and parse the digest (sha256sum format: "<hex>  <name>")
+ */
+static esp_err_t _ota_fetch_manifest(const char *url, uint8_t *sha)
+{
+	char manifest_url[OTA_URL_LEN + 8];
+	char buf[OTA_MANIFEST_LEN] = {0};
+	int len = 0, rd;
+
+	snprintf(manifest_url, sizeof(manifest_url), "%s.sha256", url);
+	esp_http_client_config_t config = { .url = manifest_url };
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (client == NULL) {
+		return ESP_FAIL;
+	}
+	if (esp_http_client_open(client, 0) != ESP_OK) {
+		esp_http_client_cleanup(client);
+		return ESP_FAIL;
+	}
+	esp_http_client_fetch_headers(client);
+	if (esp_http_client_get_status_code(client) != 200) {
+		ESP_LOGE(TAG, "No manifest at %s (%d)", manifest_url, esp_http_client_get_status_code(client));
+		_http_cleanup(client);
+		return ESP_FAIL;
+	}
+	while (len < sizeof(buf) - 1 && (rd = esp_http_client_read(client, buf + len, sizeof(buf) - 1 - len)) > 0) {
+		len += rd;
+	}
+	_http_cleanup(client);
+
+	if (len < SHA256_HASH_LEN * 2) {
+		return ESP_FAIL;
+	}
+	for (int i = 0; i < SHA256_HASH_LEN; i++) {
+		int hi = _hex(buf[2 * i]), lo = _hex(buf[2 * i + 1]);
+		if (hi < 0 || lo < 0) {
+			return ESP_FAIL;
+		}
+		sha[i] = (hi << 4) | lo;
+	}
+	return ESP_OK;
+}
+
+/*
+ * Append to the update partition, erasing sectors as we reach them
+ */
+static esp_err_t _ota_sink_write(ota_sink_t *sink, const uint8_t *data, size_t len)
+{
+	esp_err_t err;
+
+	if (sink->written + len > sink->part->size) {
+		ESP_LOGE(TAG, "Image larger than partition (0x%x)", sink->part->size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	while (sink->erased < sink->written + len) {
+		err = esp_partition_erase_range(sink->part, sink->erased, OTA_SECTOR_SIZE);
+		if (err != ESP_OK) {
+			return err;
+		}
+		sink->erased += OTA_SECTOR_SIZE;
+	}
+	err = esp_partition_write(sink->part, sink->written, data, len);
+	if (err == ESP_OK) {
+		sink->written += len;
+	}
+	return err;
+}
+
+static esp_err_t _ota_sink_cb(void *arg, const uint8_t *data, size_t len)
+{
+	return _ota_sink_write((ota_sink_t *) arg, data, len);
+}
+
+static esp_err_t _ota_delta_cb(void *arg, const uint8_t *data, size_t len)
+{
+	return DELTA_Feed((delta_t *) arg, data, len);
+}
+
+/*
+ * Does the first len characters of name end with ext?
+ */
+static bool _ota_has_ext(const char *name, size_t len, const char *ext)
 {
-    
+	size_t ext_len = strlen(ext);
+	return len > ext_len && strncmp(name + len - ext_len, ext, ext_len) == 0;
+}
 
-    esp_err_t err;
-    char fn_path[64 + OTA_FILE_BN_LEN] = { 0 };
+/*
+ * SHA-256 of what actually landed in flash
+ */
+static esp_err_t _ota_sha256_flash(const esp_partition_t *part, uint32_t len, uint8_t *sha)
+{
+	mbedtls_sha256_context ctx;
+	uint8_t *buf;
+	uint32_t off, n;
+	esp_err_t err = ESP_OK;
+
+	if ((buf = malloc(OTA_SECTOR_SIZE)) == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	for (off = 0; off < len && err == ESP_OK; off += n) {
+		n = (len - off > OTA_SECTOR_SIZE) ? OTA_SECTOR_SIZE : len - off;
+		err = esp_partition_read(part, off, buf, n);
+		mbedtls_sha256_update_ret(&ctx, buf, n);
+	}
+	mbedtls_sha256_finish_ret(&ctx, sha);
+	mbedtls_sha256_free(&ctx);
+	free(buf);
+	return err;
+}
 
-    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-    esp_ota_handle_t update_handle = 0 ;
+/*
+ * Small blobs in the "ota" NVS namespace: the download checkpoint and the
+ * post-update health state
+ */
+static bool _ota_nvs_load(const char *key, void *blob, size_t len)
+{
+	nvs_handle handle;
+	size_t sz = len;
+	bool ok;
+
+	memset(blob, 0, len);
+	if (nvs_open(ota_nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+		return false;
+	}
+	ok = (nvs_get_blob(handle, key, blob, &sz) == ESP_OK && sz == len);
+	if (!ok) {
+		memset(blob, 0, len);
+	}
+	nvs_close(handle);
+	return ok;
+}
+
+static void _ota_nvs_save(const char *key, const void *blob, size_t len)
+{
+	nvs_handle handle;
+
+	if (nvs_open(ota_nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+		return;
+	}
+	nvs_set_blob(handle, key, blob, len);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+static void _ota_nvs_erase(const char *key)
+{
+	nvs_handle handle;
+
+	if (nvs_open(ota_nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+		return;
+	}
+	nvs_erase_key(handle, key);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+/*
+ * Trigger OTA using file defined by 'ota_file_basename'
+ */
+static esp_err_t _ota_commence()
+{
+    esp_err_t err = ESP_FAIL;
+    char url[OTA_URL_LEN] = { 0 };
+    char range[32];
+    uint8_t sha[SHA256_HASH_LEN];
+    uint8_t expected_sha[SHA256_HASH_LEN];
+    ota_checkpoint_t ckpt;
+    ota_sink_t sink = { 0 };
     const esp_partition_t *update_partition = NULL;
+    uint8_t *buf = NULL;
+    delta_t *delta = NULL;
+    unpack_t *unpack = NULL;
+    uint32_t received = 0;		/* Offset into the file on the server */
+    int64_t start_us;
+    size_t name_len = strlen(ota_file_basename);
+    bool is_packed = _ota_has_ext(ota_file_basename, name_len, ".hs");
+    bool is_patch = _ota_has_ext(ota_file_basename, is_packed ? name_len - 3 : name_len, ".patch");
+    int total = -1;
+    int next_progress = OTA_PROGRESS_STEP;
+    int attempt;
+    bool done = false;
 
     ESP_LOGI(TAG, "Starting OTA...");
 
@@ -99,6 +536,11 @@ static esp_err_t _ota_commence()
     	ESP_LOGI(TAG, "No filename... Exiting.");
     	return ESP_FAIL;
     }
+    // Updating from an image that may still be rolled back would lose the way back
+    if (ota_health_running) {
+        ESP_LOGW(TAG, "Still checking the health of this image, try again later");
+        return ESP_ERR_INVALID_STATE;
+    }
 
     const esp_partition_t *configured = esp_ota_get_boot_partition();
     const esp_partition_t *running = esp_ota_get_running_partition();
@@ -111,94 +553,216 @@ static esp_err_t _ota_commence()
     ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
              running->type, running->subtype, running->address);
 
-    sprintf(fn_path, "http://air.eng.utah.edu:80/files/updates/%s", ota_file_basename);
-    ESP_LOGI(TAG, "OTA: %s", fn_path);
+    snprintf(url, sizeof(url), "%s%s", CONFIG_OTA_URL_BASE, ota_file_basename);
+    ESP_LOGI(TAG, "OTA: %s", url);
 
-    esp_http_client_config_t config = {
-        .url = fn_path,
-//        .cert_pem = (char *)server_cert_pem_start,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP connection");
-        return ESP_FAIL;
-//        task_fatal_error(TAG);
-    }
-    err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
+    if (_ota_fetch_manifest(url, expected_sha) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't get a valid manifest. Refusing to update.");
         return ESP_FAIL;
-//        task_fatal_error(TAG);
     }
-    esp_http_client_fetch_headers(client);
+    print_sha256(expected_sha, "Manifest SHA-256");
 
     update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL) {
+        ESP_LOGE(TAG, "No update partition");
+        return ESP_FAIL;
+    }
     ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
              update_partition->subtype, update_partition->address);
-    assert(update_partition != NULL);
+    sink.part = update_partition;
+
+    // Resume if the checkpoint is for this very image
+    _ota_nvs_load("ckpt", &ckpt, sizeof(ckpt));
+    if (!is_patch && !is_packed && strcmp(ckpt.file, ota_file_basename) == 0 && ckpt.part_addr == update_partition->address &&
+        memcmp(ckpt.sha, expected_sha, SHA256_HASH_LEN) == 0 && ckpt.offset % OTA_SECTOR_SIZE == 0) {
+        ESP_LOGI(TAG, "Resuming at offset %u", ckpt.offset);
+        sink.written = sink.erased = received = ckpt.offset;
+    }
+    else {
+        memset(&ckpt, 0, sizeof(ckpt));
+        strlcpy(ckpt.file, ota_file_basename, OTA_FILE_BN_LEN);
+        memcpy(ckpt.sha, expected_sha, SHA256_HASH_LEN);
+        ckpt.part_addr = update_partition->address;
+    }
 
-    err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-        _http_cleanup(client);
-        return ESP_FAIL;
-//        task_fatal_error(TAG);
+    if ((buf = malloc(CONFIG_OTA_BUF_SIZE)) == NULL) {
+        ESP_LOGE(TAG, "No memory for a %d byte buffer", CONFIG_OTA_BUF_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+    if (is_patch) {
+        if ((delta = malloc(sizeof(delta_t))) == NULL) {
+            free(buf);
+            return ESP_ERR_NO_MEM;
+        }
+        DELTA_Begin(delta, running, _ota_sink_cb, &sink);
+    }
+    if (is_packed) {
+        if ((unpack = malloc(sizeof(unpack_t))) == NULL) {
+            free(buf);
+            free(delta);
+            return ESP_ERR_NO_MEM;
+        }
+        if (delta != NULL) {
+            UNPACK_Begin(unpack, _ota_delta_cb, delta);
+        }
+        else {
+            UNPACK_Begin(unpack, _ota_sink_cb, &sink);
+        }
     }
-    ESP_LOGI(TAG, "esp_ota_begin succeeded");
+    start_us = esp_timer_get_time();
 
-    int binary_file_length = 0;
-    /*deal with all receive packet*/
-    while (1) {
-        int data_read = esp_http_client_read(client, ota_write_data, BUFFSIZE);
-        if (data_read < 0) {
-            ESP_LOGE(TAG, "Error: SSL data read error");
-            _http_cleanup(client);
-            return ESP_FAIL;
-//            task_fatal_error(TAG);
+    for (attempt = 0; attempt <= CONFIG_OTA_MAX_RETRIES && !done; attempt++) {
+        if (attempt > 0) {
+            ESP_LOGW(TAG, "Retry %d/%d from offset %u", attempt, CONFIG_OTA_MAX_RETRIES, received);
+            vTaskDelay(OTA_RETRY_DELAY);
+        }
+
+        esp_http_client_config_t config = {
+            .url = url,
+            .buffer_size = CONFIG_OTA_BUF_SIZE,
+        };
+        esp_http_client_handle_t client = esp_http_client_init(&config);
+        if (client == NULL) {
+            ESP_LOGE(TAG, "Failed to initialize HTTP connection");
+            continue;
+        }
+        if (received > 0) {
+            snprintf(range, sizeof(range), "bytes=%u-", received);
+            esp_http_client_set_header(client, "Range", range);
+        }
+        err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+            esp_http_client_cleanup(client);
+            continue;
         }
-        else if (data_read > 0) {
-            err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
-            if (err != ESP_OK) {
-                _http_cleanup(client);
-                return ESP_FAIL;
-//                task_fatal_error(TAG);
+
+        int content_length = esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        if (status == 200 && received > 0) {
+            // Server ignored the Range header. Start over.
+            ESP_LOGW(TAG, "No range support, restarting from 0");
+            sink.written = sink.erased = received = 0;
+            next_progress = OTA_PROGRESS_STEP;
+            if (delta != NULL) {
+                DELTA_Begin(delta, running, _ota_sink_cb, &sink);
+            }
+            if (unpack != NULL) {
+                UNPACK_End(unpack);
+                UNPACK_Begin(unpack, unpack->write, unpack->arg);
             }
-            binary_file_length += data_read;
-//            ESP_LOGI(TAG, "Written image length: %d", binary_file_length);
         }
-        else if (data_read == 0) {
-            ESP_LOGI(TAG, "Connection closed,all data received");
+        else if (status != 200 && status != 206) {
+            ESP_LOGE(TAG, "HTTP status %d", status);
+            _http_cleanup(client);
+            err = ESP_FAIL;
             break;
         }
-    }
-    ESP_LOGI(TAG, "Total Write binary data length : %d", binary_file_length);
+        if (content_length > 0) {
+            total = received + content_length;
+        }
 
-    if (esp_ota_end(update_handle) != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_end failed!");
+        /*deal with all receive packet*/
+        while (1) {
+            int data_read = esp_http_client_read(client, (char *)buf, CONFIG_OTA_BUF_SIZE);
+            if (data_read < 0) {
+                ESP_LOGE(TAG, "Error: data read error at offset %u", received);
+                err = ESP_FAIL;
+                break;
+            }
+            else if (data_read > 0) {
+                uint32_t sector = sink.written / OTA_SECTOR_SIZE;
+                received += data_read;
+                if (unpack != NULL) {
+                    err = UNPACK_Feed(unpack, buf, data_read);
+                }
+                else if (delta != NULL) {
+                    err = DELTA_Feed(delta, buf, data_read);
+                }
+                else {
+                    err = _ota_sink_write(&sink, buf, data_read);
+                }
+                if (err != ESP_OK) {
+                    // Not a network problem, retrying won't help
+                    ESP_LOGE(TAG, "Couldn't apply image data (%s)", esp_err_to_name(err));
+                    attempt = CONFIG_OTA_MAX_RETRIES;
+                    break;
+                }
+
+                // Crossed a sector: everything below it is final
+                if (delta == NULL && unpack == NULL && sink.written / OTA_SECTOR_SIZE != sector) {
+                    ckpt.offset = (sink.written / OTA_SECTOR_SIZE) * OTA_SECTOR_SIZE;
+                    _ota_nvs_save("ckpt", &ckpt, sizeof(ckpt));
+                }
+                if (total > 0 && received * 100LL / total >= next_progress) {
+                    CMD_Progress(&ota_ctx, "ota", next_progress);
+                    next_progress += OTA_PROGRESS_STEP;
+                }
+            }
+            else if (data_read == 0) {
+                if (total > 0 && received < total) {
+                    ESP_LOGW(TAG, "Connection closed early (%u of %d)", received, total);
+                    err = ESP_FAIL;
+                    break;
+                }
+                ESP_LOGI(TAG, "Connection closed,all data received");
+                done = true;
+                break;
+            }
+        }
         _http_cleanup(client);
+    }
+    free(buf);
+    if (done && unpack != NULL) {
+        done = (UNPACK_Finish(unpack) == ESP_OK);
+    }
+    if (done && delta != NULL) {
+        done = (DELTA_Finish(delta) == ESP_OK);
+    }
+    if (unpack != NULL) {
+        UNPACK_End(unpack);
+        free(unpack);
+    }
+    free(delta);
+
+    if (!done) {
+        ESP_LOGE(TAG, "Download failed at offset %u", received);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Downloaded %u bytes, wrote %u in %d ms (min free heap %u)", received, sink.written,
+             (int) ((esp_timer_get_time() - start_us) / 1000), esp_get_minimum_free_heap_size());
+
+    // Integrity check before we ever point the bootloader at it
+    if (_ota_sha256_flash(update_partition, sink.written, sha) != ESP_OK ||
+        memcmp(sha, expected_sha, SHA256_HASH_LEN) != 0) {
+        print_sha256(sha, "Flash SHA-256");
+        ESP_LOGE(TAG, "SHA-256 mismatch, discarding image");
+        _ota_nvs_erase("ckpt");
         return ESP_FAIL;
-//        task_fatal_error(TAG);
     }
+    _ota_nvs_erase("ckpt");
 
     if (esp_partition_check_identity(esp_ota_get_running_partition(), update_partition) == true) {
         ESP_LOGI(TAG, "The current running firmware is same as the firmware just downloaded");
         ESP_LOGI(TAG, "When a new firmware is available on the server, press the reset button to download it");
         return ESP_FAIL;
-//        while(1) {
-//            ESP_LOGI(TAG, "Waiting for a new firmware ... %d", ++i);
-//            vTaskDelay(2000 / portTICK_PERIOD_MS);
-//        }
     }
 
+    // Also validates the image header and segments
     err = esp_ota_set_boot_partition(update_partition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
-        _http_cleanup(client);
         return ESP_FAIL;
-//        task_fatal_error(TAG);
     }
+    // Health gate runs on the next boot
+    ota_pending_t pending = { .prev_addr = running->address, .boots = 0 };
+    strlcpy(pending.req_id, ota_ctx.req_id, CMD_REQ_ID_LEN);
+    strlcpy(pending.file, ota_file_basename, OTA_FILE_BN_LEN);
+    _ota_nvs_save("pending", &pending, sizeof(pending));
+
     ESP_LOGI(TAG, "Prepare to restart system!");
+    DIAG_Crumb(DIAG_OTA, 0);
+    DIAG_Flush(true);
     esp_restart();
     return ESP_OK;
 }
@@ -21,26 +21,57 @@
 #include "driver/uart.h"
 #include "esp_log.h"
 #include "pm_if.h"
+#include "wdt_if.h"
+#include "metrics_if.h"
 
 #define GPIO_PM_RESET	17
 #define GPIO_PM_SET		5
+#ifdef CONFIG_PMS_PASSIVE
+#define GPIO_OUTPUT_PIN_SEL (1ULL << GPIO_PM_SET)	/* GPIO_PM_RESET is PM_TXD_PIN, the UART needs it */
+#else
 #define GPIO_OUTPUT_PIN_SEL ((1ULL << GPIO_PM_RESET) | (1ULL << GPIO_PM_SET))
+#endif
 #define PM_TIMER_TIMEOUT_MS 5000
+#define PM_SLEEP_MIN_MS		10000	/* Not worth stopping the fan for less */
+#define PM_WARMUP_TICKS		pdMS_TO_TICKS(CONFIG_PMS_WARMUP_S * 1000)
+#define PM_READ_INTERVAL_MS	1000	/* Between passive mode read requests */
 
 static const char* TAG_PM = "PM";
 
 static void _pm_accum_rst(void);
-static esp_err_t get_packet_from_buffer(void);
-static esp_err_t get_data_from_packet(uint8_t *packet);
-static uint8_t pm_checksum();
+static esp_err_t get_packet_from_buffer(const pms_frame_t *frame);
+static void _pms_feed(const uint8_t *data, size_t len);
+static bool _pms_frame(const uint8_t *buf, size_t len);
+static esp_err_t _pms_command(uint8_t cmd, uint16_t data);
 static void uart_pm_event_mgr(void *pvParameters);
 static void vTimerCallback(TimerHandle_t xTimer);
+static uint32_t _pms_sleep_ms(uint32_t period_ms);
+static void _pms_sleep(void);
+static void _pms_quiet(uint32_t ms);
+static void _pms_wake_cb(TimerHandle_t xTimer);
+#ifdef CONFIG_PMS_PASSIVE
+static uint32_t _pms_read_delay_ms(uint32_t period_ms);
+static void _pms_read_cb(TimerHandle_t xTimer);
+#endif
 
 /* Global variables */
 static QueueHandle_t pm_event_queue;
 static TimerHandle_t pm_timer;
+static TimerHandle_t pm_wake_timer;
+#ifdef CONFIG_PMS_PASSIVE
+static TimerHandle_t pm_read_timer;
+static metric_t *m_read_req = NULL;
+#endif
+static volatile bool pm_asleep = false;
+static volatile TickType_t pm_wake_tick = 0;	/* When the fan last started */
 static pm_data_t pm_accum;
 static uint8_t pm_buf[BUF_SIZE];
+static uint8_t pm_rx[2 * PMS_FRAME_MAX];	/* Bytes not yet part of a whole frame */
+static size_t pm_rx_len = 0;
+static pms_frame_t pm_frame;				/* Latest good frame, len 0 before one */
+static portMUX_TYPE pm_frame_mux = portMUX_INITIALIZER_UNLOCKED;
+static metric_t *m_uart_ovf = NULL;
+static metric_t *m_warmup_drop = NULL;
 
 /*
  * @brief 	PM data timer callback. If no valid PM data is received
@@ -73,6 +104,121 @@ static void _pm_accum_rst()
 	pm_accum.sample_count = 0;
 }
 
+/*
+ * @brief	How long to sleep after a poll so the sensor is awake, warmed
+ * 			up, and has had CONFIG_PMS_SAMPLE_S to sample when the next
+ * 			poll comes period_ms later
+ *
+ * @return	0 to stay awake
+ */
+static uint32_t _pms_sleep_ms(uint32_t period_ms)
+{
+#ifdef CONFIG_PMS_SLEEP
+	uint32_t lead_ms = (CONFIG_PMS_WARMUP_S + CONFIG_PMS_SAMPLE_S) * 1000;
+
+	if (period_ms < lead_ms + PM_SLEEP_MIN_MS) {
+		return 0;
+	}
+	return period_ms - lead_ms;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * @brief	Fan off until the next sampling window, if there's time and
+ * 			the wake timer could be set
+ */
+static void _pms_sleep(void)
+{
+	uint32_t ms = _pms_sleep_ms(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+
+	if (ms == 0) {
+		return;
+	}
+	if (xTimerChangePeriod(pm_wake_timer, pdMS_TO_TICKS(ms), 0) != pdPASS) {
+		ESP_LOGW(TAG_PM, "Wake timer not set, staying awake");
+		return;
+	}
+	_pms_quiet(ms);
+	pm_asleep = true;
+	PMS_SET(0);
+	xTimerStop(pm_timer, 0);
+	ESP_LOGD(TAG_PM, "Sleeping %u ms", ms);
+}
+
+/*
+ * @brief	The one watchdog rule for the sensor: it owes frames while it's
+ * 			awake and we're asking for them. Whenever we stop asking (it
+ * 			sleeps, or a passive window is done), the watchdog is told
+ * 			when we'll ask again, and judges it from there. A timer that
+ * 			never fires or a sensor that never answers still shows.
+ */
+static void _pms_quiet(uint32_t ms)
+{
+	WDT_Expect(WDT_PM, ms / 1000 + 1);
+}
+
+/*
+ * @brief	Wake timer callback: fan on, warm-up starts now
+ */
+static void _pms_wake_cb(TimerHandle_t xTimer)
+{
+	pm_wake_tick = xTaskGetTickCount();
+	pm_asleep = false;
+	WDT_Alive(WDT_PM);
+	PMS_SET(1);
+#ifdef CONFIG_PMS_PASSIVE
+	PMS_SetPassive(true);
+#endif
+}
+
+#ifdef CONFIG_PMS_PASSIVE
+/*
+ * @brief	When to start requesting frames after a poll: as the sensor
+ * 			comes out of warm-up, or CONFIG_PMS_SAMPLE_S before the next
+ * 			poll if it doesn't sleep
+ */
+static uint32_t _pms_read_delay_ms(uint32_t period_ms)
+{
+	uint32_t sleep_ms = _pms_sleep_ms(period_ms);
+
+	if (sleep_ms > 0) {
+		return sleep_ms + CONFIG_PMS_WARMUP_S * 1000;
+	}
+	if (period_ms <= CONFIG_PMS_SAMPLE_S * 1000) {
+		return PM_READ_INTERVAL_MS;
+	}
+	return period_ms - CONFIG_PMS_SAMPLE_S * 1000;
+}
+
+/*
+ * @brief	Read timer callback: ask for one frame a second until
+ * 			CONFIG_PMS_PASSIVE_FRAMES are in, then leave the UART idle
+ * 			until the next window
+ */
+static void _pms_read_cb(TimerHandle_t xTimer)
+{
+	if (pm_accum.sample_count >= CONFIG_PMS_PASSIVE_FRAMES) {
+		return;
+	}
+	if (PMS_GetState() == PMS_SAMPLING) {
+		WDT_Alive(WDT_PM);
+		PMS_RequestRead();
+		METRICS_Inc(m_read_req);
+	}
+	xTimerChangePeriod(xTimer, pdMS_TO_TICKS(PM_READ_INTERVAL_MS), 0);
+}
+#endif
+
+pms_state_t PMS_GetState(void)
+{
+	if (pm_asleep) {
+		return PMS_ASLEEP;
+	}
+	return (xTaskGetTickCount() - pm_wake_tick < PM_WARMUP_TICKS) ? PMS_WARMUP : PMS_SAMPLING;
+}
+
 /*
 * @brief
 *
@@ -108,6 +254,9 @@ esp_err_t PMS_Initialize()
   if(err != ESP_OK)
   		return err;
 
+  m_uart_ovf = METRICS_Register("pm_uart_ovf", METRIC_COUNTER);
+  m_warmup_drop = METRICS_Register("pm_warmup_drop", METRIC_COUNTER);
+
   // create a task to handler UART event from ISR for the PM sensor
   xTaskCreate(uart_pm_event_mgr, "vPM_task", 2048, NULL, 12, NULL);
 
@@ -116,16 +265,28 @@ esp_err_t PMS_Initialize()
 						  (PM_TIMER_TIMEOUT_MS / portTICK_PERIOD_MS),
 						  pdFALSE, (void *)NULL,
 						  vTimerCallback);
+  pm_wake_timer = xTimerCreate("pm_wake", 1, pdFALSE, NULL, _pms_wake_cb);
+#ifdef CONFIG_PMS_PASSIVE
+  pm_read_timer = xTimerCreate("pm_read", 1, pdFALSE, NULL, _pms_read_cb);
+  m_read_req = METRICS_Register("pm_read_req", METRIC_COUNTER);
+#endif
 
   // clear out the pm data accumulator
   _pm_accum_rst();
 
   PMS_GPIOEnable();
+  pm_wake_tick = xTaskGetTickCount();
   PMS_SET(1);
   PMS_RESET(1);
 
+#ifdef CONFIG_PMS_PASSIVE
+  // Frames only on request from here on, the first window opens after warm-up
+  PMS_SetPassive(true);
+  xTimerChangePeriod(pm_read_timer, PM_WARMUP_TICKS + 1, 0);
+#else
   // start the first timer
   xTimerStart(pm_timer, 0);
+#endif
 
   return err;
 }
@@ -144,6 +305,10 @@ void PMS_GPIOEnable()
 
 esp_err_t PMS_Poll(pm_data_t *dat)
 {
+#ifdef CONFIG_PMS_PASSIVE
+	uint32_t delay_ms;
+#endif
+
 	if(pm_accum.sample_count == 0) {
 		dat->pm1   = -1;
 		dat->pm2_5 = -1;
@@ -156,13 +321,26 @@ esp_err_t PMS_Poll(pm_data_t *dat)
 	dat->pm10  = pm_accum.pm10  / pm_accum.sample_count;
 
 	_pm_accum_rst();
+	_pms_sleep();
+#ifdef CONFIG_PMS_PASSIVE
+	// Nothing asked for until the next window, even if this one came up short
+	delay_ms = _pms_read_delay_ms(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+	if (xTimerChangePeriod(pm_read_timer, pdMS_TO_TICKS(delay_ms), 0) == pdPASS) {
+		_pms_quiet(delay_ms);
+	}
+	else {
+		ESP_LOGW(TAG_PM, "Read timer not set, no window");
+	}
+#endif
 
 	return ESP_OK;
 }
 
 void PMS_RESET(uint32_t level)
 {
+#ifndef CONFIG_PMS_PASSIVE
   gpio_set_level(GPIO_PM_RESET, level);
+#endif
 }
 
 
@@ -191,7 +369,9 @@ void PMS_SET(uint32_t level)
 static void uart_pm_event_mgr(void *pvParameters)
 {
   uart_event_t event;
+  int len;
 
+  METRICS_WatchTask(NULL);
   for(;;) 
   {
     //Waiting for UART event.
@@ -200,22 +380,22 @@ static void uart_pm_event_mgr(void *pvParameters)
       switch(event.type) 
       {
         case UART_DATA:
-          if(event.size == 24) 
-          {
-            uart_read_bytes(PM_UART_CH, pm_buf, event.size, portMAX_DELAY);
-            get_packet_from_buffer();
-          }
-          uart_flush_input(PM_UART_CH);
+          // Frames can arrive split or back to back, _pms_feed puts them together
+          len = uart_read_bytes(PM_UART_CH, pm_buf, (event.size < BUF_SIZE) ? event.size : BUF_SIZE, 0);
+          if(len > 0)
+            _pms_feed(pm_buf, len);
           break;
 
         case UART_FIFO_OVF:
           ESP_LOGI(TAG_PM, "hw fifo overflow");
+          METRICS_Inc(m_uart_ovf);
           uart_flush_input(PM_UART_CH);
           xQueueReset(pm_event_queue);
           break;
                 
         case UART_BUFFER_FULL:
           ESP_LOGI(TAG_PM, "ring buffer full");
+          METRICS_Inc(m_uart_ovf);
           uart_flush_input(PM_UART_CH);
           xQueueReset(pm_event_queue);
           break;
@@ -244,91 +424,132 @@ static void uart_pm_event_mgr(void *pvParameters)
 
 
 /*
-* @brief
-*
-* @param
-*
-* @return
-*
-*/
-static esp_err_t get_packet_from_buffer(){
-  if(pm_buf[0] == 'B' && pm_buf[1] == 'M'){
-	  if(pm_checksum()){
-		  pm_accum.pm1   += (float)((pm_buf[PKT_PM1_HIGH]   << 8) | pm_buf[PKT_PM1_LOW]);
-		  pm_accum.pm2_5 += (float)((pm_buf[PKT_PM2_5_HIGH] << 8) | pm_buf[PKT_PM2_5_LOW]);
-		  pm_accum.pm10  += (float)((pm_buf[PKT_PM10_HIGH]  << 8) | pm_buf[PKT_PM10_LOW]);
-		  pm_accum.sample_count++;
-		  xTimerReset(pm_timer, 0);
-		  return ESP_OK;
-	  }
-  }
-  return ESP_FAIL;
+ * @brief	Append UART bytes and handle every whole frame in them. Junk
+ * 			and frames that fail their checksum are skipped a byte at a
+ * 			time until the next "BM".
+ */
+static void _pms_feed(const uint8_t *data, size_t len)
+{
+	size_t n, off, flen;
+
+	while (len > 0) {
+		n = sizeof(pm_rx) - pm_rx_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(pm_rx + pm_rx_len, data, n);
+		pm_rx_len += n;
+		data += n;
+		len -= n;
+
+		off = 0;
+		while (pm_rx_len - off >= PMS_HDR_LEN) {
+			flen = PMS_HDR_LEN + ((pm_rx[off + 2] << 8) | pm_rx[off + 3]);
+			if (pm_rx[off] != 'B' || pm_rx[off + 1] != 'M' ||
+				(flen != PMS3003_FRAME_LEN && flen != PMS5003_FRAME_LEN && flen != PMS_ACK_FRAME_LEN)) {
+				off++;
+				continue;
+			}
+			if (pm_rx_len - off < flen) {
+				break;
+			}
+			off += _pms_frame(pm_rx + off, flen) ? flen : 1;
+		}
+
+		// A partial frame is at most PMS_FRAME_MAX long, so there's always room for more
+		memmove(pm_rx, pm_rx + off, pm_rx_len - off);
+		pm_rx_len -= off;
+	}
 }
 
+/*
+ * @brief	One whole frame of len bytes
+ *
+ * @return	false if its checksum is wrong
+ */
+static bool _pms_frame(const uint8_t *buf, size_t len)
+{
+	pms_frame_t frame;
+
+	if (len == PMS_ACK_FRAME_LEN) {
+		if (PMS_Sum(buf, len - 2) != ((buf[len - 2] << 8) | buf[len - 1])) {
+			return false;
+		}
+		ESP_LOGI(TAG_PM, "Command 0x%02x acknowledged (0x%02x)", buf[4], buf[5]);
+		return true;
+	}
+
+	if (PMS_ParseFrame(buf, len, &frame) != ESP_OK) {
+		return false;
+	}
+	portENTER_CRITICAL(&pm_frame_mux);
+	pm_frame = frame;
+	portEXIT_CRITICAL(&pm_frame_mux);
+	get_packet_from_buffer(&frame);
+	return true;
+}
+
+bool PMS_GetFrame(pms_frame_t *frame)
+{
+	portENTER_CRITICAL(&pm_frame_mux);
+	*frame = pm_frame;
+	portEXIT_CRITICAL(&pm_frame_mux);
+	return frame->len != 0;
+}
 
 /*
-* @brief
-*
-* @param
-*
-* @return
-*
-*/
-static esp_err_t get_data_from_packet(uint8_t *packet)
+ * @brief	"BM", command, data and checksum
+ */
+static esp_err_t _pms_command(uint8_t cmd, uint16_t data)
 {
-  uint16_t tmp;
-  uint8_t tmp2;
+	uint8_t buf[PMS_CMD_LEN] = { 'B', 'M', cmd, data >> 8, data & 0xff };
+	uint16_t sum = PMS_Sum(buf, PMS_CMD_LEN - 2);
 
-    
-  if(packet == NULL)
-    return ESP_FAIL;
-
-  // PM1 data
-  tmp = packet[PKT_PM1_HIGH];
-  tmp2 = packet[PKT_PM1_LOW];
-  tmp = tmp << sizeof(uint8_t);
-  tmp = tmp | tmp2;
-  pm_accum.pm1 += tmp;
-
-  // PM2.5 data
-  tmp = packet[PKT_PM2_5_HIGH];
-  tmp2 = packet[PKT_PM2_5_LOW];
-  tmp = tmp << sizeof(uint8_t);
-  tmp = tmp | tmp2;
-  pm_accum.pm2_5 += tmp;
-
-  // PM10 data
-  tmp = packet[PKT_PM10_HIGH] << 8 ;
-  tmp2 = packet[PKT_PM10_LOW];
-  tmp = tmp << sizeof(uint8_t);
-  tmp = tmp | tmp2;
-  pm_accum.pm10 += tmp;
+	buf[PMS_CMD_LEN - 2] = sum >> 8;
+	buf[PMS_CMD_LEN - 1] = sum & 0xff;
+	return (uart_write_bytes(PM_UART_CH, (const char *) buf, PMS_CMD_LEN) == PMS_CMD_LEN) ? ESP_OK : ESP_FAIL;
+}
 
-  pm_accum.sample_count++;
+esp_err_t PMS_SetPassive(bool passive)
+{
+	return _pms_command(PMS_CMD_MODE, passive ? 0 : 1);
+}
 
-  return ESP_OK;
+esp_err_t PMS_RequestRead(void)
+{
+	return _pms_command(PMS_CMD_READ, 0);
 }
 
 
 /*
-* @brief
+* @brief Add a data frame to the accumulator
 *
-* @param
+* @param frame - decoded frame
 *
-* @return
+* @return ESP_OK
 *
 */
-static uint8_t pm_checksum()
-{
-	uint16_t checksum;
-	uint16_t sum = 0;
-	uint16_t i;
-
-	checksum = ((uint16_t) pm_buf[PM_PKT_LEN-2]) << 8;
-	checksum += (uint16_t) pm_buf[PM_PKT_LEN-1];
-
-	for(i = 0; i < PM_PKT_LEN-2 ; i++)
-		sum += pm_buf[i];
-
-	return (sum == checksum);
+static esp_err_t get_packet_from_buffer(const pms_frame_t *frame){
+  // The sensor is alive, but a frame from a settling fan isn't a reading
+  if(PMS_GetState() != PMS_SAMPLING){
+	  METRICS_Inc(m_warmup_drop);
+	  WDT_Progress(WDT_PM);
+	  return ESP_OK;
+  }
+  pm_accum.pm1   += (float)frame->pm1_cf1;
+  pm_accum.pm2_5 += (float)frame->pm2_5_cf1;
+  pm_accum.pm10  += (float)frame->pm10_cf1;
+  pm_accum.sample_count++;
+#ifndef CONFIG_PMS_PASSIVE
+  xTimerReset(pm_timer, 0);	// Passive mode frames stop on purpose
+#endif
+  WDT_Progress(WDT_PM);
+#ifdef CONFIG_PMS_PASSIVE
+  // Window's frames are in. The poll that closes it comes within a period
+  // and sets the next deadline.
+  if (pm_accum.sample_count >= CONFIG_PMS_PASSIVE_FRAMES) {
+	  _pms_quiet(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+  }
+#endif
+  return ESP_OK;
 }
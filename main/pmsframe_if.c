@@ -0,0 +1,62 @@
+/*
+ * pmsframe_if.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <string.h>
+#include "pmsframe_if.h"
+
+uint16_t PMS_Sum(const uint8_t *buf, size_t len)
+{
+	uint16_t sum = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		sum += buf[i];
+	}
+	return sum;
+}
+
+esp_err_t PMS_ParseFrame(const uint8_t *buf, size_t len, pms_frame_t *frame)
+{
+	uint16_t word[(PMS_FRAME_MAX - PMS_HDR_LEN) / 2];
+	size_t flen, words;
+
+	if (len < PMS_HDR_LEN || buf[0] != 'B' || buf[1] != 'M') {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	flen = PMS_HDR_LEN + ((buf[2] << 8) | buf[3]);
+	if ((flen != PMS3003_FRAME_LEN && flen != PMS5003_FRAME_LEN) || len < flen) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	// Data words, then the checksum
+	words = (flen - PMS_HDR_LEN) / 2;
+	for (size_t i = 0; i < words; i++) {
+		word[i] = (buf[PMS_HDR_LEN + 2 * i] << 8) | buf[PMS_HDR_LEN + 2 * i + 1];
+	}
+	if (PMS_Sum(buf, flen - 2) != word[words - 1]) {
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	memset(frame, 0, sizeof(*frame));
+	frame->pm1_cf1   = word[0];
+	frame->pm2_5_cf1 = word[1];
+	frame->pm10_cf1  = word[2];
+	frame->pm1_atm   = word[3];
+	frame->pm2_5_atm = word[4];
+	frame->pm10_atm  = word[5];
+	if (flen == PMS5003_FRAME_LEN) {
+		frame->cnt_0_3 = word[6];
+		frame->cnt_0_5 = word[7];
+		frame->cnt_1_0 = word[8];
+		frame->cnt_2_5 = word[9];
+		frame->cnt_5_0 = word[10];
+		frame->cnt_10  = word[11];
+		frame->version = word[12] >> 8;
+		frame->error   = word[12] & 0xff;
+	}
+	frame->len = flen;
+	return ESP_OK;
+}
@@ -0,0 +1,520 @@
+/*
+ * probe_if.c
+ *
+ * Notes:
+ * 		Replaces the single ICMP ping to 8.8.8.8, which a lot of customer
+ * 		networks block. Every registered probe runs in its own short-lived
+ * 		task and the first one to succeed answers the question. A positive
+ * 		answer is cached for CONFIG_PROBE_CACHE_TTL_S. Negative answers are
+ * 		never cached so we notice recovery right away.
+ *
+ * 		Names are resolved with our own query to the DHCP-provided server
+ * 		rather than getaddrinfo, which can block for lwIP's whole retry
+ * 		schedule. Every step of a probe is bounded by the run's deadline,
+ * 		so no probe task outlives its run by more than a socket close.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "probe_if.h"
+
+#define PROBE_TASK_STACK		3072
+#define PROBE_TASK_PRIO			5
+#define PROBE_OK_BIT(i)			(1 << (i))
+#define PROBE_DONE_BIT(i)		(1 << ((i) + PROBE_MAX_PROBES))
+#define DNS_PORT				53
+#define HTTP_PORT				80
+#define DNS_BUF_LEN				256
+#define DNS_HDR_LEN				12
+#define DNS_TYPE_A				1
+#define DNS_CLASS_IN			1
+#define HTTP_RX_LEN				32
+
+static const char *TAG = "PROBE";
+
+/*
+ * One run of PROBE_Check. Shared by the caller and every probe task, freed by
+ * whoever lets go of it last, so a slow probe can outlive the caller.
+ */
+typedef struct {
+	EventGroupHandle_t group;
+	uint32_t timeout_ms;
+	int refs;
+} probe_run_t;
+
+typedef struct {
+	probe_run_t *run;
+	probe_t *probe;
+	int idx;
+} probe_job_t;
+
+static probe_t probes[PROBE_MAX_PROBES];
+static int probe_count = 0;
+static SemaphoreHandle_t probe_mutex = NULL;
+static portMUX_TYPE probe_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t cache_time_us = 0;
+static bool cache_valid = false;
+static uint32_t cache_gen = 0;			/* Bumped by PROBE_Invalidate */
+
+static esp_err_t _probe_tcp_broker(uint32_t timeout_ms);
+static esp_err_t _probe_dns(uint32_t timeout_ms);
+static esp_err_t _probe_http_204(uint32_t timeout_ms);
+
+
+/*
+* @brief	Time left until deadline_us as a timeval
+*
+* @return	false if the deadline has passed
+*/
+static bool _probe_left(int64_t deadline_us, struct timeval *tv)
+{
+	int64_t left = deadline_us - esp_timer_get_time();
+
+	if (left <= 0) {
+		return false;
+	}
+	tv->tv_sec = left / 1000000;
+	tv->tv_usec = left % 1000000;
+	return true;
+}
+
+/*
+* @brief	Send an A query for host to the DHCP-provided DNS server and wait
+* 			for the answer until deadline_us
+*
+* @param	buf: 	DNS_BUF_LEN bytes, holds the response on success
+* @param	qlen: 	set to the length of the query, i.e. where the answers start
+*
+* @return	length of a response with our id, QR set and RCODE 0, or -1
+*/
+static int _probe_dns_query(const char *host, int64_t deadline_us, uint8_t *buf, size_t *qlen)
+{
+	struct timeval tv;
+	struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = htons(DNS_PORT) };
+	const ip_addr_t *server = dns_getserver(0);
+	uint16_t id = esp_random() & 0xffff;
+	size_t n = 0;
+	int sock, rx;
+
+	if (server == NULL || ip_addr_isany(server)) {
+		return -1;
+	}
+	to.sin_addr.s_addr = ip_2_ip4(server)->addr;
+
+	/* Header: id, RD flag, one question */
+	memset(buf, 0, DNS_HDR_LEN);
+	buf[0] = id >> 8;
+	buf[1] = id & 0xff;
+	buf[2] = 0x01;
+	buf[5] = 0x01;
+	n = DNS_HDR_LEN;
+
+	/* QNAME as length-prefixed labels */
+	while (*host && n < DNS_BUF_LEN - 6) {
+		const char *dot = strchr(host, '.');
+		size_t lbl = dot ? (size_t)(dot - host) : strlen(host);
+		if (lbl == 0 || lbl > 63 || n + lbl + 1 >= DNS_BUF_LEN - 6) {
+			return -1;
+		}
+		buf[n++] = lbl;
+		memcpy(&buf[n], host, lbl);
+		n += lbl;
+		host += lbl + (dot ? 1 : 0);
+	}
+	buf[n++] = 0;
+	buf[n++] = 0; buf[n++] = DNS_TYPE_A;
+	buf[n++] = 0; buf[n++] = DNS_CLASS_IN;
+	*qlen = n;
+
+	if (!_probe_left(deadline_us, &tv)) {
+		return -1;
+	}
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		return -1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (sendto(sock, buf, n, 0, (struct sockaddr *)&to, sizeof(to)) != (int) n) {
+		close(sock);
+		return -1;
+	}
+	rx = recv(sock, buf, DNS_BUF_LEN, 0);
+	close(sock);
+
+	if (rx >= (int) n && buf[0] == (id >> 8) && buf[1] == (id & 0xff) &&
+		(buf[2] & 0x80) && (buf[3] & 0x0f) == 0) {
+		return rx;
+	}
+	return -1;
+}
+
+/*
+* @brief	Resolve host (or parse a dotted quad) before deadline_us
+*/
+static esp_err_t _probe_resolve(const char *host, int64_t deadline_us, struct in_addr *addr)
+{
+	uint8_t buf[DNS_BUF_LEN];
+	size_t n, qlen;
+	int rx, an;
+	uint16_t type, class, rdlen;
+
+	if (inet_aton(host, addr)) {
+		return ESP_OK;
+	}
+	if ((rx = _probe_dns_query(host, deadline_us, buf, &qlen)) < 0) {
+		return ESP_FAIL;
+	}
+
+	/* The question is echoed back, the answers follow. Skip CNAMEs. */
+	an = (buf[6] << 8) | buf[7];
+	n = qlen;
+	while (an-- > 0) {
+		/* Owner name: a compression pointer, or labels up to the root */
+		while (n < (size_t) rx && buf[n] != 0 && (buf[n] & 0xc0) != 0xc0) {
+			n += buf[n] + 1;
+		}
+		n += (n < (size_t) rx && buf[n] != 0) ? 2 : 1;
+		if (n + 10 > (size_t) rx) {
+			break;
+		}
+		type = (buf[n] << 8) | buf[n + 1];
+		class = (buf[n + 2] << 8) | buf[n + 3];
+		rdlen = (buf[n + 8] << 8) | buf[n + 9];
+		n += 10;
+		if (n + rdlen > (size_t) rx) {
+			break;
+		}
+		if (type == DNS_TYPE_A && class == DNS_CLASS_IN && rdlen == 4) {
+			memcpy(&addr->s_addr, &buf[n], 4);
+			return ESP_OK;
+		}
+		n += rdlen;
+	}
+	return ESP_FAIL;
+}
+
+/*
+* @brief	Open a TCP connection to host:port, giving up at deadline_us.
+* 			The socket's send and receive timeouts are set to what's left.
+*
+* @return	socket on success, -1 otherwise
+*/
+static int _probe_connect(const char *host, uint16_t port, int64_t deadline_us)
+{
+	struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = htons(port) };
+	struct timeval tv;
+	fd_set wfds;
+	int err = 0;
+	socklen_t len = sizeof(err);
+	int sock;
+
+	if (_probe_resolve(host, deadline_us, &to.sin_addr) != ESP_OK) {
+		return -1;
+	}
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return -1;
+	}
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+	if (connect(sock, (struct sockaddr *)&to, sizeof(to)) != 0 && errno != EINPROGRESS) {
+		goto fail;
+	}
+
+	FD_ZERO(&wfds);
+	FD_SET(sock, &wfds);
+	if (!_probe_left(deadline_us, &tv) || select(sock + 1, NULL, &wfds, NULL, &tv) <= 0) {
+		goto fail;
+	}
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+		goto fail;
+	}
+	if (!_probe_left(deadline_us, &tv)) {
+		goto fail;
+	}
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	return sock;
+
+fail:
+	close(sock);
+	return -1;
+}
+
+/*
+ * TCP handshake with the MQTT broker. This is the path we actually care about.
+ */
+static esp_err_t _probe_tcp_broker(uint32_t timeout_ms)
+{
+	int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+	int sock = _probe_connect(CONFIG_MQTT_HOST, atoi(CONFIG_PROBE_TCP_PORT), deadline);
+	if (sock < 0) {
+		return ESP_FAIL;
+	}
+	close(sock);
+	return ESP_OK;
+}
+
+/*
+ * Ask the DHCP-provided DNS server for an A record of CONFIG_PROBE_DNS_HOST.
+ * Goes straight to the server rather than through getaddrinfo so lwIP's
+ * resolver cache can't answer for us.
+ */
+static esp_err_t _probe_dns(uint32_t timeout_ms)
+{
+	uint8_t buf[DNS_BUF_LEN];
+	size_t qlen;
+	int rx = _probe_dns_query(CONFIG_PROBE_DNS_HOST, esp_timer_get_time() + timeout_ms * 1000LL, buf, &qlen);
+
+	/* At least one answer */
+	if (rx >= 0 && (buf[6] | buf[7]) != 0) {
+		return ESP_OK;
+	}
+	return ESP_FAIL;
+}
+
+/*
+ * Fetch a generate_204 page. A captive portal answers with 200 or a redirect,
+ * so only a real 204 counts.
+ */
+static esp_err_t _probe_http_204(uint32_t timeout_ms)
+{
+	static const char req[] = "GET " CONFIG_PROBE_HTTP_PATH " HTTP/1.1\r\n"
+							  "Host: " CONFIG_PROBE_HTTP_HOST "\r\n"
+							  "Connection: close\r\n\r\n";
+	char rx[HTTP_RX_LEN] = {0};
+	int sock, len;
+
+	sock = _probe_connect(CONFIG_PROBE_HTTP_HOST, HTTP_PORT, esp_timer_get_time() + timeout_ms * 1000LL);
+	if (sock < 0) {
+		return ESP_FAIL;
+	}
+	if (write(sock, req, sizeof(req) - 1) != (int) sizeof(req) - 1) {
+		close(sock);
+		return ESP_FAIL;
+	}
+	len = read(sock, rx, sizeof(rx) - 1);
+	close(sock);
+
+	if (len > 12 && strncmp(rx, "HTTP/1.", 7) == 0 && strncmp(&rx[8], " 204", 4) == 0) {
+		return ESP_OK;
+	}
+	return ESP_FAIL;
+}
+
+static void _probe_run_release(probe_run_t *run)
+{
+	bool last;
+
+	portENTER_CRITICAL(&probe_mux);
+	last = (--run->refs == 0);
+	portEXIT_CRITICAL(&probe_mux);
+
+	if (last) {
+		vEventGroupDelete(run->group);
+		free(run);
+	}
+}
+
+static void probe_task(void *pvParameters)
+{
+	probe_job_t *job = (probe_job_t *) pvParameters;
+	int64_t start = esp_timer_get_time();
+	esp_err_t err = job->probe->fn(job->run->timeout_ms);
+	uint32_t latency_ms = (esp_timer_get_time() - start) / 1000;
+
+	/* A straggler from the last run may be finishing the same probe */
+	portENTER_CRITICAL(&probe_mux);
+	job->probe->last_latency_ms = latency_ms;
+	if (err == ESP_OK) {
+		job->probe->successes++;
+	}
+	else {
+		job->probe->failures++;
+	}
+	portEXIT_CRITICAL(&probe_mux);
+
+	xEventGroupSetBits(job->run->group, PROBE_DONE_BIT(job->idx) | ((err == ESP_OK) ? PROBE_OK_BIT(job->idx) : 0));
+	ESP_LOGI(TAG, "%s: %s in %u ms", job->probe->name, err == ESP_OK ? "ok" : "fail", latency_ms);
+
+	_probe_run_release(job->run);
+	free(job);
+	vTaskDelete(NULL);
+}
+
+/*
+* @brief	Start every probe and wait for the first success
+*
+* @return	true if a probe succeeded before CONFIG_PROBE_TIMEOUT_MS
+*/
+static bool _probe_run_all(void)
+{
+	probe_run_t *run;
+	EventBits_t ok_mask = 0, done_mask = 0, seen = 0, bits;
+	int64_t deadline = esp_timer_get_time() + CONFIG_PROBE_TIMEOUT_MS * 1000LL;
+	int64_t remaining;
+	bool ok = false;
+
+	if ((run = calloc(1, sizeof(probe_run_t))) == NULL) {
+		return false;
+	}
+	if ((run->group = xEventGroupCreate()) == NULL) {
+		free(run);
+		return false;
+	}
+	run->timeout_ms = CONFIG_PROBE_TIMEOUT_MS;
+	run->refs = 1;
+
+	for (int i = 0; i < probe_count; i++) {
+		probe_job_t *job = malloc(sizeof(probe_job_t));
+		if (job == NULL) {
+			continue;
+		}
+		job->run = run;
+		job->probe = &probes[i];
+		job->idx = i;
+
+		portENTER_CRITICAL(&probe_mux);
+		run->refs++;
+		portEXIT_CRITICAL(&probe_mux);
+
+		if (xTaskCreate(&probe_task, "probe_task", PROBE_TASK_STACK, job, PROBE_TASK_PRIO, NULL) != pdPASS) {
+			ESP_LOGW(TAG, "Couldn't start %s probe", probes[i].name);
+			free(job);
+			_probe_run_release(run);
+			continue;
+		}
+		ok_mask |= PROBE_OK_BIT(i);
+		done_mask |= PROBE_DONE_BIT(i);
+	}
+
+	/* First OK wins. Clear DONE bits as they arrive so the wait keeps blocking. */
+	while (ok_mask && (seen & done_mask) != done_mask) {
+		remaining = deadline - esp_timer_get_time();
+		if (remaining <= 0) {
+			break;
+		}
+		bits = xEventGroupWaitBits(run->group, ok_mask | (done_mask & ~seen), pdFALSE, pdFALSE,
+								   remaining / 1000 / portTICK_PERIOD_MS + 1);
+		if (bits & ok_mask) {
+			ok = true;
+			break;
+		}
+		seen |= bits & done_mask;
+	}
+
+	_probe_run_release(run);
+	return ok;
+}
+
+void PROBE_Initialize(void)
+{
+	if (probe_mutex != NULL) {
+		return;
+	}
+	probe_mutex = xSemaphoreCreateMutex();
+	PROBE_Register("tcp_broker", _probe_tcp_broker);
+	PROBE_Register("dns", _probe_dns);
+	PROBE_Register("http_204", _probe_http_204);
+}
+
+esp_err_t PROBE_Register(const char *name, probe_fn_t fn)
+{
+	esp_err_t err = ESP_OK;
+
+	if (probe_mutex == NULL) {
+		ESP_LOGE(TAG, "Register %s: PROBE_Initialize not called", name);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	/* Not while a run is walking the table */
+	xSemaphoreTake(probe_mutex, portMAX_DELAY);
+	if (probe_count >= PROBE_MAX_PROBES) {
+		err = ESP_ERR_NO_MEM;
+	}
+	else {
+		probes[probe_count].name = name;
+		probes[probe_count].fn = fn;
+		probe_count++;
+	}
+	xSemaphoreGive(probe_mutex);
+	return err;
+}
+
+bool PROBE_Check(void)
+{
+	uint32_t gen;
+	bool ok;
+
+	if (probe_mutex == NULL) {
+		ESP_LOGE(TAG, "PROBE_Initialize not called");
+		return false;
+	}
+	xSemaphoreTake(probe_mutex, portMAX_DELAY);
+
+	portENTER_CRITICAL(&probe_mux);
+	ok = cache_valid && esp_timer_get_time() - cache_time_us < CONFIG_PROBE_CACHE_TTL_S * 1000000LL;
+	gen = cache_gen;
+	portEXIT_CRITICAL(&probe_mux);
+	if (ok) {
+		xSemaphoreGive(probe_mutex);
+		return true;
+	}
+
+	ok = _probe_run_all();
+
+	/* Invalidated mid-run: the answer may be from before the IP was lost */
+	portENTER_CRITICAL(&probe_mux);
+	cache_valid = ok && gen == cache_gen;
+	cache_time_us = esp_timer_get_time();
+	portEXIT_CRITICAL(&probe_mux);
+	ESP_LOGI(TAG, "Internet %s", ok ? "reachable" : "unreachable");
+
+	xSemaphoreGive(probe_mutex);
+	return ok;
+}
+
+/*
+ * Called from the event loop: takes the spinlock, not probe_mutex, which
+ * PROBE_Check holds for a whole run.
+ */
+void PROBE_Invalidate(void)
+{
+	portENTER_CRITICAL(&probe_mux);
+	cache_valid = false;
+	cache_gen++;
+	portEXIT_CRITICAL(&probe_mux);
+}
+
+bool PROBE_GetStats(int idx, probe_t *stats)
+{
+	bool ok = false;
+
+	portENTER_CRITICAL(&probe_mux);
+	if (idx >= 0 && idx < probe_count) {
+		*stats = probes[idx];
+		ok = true;
+	}
+	portEXIT_CRITICAL(&probe_mux);
+	return ok;
+}
@@ -147,10 +147,8 @@ esp_err_t sd_deinit(void)
 }
 
 /*
- * Currently the date comes exclusively from the GPS module. I'm doing this
- * because I don't want the date and time to jump between NTP and GPS, and I
- * believe GPS is a local time. GPS should always be correct as long as there's
- * a battery, so I don't think it will be a big deal.
+ * The date comes from TIME_Now, which fuses GPS and NTP into one clock that
+ * doesn't jump between them. All zeros until it has been set.
  */
 esp_err_t sd_write_data(char* pkt, uint8_t year, uint8_t month, uint8_t day)
 {
@@ -5,26 +5,35 @@
  *      Author: tombo
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
 #include "esp_attr.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "lwip/err.h"
 #include "lwip/apps/sntp.h"
 #include "wifi_manager.h"
+#include "cmd_if.h"
+#include "metrics_if.h"
 #include "time_if.h"
 
 #define WIFI_CONNECTED_BIT 	BIT0
 #define GOT_TS_BIT			BIT1
+#define TIME_SYS_CHECK_MS	10000	/* System clock checked for SNTP updates this often */
+#define TIME_SYS_STEP_US	50		/* Offset change that counts as an update, well above read jitter */
+#define TIME_REPLY_LEN		160
 
 static const unsigned long MS_BETWEEN_NTP_UPDATE = 600000;
 static const unsigned long SEC_JAN1_2018 = 1514764800;
@@ -34,8 +43,18 @@ static clock_t ms_active = 0;
 
 static EventGroupHandle_t ntp_event_group;
 
+static clock_disc_t time_clk;
+static SemaphoreHandle_t time_mutex = NULL;
+static TimerHandle_t time_sys_timer;
+static int64_t time_sys_off;				/* System clock - esp_timer, as last seen */
+static bool time_sys_seen = false;
+static metric_t *m_err_ms = NULL, *m_drift_ppb = NULL, *m_quality = NULL;
+
 static time_t _sntp_obtain_time(int);
 static void sntp_task(void *pvParameters);
+static void _time_sample(clock_src_t src, int64_t mono_us, int64_t utc_us);
+static void _time_sys_cb(TimerHandle_t xTimer);
+static esp_err_t _cmd_time(const cmd_ctx_t *ctx, int argc, char **argv);
 
 
 void SNTP_time_is_set(void)
@@ -152,3 +171,159 @@ int SNTP_Initialize(void)
 
     return (now < SEC_JAN1_2018) ? -1 : 0;
 }
+
+
+static void _time_sample(clock_src_t src, int64_t mono_us, int64_t utc_us)
+{
+	static const char *src_names[CLOCK_SOURCES] = {
+		[CLOCK_SRC_GPS_RTC] = "GPS RTC",
+		[CLOCK_SRC_SNTP] = "SNTP",
+		[CLOCK_SRC_GPS] = "GPS",
+	};
+	bool moved;
+
+	if (time_mutex == NULL) {
+		return;
+	}
+	xSemaphoreTake(time_mutex, portMAX_DELAY);
+	moved = CLOCK_Sample(&time_clk, src, mono_us, utc_us);
+	xSemaphoreGive(time_mutex);
+
+	if (moved) {
+		ESP_LOGI(TAG, "%s sample %lld.%06lld", src_names[src], utc_us / 1000000, utc_us % 1000000);
+	}
+}
+
+/*
+* @brief	lwIP's SNTP steps the system clock (settimeofday), which otherwise
+* 			runs at esp_timer's rate. A change in their difference is a new
+* 			SNTP time, good from whenever it happened until now.
+*
+* 			Also sets the system clock from GPS if SNTP hasn't yet, and
+* 			updates the clock metrics.
+*/
+static void _time_sys_cb(TimerHandle_t xTimer)
+{
+	struct timeval tv;
+	int64_t mono, sys;
+	clock_quality_t q;
+	time_status_t st;
+
+	gettimeofday(&tv, NULL);
+	mono = esp_timer_get_time();
+	sys = tv.tv_sec * 1000000LL + tv.tv_usec;
+
+	if (tv.tv_sec >= (time_t) SEC_JAN1_2018) {
+		if (!time_sys_seen || llabs(sys - mono - time_sys_off) > TIME_SYS_STEP_US) {
+			_time_sample(CLOCK_SRC_SNTP, mono, sys);
+		}
+		time_sys_off = sys - mono;
+		time_sys_seen = true;
+	}
+	else if ((q = TIME_Now(&tv, NULL)) >= CLOCK_Q_SNTP) {
+		settimeofday(&tv, NULL);
+		time_sys_off = tv.tv_sec * 1000000LL + tv.tv_usec - esp_timer_get_time();
+		time_sys_seen = true;
+		ESP_LOGI(TAG, "System clock set from %s: %lu", TIME_QualityName(q), tv.tv_sec);
+	}
+
+	TIME_GetStatus(&st);
+	METRICS_Set(m_quality, st.quality);
+	METRICS_Set(m_err_ms, (st.err_ms > INT32_MAX) ? INT32_MAX : st.err_ms);
+	METRICS_Set(m_drift_ppb, st.drift_ppb);
+}
+
+static esp_err_t _cmd_time(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	char reply[TIME_REPLY_LEN];
+	struct timeval tv;
+	struct tm tm;
+	time_status_t st;
+	int n;
+
+	TIME_Now(&tv, NULL);
+	TIME_GetStatus(&st);
+	gmtime_r(&tv.tv_sec, &tm);
+
+	n = strftime(reply, sizeof(reply), "time %Y-%m-%dT%H:%M:%SZ", &tm);
+	n += snprintf(reply + n, sizeof(reply) - n, " %s err %u ms samples %u rejected %u steps %u",
+				  TIME_QualityName(st.quality), st.err_ms, st.samples, st.rejected, st.steps);
+	if (st.drift_known) {
+		snprintf(reply + n, sizeof(reply) - n, " drift %d ppb", st.drift_ppb);
+	}
+	CMD_Reply(ctx, CONFIG_MQTT_ACK_QOS, reply);
+	return ESP_OK;
+}
+
+static const cmd_t time_command = { .name = "time", .handler = _cmd_time, .min_args = 0, .max_args = 0 };
+
+void TIME_Initialize(void)
+{
+	CLOCK_Reset(&time_clk);
+	time_mutex = xSemaphoreCreateMutex();
+
+	m_quality = METRICS_Register("clock_quality", METRIC_GAUGE);
+	m_err_ms = METRICS_Register("clock_err_ms", METRIC_GAUGE);
+	m_drift_ppb = METRICS_Register("clock_drift_ppb", METRIC_GAUGE);
+
+	time_sys_timer = xTimerCreate("time_sys", pdMS_TO_TICKS(TIME_SYS_CHECK_MS), pdTRUE, NULL, _time_sys_cb);
+	xTimerStart(time_sys_timer, 0);
+
+	CMD_Register(&time_command);
+}
+
+clock_quality_t TIME_Now(struct timeval *tv, uint32_t *err_ms)
+{
+	clock_quality_t q = CLOCK_Q_NONE;
+	int64_t utc = 0;
+	uint32_t err = UINT32_MAX;
+
+	if (time_mutex != NULL) {
+		xSemaphoreTake(time_mutex, portMAX_DELAY);
+		q = CLOCK_Now(&time_clk, esp_timer_get_time(), &utc, &err);
+		xSemaphoreGive(time_mutex);
+	}
+
+	tv->tv_sec = utc / 1000000;
+	tv->tv_usec = utc % 1000000;
+	if (err_ms) {
+		*err_ms = (err == UINT32_MAX) ? UINT32_MAX : err / 1000;
+	}
+	return q;
+}
+
+void TIME_GPS(int64_t mono_us, int64_t utc_us, bool fix)
+{
+	_time_sample(fix ? CLOCK_SRC_GPS : CLOCK_SRC_GPS_RTC, mono_us, utc_us);
+}
+
+void TIME_GetStatus(time_status_t *st)
+{
+	struct timeval tv;
+
+	memset(st, 0, sizeof(*st));
+	st->quality = TIME_Now(&tv, &st->err_ms);
+	if (time_mutex == NULL) {
+		return;
+	}
+	xSemaphoreTake(time_mutex, portMAX_DELAY);
+	st->drift_ppb = -time_clk.rate_ppb;
+	st->drift_known = time_clk.rated;
+	st->samples = time_clk.count;
+	st->rejected = time_clk.rejected;
+	st->steps = time_clk.steps;
+	xSemaphoreGive(time_mutex);
+}
+
+const char *TIME_QualityName(clock_quality_t q)
+{
+	static const char *names[] = {
+		[CLOCK_Q_NONE] = "none",
+		[CLOCK_Q_COARSE] = "gps-rtc",
+		[CLOCK_Q_HOLDOVER] = "holdover",
+		[CLOCK_Q_SNTP] = "sntp",
+		[CLOCK_Q_GPS] = "gps",
+	};
+
+	return (q <= CLOCK_Q_GPS) ? names[q] : "?";
+}
@@ -0,0 +1,295 @@
+/*
+ * trace_if.c
+ *
+ * Notes:
+ * 		Latency spans in a fixed ring, dumped as Chrome trace-event JSON
+ * 		over HTTP (GET /trace.json) or to the SD card ("trace" command).
+ *
+ * 		Spans are timed with the CPU cycle counter. Each core has its own,
+ * 		so at start-up both are lined up with esp_timer and every span is
+ * 		stored on that shared timeline: a task that moves core mid-span
+ * 		still gets the right duration. The counters are 32 bits (about
+ * 		26 s at 160 MHz), so each span also keeps the tick count, which
+ * 		puts it in the right wrap when dumped. That holds as long as the
+ * 		CPU clock is fixed, i.e. without CONFIG_PM_ENABLE.
+ *
+ * 		Builds on the host too (see trace_if.h), with clock_gettime
+ * 		nanoseconds standing in for cycles.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "trace_if.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_clk.h"
+#include "esp_ipc.h"
+#include "esp_log.h"
+#include "cmd_if.h"
+#else
+#include <pthread.h>
+#endif
+
+#ifdef CONFIG_TRACE_ENABLE
+
+#define TRACE_CAL_SPANS		64			/* Spans timed to measure the overhead */
+#define TRACE_LINE_LEN		128
+
+#ifdef ESP_PLATFORM
+#define TRACE_CORES			portNUM_PROCESSORS
+#define TRACE_TICK_US		(portTICK_PERIOD_MS * 1000)
+#define TRACE_LOCK()		portENTER_CRITICAL(&trace_mux)
+#define TRACE_UNLOCK()		portEXIT_CRITICAL(&trace_mux)
+#define _trace_ticks()		xTaskGetTickCount()
+#define _trace_time_us()	esp_timer_get_time()
+#else
+#define TRACE_CORES			1
+#define TRACE_TICK_US		1000
+#define TRACE_LOCK()		pthread_mutex_lock(&trace_mutex)
+#define TRACE_UNLOCK()		pthread_mutex_unlock(&trace_mutex)
+#define ESP_LOGI(tag, fmt, ...)	printf("%s: " fmt "\n", tag, ##__VA_ARGS__)
+#endif
+
+typedef struct {
+	const char *name;
+	uint32_t start;			/* Cycles on the esp_timer timeline, mod 2^32 */
+	uint32_t cycles;
+	uint32_t tick;			/* Tick count when the span ended */
+	uint8_t core;			/* Core the span ended on */
+} trace_event_t;
+
+static const char *TAG = "TRACE";
+static trace_event_t ring[CONFIG_TRACE_RING_LEN];
+static uint32_t head = 0;					/* Spans recorded, ring[head % LEN] is next */
+static uint32_t ccount_offset[TRACE_CORES];	/* Cycle counter minus esp_timer in cycles */
+static int64_t tick_offset_us = 0;			/* esp_timer minus tick count in us */
+static uint32_t cycles_per_us = 1;
+static uint32_t overhead = 0;
+#ifdef ESP_PLATFORM
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+#else
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void _trace_calibrate(void *arg);
+static int _trace_write_file(const char *buf, size_t len, void *arg);
+#ifdef ESP_PLATFORM
+static esp_err_t _cmd_trace(const cmd_ctx_t *ctx, int argc, char **argv);
+#endif
+
+#ifndef ESP_PLATFORM
+static uint32_t _trace_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t _trace_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int xPortGetCoreID(void)
+{
+	return 0;
+}
+#endif
+
+
+void TRACE_Record(const char *name, trace_span_t begin)
+{
+	trace_span_t end = TRACE_Now();
+	uint32_t tick = _trace_ticks();
+	uint32_t start = (uint32_t) begin - ccount_offset[begin >> 32];
+	trace_event_t *e;
+
+	TRACE_LOCK();
+	e = &ring[head % CONFIG_TRACE_RING_LEN];
+	e->name = name;
+	e->start = start;
+	e->cycles = (uint32_t) end - ccount_offset[end >> 32] - start;
+	e->tick = tick;
+	e->core = end >> 32;
+	head++;
+	TRACE_UNLOCK();
+}
+
+/*
+* @brief	Sample esp_timer and this core's cycle counter together
+*/
+static void _trace_calibrate(void *arg)
+{
+	int64_t now_us = _trace_time_us();
+	uint32_t ccount = (uint32_t) TRACE_Now();
+
+	ccount_offset[xPortGetCoreID()] = ccount - (uint32_t) (now_us * cycles_per_us);
+}
+
+static int _trace_write_file(const char *buf, size_t len, void *arg)
+{
+	return fwrite(buf, 1, len, (FILE *) arg) == len ? 0 : -1;
+}
+
+esp_err_t TRACE_Dump(trace_write_fn_t fn, void *arg)
+{
+	trace_event_t *snap;
+	char line[TRACE_LINE_LEN];
+	uint32_t n, first;
+	int64_t approx, start;
+	int len;
+	esp_err_t err = ESP_OK;
+
+	if ((snap = malloc(sizeof(ring))) == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	TRACE_LOCK();
+	memcpy(snap, ring, sizeof(ring));
+	n = (head < CONFIG_TRACE_RING_LEN) ? head : CONFIG_TRACE_RING_LEN;
+	first = head - n;
+	TRACE_UNLOCK();
+
+	len = snprintf(line, sizeof(line),
+				   "{\"otherData\":{\"cpu_mhz\":%u,\"overhead_cycles\":%u,\"dropped\":%u},\"traceEvents\":[",
+				   cycles_per_us, overhead, first);
+	if (fn(line, len, arg) != 0) {
+		err = ESP_FAIL;
+	}
+
+	for (uint32_t i = 0; i < n && err == ESP_OK; i++) {
+		trace_event_t *e = &snap[(first + i) % CONFIG_TRACE_RING_LEN];
+
+		// The tick count says roughly when the span started; its low 32 bits fix it exactly
+		approx = ((int64_t) e->tick * TRACE_TICK_US + tick_offset_us) * cycles_per_us - e->cycles;
+		start = approx + (int32_t) (e->start - (uint32_t) approx);
+
+		len = snprintf(line, sizeof(line),
+					   "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%lld.%03u,\"dur\":%u.%03u}",
+					   i ? "," : "", e->name, e->core,
+					   (long long) (start / cycles_per_us), (unsigned) ((start % cycles_per_us) * 1000 / cycles_per_us),
+					   e->cycles / cycles_per_us, (e->cycles % cycles_per_us) * 1000 / cycles_per_us);
+		if (fn(line, len, arg) != 0) {
+			err = ESP_FAIL;
+		}
+	}
+
+	if (err == ESP_OK && fn("]}\n", 3, arg) != 0) {
+		err = ESP_FAIL;
+	}
+	free(snap);
+	return err;
+}
+
+esp_err_t TRACE_DumpFile(const char *path)
+{
+	FILE *f;
+	esp_err_t err;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		return ESP_FAIL;
+	}
+	err = TRACE_Dump(_trace_write_file, f);
+	if (fclose(f) != 0 && err == ESP_OK) {
+		err = ESP_FAIL;
+	}
+	return err;
+}
+
+uint32_t TRACE_Overhead(void)
+{
+	return overhead;
+}
+
+#ifdef ESP_PLATFORM
+/*
+* @brief	"trace": write the ring to TRACE_JSON_PATH on the SD card
+*/
+static esp_err_t _cmd_trace(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	char msg[48];
+	esp_err_t err = TRACE_DumpFile(TRACE_JSON_PATH);
+
+	if (err == ESP_OK) {
+		snprintf(msg, sizeof(msg), "trace ok %u", (head < CONFIG_TRACE_RING_LEN) ? head : CONFIG_TRACE_RING_LEN);
+		CMD_Reply(ctx, CONFIG_MQTT_ACK_QOS, msg);
+	}
+	return err;
+}
+
+static const cmd_t trace_command = { .name = "trace", .handler = _cmd_trace, .min_args = 0, .max_args = 0 };
+#endif
+
+void TRACE_Initialize(void)
+{
+	trace_span_t t0, t1;
+
+#ifdef ESP_PLATFORM
+	cycles_per_us = esp_clk_cpu_freq() / 1000000;
+	for (int core = 0; core < TRACE_CORES; core++) {
+		if (core == xPortGetCoreID()) {
+			_trace_calibrate(NULL);
+		}
+		else {
+			esp_ipc_call_blocking(core, _trace_calibrate, NULL);
+		}
+	}
+	CMD_Register(&trace_command);
+#else
+	cycles_per_us = 1000;
+	_trace_calibrate(NULL);
+#endif
+	tick_offset_us = _trace_time_us() - (int64_t) _trace_ticks() * TRACE_TICK_US;
+
+	// Time a burst of empty spans, then forget them
+	t0 = TRACE_Now();
+	for (int i = 0; i < TRACE_CAL_SPANS; i++) {
+		TRACE_BEGIN(t);
+		TRACE_END(t, "cal");
+	}
+	t1 = TRACE_Now();
+	overhead = ((uint32_t) t1 - (uint32_t) t0) / TRACE_CAL_SPANS;
+	TRACE_LOCK();
+	head = 0;
+	TRACE_UNLOCK();
+
+	ESP_LOGI(TAG, "%u span ring, %u cycles per span", CONFIG_TRACE_RING_LEN, overhead);
+}
+
+#else /* !CONFIG_TRACE_ENABLE */
+
+void TRACE_Initialize(void)
+{
+}
+
+void TRACE_Record(const char *name, trace_span_t begin)
+{
+}
+
+esp_err_t TRACE_Dump(trace_write_fn_t fn, void *arg)
+{
+	return fn("{\"traceEvents\":[]}\n", 19, arg) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t TRACE_DumpFile(const char *path)
+{
+	return ESP_FAIL;
+}
+
+uint32_t TRACE_Overhead(void)
+{
+	return 0;
+}
+
+#endif /* CONFIG_TRACE_ENABLE */
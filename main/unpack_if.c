@@ -0,0 +1,161 @@
+/*
+ * unpack_if.c
+ *
+ * Notes:
+ * 		Streaming LZSS (heatshrink bit stream) decoder for compressed OTA
+ * 		files. RAM use is the 2^window_sz2 byte window plus this struct,
+ * 		window_sz2 is capped by CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "unpack_if.h"
+
+static const char *TAG = "UNPACK";
+
+static esp_err_t _unpack_emit(unpack_t *u, uint8_t c);
+static esp_err_t _unpack_flush(unpack_t *u);
+static esp_err_t _unpack_header(unpack_t *u);
+
+
+static esp_err_t _unpack_flush(unpack_t *u)
+{
+	esp_err_t err = ESP_OK;
+
+	if (u->out_fill > 0) {
+		err = u->write(u->arg, u->out, u->out_fill);
+		u->out_fill = 0;
+	}
+	return err;
+}
+
+/*
+* @brief	Append one byte to the window and the output batch
+*/
+static esp_err_t _unpack_emit(unpack_t *u, uint8_t c)
+{
+	if (u->out_len >= u->size) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	u->window[u->head++ & ((1 << u->window_sz2) - 1)] = c;
+	u->out[u->out_fill++] = c;
+	u->out_len++;
+	if (u->out_fill == UNPACK_OUT_LEN) {
+		return _unpack_flush(u);
+	}
+	return ESP_OK;
+}
+
+static esp_err_t _unpack_header(unpack_t *u)
+{
+	if (memcmp(u->hdr, UNPACK_MAGIC, 4) != 0) {
+		ESP_LOGE(TAG, "Not a packed file");
+		return ESP_ERR_INVALID_STATE;
+	}
+	u->window_sz2 = u->hdr[4];
+	u->lookahead_sz2 = u->hdr[5];
+	u->size = u->hdr[8] | (u->hdr[9] << 8) | (u->hdr[10] << 16) | ((uint32_t) u->hdr[11] << 24);
+	if (u->window_sz2 < 4 || u->window_sz2 > CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2 ||
+		u->lookahead_sz2 < 3 || u->lookahead_sz2 >= u->window_sz2) {
+		ESP_LOGE(TAG, "Unsupported window %u/%u", u->window_sz2, u->lookahead_sz2);
+		return ESP_ERR_INVALID_STATE;
+	}
+	// Back-references before the start read zeros, as in heatshrink
+	if ((u->window = calloc(1, 1 << u->window_sz2)) == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	ESP_LOGI(TAG, "Unpacking %u bytes, %u byte window", u->size, 1 << u->window_sz2);
+	return ESP_OK;
+}
+
+esp_err_t UNPACK_Begin(unpack_t *u, unpack_write_fn_t write, void *arg)
+{
+	memset(u, 0, sizeof(unpack_t));
+	u->state = UNPACK_STATE_HEADER;
+	u->write = write;
+	u->arg = arg;
+	return ESP_OK;
+}
+
+esp_err_t UNPACK_Feed(unpack_t *u, const uint8_t *data, size_t len)
+{
+	esp_err_t err = ESP_OK;
+	uint32_t need, v, dist, count, mask;
+
+	while (err == ESP_OK && len > 0) {
+		if (u->state == UNPACK_STATE_HEADER) {
+			u->hdr[u->hdr_len++] = *data++;
+			len--;
+			if (u->hdr_len == UNPACK_HEADER_LEN) {
+				err = _unpack_header(u);
+				u->state = UNPACK_STATE_TAG;
+			}
+			continue;
+		}
+		if (u->state == UNPACK_STATE_DONE) {
+			// Only the padding of the last byte should be left
+			return (len > 1) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+		}
+
+		u->bits = (u->bits << 8) | *data++;
+		u->bit_cnt += 8;
+		len--;
+
+		// Decode every token the accumulator holds (tokens are at most 23 bits)
+		for (;;) {
+			need = (u->state == UNPACK_STATE_TAG) ? 1 :
+				   (u->state == UNPACK_STATE_LITERAL) ? 8 : u->window_sz2 + u->lookahead_sz2;
+			if (u->state == UNPACK_STATE_DONE || u->bit_cnt < need || err != ESP_OK) {
+				break;
+			}
+			u->bit_cnt -= need;
+			v = (u->bits >> u->bit_cnt) & ((1 << need) - 1);
+
+			switch (u->state) {
+			case UNPACK_STATE_TAG:
+				u->state = v ? UNPACK_STATE_LITERAL : UNPACK_STATE_BACKREF;
+				break;
+			case UNPACK_STATE_LITERAL:
+				err = _unpack_emit(u, v);
+				u->state = UNPACK_STATE_TAG;
+				break;
+			case UNPACK_STATE_BACKREF:
+				dist = (v >> u->lookahead_sz2) + 1;
+				count = (v & ((1 << u->lookahead_sz2) - 1)) + 1;
+				mask = (1 << u->window_sz2) - 1;
+				while (count-- > 0 && err == ESP_OK) {
+					err = _unpack_emit(u, u->window[(u->head - dist) & mask]);
+				}
+				u->state = UNPACK_STATE_TAG;
+				break;
+			default:
+				break;
+			}
+			if (u->out_len == u->size) {
+				u->state = UNPACK_STATE_DONE;
+			}
+		}
+	}
+	return err;
+}
+
+esp_err_t UNPACK_Finish(unpack_t *u)
+{
+	esp_err_t err = _unpack_flush(u);
+
+	if (err == ESP_OK && (u->state == UNPACK_STATE_HEADER || u->out_len != u->size)) {
+		ESP_LOGE(TAG, "Packed file truncated (%u of %u bytes)", u->out_len, u->size);
+		err = ESP_ERR_INVALID_SIZE;
+	}
+	return err;
+}
+
+void UNPACK_End(unpack_t *u)
+{
+	free(u->window);
+	u->window = NULL;
+}
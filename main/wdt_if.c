@@ -0,0 +1,189 @@
+/*
+ * wdt_if.c
+ *
+ * Notes:
+ * 		Replaces the unconditional hourly abort(). The device only resets
+ * 		when a component stops checking in or stops making progress, and
+ * 		the reason is kept in NVS ("wdt"/"reason") for the next boot.
+ *
+ * 		The monitor task itself is on the IDF task watchdog, switched to
+ * 		panic (CONFIG_TASK_WDT_PANIC is off in sdkconfig), so a stalled
+ * 		monitor or a starved idle task still ends in a reset.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "app_utils.h"
+#include "wdt_if.h"
+#include "diag_if.h"
+
+#define WDT_CHECK_PERIOD	(2 * ONE_SECOND_DELAY)	/* Under the 5 s task watchdog */
+#define WDT_TASK_STACK		2048
+#define WDT_TASK_PRIO		10
+#define WDT_US_PER_S		1000000LL
+
+static const char *TAG = "WDT";
+static const char wdt_nvs_namespace[] = "wdt";
+static portMUX_TYPE wdt_mux = portMUX_INITIALIZER_UNLOCKED;
+static char last_reason[WDT_REASON_LEN];
+static bool have_last_reason = false;
+
+static wdt_entry_t entries[WDT_COMPONENT_COUNT] = {
+	[WDT_DATA] = { .name = "data", .alive_timeout_s = 3 * CONFIG_DATA_UPLOAD_PERIOD + 60 },
+	[WDT_PM]   = { .name = "pm",   .progress_timeout_s = CONFIG_WDT_SENSOR_TIMEOUT_S },
+	[WDT_GPS]  = { .name = "gps",  .progress_timeout_s = CONFIG_WDT_SENSOR_TIMEOUT_S },
+	[WDT_MQTT] = { .name = "mqtt", .alive_timeout_s = 120, .progress_timeout_s = CONFIG_WDT_MQTT_TIMEOUT_S },
+	[WDT_WIFI] = { .name = "wifi", .alive_timeout_s = 300 },
+};
+
+static void wdt_task(void *pvParameters);
+static void _wdt_reset(wdt_component_t c, const char *reason);
+static uint32_t _wdt_idle_s(int64_t now, int64_t last_us, int64_t quiet_until_us);
+
+
+void WDT_Alive(wdt_component_t c)
+{
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL(&wdt_mux);
+	entries[c].alive++;
+	entries[c].last_alive_us = now;
+	if (!entries[c].armed) {
+		entries[c].armed = true;
+		entries[c].last_progress_us = now;
+	}
+	portEXIT_CRITICAL(&wdt_mux);
+}
+
+void WDT_Progress(wdt_component_t c)
+{
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL(&wdt_mux);
+	entries[c].alive++;
+	entries[c].progress++;
+	entries[c].last_alive_us = now;
+	entries[c].last_progress_us = now;
+	entries[c].armed = true;
+	portEXIT_CRITICAL(&wdt_mux);
+}
+
+void WDT_Disarm(wdt_component_t c)
+{
+	portENTER_CRITICAL(&wdt_mux);
+	entries[c].armed = false;
+	portEXIT_CRITICAL(&wdt_mux);
+}
+
+void WDT_Expect(wdt_component_t c, uint32_t quiet_s)
+{
+	int64_t until = esp_timer_get_time() + quiet_s * WDT_US_PER_S;
+
+	portENTER_CRITICAL(&wdt_mux);
+	entries[c].quiet_until_us = until;
+	portEXIT_CRITICAL(&wdt_mux);
+}
+
+void WDT_GetEntry(wdt_component_t c, wdt_entry_t *entry)
+{
+	portENTER_CRITICAL(&wdt_mux);
+	*entry = entries[c];
+	portEXIT_CRITICAL(&wdt_mux);
+}
+
+bool WDT_GetLastReason(char *reason, size_t len)
+{
+	if (have_last_reason) {
+		strlcpy(reason, last_reason, len);
+	}
+	return have_last_reason;
+}
+
+/*
+* @brief	Persist why, then reset
+*/
+static void _wdt_reset(wdt_component_t c, const char *reason)
+{
+	nvs_handle handle;
+
+	ESP_LOGE(TAG, "Resetting: %s", reason);
+	DIAG_Crumb(DIAG_WDT, c);
+	DIAG_Flush(true);
+	if (nvs_open(wdt_nvs_namespace, NVS_READWRITE, &handle) == ESP_OK) {
+		nvs_set_str(handle, "reason", reason);
+		nvs_commit(handle);
+		nvs_close(handle);
+	}
+	esp_restart();
+}
+
+/*
+* @brief	Seconds since the last report, or since the end of a quiet spell
+*/
+static uint32_t _wdt_idle_s(int64_t now, int64_t last_us, int64_t quiet_until_us)
+{
+	return (now - ((last_us > quiet_until_us) ? last_us : quiet_until_us)) / WDT_US_PER_S;
+}
+
+static void wdt_task(void *pvParameters)
+{
+	wdt_entry_t e;
+	char reason[WDT_REASON_LEN];
+	int64_t now;
+	uint32_t idle_s;
+
+	// Already running from the config, this only turns its report into a reset
+	esp_task_wdt_init(CONFIG_TASK_WDT_TIMEOUT_S, true);
+	esp_task_wdt_add(NULL);
+
+	for (;;) {
+		vTaskDelay(WDT_CHECK_PERIOD);
+		esp_task_wdt_reset();
+		now = esp_timer_get_time();
+
+		for (int c = 0; c < WDT_COMPONENT_COUNT; c++) {
+			WDT_GetEntry(c, &e);
+			if (!e.armed || now < e.quiet_until_us) {
+				continue;
+			}
+			idle_s = _wdt_idle_s(now, e.last_alive_us, e.quiet_until_us);
+			if (e.alive_timeout_s > 0 && idle_s > e.alive_timeout_s) {
+				snprintf(reason, sizeof(reason), "%s alive %us", e.name, idle_s);
+				_wdt_reset(c, reason);
+			}
+			idle_s = _wdt_idle_s(now, e.last_progress_us, e.quiet_until_us);
+			if (e.progress_timeout_s > 0 && idle_s > e.progress_timeout_s) {
+				snprintf(reason, sizeof(reason), "%s progress %us", e.name, idle_s);
+				_wdt_reset(c, reason);
+			}
+		}
+	}
+}
+
+void WDT_Initialize(void)
+{
+	nvs_handle handle;
+	size_t len = sizeof(last_reason);
+
+	if (nvs_open(wdt_nvs_namespace, NVS_READWRITE, &handle) == ESP_OK) {
+		if (nvs_get_str(handle, "reason", last_reason, &len) == ESP_OK) {
+			have_last_reason = true;
+			ESP_LOGW(TAG, "Last reset by watchdog: %s", last_reason);
+			nvs_erase_key(handle, "reason");
+			nvs_commit(handle);
+		}
+		nvs_close(handle);
+	}
+
+	xTaskCreate(&wdt_task, "wdt_task", WDT_TASK_STACK, NULL, WDT_TASK_PRIO, NULL);
+}
@@ -51,14 +51,15 @@ Contains the freeRTOS task and all necessary support
 #include "lwip/inet.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/dns.h"
-#include "esp_ping.h"
-#include "ping/ping.h"
 
 
 #include "json.h"
 #include "wifi_manager.h"
 #include "http_server_if.h"
 #include "led_if.h"
+#include "probe_if.h"
+#include "wdt_if.h"
+#include "diag_if.h"
 
 #define str(x) #x
 #define xstr(x) str(x)
@@ -67,7 +68,7 @@ Contains the freeRTOS task and all necessary support
 #define THIRTY_SECONDS_TIMEOUT (30000 / portTICK_PERIOD_MS)
 #define ONE_SECOND_DELAY (1000 / portTICK_PERIOD_MS)
 #define RECONNECT_RETRY_PERIOD 30 * ONE_SECOND_DELAY
-#define PING_TEST_TIMEOUT_MS 3000
+#define WIFI_MANAGER_WDT_PERIOD (60 * ONE_SECOND_DELAY)	/* Longest wait for a request before checking in */
 
 static const char* TAG = "WIFI_MANAGER";
 static TimerHandle_t wifi_reconnect_timer;
@@ -81,7 +82,6 @@ char *reg_info_json = NULL;
 wifi_config_t* wifi_manager_config_sta = NULL;
 
 static void vTimerCallback(TimerHandle_t xTimer);
-static void wifi_manager_ping_test(void);
 
 /**
  * The actual WiFi settings in use
@@ -138,7 +138,7 @@ const int WIFI_MANAGER_REQUEST_WIFI_DISCONNECT = BIT6;
  * */
 const int WIFI_MANAGER_REQUEST_RECONNECT = BIT7;
 
-/* @brief Issue ping test to google. If successful this bit is set */
+/* @brief Set when a reachability probe succeeds (see probe_if.c) */
 const int WIFI_MANAGER_HAVE_INTERNET_BIT = BIT8;
 
 /* @brief Ping test requested */
@@ -147,6 +147,9 @@ const int WIFI_MANAGER_REQUEST_PING_TEST = BIT9;
 EventBits_t wifi_manager_wait_connect() {
 	return xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY );
 }
+bool wifi_manager_have_internet() {
+	return (xEventGroupGetBits(wifi_manager_event_group) & WIFI_MANAGER_HAVE_INTERNET_BIT) != 0;
+}
 EventBits_t wifi_manager_wait_internet_access() {
 	return xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT, pdFALSE, pdTRUE, portMAX_DELAY );
 }
@@ -571,6 +574,7 @@ esp_err_t wifi_manager_event_handler(void *ctx, system_event_t *event)
 
 	case SYSTEM_EVENT_STA_DISCONNECTED:
     	ESP_LOGW(TAG, "disconnect reason [%d]", event->event_info.disconnected.reason);
+    	DIAG_SetError(DIAG_SRC_WIFI, event->event_info.disconnected.reason);
     	if ((event->event_info.disconnected.reason != WIFI_REASON_ASSOC_LEAVE)  				/*Get kicked off by router*/
     			& (event->event_info.disconnected.reason != WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) /*Authenticate failed*/
 				& (event->event_info.disconnected.reason != WIFI_REASON_AUTH_FAIL) 				/*Authenticate failed*/
@@ -584,6 +588,7 @@ esp_err_t wifi_manager_event_handler(void *ctx, system_event_t *event)
     	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_STA_DISCONNECT_BIT);
 		xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT);
 		xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT);
+		PROBE_Invalidate();
 		LED_SetEventBit(LED_EVENT_WIFI_DISCONNECTED_BIT);
         break;
 
@@ -842,16 +847,22 @@ void wifi_manager( void * pvParameters ){
 	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_SCAN);
 
 	EventBits_t uxBits;
-	for(;;){
-
-		/* actions that can trigger: request a connection, a scan, or a disconnection */
-		uxBits = xEventGroupWaitBits(wifi_manager_event_group,
-				WIFI_MANAGER_REQUEST_STA_CONNECT_BIT |
+	const EventBits_t request_bits = WIFI_MANAGER_REQUEST_STA_CONNECT_BIT |
 				WIFI_MANAGER_REQUEST_WIFI_SCAN |
 				WIFI_MANAGER_REQUEST_WIFI_DISCONNECT |
 				/*WIFI_MANAGER_REQUEST_RECONNECT |*/
-				WIFI_MANAGER_REQUEST_PING_TEST,
-				pdFALSE, pdFALSE, portMAX_DELAY );
+				WIFI_MANAGER_REQUEST_PING_TEST;
+	for(;;){
+
+		/* actions that can trigger: request a connection, a scan, or a disconnection */
+		uxBits = xEventGroupWaitBits(wifi_manager_event_group, request_bits,
+				pdFALSE, pdFALSE, WIFI_MANAGER_WDT_PERIOD );
+
+		/* wake up now and then so the watchdog knows we aren't stuck */
+		WDT_Alive(WDT_WIFI);
+		if ((uxBits & request_bits) == 0) {
+			continue;
+		}
 		ESP_LOGI(TAG, "uxBits: 0x%x", uxBits);
 
 		if(uxBits & WIFI_MANAGER_REQUEST_WIFI_DISCONNECT){
@@ -937,9 +948,9 @@ void wifi_manager( void * pvParameters ){
 					ESP_LOGI(TAG, "AirU obtained an IP address from AP\n\r");
 					wifi_manager_save_sta_config();
 
-					ESP_LOGI(TAG, "Got IP address, ping Google DNS 8.8.8.8 to test internet access");
+					ESP_LOGI(TAG, "Got IP address, probing for internet access");
 					if(wifi_manager_check_connection() == 1){
-						ESP_LOGI(TAG, "Ping success! Got internet access.");
+						ESP_LOGI(TAG, "Probe success! Got internet access.");
 						xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_RECONNECT);
 					}
 					else{
@@ -1082,40 +1093,6 @@ void wifi_manager( void * pvParameters ){
 } /*void wifi_manager*/
 
 
-esp_err_t pingResults(ping_target_id_t msgType, esp_ping_found * pf){
-//	ESP_LOGI("PING", "\n\r\tAvgTime:\t%.1fmS \n\r\tSent:\t\t%d \n\r\tRec:\t\t%d \n\r\tErr Cnt:\t%d  \n\r\tErr:\t\t%d \n\r\tmin(mS):\t%d \n\r\tmax(mS):\t%d \n\r\tResp(mS):\t%d \n\r\tTimeouts:\t%d \n\r\tTotal Time:\t%d\n", (float)pf->total_time/pf->recv_count, pf->send_count, pf->recv_count, pf->err_count, pf->ping_err, pf->min_time, pf->max_time,pf->resp_time, pf->timeout_count, pf->total_time );
-	if (pf->recv_count > 0){
-		ESP_LOGI("PING", "PING TEST SUCCESS");
-		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT);
-		LED_SetEventBit(LED_EVENT_WIFI_CONNECTED_BIT);
-		xTimerStop(wifi_reconnect_timer, 0);
-	}
-	else{
-		ESP_LOGE("PING", "Couldn't ping 8.8.8.8. Internet is down!");
-		wifi_manager_connect_async();
-	}
-
-	return ESP_OK;
-}
-
-static void wifi_manager_ping_test(){
-	uint32_t ping_timeout = PING_TEST_TIMEOUT_MS; 	// ms till we consider it timed out
-	uint32_t ping_count = 1;
-	struct in_addr ip;
-	inet_aton("8.8.8.8", &ip);		// Google's DNS
-
-	ESP_LOGI("PING", "Issuing Ping test. IP binary: 0x%08x", ip.s_addr);
-
-	xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT);
-	LED_SetEventBit(LED_EVENT_WIFI_DISCONNECTED_BIT);
-	esp_ping_set_target(PING_TARGET_IP_ADDRESS_COUNT, &ping_count, sizeof(uint32_t));
-	esp_ping_set_target(PING_TARGET_RCV_TIMEO, &ping_timeout, sizeof(uint32_t));
-	esp_ping_set_target(PING_TARGET_IP_ADDRESS, &ip.s_addr, sizeof(uint32_t));
-	esp_ping_set_target(PING_TARGET_RES_FN, &pingResults, sizeof(pingResults));
-	ping_init();
-
-}
-
 void wifi_manager_check_connection_async()
 {
 	ESP_LOGI(TAG, "function called %s", __func__);
@@ -1124,33 +1101,28 @@ void wifi_manager_check_connection_async()
 
 int wifi_manager_check_connection()
 {
-	EventBits_t uxBits;
 	if(wifi_manager_connected_to_access_point()){
 
-		// Issue ping test
-		wifi_manager_ping_test();
-
-		// Wait up to PING_TEST_TIMEOUT_MS for ping test callback to set WIFI_MANAGER_HAVE_INTERNET_BIT
-		int ret = (WIFI_MANAGER_HAVE_INTERNET_BIT & \
-				xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT, pdFALSE, pdTRUE, MS2TICK(PING_TEST_TIMEOUT_MS)));
-
-		// Ping test failed. Start the reconnect timer
-		if (!ret){
-			LED_SetEventBit(LED_EVENT_WIFI_DISCONNECTED_BIT);
-
-			// Ping test failed. Start the reconnect timer
-			if(!xTimerIsTimerActive(wifi_reconnect_timer)) {
-				ESP_LOGI(TAG, "Starting timer");
-				xTimerStart(wifi_reconnect_timer, 0);
-			}
+		// Run the reachability probes (or use a recent cached success)
+		if (PROBE_Check()){
+			ESP_LOGI(TAG, "%s, WE HAVE INTERNET! Stop the reconnect timer.", __func__);
+			xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT);
+			LED_SetEventBit(LED_EVENT_WIFI_CONNECTED_BIT);
+			xTimerStop(wifi_reconnect_timer, 0);
+			return 1;
 		}
 
-		// ping test was successful.
-		else{
-			ESP_LOGI(TAG, "%s, WE HAVE INTERNET! Stop the reconnect timer.", __func__);
+		// Every probe failed. Reconnect and start the reconnect timer
+		ESP_LOGE(TAG, "%s, no probe reached the internet!", __func__);
+		xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_HAVE_INTERNET_BIT);
+		LED_SetEventBit(LED_EVENT_WIFI_DISCONNECTED_BIT);
+		wifi_manager_connect_async();
 
+		if(!xTimerIsTimerActive(wifi_reconnect_timer)) {
+			ESP_LOGI(TAG, "Starting timer");
+			xTimerStart(wifi_reconnect_timer, 0);
 		}
-		return ret;
+		return 0;
 	}
 	else{
 		return ERR_WIFI_DISCONECTED;
@@ -0,0 +1,1348 @@
+/*
+ * host_rtos.c
+ *
+ * Notes:
+ * 		The FreeRTOS and ESP-IDF calls declared in stubs/host_idf.h, on
+ * 		pthreads. Good enough to run the firmware's modules and their races
+ * 		on a PC, not a model of the scheduler: priorities, stacks and cores
+ * 		are ignored.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdarg.h>
+#include <time.h>
+#include "host_idf.h"
+
+#define HOST_NVS_KEYS		16
+#define HOST_NVS_LEN		128
+#define HOST_APP_SIZE		0x100000	/* Each app partition */
+#define HOST_APP_BASE		0x10000
+#define HOST_SIM_STEP_US	100000
+#define HOST_NOTIFY_TASKS	16
+#define HOST_I2C_OPS		32			/* In one command link */
+#define HOST_TIMERS			16
+#define HOST_UART_RX		2048		/* Largest RX buffer */
+#define HOST_UART_PATTERNS	32			/* Longest pattern position queue */
+#define HOST_SIM_STEP_TICKS	(HOST_SIM_STEP_US / 1000 / portTICK_PERIOD_MS)
+
+struct host_sem {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int count;
+	bool mutex;
+};
+
+struct host_group {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	EventBits_t bits;
+};
+
+struct host_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t *items;
+	UBaseType_t len, size, head, count;
+};
+
+struct host_timer {
+	TickType_t period;
+	bool reload, active;
+	int64_t expiry_us;
+	void *id;
+	TimerCallbackFunction_t cb;
+};
+
+struct host_i2c_cmd {
+	host_i2c_op_t ops[HOST_I2C_OPS];
+	int n;
+};
+
+typedef struct {
+	TaskFunction_t fn;
+	void *arg;
+} host_start_t;
+
+esp_log_level_t host_log_level = ESP_LOG_ERROR;
+jmp_buf *host_restart = NULL;
+int host_twdt_fired = 0;
+void (*host_gpio_write)(gpio_num_t gpio, int level) = NULL;
+int (*host_gpio_read)(gpio_num_t gpio) = NULL;
+int (*host_adc1_read)(adc1_channel_t channel) = NULL;
+esp_err_t (*host_i2c_bus)(i2c_port_t port, const host_i2c_op_t *ops, int n, TickType_t wait) = NULL;
+void (*host_uart_tx)(uart_port_t port, const uint8_t *data, size_t len) = NULL;
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_mutex_t state = PTHREAD_MUTEX_INITIALIZER;
+static int tasks_alive = 0;
+static int64_t task_longest_us = 0;
+static __thread int64_t task_start_us;
+static bool sim = false;
+static int64_t sim_us = 0;
+static void (*sim_tick)(int64_t now_us) = NULL;
+static pthread_cond_t notified = PTHREAD_COND_INITIALIZER;
+static struct { TaskHandle_t task; uint32_t count; } notify[HOST_NOTIFY_TASKS];
+static struct { char ns[16], key[16]; uint8_t val[HOST_NVS_LEN]; size_t len; bool used; } nvs[HOST_NVS_KEYS];
+static char nvs_ns[4][16];
+static const esp_partition_t apps[] = {
+	{ ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, HOST_APP_BASE, HOST_APP_SIZE, "factory", false },
+	{ ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, HOST_APP_BASE + HOST_APP_SIZE, HOST_APP_SIZE, "ota_0", false },
+	{ ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, HOST_APP_BASE + 2 * HOST_APP_SIZE, HOST_APP_SIZE, "ota_1", false },
+};
+#define HOST_APPS			(sizeof(apps) / sizeof(apps[0]))
+static uint8_t *flash = NULL;			/* The app partitions, back to back */
+static const esp_partition_t *running = &apps[0];
+static const esp_partition_t *boot = &apps[0];
+static host_flash_stats_t flash_stats;
+static const esp_app_desc_t app_desc = { .magic_word = 0xABCD5432, .version = "host", .project_name = "airu" };
+/* Task watchdog as sdkconfig.old sets it up: 5 s, report only */
+static struct { uint32_t timeout_s; bool panic, subscribed; int64_t fed_us; } twdt = { 5, false, false, 0 };
+static uint8_t gpio_level[HOST_GPIOS];
+static bool i2c_installed[I2C_NUM_MAX];
+static struct host_timer timers[HOST_TIMERS];
+static int timers_n = 0;
+static struct {
+	bool installed;
+	QueueHandle_t queue;
+	uint8_t rx[HOST_UART_RX];
+	size_t size, len;
+	int pattern;						/* -1: detection off */
+	int pos[HOST_UART_PATTERNS];		/* Pattern positions from the read end */
+	int pos_n, pos_len;
+} uarts[UART_NUM_MAX];
+
+static void _host_twdt_check(void);
+static void _host_timers_run(int64_t until_us);
+
+
+/*
+* @brief	Absolute CLOCK_REALTIME deadline for a wait of ticks
+*/
+static struct timespec _host_deadline(TickType_t ticks)
+{
+	struct timespec ts;
+	int64_t ns;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ns = ts.tv_nsec + (int64_t) ticks * portTICK_PERIOD_MS * 1000000LL;
+	ts.tv_sec += ns / 1000000000LL;
+	ts.tv_nsec = ns % 1000000000LL;
+	return ts;
+}
+
+/*
+* @brief	Wait on cond until ready() or ticks run out. Called with lock held.
+*/
+static bool _host_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+					   bool (*ready)(void *), void *arg)
+{
+	struct timespec ts = _host_deadline(ticks);
+
+	while (!ready(arg)) {
+		if (ticks == 0) {
+			return false;
+		}
+		if (ticks == portMAX_DELAY) {
+			pthread_cond_wait(cond, lock);
+		}
+		else if (pthread_cond_timedwait(cond, lock, &ts) != 0) {
+			return ready(arg);
+		}
+	}
+	return true;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+	static char buf[16];
+
+	snprintf(buf, sizeof(buf), "0x%x", code);
+	return buf;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	va_list args;
+
+	if (level > host_log_level) {
+		return;
+	}
+	fprintf(stderr, "%c (%s) ", "NEWIDV"[level], tag);
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+void host_critical(portMUX_TYPE *mux, bool enter)
+{
+	(void) mux;
+	if (enter) {
+		pthread_mutex_lock(&critical);
+	}
+	else {
+		pthread_mutex_unlock(&critical);
+	}
+}
+
+static void *_host_task(void *arg)
+{
+	host_start_t start = *(host_start_t *) arg;
+
+	free(arg);
+	task_start_us = esp_timer_get_time();
+	start.fn(start.arg);
+	vTaskDelete(NULL);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+	host_start_t *start = malloc(sizeof(host_start_t));
+	pthread_t thread;
+
+	(void) name; (void) stack; (void) prio;
+	start->fn = fn;
+	start->arg = arg;
+	pthread_mutex_lock(&state);
+	tasks_alive++;
+	pthread_mutex_unlock(&state);
+	if (pthread_create(&thread, NULL, _host_task, start) != 0) {
+		pthread_mutex_lock(&state);
+		tasks_alive--;
+		pthread_mutex_unlock(&state);
+		free(start);
+		return pdFAIL;
+	}
+	pthread_detach(thread);
+	if (handle) {
+		*handle = (TaskHandle_t) thread;	/* Opaque, never dereferenced */
+	}
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	int64_t life;
+
+	if (task != NULL) {
+		fprintf(stderr, "host: deleting another task isn't supported\n");
+		abort();
+	}
+	life = esp_timer_get_time() - task_start_us;
+	pthread_mutex_lock(&state);
+	tasks_alive--;
+	task_longest_us = (life > task_longest_us) ? life : task_longest_us;
+	pthread_mutex_unlock(&state);
+	pthread_exit(NULL);
+}
+
+int host_tasks_alive(void)
+{
+	int n;
+
+	pthread_mutex_lock(&state);
+	n = tasks_alive;
+	pthread_mutex_unlock(&state);
+	return n;
+}
+
+int64_t host_task_longest_us(void)
+{
+	int64_t longest;
+
+	pthread_mutex_lock(&state);
+	longest = task_longest_us;
+	task_longest_us = 0;
+	pthread_mutex_unlock(&state);
+	return longest;
+}
+
+void host_sim_start(int64_t start_us, void (*tick)(int64_t now_us))
+{
+	sim = true;
+	sim_us = start_us;
+	sim_tick = tick;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec ts;
+
+	if (sim) {
+		return sim_us;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	int64_t until;
+
+	if (!sim) {
+		usleep(ticks * portTICK_PERIOD_MS * 1000);
+		return;
+	}
+	until = sim_us + (int64_t) ticks * portTICK_PERIOD_MS * 1000;
+	while (sim_us < until) {
+		_host_timers_run((until - sim_us < HOST_SIM_STEP_US) ? until : sim_us + HOST_SIM_STEP_US);
+		sim_us = (until - sim_us < HOST_SIM_STEP_US) ? until : sim_us + HOST_SIM_STEP_US;
+		if (sim_tick) {
+			sim_tick(sim_us);
+		}
+		_host_twdt_check();
+	}
+}
+
+void vTaskDelayUntil(TickType_t *prev_wake, TickType_t increment)
+{
+	TickType_t now = xTaskGetTickCount();
+
+	*prev_wake += increment;
+	if ((int32_t) (*prev_wake - now) > 0) {
+		vTaskDelay(*prev_wake - now);
+	}
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return esp_timer_get_time() / 1000 / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return (TaskHandle_t) pthread_self();
+}
+
+/*
+* @brief	Notification count of a task, created on first use. Caller holds state.
+*/
+static uint32_t *_host_notify(TaskHandle_t task)
+{
+	for (int i = 0; i < HOST_NOTIFY_TASKS; i++) {
+		if (notify[i].task == task || notify[i].task == NULL) {
+			notify[i].task = task;
+			return &notify[i].count;
+		}
+	}
+	fprintf(stderr, "host: more than %d tasks take notifications\n", HOST_NOTIFY_TASKS);
+	abort();
+}
+
+static bool _host_notify_ready(void *arg)
+{
+	return *(uint32_t *) arg > 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	pthread_mutex_lock(&state);
+	(*_host_notify(task))++;
+	pthread_cond_broadcast(&notified);
+	pthread_mutex_unlock(&state);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+	uint32_t *count, n;
+
+	pthread_mutex_lock(&state);
+	count = _host_notify(xTaskGetCurrentTaskHandle());
+	if (sim && *count == 0) {
+		pthread_mutex_unlock(&state);
+		vTaskDelay(wait);
+		pthread_mutex_lock(&state);
+	}
+	else {
+		_host_wait(&notified, &state, wait, _host_notify_ready, count);
+	}
+	n = *count;
+	*count = (clear || n == 0) ? 0 : n - 1;
+	pthread_mutex_unlock(&state);
+	return n;
+}
+
+uint32_t esp_random(void)
+{
+	static unsigned int seed = 1;
+	uint32_t r;
+
+	pthread_mutex_lock(&state);
+	r = ((uint32_t) rand_r(&seed) << 16) ^ rand_r(&seed);
+	pthread_mutex_unlock(&state);
+	return r;
+}
+
+void esp_restart(void)
+{
+	if (host_restart) {
+		longjmp(*host_restart, 1);
+	}
+	fprintf(stderr, "host: esp_restart\n");
+	abort();
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+	return 100000;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return 80000;
+}
+
+esp_err_t esp_task_wdt_init(uint32_t timeout_s, bool panic)
+{
+	twdt.timeout_s = timeout_s;
+	twdt.panic = panic;
+	return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t task)
+{
+	(void) task;
+	twdt.subscribed = true;
+	twdt.fed_us = esp_timer_get_time();
+	return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset(void)
+{
+	twdt.fed_us = esp_timer_get_time();
+	return ESP_OK;
+}
+
+/*
+* @brief	The task watchdog's timer, on simulated time. Only one task
+* 			subscribes on the host. It reports and starts over, or panics.
+*/
+static void _host_twdt_check(void)
+{
+	if (!twdt.subscribed || sim_us - twdt.fed_us <= twdt.timeout_s * 1000000LL) {
+		return;
+	}
+	host_twdt_fired++;
+	twdt.fed_us = sim_us;
+	if (twdt.panic) {
+		twdt.subscribed = false;
+		esp_restart();
+	}
+}
+
+static SemaphoreHandle_t _host_sem(int count, bool mutex)
+{
+	SemaphoreHandle_t sem = calloc(1, sizeof(struct host_sem));
+
+	pthread_mutex_init(&sem->lock, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->count = count;
+	sem->mutex = mutex;
+	return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return _host_sem(1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return _host_sem(0, false);
+}
+
+static bool _host_sem_ready(void *arg)
+{
+	return ((SemaphoreHandle_t) arg)->count > 0;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+	bool ok;
+
+	pthread_mutex_lock(&sem->lock);
+	ok = _host_wait(&sem->cond, &sem->lock, wait, _host_sem_ready, sem);
+	if (ok) {
+		sem->count--;
+	}
+	pthread_mutex_unlock(&sem->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	bool ok;
+
+	pthread_mutex_lock(&sem->lock);
+	ok = sem->count == 0;
+	if (ok) {
+		sem->count++;
+		pthread_cond_broadcast(&sem->cond);
+	}
+	pthread_mutex_unlock(&sem->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+	pthread_mutex_destroy(&sem->lock);
+	pthread_cond_destroy(&sem->cond);
+	free(sem);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	EventGroupHandle_t group = calloc(1, sizeof(struct host_group));
+
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->cond, NULL);
+	return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+	pthread_mutex_destroy(&group->lock);
+	pthread_cond_destroy(&group->cond);
+	free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	EventBits_t now;
+
+	pthread_mutex_lock(&group->lock);
+	now = (group->bits |= bits);
+	pthread_cond_broadcast(&group->cond);
+	pthread_mutex_unlock(&group->lock);
+	return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	EventBits_t before;
+
+	pthread_mutex_lock(&group->lock);
+	before = group->bits;
+	group->bits &= ~bits;
+	pthread_mutex_unlock(&group->lock);
+	return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+	EventBits_t bits;
+
+	pthread_mutex_lock(&group->lock);
+	bits = group->bits;
+	pthread_mutex_unlock(&group->lock);
+	return bits;
+}
+
+typedef struct {
+	EventGroupHandle_t group;
+	EventBits_t bits;
+	bool all;
+} host_bits_t;
+
+static bool _host_bits_ready(void *arg)
+{
+	host_bits_t *w = arg;
+	EventBits_t got = w->group->bits & w->bits;
+
+	return w->all ? got == w->bits : got != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait)
+{
+	host_bits_t w = { group, bits, all };
+	EventBits_t now;
+
+	pthread_mutex_lock(&group->lock);
+	if (_host_wait(&group->cond, &group->lock, wait, _host_bits_ready, &w) && clear) {
+		now = group->bits;
+		group->bits &= ~bits;
+	}
+	else {
+		now = group->bits;
+	}
+	pthread_mutex_unlock(&group->lock);
+	return now;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size)
+{
+	QueueHandle_t q = calloc(1, sizeof(struct host_queue));
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	q->items = calloc(len, size);
+	q->len = len;
+	q->size = size;
+	return q;
+}
+
+static bool _host_queue_space(void *arg)
+{
+	QueueHandle_t q = arg;
+
+	return q->count < q->len;
+}
+
+static bool _host_queue_items(void *arg)
+{
+	return ((QueueHandle_t) arg)->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait)
+{
+	bool ok;
+
+	pthread_mutex_lock(&q->lock);
+	ok = _host_wait(&q->cond, &q->lock, wait, _host_queue_space, q);
+	if (ok) {
+		memcpy(&q->items[((q->head + q->count) % q->len) * q->size], item, q->size);
+		q->count++;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+	TickType_t waited = 0, step;
+	bool ok;
+
+	pthread_mutex_lock(&q->lock);
+	if (sim) {
+		// Nothing else runs: only the test's tick or a timer can send
+		while (q->count == 0 && (wait == portMAX_DELAY || waited < wait)) {
+			step = (wait == portMAX_DELAY || wait - waited > HOST_SIM_STEP_TICKS) ? HOST_SIM_STEP_TICKS : wait - waited;
+			pthread_mutex_unlock(&q->lock);
+			vTaskDelay(step);
+			waited += step;
+			pthread_mutex_lock(&q->lock);
+		}
+		ok = q->count > 0;
+	}
+	else {
+		ok = _host_wait(&q->cond, &q->lock, wait, _host_queue_items, q);
+	}
+	if (ok) {
+		memcpy(item, &q->items[q->head * q->size], q->size);
+		q->head = (q->head + 1) % q->len;
+		q->count--;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->head = q->count = 0;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+	UBaseType_t n;
+
+	pthread_mutex_lock(&q->lock);
+	n = q->count;
+	pthread_mutex_unlock(&q->lock);
+	return n;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle)
+{
+	(void) mode;
+	for (int i = 0; i < 4; i++) {
+		if (nvs_ns[i][0] == 0 || strcmp(nvs_ns[i], name) == 0) {
+			strncpy(nvs_ns[i], name, sizeof(nvs_ns[i]) - 1);
+			*handle = i;
+			return ESP_OK;
+		}
+	}
+	return ESP_FAIL;
+}
+
+void nvs_close(nvs_handle handle)
+{
+	(void) handle;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+	(void) handle;
+	return ESP_OK;
+}
+
+static int _host_nvs_find(nvs_handle handle, const char *key)
+{
+	for (int i = 0; i < HOST_NVS_KEYS; i++) {
+		if (nvs[i].used && strcmp(nvs[i].ns, nvs_ns[handle]) == 0 && strcmp(nvs[i].key, key) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+	int i = _host_nvs_find(handle, key);
+
+	if (i < 0) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	nvs[i].used = false;
+	return ESP_OK;
+}
+
+static esp_err_t _host_nvs_set(nvs_handle handle, const char *key, const void *value, size_t len)
+{
+	int i = _host_nvs_find(handle, key);
+
+	for (int j = 0; i < 0 && j < HOST_NVS_KEYS; j++) {
+		if (!nvs[j].used) {
+			i = j;
+		}
+	}
+	if (i < 0 || len > HOST_NVS_LEN) {
+		return ESP_ERR_NO_MEM;
+	}
+	strncpy(nvs[i].ns, nvs_ns[handle], sizeof(nvs[i].ns) - 1);
+	strncpy(nvs[i].key, key, sizeof(nvs[i].key) - 1);
+	memcpy(nvs[i].val, value, len);
+	nvs[i].len = len;
+	nvs[i].used = true;
+	return ESP_OK;
+}
+
+static esp_err_t _host_nvs_get(nvs_handle handle, const char *key, void *value, size_t *len)
+{
+	int i = _host_nvs_find(handle, key);
+
+	if (i < 0) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if (value == NULL) {
+		*len = nvs[i].len;
+		return ESP_OK;
+	}
+	if (nvs[i].len > *len) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memcpy(value, nvs[i].val, nvs[i].len);
+	*len = nvs[i].len;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value)
+{
+	return _host_nvs_set(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *value, size_t *len)
+{
+	return _host_nvs_get(handle, key, value, len);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t len)
+{
+	return _host_nvs_set(handle, key, value, len);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *value, size_t *len)
+{
+	return _host_nvs_get(handle, key, value, len);
+}
+
+void host_nvs_clear(void)
+{
+	memset(nvs, 0, sizeof(nvs));
+}
+
+void host_flash_reset(void)
+{
+	if (flash == NULL) {
+		flash = malloc(HOST_APPS * HOST_APP_SIZE);
+	}
+	memset(flash, 0xff, HOST_APPS * HOST_APP_SIZE);
+	memset(&flash_stats, 0, sizeof(flash_stats));
+	running = boot = &apps[0];
+}
+
+const esp_partition_t *host_flash_boot(void)
+{
+	running = boot;
+	return running;
+}
+
+void host_flash_stats(host_flash_stats_t *stats)
+{
+	*stats = flash_stats;
+}
+
+/*
+* @brief	Where a partition range lives in flash[], NULL if out of bounds
+*/
+static uint8_t *_host_flash_at(const esp_partition_t *part, size_t offset, size_t size)
+{
+	if (flash == NULL) {
+		host_flash_reset();
+	}
+	if (part < &apps[0] || part >= &apps[HOST_APPS] || offset + size > part->size) {
+		return NULL;
+	}
+	return flash + (part->address - HOST_APP_BASE) + offset;
+}
+
+struct host_part_it {
+	size_t i;
+	esp_partition_type_t type;
+	esp_partition_subtype_t subtype;
+};
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+	esp_partition_iterator_t it = calloc(1, sizeof(struct host_part_it));
+
+	it->type = type;
+	it->subtype = subtype;
+	for (it->i = 0; it->i < HOST_APPS; it->i++) {
+		if (apps[it->i].type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || apps[it->i].subtype == subtype) &&
+			(label == NULL || strcmp(apps[it->i].label, label) == 0)) {
+			return it;
+		}
+	}
+	free(it);
+	return NULL;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t it)
+{
+	return &apps[it->i];
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t it)
+{
+	while (++it->i < HOST_APPS) {
+		if (apps[it->i].type == it->type &&
+			(it->subtype == ESP_PARTITION_SUBTYPE_ANY || apps[it->i].subtype == it->subtype)) {
+			return it;
+		}
+	}
+	free(it);
+	return NULL;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t it)
+{
+	free(it);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset, void *dst, size_t size)
+{
+	uint8_t *at = _host_flash_at(part, src_offset, size);
+
+	if (at == NULL) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memcpy(dst, at, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset, const void *src, size_t size)
+{
+	uint8_t *at = _host_flash_at(part, dst_offset, size);
+	const uint8_t *in = src;
+	bool bad = false;
+
+	if (at == NULL) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	for (size_t i = 0; i < size; i++) {
+		bad |= (in[i] & ~at[i]) != 0;
+		at[i] &= in[i];
+	}
+	flash_stats.writes++;
+	flash_stats.bad_writes += bad;
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t start, size_t size)
+{
+	uint8_t *at = _host_flash_at(part, start, size);
+
+	if (at == NULL || start % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	memset(at, 0xff, size);
+	flash_stats.erases += size / SPI_FLASH_SEC_SIZE;
+	return ESP_OK;
+}
+
+bool esp_partition_check_identity(const esp_partition_t *a, const esp_partition_t *b)
+{
+	return a->size == b->size && memcmp(_host_flash_at(a, 0, a->size), _host_flash_at(b, 0, b->size), a->size) == 0;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+	return running;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+	return boot;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start)
+{
+	const esp_partition_t *from = start ? start : running;
+
+	return from == &apps[1] ? &apps[2] : &apps[1];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *part)
+{
+	uint8_t *at = _host_flash_at(part, 0, 1);
+
+	if (at == NULL) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (*at != ESP_IMAGE_HEADER_MAGIC) {
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+	boot = part;
+	return ESP_OK;
+}
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+	return &app_desc;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+	return ESP_OK;
+}
+
+void ets_delay_us(uint32_t us)
+{
+	if (sim) {
+		sim_us += us;	/* Busy wait: no tick, no other task runs */
+	}
+	else {
+		usleep(us);
+	}
+}
+
+esp_err_t gpio_config(const gpio_config_t *conf)
+{
+	for (int i = 0; i < HOST_GPIOS; i++) {
+		if (conf->pin_bit_mask & (1ULL << i)) {
+			gpio_set_direction(i, conf->mode);
+		}
+	}
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+	(void) mode;
+	return (gpio >= 0 && gpio < HOST_GPIOS) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull)
+{
+	(void) pull;
+	return (gpio >= 0 && gpio < HOST_GPIOS) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+	if (gpio < 0 || gpio >= HOST_GPIOS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	gpio_level[gpio] = level ? 1 : 0;
+	if (host_gpio_write) {
+		host_gpio_write(gpio, gpio_level[gpio]);
+	}
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+	if (gpio < 0 || gpio >= HOST_GPIOS) {
+		return 0;
+	}
+	return gpio_level[gpio] & (host_gpio_read ? host_gpio_read(gpio) : 1);
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t width)
+{
+	(void) width;
+	return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+	(void) channel; (void) atten;
+	return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel)
+{
+	int raw = host_adc1_read ? host_adc1_read(channel) : 0;
+
+	return (raw < 0) ? 0 : (raw > 4095) ? 4095 : raw;
+}
+
+esp_err_t esp_adc_cal_check_efuse(esp_adc_cal_value_t value_type)
+{
+	(void) value_type;
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+											 uint32_t default_vref, esp_adc_cal_characteristics_t *chars)
+{
+	chars->adc_num = adc_num;
+	chars->atten = atten;
+	chars->bit_width = bit_width;
+	chars->coeff_a = (3300 << 16) / 4095;
+	chars->coeff_b = 0;
+	chars->vref = default_vref;
+	return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars)
+{
+	return ((chars->coeff_a * adc_reading + (1 << 15)) >> 16) + chars->coeff_b;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void)
+{
+	return calloc(1, sizeof(struct host_i2c_cmd));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd)
+{
+	free(cmd);
+}
+
+static esp_err_t _host_i2c_op(i2c_cmd_handle_t cmd, host_i2c_kind_t kind, uint8_t byte, uint8_t *data, bool ack)
+{
+	if (cmd->n >= HOST_I2C_OPS) {
+		fprintf(stderr, "host: more than %d ops in a command link\n", HOST_I2C_OPS);
+		abort();
+	}
+	cmd->ops[cmd->n++] = (host_i2c_op_t) { kind, byte, data, ack };
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd)
+{
+	return _host_i2c_op(cmd, HOST_I2C_START, 0, NULL, false);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack_en)
+{
+	return _host_i2c_op(cmd, HOST_I2C_WRITE, data, NULL, ack_en);
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, i2c_ack_type_t ack)
+{
+	return _host_i2c_op(cmd, HOST_I2C_READ, 0, data, ack == I2C_MASTER_ACK);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd)
+{
+	return _host_i2c_op(cmd, HOST_I2C_STOP, 0, NULL, false);
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t wait)
+{
+	if (port < 0 || port >= I2C_NUM_MAX || !i2c_installed[port]) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	return host_i2c_bus ? host_i2c_bus(port, cmd->ops, cmd->n, wait) : ESP_FAIL;
+}
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf)
+{
+	(void) conf;
+	return (port >= 0 && port < I2C_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len,
+							 int intr_alloc_flags)
+{
+	(void) mode; (void) slv_rx_buf_len; (void) slv_tx_buf_len; (void) intr_alloc_flags;
+	if (port < 0 || port >= I2C_NUM_MAX || i2c_installed[port]) {
+		return ESP_FAIL;
+	}
+	i2c_installed[port] = true;
+	return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t port)
+{
+	if (port < 0 || port >= I2C_NUM_MAX || !i2c_installed[port]) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	i2c_installed[port] = false;
+	return ESP_OK;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *id,
+						   TimerCallbackFunction_t cb)
+{
+	TimerHandle_t timer;
+
+	(void) name;
+	if (timers_n == HOST_TIMERS || period == 0) {
+		return NULL;
+	}
+	timer = &timers[timers_n++];
+	*timer = (struct host_timer) { .period = period, .reload = reload, .id = id, .cb = cb };
+	return timer;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	(void) wait;
+	if (period == 0) {
+		return pdFAIL;
+	}
+	timer->period = period;
+	timer->expiry_us = esp_timer_get_time() + (int64_t) period * portTICK_PERIOD_MS * 1000;
+	timer->active = true;
+	return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+	return xTimerChangePeriod(timer, timer->period, wait);
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+	return xTimerChangePeriod(timer, timer->period, wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	(void) wait;
+	timer->active = false;
+	return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	return timer->active;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
+
+/*
+* @brief	Fire every timer due by until_us, in order, each at its own time
+*/
+static void _host_timers_run(int64_t until_us)
+{
+	struct host_timer *next;
+
+	for (;;) {
+		next = NULL;
+		for (int i = 0; i < timers_n; i++) {
+			if (timers[i].active && timers[i].expiry_us <= until_us &&
+				(next == NULL || timers[i].expiry_us < next->expiry_us)) {
+				next = &timers[i];
+			}
+		}
+		if (next == NULL) {
+			return;
+		}
+		sim_us = next->expiry_us;
+		if (next->reload) {
+			next->expiry_us += (int64_t) next->period * portTICK_PERIOD_MS * 1000;
+		}
+		else {
+			next->active = false;
+		}
+		next->cb(next);
+	}
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *conf)
+{
+	(void) conf;
+	return (port >= 0 && port < UART_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)
+{
+	(void) tx; (void) rx; (void) rts; (void) cts;
+	return (port >= 0 && port < UART_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size,
+							  QueueHandle_t *queue, int intr_alloc_flags)
+{
+	(void) tx_buffer_size; (void) intr_alloc_flags;
+	// As the driver: the RX buffer has to be bigger than the FIFO
+	if (port < 0 || port >= UART_NUM_MAX || uarts[port].installed || rx_buffer_size <= UART_FIFO_LEN ||
+		rx_buffer_size > HOST_UART_RX) {
+		return ESP_FAIL;
+	}
+	uarts[port].installed = true;
+	uarts[port].size = rx_buffer_size;
+	uarts[port].len = 0;
+	uarts[port].pattern = -1;
+	uarts[port].pos_n = uarts[port].pos_len = 0;
+	uarts[port].queue = (queue && queue_size > 0) ? xQueueCreate(queue_size, sizeof(uart_event_t)) : NULL;
+	if (queue) {
+		*queue = uarts[port].queue;
+	}
+	return ESP_OK;
+}
+
+size_t host_uart_rx(uart_port_t port, const uint8_t *data, size_t len)
+{
+	size_t n = uarts[port].size - uarts[port].len;
+	uart_event_t event = { .type = UART_DATA };
+
+	if (!uarts[port].installed) {
+		return 0;
+	}
+	n = (len < n) ? len : n;
+	memcpy(uarts[port].rx + uarts[port].len, data, n);
+	uarts[port].len += n;
+	if (uarts[port].queue && n > 0) {
+		event.size = n;
+		xQueueSend(uarts[port].queue, &event, 0);
+	}
+	// One event per pattern character, its position queued if there's room
+	for (size_t i = 0; i < n && uarts[port].pattern >= 0; i++) {
+		if (data[i] != uarts[port].pattern) {
+			continue;
+		}
+		if (uarts[port].pos_n < uarts[port].pos_len) {
+			uarts[port].pos[uarts[port].pos_n++] = uarts[port].len - n + i;
+		}
+		if (uarts[port].queue) {
+			event.type = UART_PATTERN_DET;
+			event.size = 0;
+			xQueueSend(uarts[port].queue, &event, 0);
+		}
+	}
+	if (uarts[port].queue && n < len) {
+		event.type = UART_BUFFER_FULL;
+		event.size = 0;
+		xQueueSend(uarts[port].queue, &event, 0);
+	}
+	return n;
+}
+
+int uart_read_bytes(uart_port_t port, uint8_t *buf, uint32_t len, TickType_t wait)
+{
+	size_t n;
+
+	(void) wait;
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed) {
+		return -1;
+	}
+	n = (len < uarts[port].len) ? len : uarts[port].len;
+	memcpy(buf, uarts[port].rx, n);
+	memmove(uarts[port].rx, uarts[port].rx + n, uarts[port].len - n);
+	uarts[port].len -= n;
+	// As the driver: positions move with the read end, those read are gone
+	for (int i = 0; i < uarts[port].pos_n; i++) {
+		uarts[port].pos[i] -= n;
+	}
+	while (uarts[port].pos_n > 0 && uarts[port].pos[0] < 0) {
+		memmove(uarts[port].pos, uarts[port].pos + 1, --uarts[port].pos_n * sizeof(int));
+	}
+	return n;
+}
+
+int uart_write_bytes(uart_port_t port, const char *src, size_t len)
+{
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed) {
+		return -1;
+	}
+	if (host_uart_tx) {
+		host_uart_tx(port, (const uint8_t *) src, len);
+	}
+	return len;
+}
+
+esp_err_t uart_flush_input(uart_port_t port)
+{
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed) {
+		return ESP_FAIL;
+	}
+	uarts[port].len = 0;
+	uarts[port].pos_n = 0;
+	return ESP_OK;
+}
+
+esp_err_t uart_flush(uart_port_t port)
+{
+	return uart_flush_input(port);
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *len)
+{
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed) {
+		return ESP_FAIL;
+	}
+	*len = uarts[port].len;
+	return ESP_OK;
+}
+
+esp_err_t uart_enable_pattern_det_intr(uart_port_t port, char pattern_chr, uint8_t chr_num, int chr_tout,
+									   int post_idle, int pre_idle)
+{
+	(void) chr_tout; (void) post_idle; (void) pre_idle;
+	// Only single character patterns
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed || chr_num != 1) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	uarts[port].pattern = (uint8_t) pattern_chr;
+	return ESP_OK;
+}
+
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queue_length)
+{
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed || queue_length > HOST_UART_PATTERNS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	uarts[port].pos_len = queue_length;
+	uarts[port].pos_n = 0;
+	return ESP_OK;
+}
+
+int uart_pattern_pop_pos(uart_port_t port)
+{
+	int pos;
+
+	if (port < 0 || port >= UART_NUM_MAX || !uarts[port].installed || uarts[port].pos_n == 0) {
+		return -1;
+	}
+	pos = uarts[port].pos[0];
+	memmove(uarts[port].pos, uarts[port].pos + 1, --uarts[port].pos_n * sizeof(int));
+	return pos;
+}
@@ -0,0 +1,535 @@
+/*
+ * host_idf.h
+ *
+ * Notes:
+ * 		The slice of ESP-IDF (v3.3) that the host-tested modules use, backed
+ * 		by pthreads and POSIX sockets in host_rtos.c. Every stub header in
+ * 		this directory just includes this one. Behaviour is only as close to
+ * 		the chip as the tests need: tasks are threads, ticks are 10 ms, one
+ * 		lock serves every portMUX.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#ifndef TEST_STUBS_HOST_IDF_H_
+#define TEST_STUBS_HOST_IDF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <openssl/evp.h>
+
+/* newlib has strlcpy, glibc only from 2.38 */
+static inline size_t host_strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size > 0) {
+		size_t n = (len < size - 1) ? len : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+#define strlcpy		host_strlcpy
+
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ			100
+#endif
+
+/* esp_err.h */
+typedef int32_t esp_err_t;
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_INVALID_SIZE		0x104
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_NOT_SUPPORTED		0x106
+#define ESP_ERR_TIMEOUT				0x107
+#define ESP_ERR_INVALID_RESPONSE	0x108
+#define ESP_ERR_INVALID_CRC			0x109
+#define ESP_ERR_INVALID_VERSION		0x10A
+#define ESP_ERR_NVS_NOT_FOUND		0x1102
+#define ESP_ERR_OTA_VALIDATE_FAILED	0x1503
+const char *esp_err_to_name(esp_err_t code);
+
+/* esp_log.h: printed at or below host_log_level (default: errors) */
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+extern esp_log_level_t host_log_level;
+typedef int (*vprintf_like_t)(const char *, va_list);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+#define ESP_LOGE(tag, fmt, ...)		esp_log_write(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)		esp_log_write(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...)		esp_log_write(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)		esp_log_write(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...)		esp_log_write(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+/* FreeRTOS */
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef TickType_t portTickType;
+typedef uint32_t EventBits_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct host_task *TaskHandle_t;
+typedef struct host_sem *SemaphoreHandle_t;
+typedef struct host_group *EventGroupHandle_t;
+typedef struct host_queue *QueueHandle_t;
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	{ 0 }
+#define portENTER_CRITICAL(m)			host_critical(m, true)
+#define portEXIT_CRITICAL(m)			host_critical(m, false)
+#define portENTER_CRITICAL_ISR(m)		host_critical(m, true)
+#define portEXIT_CRITICAL_ISR(m)		host_critical(m, false)
+void host_critical(portMUX_TYPE *mux, bool enter);
+#define portTICK_PERIOD_MS			(1000 / CONFIG_FREERTOS_HZ)
+#define portTICK_RATE_MS			portTICK_PERIOD_MS
+#define portMAX_DELAY				((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(ms)			((TickType_t)((ms) * CONFIG_FREERTOS_HZ / 1000))
+#define pdTRUE						1
+#define pdFALSE						0
+#define pdPASS						1
+#define pdFAIL						0
+#define BIT0						0x00000001
+#define BIT1						0x00000002
+#define BIT2						0x00000004
+#define BIT3						0x00000008
+#define BIT4						0x00000010
+#define BIT5						0x00000020
+#define BIT6						0x00000040
+#define BIT7						0x00000080
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *prev_wake, TickType_t increment);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+EventGroupHandle_t xEventGroupCreate(void);
+void vEventGroupDelete(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait);
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t size);
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+BaseType_t xQueueReset(QueueHandle_t q);
+#define xQueueSendToBack			xQueueSend
+
+/*
+ * freertos/timers.h: timers run on simulated time only, from vTaskDelay,
+ * which stops at each expiry.
+ */
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *id,
+						   TimerCallbackFunction_t cb);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+/* esp_timer.h, esp_system.h, esp_task_wdt.h */
+int64_t esp_timer_get_time(void);
+uint32_t esp_random(void);
+void esp_restart(void) __attribute__((noreturn));
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+esp_err_t esp_task_wdt_init(uint32_t timeout_s, bool panic);
+esp_err_t esp_task_wdt_add(TaskHandle_t task);
+esp_err_t esp_task_wdt_reset(void);
+
+/*
+ * driver/gpio.h: pin levels kept in host_rtos.c. A pin reads back what was
+ * set, ANDed with host_gpio_read (open drain: a slave can hold it low).
+ */
+#define HOST_GPIOS					40
+typedef int gpio_num_t;
+typedef enum {
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT,
+	GPIO_MODE_OUTPUT,
+	GPIO_MODE_OUTPUT_OD,
+	GPIO_MODE_INPUT_OUTPUT_OD,
+	GPIO_MODE_INPUT_OUTPUT,
+} gpio_mode_t;
+typedef enum { GPIO_PULLUP_ONLY, GPIO_PULLDOWN_ONLY, GPIO_PULLUP_PULLDOWN, GPIO_FLOATING } gpio_pull_mode_t;
+typedef enum { GPIO_PULLUP_DISABLE = 0, GPIO_PULLUP_ENABLE } gpio_pullup_t;
+typedef enum { GPIO_PULLDOWN_DISABLE = 0, GPIO_PULLDOWN_ENABLE } gpio_pulldown_t;
+typedef enum { GPIO_PIN_INTR_DISABLE = 0 } gpio_int_type_t;
+typedef struct {
+	uint64_t pin_bit_mask;
+	gpio_mode_t mode;
+	gpio_pullup_t pull_up_en;
+	gpio_pulldown_t pull_down_en;
+	gpio_int_type_t intr_type;
+} gpio_config_t;
+esp_err_t gpio_config(const gpio_config_t *conf);
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode);
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+int gpio_get_level(gpio_num_t gpio);
+
+/*
+ * driver/i2c.h: command links are recorded as a list of ops, and
+ * i2c_master_cmd_begin hands them to host_i2c_bus, the test's devices
+ */
+typedef int i2c_port_t;
+#define I2C_NUM_0					0
+#define I2C_NUM_1					1
+#define I2C_NUM_MAX					2
+typedef enum { I2C_MODE_SLAVE = 0, I2C_MODE_MASTER } i2c_mode_t;
+typedef enum { I2C_MASTER_WRITE = 0, I2C_MASTER_READ } i2c_rw_t;
+typedef enum { I2C_MASTER_ACK = 0, I2C_MASTER_NACK, I2C_MASTER_LAST_NACK } i2c_ack_type_t;
+typedef struct {
+	i2c_mode_t mode;
+	int sda_io_num;
+	gpio_pullup_t sda_pullup_en;
+	int scl_io_num;
+	gpio_pullup_t scl_pullup_en;
+	struct { uint32_t clk_speed; } master;
+} i2c_config_t;
+typedef enum { HOST_I2C_START, HOST_I2C_WRITE, HOST_I2C_READ, HOST_I2C_STOP } host_i2c_kind_t;
+typedef struct {
+	host_i2c_kind_t kind;
+	uint8_t byte;				/* Written */
+	uint8_t *data;				/* Where a read goes */
+	bool ack;					/* Write: check the slave's ACK. Read: master ACKs. */
+} host_i2c_op_t;
+typedef struct host_i2c_cmd *i2c_cmd_handle_t;
+i2c_cmd_handle_t i2c_cmd_link_create(void);
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack_en);
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, i2c_ack_type_t ack);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t wait);
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf);
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len,
+							 int intr_alloc_flags);
+esp_err_t i2c_driver_delete(i2c_port_t port);
+
+/*
+ * driver/adc.h, esp_adc_cal.h: adc1_get_raw asks host_adc1_read, the
+ * test's signal source. Calibration is linear, 4095 is 3300 mV.
+ */
+typedef enum { ADC_UNIT_1 = 1, ADC_UNIT_2 = 2 } adc_unit_t;
+typedef enum { ADC_WIDTH_BIT_9 = 0, ADC_WIDTH_BIT_10, ADC_WIDTH_BIT_11, ADC_WIDTH_BIT_12 } adc_bits_width_t;
+typedef enum { ADC_ATTEN_DB_0 = 0, ADC_ATTEN_DB_2_5, ADC_ATTEN_DB_6, ADC_ATTEN_DB_11 } adc_atten_t;
+typedef enum {
+	ADC_CHANNEL_0 = 0, ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3,
+	ADC_CHANNEL_4, ADC_CHANNEL_5, ADC_CHANNEL_6, ADC_CHANNEL_7,
+} adc_channel_t;
+typedef adc_channel_t adc1_channel_t;
+typedef enum { ESP_ADC_CAL_VAL_EFUSE_VREF = 0, ESP_ADC_CAL_VAL_EFUSE_TP, ESP_ADC_CAL_VAL_DEFAULT_VREF } esp_adc_cal_value_t;
+typedef struct {
+	adc_unit_t adc_num;
+	adc_atten_t atten;
+	adc_bits_width_t bit_width;
+	uint32_t coeff_a;			/* mV per count, << 16 */
+	uint32_t coeff_b;			/* mV */
+	uint32_t vref;
+} esp_adc_cal_characteristics_t;
+esp_err_t adc1_config_width(adc_bits_width_t width);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+esp_err_t esp_adc_cal_check_efuse(esp_adc_cal_value_t value_type);
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+											 uint32_t default_vref, esp_adc_cal_characteristics_t *chars);
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars);
+
+/*
+ * driver/uart.h: what the test puts on a port with host_uart_rx comes
+ * out of uart_read_bytes, announced by a UART_DATA event on the driver's
+ * queue, and a UART_PATTERN_DET for each pattern character once detection
+ * is on. What the firmware writes goes to host_uart_tx, the test's device.
+ */
+typedef int uart_port_t;
+#define UART_NUM_0					0
+#define UART_NUM_1					1
+#define UART_NUM_2					2
+#define UART_NUM_MAX				3
+#define UART_FIFO_LEN				128
+#define UART_PIN_NO_CHANGE			(-1)
+typedef enum { UART_DATA_5_BITS = 0, UART_DATA_6_BITS, UART_DATA_7_BITS, UART_DATA_8_BITS } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE = 0, UART_PARITY_EVEN = 2, UART_PARITY_ODD = 3 } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 1, UART_STOP_BITS_1_5, UART_STOP_BITS_2 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE = 0, UART_HW_FLOWCTRL_RTS, UART_HW_FLOWCTRL_CTS } uart_hw_flowcontrol_t;
+typedef struct {
+	int baud_rate;
+	uart_word_length_t data_bits;
+	uart_parity_t parity;
+	uart_stop_bits_t stop_bits;
+	uart_hw_flowcontrol_t flow_ctrl;
+	uint8_t rx_flow_ctrl_thresh;
+} uart_config_t;
+typedef enum {
+	UART_DATA, UART_BREAK, UART_BUFFER_FULL, UART_FIFO_OVF, UART_FRAME_ERR, UART_PARITY_ERR,
+	UART_DATA_BREAK, UART_PATTERN_DET, UART_EVENT_MAX,
+} uart_event_type_t;
+typedef struct {
+	uart_event_type_t type;
+	size_t size;
+} uart_event_t;
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *conf);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size,
+							  QueueHandle_t *queue, int intr_alloc_flags);
+int uart_read_bytes(uart_port_t port, uint8_t *buf, uint32_t len, TickType_t wait);
+int uart_write_bytes(uart_port_t port, const char *src, size_t len);
+esp_err_t uart_flush(uart_port_t port);
+esp_err_t uart_flush_input(uart_port_t port);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *len);
+esp_err_t uart_enable_pattern_det_intr(uart_port_t port, char pattern_chr, uint8_t chr_num, int chr_tout,
+									   int post_idle, int pre_idle);
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queue_length);
+int uart_pattern_pop_pos(uart_port_t port);
+
+/* rom/ets_sys.h */
+void ets_delay_us(uint32_t us);
+
+/* nvs.h: in memory, strings and small blobs */
+typedef uint32_t nvs_handle;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode;
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value);
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *value, size_t *len);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t len);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *value, size_t *len);
+
+/*
+ * esp_partition.h, esp_spi_flash.h, esp_ota_ops.h: NOR flash in memory
+ * with a factory and two OTA app partitions. A write can only clear bits
+ * (as on the chip, it's ANDed in); host_flash_stats counts writes that
+ * needed an erase first. The bootloader's choice is only made at
+ * host_flash_boot, and esp_ota_set_boot_partition wants an image header.
+ */
+#define SPI_FLASH_SEC_SIZE			4096
+#define ESP_IMAGE_HEADER_MAGIC		0xE9
+typedef enum { ESP_PARTITION_TYPE_APP = 0x00, ESP_PARTITION_TYPE_DATA = 0x01 } esp_partition_type_t;
+typedef enum {
+	ESP_PARTITION_SUBTYPE_APP_FACTORY = 0x00,
+	ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+	ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11,
+	ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+typedef struct {
+	esp_partition_type_t type;
+	esp_partition_subtype_t subtype;
+	uint32_t address;
+	uint32_t size;
+	char label[17];
+	bool encrypted;
+} esp_partition_t;
+typedef struct host_part_it *esp_partition_iterator_t;
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t it);
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t it);
+void esp_partition_iterator_release(esp_partition_iterator_t it);
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t start, size_t size);
+bool esp_partition_check_identity(const esp_partition_t *a, const esp_partition_t *b);
+
+typedef struct {
+	uint32_t magic_word;
+	uint32_t secure_version;
+	uint32_t reserv1[2];
+	char version[32];
+	char project_name[32];
+	char time[16];
+	char date[16];
+	char idf_ver[32];
+	uint8_t app_elf_sha256[32];
+} esp_app_desc_t;
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *part);
+const esp_app_desc_t *esp_ota_get_app_description(void);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+
+/* esp_http_client.h: types only, a test that links a module using it supplies the client */
+typedef struct esp_http_client *esp_http_client_handle_t;
+typedef struct {
+	const char *url;
+	const char *cert_pem;
+	int timeout_ms;
+	int buffer_size;
+	void *user_data;
+} esp_http_client_config_t;
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+/* mbedtls/sha256.h on the host's libcrypto */
+typedef struct { EVP_MD_CTX *md; } mbedtls_sha256_context;
+static inline void mbedtls_sha256_init(mbedtls_sha256_context *ctx) { ctx->md = EVP_MD_CTX_new(); }
+static inline void mbedtls_sha256_free(mbedtls_sha256_context *ctx) { EVP_MD_CTX_free(ctx->md); }
+static inline int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224)
+{
+	return EVP_DigestInit_ex(ctx->md, is224 ? EVP_sha224() : EVP_sha256(), NULL) == 1 ? 0 : -1;
+}
+static inline int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *in, size_t len)
+{
+	return EVP_DigestUpdate(ctx->md, in, len) == 1 ? 0 : -1;
+}
+static inline int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char out[32])
+{
+	return EVP_DigestFinal_ex(ctx->md, out, NULL) == 1 ? 0 : -1;
+}
+
+/* lwIP: the real socket API, plus what the probes ask of the stack */
+typedef int err_t;
+#define ERR_OK						0
+typedef struct { uint32_t addr; } ip_addr_t;
+#define ip_addr_isany(a)			((a) == NULL || (a)->addr == 0)
+#define ip_2_ip4(a)					(a)
+const ip_addr_t *dns_getserver(uint8_t idx);
+struct netconn;
+
+/* esp_wifi_types.h, tcpip_adapter.h, esp_event_legacy.h: what wifi_manager.h names */
+typedef int wifi_bandwidth_t;
+typedef int wifi_ps_type_t;
+typedef struct { ip_addr_t ip, netmask, gw; } tcpip_adapter_ip_info_t;
+typedef struct { uint8_t ssid[33]; int8_t rssi; } wifi_ap_record_t;
+typedef union { struct { uint8_t ssid[32], password[64]; } sta; } wifi_config_t;
+typedef struct { int event_id; } system_event_t;
+
+/* mqtt_client.h (esp-mqtt): types only, a test that links a module using it supplies the client */
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+typedef enum {
+	MQTT_EVENT_ERROR = 0,
+	MQTT_EVENT_CONNECTED,
+	MQTT_EVENT_DISCONNECTED,
+	MQTT_EVENT_SUBSCRIBED,
+	MQTT_EVENT_UNSUBSCRIBED,
+	MQTT_EVENT_PUBLISHED,
+	MQTT_EVENT_DATA,
+	MQTT_EVENT_BEFORE_CONNECT,
+} esp_mqtt_event_id_t;
+typedef enum { MQTT_TRANSPORT_UNKNOWN, MQTT_TRANSPORT_OVER_TCP, MQTT_TRANSPORT_OVER_SSL } esp_mqtt_transport_t;
+#define MQTT_TCP_DEFAULT_PORT		1883
+#define MQTT_SSL_DEFAULT_PORT		8883
+typedef struct {
+	esp_mqtt_event_id_t event_id;
+	esp_mqtt_client_handle_t client;
+	void *user_context;
+	char *data;
+	int data_len;
+	int total_data_len;
+	int current_data_offset;
+	char *topic;
+	int topic_len;
+	int msg_id;
+	int session_present;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef esp_err_t (*mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+typedef struct {
+	mqtt_event_callback_t event_handle;
+	const char *host;
+	const char *uri;
+	uint32_t port;
+	const char *client_id;
+	const char *username;
+	const char *password;
+	int keepalive;
+	bool disable_clean_session;
+	esp_mqtt_transport_t transport;
+	const char *cert_pem;
+	void *user_context;
+} esp_mqtt_client_config_t;
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+
+/*
+ * Host-only control, see host_rtos.c:
+ *
+ * 		host_tasks_alive():	tasks created and not yet deleted
+ * 		host_task_longest_us():	longest any task has run since the last call
+ * 		host_sim_start():	switch to simulated time. esp_timer_get_time
+ * 							then only moves in vTaskDelay, which calls tick
+ * 							every 100 ms of it. Single-threaded use only.
+ * 		host_restart:		esp_restart longjmps here if set, else aborts
+ * 		host_twdt_fired:	times the task watchdog timed out (simulated
+ * 							time only), it panics if esp_task_wdt_init
+ * 							asked for that
+ * 		host_flash_reset():	erase the flash, boot and run the factory app
+ * 		host_flash_boot():	reset: run what the boot partition says
+ * 		host_flash_stats():	writes and erases since the last reset, and
+ * 							writes that tried to set a bit
+ * 		host_nvs_clear():	erase every key
+ * 		host_gpio_write:	called after every gpio_set_level
+ * 		host_gpio_read:		the level the outside world lets a pin have,
+ * 							1 if not set
+ * 		host_adc1_read:		what an ADC1 channel reads, 0 if not set
+ * 		host_i2c_bus:		the devices on the I2C bus: gets the ops of each
+ * 							command link run, returns its result (ESP_FAIL
+ * 							for a NACK, as the driver does). Not set: no
+ * 							one answers.
+ * 		host_uart_rx():		bytes arriving on a port, returns how many fit
+ * 							in its RX buffer (UART_BUFFER_FULL if not all)
+ * 		host_uart_tx:		gets what the firmware writes to a port
+ */
+int host_tasks_alive(void);
+int64_t host_task_longest_us(void);
+void host_sim_start(int64_t start_us, void (*tick)(int64_t now_us));
+#include <setjmp.h>
+extern jmp_buf *host_restart;
+extern int host_twdt_fired;
+void host_flash_reset(void);
+const esp_partition_t *host_flash_boot(void);
+typedef struct { uint32_t writes, erases, bad_writes; } host_flash_stats_t;
+void host_flash_stats(host_flash_stats_t *stats);
+void host_nvs_clear(void);
+extern void (*host_gpio_write)(gpio_num_t gpio, int level);
+extern int (*host_gpio_read)(gpio_num_t gpio);
+extern int (*host_adc1_read)(adc1_channel_t channel);
+extern esp_err_t (*host_i2c_bus)(i2c_port_t port, const host_i2c_op_t *ops, int n, TickType_t wait);
+size_t host_uart_rx(uart_port_t port, const uint8_t *data, size_t len);
+extern void (*host_uart_tx)(uart_port_t port, const uint8_t *data, size_t len);
+
+#endif /* TEST_STUBS_HOST_IDF_H_ */
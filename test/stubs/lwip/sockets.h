@@ -0,0 +1,10 @@
+#include "../host_idf.h"
+
+/*
+ * The probes dial fixed ports (53, 80) at addresses from the network. A
+ * test routes them to its stand-in servers through these, see test_probe.c.
+ */
+int host_connect(int sock, const struct sockaddr *addr, socklen_t len);
+ssize_t host_sendto(int sock, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t alen);
+#define connect(s, a, l)			host_connect(s, a, l)
+#define sendto(s, b, n, f, a, l)	host_sendto(s, b, n, f, a, l)
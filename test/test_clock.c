@@ -0,0 +1,239 @@
+/*
+ * test_clock.c
+ *
+ * Notes:
+ * 		Replays days of GPS RMC and SNTP samples through clock_if against a
+ * 		timer with an injected skew (and a daily wander on top), one
+ * 		CLOCK_Now a second, and checks that:
+ *
+ * 			- UTC never goes backwards, except when leaving the receiver's RTC
+ * 			- the error against the true time stays within the reported bound
+ * 			- the drift estimate ends up on the injected skew
+ * 			- the quality flag follows the sources that are up
+ *
+ * 		GPS samples are what time_if makes of an RMC sentence: the second
+ * 		it names, stamped on arrival less CONFIG_GPS_TIME_LATENCY_MS, with
+ * 		the real latency spread around that. The receiver is duty cycled
+ * 		(GPS standby), so GPS time only comes in for a few minutes an hour.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../main/clock_if.c"
+
+#define TEST_UTC0_S			1790000000LL	/* 2026-09-21 */
+#define TEST_LATENCY_US		150000			/* CONFIG_GPS_TIME_LATENCY_MS */
+#define TEST_HOUR_S			3600
+#define TEST_DAY_S			(24 * TEST_HOUR_S)
+#ifndef TEST_SEED
+#define TEST_SEED			1
+#endif
+
+typedef struct {
+	const char *name;
+	int days;
+	double ppm;					/* Timer skew: utc - mono grows at this rate */
+	double wander_ppm;			/* Daily swing on top (temperature) */
+	int gps_on_s;				/* GPS awake for this long every hour, 0: never */
+	int gps_jitter_ms;			/* RMC latency spread around TEST_LATENCY_US */
+	int gps_off_from_h, gps_off_h;	/* No fix for gps_off_h hours */
+	int sntp_every_s;			/* 0: no network */
+	int rtc_off_s;				/* Receiver's RTC before the first fix, 0: none */
+	int glitch_h;				/* A sentence 2 s off at this hour, 0: none */
+	uint32_t max_err_us;		/* Actual error, once out of CLOCK_Q_COARSE */
+	int rate_tol_ppb;			/* Final drift estimate to the injected skew */
+	clock_quality_t end_q;
+} scenario_t;
+
+/*
+ * The limits are regression bounds, with room over seeds 1-20 (build with
+ * -DTEST_SEED=n). The error bound reported by CLOCK_Now is checked on
+ * every reading, with no slack. SNTP alone takes three hourly samples
+ * before the drift is estimated, hence its larger error.
+ */
+static const scenario_t scenarios[] = {
+	{ "standby 2 min/h, 35 ppm",  5,  35, 0,   120, 50, 0,  0,  3600, 0,    0,  200000,  1000, CLOCK_Q_GPS },
+	{ "standby 2 min/h, -35 ppm", 5, -35, 0.5, 120, 50, 0,  0,  3600, 0,    0,  200000,  1000, CLOCK_Q_GPS },
+	{ "GPS lost a day, SNTP",     5,  35, 0.5, 120, 50, 40, 24, 3600, 0,    0,  200000,  1000, CLOCK_Q_GPS },
+	{ "GPS lost, no network",     3,  35, 0.5, 120, 50, 30, 48, 0,    0,    0,  200000,  1000, CLOCK_Q_HOLDOVER },
+	{ "SNTP only, 80 ppm",        3,  80, 0,   0,   0,  0,  0,  3600, 0,    0,  700000,  2000, CLOCK_Q_SNTP },
+	{ "RTC 2 h ahead",            2,  35, 0,   120, 50, 0,  0,  0,    7200, 0,  200000,  1000, CLOCK_Q_GPS },
+	{ "bad RMC second",           3,  35, 0,   600, 50, 0,  0,  0,    0,    30, 200000,  1000, CLOCK_Q_GPS },
+};
+
+static unsigned int seed = TEST_SEED;
+
+
+static double _uniform(void)
+{
+	return rand_r(&seed) / (double) RAND_MAX;
+}
+
+/*
+* @brief	True UTC at mono_us: the timer's skew plus a daily sine on top
+*/
+static int64_t _truth(const scenario_t *s, int64_t mono_us)
+{
+	double t = mono_us / 1e6;
+	double drift = s->ppm * t + s->wander_ppm * TEST_DAY_S / (2 * M_PI) * (1 - cos(2 * M_PI * t / TEST_DAY_S));
+
+	return TEST_UTC0_S * 1000000 + mono_us + llround(drift);
+}
+
+static int _run(const scenario_t *s)
+{
+	static clock_disc_t c;
+	clock_quality_t q, prev_q = CLOCK_Q_NONE;
+	int64_t mono, truth, utc, last = 0, sec, arrive;
+	uint32_t bound;
+	bool gps_on, fix, backward = false, over = false;
+	double err, max_err = 0, max_bound = 0;
+	long readings = 0;
+	int fails = 0, holdover = 0, rate_err;
+
+	CLOCK_Reset(&c);
+	for (int64_t t = 1; t <= (int64_t) s->days * TEST_DAY_S; t++) {
+		mono = t * 1000000;
+		truth = _truth(s, mono);
+
+		// RMC for the second that just started, on the wire some 150 ms later
+		gps_on = s->gps_on_s > 0 && (t < 1800 || t % TEST_HOUR_S < s->gps_on_s);
+		fix = !(t >= s->gps_off_from_h * TEST_HOUR_S && t < (s->gps_off_from_h + s->gps_off_h) * TEST_HOUR_S);
+		if (s->rtc_off_s && t < 600) {
+			fix = false;
+		}
+		if (gps_on && (fix || s->rtc_off_s)) {
+			sec = truth / 1000000 * 1000000;
+			arrive = mono - (truth - sec) + TEST_LATENCY_US + (_uniform() - 0.5) * s->gps_jitter_ms * 1000;
+			if (s->glitch_h && t / TEST_HOUR_S == s->glitch_h) {
+				sec += 2000000;
+			}
+			if (!fix) {
+				CLOCK_Sample(&c, CLOCK_SRC_GPS_RTC, arrive - TEST_LATENCY_US, sec + s->rtc_off_s * 1000000LL);
+			}
+			else {
+				CLOCK_Sample(&c, CLOCK_SRC_GPS, arrive - TEST_LATENCY_US, sec);
+			}
+		}
+		// lwIP SNTP: +-20 ms of network asymmetry
+		if (s->sntp_every_s && t % s->sntp_every_s == 60) {
+			CLOCK_Sample(&c, CLOCK_SRC_SNTP, mono, truth + (_uniform() - 0.5) * 40000);
+		}
+
+		q = CLOCK_Now(&c, mono, &utc, &bound);
+		if (q == CLOCK_Q_NONE) {
+			continue;
+		}
+		if (utc < last && prev_q != CLOCK_Q_COARSE && !backward) {
+			printf("  FAIL: went back %lld us at %llds (%d -> %d)\n", (long long) (last - utc),
+				   (long long) t, prev_q, q);
+			backward = true;
+			fails++;
+		}
+		last = utc;
+		prev_q = q;
+		holdover += q == CLOCK_Q_HOLDOVER;
+		if (q == CLOCK_Q_COARSE) {
+			continue;
+		}
+
+		readings++;
+		err = fabs((double) (utc - truth));
+		if (err > max_err) {
+			max_err = err;
+		}
+		if (bound > max_bound) {
+			max_bound = bound;
+		}
+		if (err > bound && !over) {
+			printf("  FAIL: %.0f us off at %llds, bound %u (quality %d)\n", err, (long long) t, bound, q);
+			over = true;
+			fails++;
+		}
+	}
+
+	rate_err = abs(c.rate_ppb - (int) lround(s->ppm * 1000));
+	printf("%-26s %6u %4u %3u %7d %5d %6d %8.0f %8.0f %6d\n", s->name, c.accepted, c.rejected, c.steps,
+		   c.rate_ppb, c.rate_err_ppb, rate_err, max_err, max_bound, holdover / TEST_HOUR_S);
+
+	if (readings == 0) {
+		printf("  FAIL: never disciplined\n");
+		return fails + 1;
+	}
+	if (max_err > s->max_err_us) {
+		printf("  FAIL: %.0f us off, at most %u\n", max_err, s->max_err_us);
+		fails++;
+	}
+	if (!c.rated || rate_err > s->rate_tol_ppb) {
+		printf("  FAIL: drift %d ppb, injected %.0f\n", c.rate_ppb, s->ppm * 1000);
+		fails++;
+	}
+	// The wander is deterministic, the sampling noise isn't: 2 sigma holds most of the time
+	if (s->wander_ppm == 0 && rate_err > 2 * c.rate_err_ppb + 100) {
+		printf("  FAIL: drift off by %d ppb, claimed 2 sigma %d\n", rate_err, c.rate_err_ppb);
+		fails++;
+	}
+	if (prev_q != s->end_q) {
+		printf("  FAIL: ended with quality %d, expected %d\n", prev_q, s->end_q);
+		fails++;
+	}
+	// With SNTP up, only until its next sample once GPS has gone quiet
+	if ((s->gps_off_h > 0 && s->sntp_every_s == 0) ? holdover == 0 : holdover > s->sntp_every_s) {
+		printf("  FAIL: %ds in holdover\n", holdover);
+		fails++;
+	}
+	if (s->glitch_h && (c.rejected == 0 || c.steps > 0)) {
+		printf("  FAIL: bad second taken (%u rejected, %u steps)\n", c.rejected, c.steps);
+		fails++;
+	}
+	if (s->rtc_off_s && c.steps != 1) {
+		printf("  FAIL: %u steps leaving the RTC, expected 1\n", c.steps);
+		fails++;
+	}
+	return fails;
+}
+
+static int _test_civil(void)
+{
+	static const struct { int y, mo, d, h, mi, s; int64_t epoch; } dates[] = {
+		{ 1970, 1, 1, 0, 0, 0, 0 },
+		{ 2000, 2, 29, 12, 0, 0, 951825600 },
+		{ 2026, 9, 21, 14, 13, 20, TEST_UTC0_S },
+		{ 2038, 1, 19, 3, 14, 8, 2147483648LL },
+		{ 2100, 3, 1, 0, 0, 0, 4107542400LL },
+	};
+	int fails = 0;
+
+	for (size_t i = 0; i < sizeof(dates) / sizeof(dates[0]); i++) {
+		int64_t got = CLOCK_FromCivil(dates[i].y, dates[i].mo, dates[i].d, dates[i].h, dates[i].mi, dates[i].s);
+
+		if (got != dates[i].epoch) {
+			printf("  FAIL: %04d-%02d-%02d %02d:%02d:%02d is %lld, expected %lld\n", dates[i].y,
+				   dates[i].mo, dates[i].d, dates[i].h, dates[i].mi, dates[i].s, (long long) got,
+				   (long long) dates[i].epoch);
+			fails++;
+		}
+	}
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	printf("%-26s %6s %4s %3s %7s %5s %6s %8s %8s %6s\n", "scenario", "taken", "rej", "stp", "ppb",
+		   "2sig", "off", "err us", "bound", "hold h");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i]);
+	}
+	printf("CLOCK_FromCivil\n");
+	fails += _test_civil();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
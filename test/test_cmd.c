@@ -0,0 +1,315 @@
+/*
+ * test_cmd.c
+ *
+ * Notes:
+ * 		Feeds payloads through CMD_Submit as the MQTT event handler does
+ * 		and checks what cmd_if makes of them: the "@id" prefix, argument
+ * 		count limits, unknown commands and the replies they get, and
+ * 		payloads that are dropped before they reach the queue.
+ *
+ * 		The parsing cases and the queue-full case drain the queue by hand,
+ * 		so nothing races the submitter. The last case runs the real
+ * 		cmd_task and pushes hundreds of commands through it while the
+ * 		queue keeps filling up, as a burst on the "all" topic would.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#define CONFIG_MQTT_ROOT_TOPIC		"airu"
+#define CONFIG_MQTT_ACK_QOS			1
+
+#include "../main/cmd_if.c"
+
+#define TEST_BURST			500
+#define TEST_WAIT_MS		5000
+
+typedef struct {
+	const char *payload;
+	const char *handler;		/* Handler that runs, NULL: none */
+	int argc;
+	const char *last_arg;
+	const char *req_id;
+	const char *reply;			/* Published on the ack topic, NULL: nothing */
+} parse_case_t;
+
+static const parse_case_t cases[] = {
+	{ "echo",                               "echo", 1, "echo", "",   NULL },
+	{ "@42 echo a b",                       "echo", 3, "b",    "42", NULL },
+	{ "  echo  a \r\n",                     "echo", 2, "a",    "",   NULL },
+	{ "echo   a\r\n",                       "echo", 2, "a",    "",   NULL },
+	{ "echo 1 2 3 4 5 6 7",                 "echo", 8, "7",    "",   NULL },
+	{ "echo 1 2 3 4 5 6 7 8",               NULL,   0, NULL,   "",   NULL },
+	{ "@5 echo 1 2 3 4 5 6 7 8",            NULL,   0, NULL,   "",   "@5 echo err invalid" },
+	{ "set x y",                            "set",  3, "y",    "",   NULL },
+	{ "set x",                              NULL,   0, NULL,   "",   NULL },
+	{ "@7 set x",                           NULL,   0, NULL,   "",   "@7 set err invalid" },
+	{ "@7 set x y z",                       NULL,   0, NULL,   "",   "@7 set err invalid" },
+	{ "opt",                                "opt",  1, "opt",  "",   NULL },
+	{ "opt a",                              "opt",  2, "a",    "",   NULL },
+	{ "@8 opt a b",                         NULL,   0, NULL,   "",   "@8 opt err invalid" },
+	{ "@9 nosuch",                          NULL,   0, NULL,   "",   "@9 nosuch err invalid" },
+	{ "@1 @2 echo",                         NULL,   0, NULL,   "",   "@1 @2 err invalid" },
+	{ "@7",                                 NULL,   0, NULL,   "",   NULL },
+	{ "@abcdefghijklmnopqrstuvwxyz echo",   "echo", 1, "echo", "abcdefghijklmno", NULL },
+	{ "@3 fail",                            "fail", 1, "fail", "3",  "@3 fail err -1" },
+	{ "fail",                               "fail", 1, "fail", "",   "fail err -1" },
+};
+
+static struct {
+	const char *handler;
+	int argc;
+	char last_arg[32];
+	char req_id[CMD_REQ_ID_LEN];
+	int seq[TEST_BURST];		/* Burst: times each "echo <n>" was handled */
+	int order_errors;
+	int next;
+	char reply[CMD_REPLY_LEN];
+	char topic[64];
+	int replies;
+} seen;
+
+char DEVICE_MAC[13] = "f4e5d6c7b8a9";
+
+
+int MQTT_Publish_General(const char *topic, const char *msg, int qos)
+{
+	(void) qos;
+	strlcpy(seen.topic, topic, sizeof(seen.topic));
+	strlcpy(seen.reply, msg, sizeof(seen.reply));
+	seen.replies++;
+	return 1;
+}
+
+static void _seen(const char *handler, const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	seen.handler = handler;
+	seen.argc = argc;
+	strlcpy(seen.last_arg, argv[argc - 1], sizeof(seen.last_arg));
+	strlcpy(seen.req_id, ctx->req_id, sizeof(seen.req_id));
+}
+
+static esp_err_t _echo(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	int n;
+
+	_seen("echo", ctx, argc, argv);
+	if (argc == 2 && sscanf(argv[1], "%d", &n) == 1 && n >= 0 && n < TEST_BURST) {
+		seen.order_errors += n != seen.next;
+		seen.next = n + 1;
+		seen.seq[n]++;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t _set(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	_seen("set", ctx, argc, argv);
+	return ESP_OK;
+}
+
+static esp_err_t _opt(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	_seen("opt", ctx, argc, argv);
+	return ESP_OK;
+}
+
+static esp_err_t _fail(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	_seen("fail", ctx, argc, argv);
+	return ESP_FAIL;
+}
+
+static esp_err_t _nop(const cmd_ctx_t *ctx, int argc, char **argv)
+{
+	(void) ctx; (void) argc; (void) argv;
+	return ESP_OK;
+}
+
+/*
+* @brief	What cmd_task does, for whatever is queued now
+*
+* @return	jobs run
+*/
+static int _drain(void)
+{
+	cmd_job_t *job;
+	int n = 0;
+
+	while (xQueueReceive(cmd_queue, &job, 0) == pdTRUE) {
+		_cmd_dispatch(job);
+		free(job);
+		n++;
+	}
+	return n;
+}
+
+static int _test_registry(void)
+{
+	static const cmd_t mine[] = {
+		{ "echo", _echo, 0, CMD_MAX_ARGS - 1 },
+		{ "set",  _set,  2, 2 },
+		{ "opt",  _opt,  0, 1 },
+		{ "fail", _fail, 0, 0 },
+	};
+	cmd_t filler = { "nop", _nop, 0, 0 };
+	int fails = 0;
+
+	for (size_t i = 0; i < sizeof(mine) / sizeof(mine[0]); i++) {
+		fails += CMD_Register(&mine[i]) != ESP_OK;
+	}
+	while (command_count < CMD_MAX_COMMANDS) {
+		fails += CMD_Register(&filler) != ESP_OK;
+	}
+	if (CMD_Register(&filler) != ESP_ERR_NO_MEM) {
+		printf("  FAIL: registered past CMD_MAX_COMMANDS\n");
+		fails++;
+	}
+	return fails;
+}
+
+static int _test_parse(void)
+{
+	int fails = 0;
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const parse_case_t *c = &cases[i];
+		bool ok;
+
+		memset(&seen, 0, sizeof(seen));
+		if (CMD_Submit(c->payload, strlen(c->payload)) != ESP_OK || _drain() != 1) {
+			printf("  FAIL: \"%s\" not queued\n", c->payload);
+			fails++;
+			continue;
+		}
+		ok = (c->handler == NULL) ? seen.handler == NULL
+			 : (seen.handler != NULL && strcmp(seen.handler, c->handler) == 0 && seen.argc == c->argc &&
+				strcmp(seen.last_arg, c->last_arg) == 0 && strcmp(seen.req_id, c->req_id) == 0);
+		ok = ok && (c->reply == NULL ? seen.replies == 0
+					: (seen.replies == 1 && strcmp(seen.reply, c->reply) == 0 &&
+					   strcmp(seen.topic, "airu/ack/f4e5d6c7b8a9") == 0));
+		if (!ok) {
+			printf("  FAIL: \"%s\": ran %s argc %d last \"%s\" id \"%s\", %d replies \"%s\"\n", c->payload,
+				   seen.handler ? seen.handler : "nothing", seen.argc, seen.last_arg, seen.req_id, seen.replies,
+				   seen.reply);
+			fails++;
+		}
+	}
+	return fails;
+}
+
+static int _test_dropped(void)
+{
+	static char big[CMD_MAX_LEN + 1];
+	const char *raw = "echo abc";
+	cmd_stats_t before, after;
+	int fails = 0;
+
+	CMD_GetStats(&before);
+	memset(big, 'x', CMD_MAX_LEN);
+	fails += CMD_Submit("", 0) != ESP_FAIL;
+	fails += CMD_Submit(big, CMD_MAX_LEN) != ESP_FAIL;
+	fails += CMD_Submit(big, CMD_MAX_LEN - 1) != ESP_OK;		/* Longest accepted: unknown command */
+
+	// The payload is not NUL terminated, only len counts
+	memset(&seen, 0, sizeof(seen));
+	fails += CMD_Submit(raw, 6) != ESP_OK;
+	_drain();
+	if (seen.handler == NULL || seen.argc != 2 || strcmp(seen.last_arg, "a") != 0) {
+		printf("  FAIL: \"echo abc\" cut to 6 bytes gave argc %d last \"%s\"\n", seen.argc, seen.last_arg);
+		fails++;
+	}
+
+	// Queue full: the submitter is the MQTT event task, it must never wait
+	for (int i = 0; i < CMD_QUEUE_LEN; i++) {
+		fails += CMD_Submit("echo", 4) != ESP_OK;
+	}
+	if (CMD_Submit("echo", 4) != ESP_FAIL) {
+		printf("  FAIL: queued past CMD_QUEUE_LEN\n");
+		fails++;
+	}
+	if (_drain() != CMD_QUEUE_LEN) {
+		printf("  FAIL: queue didn't hold CMD_QUEUE_LEN jobs\n");
+		fails++;
+	}
+
+	CMD_GetStats(&after);
+	if (after.dropped - before.dropped != 3 || after.received - before.received != 13 ||
+		after.unknown - before.unknown != 1) {
+		printf("  FAIL: %u dropped, %u received, %u unknown; expected 3, 13, 1\n", after.dropped - before.dropped,
+			   after.received - before.received, after.unknown - before.unknown);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	Hundreds of commands through the real cmd_task. The submitter
+* 			resends what the full queue turned away, as the broker would
+* 			redeliver a QoS 1 command.
+*/
+static int _test_burst(void)
+{
+	char msg[32];
+	cmd_stats_t before, st;
+	int rejected = 0, fails = 0, len, waited = 0;
+
+	CMD_GetStats(&before);
+	memset(&seen, 0, sizeof(seen));
+	xTaskCreate(&cmd_task, "cmd_task", CMD_TASK_STACK, NULL, CMD_TASK_PRIO, NULL);
+
+	for (int i = 0; i < TEST_BURST; i++) {
+		len = snprintf(msg, sizeof(msg), "@%d echo %d", i, i);
+		while (CMD_Submit(msg, len) != ESP_OK) {
+			rejected++;
+			vTaskDelay(1);
+		}
+	}
+	do {
+		vTaskDelay(1);
+		CMD_GetStats(&st);
+	} while (st.handled - before.handled < TEST_BURST && ++waited < TEST_WAIT_MS);
+
+	printf("%d commands, %d turned away by a full queue, longest submit %u us, longest wait %u us\n",
+		   TEST_BURST, rejected, st.max_submit_us, st.max_queue_us);
+	if (st.handled - before.handled != TEST_BURST) {
+		printf("  FAIL: %u of %d handled\n", st.handled - before.handled, TEST_BURST);
+		return 1;
+	}
+	for (int i = 0; i < TEST_BURST; i++) {
+		if (seen.seq[i] != 1) {
+			printf("  FAIL: \"echo %d\" handled %d times\n", i, seen.seq[i]);
+			fails++;
+			break;
+		}
+	}
+	if (seen.order_errors) {
+		printf("  FAIL: %d commands out of order\n", seen.order_errors);
+		fails++;
+	}
+	if (st.dropped - before.dropped != (uint32_t) rejected) {
+		printf("  FAIL: %u counted as dropped, %d turned away\n", st.dropped - before.dropped, rejected);
+		fails++;
+	}
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	cmd_queue = xQueueCreate(CMD_QUEUE_LEN, sizeof(cmd_job_t *));
+
+	printf("registry\n");
+	fails += _test_registry();
+	printf("parsing, %zu payloads\n", sizeof(cases) / sizeof(cases[0]));
+	fails += _test_parse();
+	printf("dropped payloads, full queue\n");
+	fails += _test_dropped();
+	printf("burst through cmd_task\n");
+	fails += _test_burst();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
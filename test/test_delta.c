@@ -0,0 +1,429 @@
+/*
+ * test_delta.c
+ *
+ * Notes:
+ * 		Makes patches with main/mkpatch.py between synthetic firmware
+ * 		images and applies them with delta_if, reading the old image back
+ * 		from the flash emulator's factory partition and writing the new
+ * 		one into ota_0, the patch fed in random sized pieces as it would
+ * 		arrive over HTTP. Checks the rebuilt image against the manifest
+ * 		mkpatch.py writes and reports the patch size as a share of the
+ * 		full image.
+ *
+ * 		The images are made of functions that call each other by absolute
+ * 		address, and a string table. Moving code changes every call into
+ * 		what moved, as a real relink does, which is what the diff blocks
+ * 		are for.
+ *
+ * 		Also feeds patches that must be refused: made against another
+ * 		image, truncated, or with a broken header or control record.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include "../main/delta_if.c"
+
+#define TEST_FUNCS			400
+#define TEST_STRINGS		200
+#define TEST_IMAGE_MAX		(512 * 1024)
+#define TEST_BASE			0x400d0020		/* Where the app is mapped */
+#define TEST_MAX_FEED		4096
+#ifndef TEST_SEED
+#define TEST_SEED			1
+#endif
+
+/*
+ * A firmware build: which body each function has, in link order, and the
+ * string table. An edit is a change to these.
+ */
+typedef struct {
+	unsigned body[TEST_FUNCS + 1];
+	int funcs;
+	unsigned strings[TEST_STRINGS];
+} build_t;
+
+typedef struct {
+	const char *name;
+	void (*edit)(build_t *b);
+	double max_ratio;			/* Patch size / new image size */
+} scenario_t;
+
+typedef struct {
+	const esp_partition_t *part;
+	uint32_t written, erased;
+} sink_t;
+
+static unsigned int seed = TEST_SEED;
+static uint8_t old_img[TEST_IMAGE_MAX], new_img[TEST_IMAGE_MAX];
+static size_t old_len, new_len;
+static uint8_t *patch;
+static size_t patch_len;
+static char dir[] = "/tmp/test_delta.XXXXXX";
+
+void print_sha256(const uint8_t *image_hash, const char *label) { (void) image_hash; (void) label; }
+
+
+static void _edit_string(build_t *b) { b->strings[TEST_STRINGS / 2]++; }
+static void _edit_one(build_t *b) { b->body[TEST_FUNCS / 4]++; }
+
+static void _edit_insert(build_t *b)
+{
+	memmove(&b->body[51], &b->body[50], (b->funcs - 50) * sizeof(b->body[0]));
+	b->body[50] = 999999;
+	b->funcs++;
+}
+
+static void _edit_tenth(build_t *b)
+{
+	for (int i = 0; i < b->funcs; i += 10) {
+		b->body[i] += 1000000;
+	}
+}
+
+static void _edit_all(build_t *b)
+{
+	for (int i = 0; i < b->funcs; i++) {
+		b->body[i] += 2000000;
+	}
+	for (int i = 0; i < TEST_STRINGS; i++) {
+		b->strings[i] += 2000000;
+	}
+}
+
+/*
+ * Regression bounds, with room over what mkpatch.py makes today. A changed
+ * function usually changes size, so every call into the code linked after
+ * it changes too; that, not the function itself, is most of its patch.
+ */
+static const scenario_t scenarios[] = {
+	{ "string changed",        _edit_string, 0.01 },
+	{ "one function changed",  _edit_one,    0.10 },
+	{ "function inserted",     _edit_insert, 0.15 },
+	{ "10% of functions",      _edit_tenth,  0.25 },
+	{ "unrelated build",       _edit_all,    1.05 },
+};
+
+static size_t _func_len(unsigned body)
+{
+	unsigned s = body;
+
+	return 64 + rand_r(&s) % 960;
+}
+
+/*
+* @brief	Link a build: image header, functions, strings
+*/
+static size_t _link(const build_t *b, uint8_t *out)
+{
+	uint32_t addr[TEST_FUNCS + 1];
+	size_t len = 24, at;
+	unsigned s;
+
+	memset(out, 0, len);
+	out[0] = 0xE9;
+	for (int i = 0, off = len; i < b->funcs; off += _func_len(b->body[i]), i++) {
+		addr[i] = TEST_BASE + off;
+	}
+	for (int i = 0; i < b->funcs; i++) {
+		s = b->body[i];
+		at = len + _func_len(b->body[i]);
+		rand_r(&s);
+		while (len + 5 <= at) {
+			// Mostly short instructions from a small set, a call now and then
+			if (rand_r(&s) % 12 == 0) {
+				uint32_t to = addr[rand_r(&s) % b->funcs];
+
+				out[len++] = 0xE5;
+				memcpy(out + len, &to, 4);
+				len += 4;
+			}
+			else {
+				out[len++] = 0x10 + rand_r(&s) % 32;
+				out[len++] = rand_r(&s) % 16;
+				out[len++] = rand_r(&s);
+			}
+		}
+		while (len < at) {
+			out[len++] = 0x00;
+		}
+	}
+	for (int i = 0; i < TEST_STRINGS; i++) {
+		len += sprintf((char *) out + len, "sensor %u: reading %u out of range", b->strings[i] % 97,
+					   b->strings[i]) + 1;
+	}
+	return len;
+}
+
+static bool _write_file(const char *name, const uint8_t *data, size_t len)
+{
+	char path[64];
+	FILE *f;
+	bool ok;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "wb")) == NULL) {
+		return false;
+	}
+	ok = fwrite(data, 1, len, f) == len;
+	return fclose(f) == 0 && ok;
+}
+
+static uint8_t *_read_file(const char *name, size_t *len)
+{
+	char path[64];
+	uint8_t *data = NULL;
+	FILE *f;
+	long n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "rb")) == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	rewind(f);
+	if ((data = malloc(n + 1)) != NULL && fread(data, 1, n, f) == (size_t) n) {
+		data[n] = '\0';
+		*len = n;
+	}
+	fclose(f);
+	return data;
+}
+
+/*
+* @brief	mkpatch.py old.bin new.bin new.patch
+*/
+static bool _mkpatch(void)
+{
+	char cmd[256];
+
+	free(patch);
+	patch = NULL;
+	if (!_write_file("old.bin", old_img, old_len) || !_write_file("new.bin", new_img, new_len)) {
+		return false;
+	}
+	snprintf(cmd, sizeof(cmd), "%s %s/mkpatch.py %s/old.bin %s/new.bin %s/new.patch >/dev/null", HOST_PYTHON,
+			 HOST_MAIN_DIR, dir, dir, dir);
+	return system(cmd) == 0 && (patch = _read_file("new.patch", &patch_len)) != NULL;
+}
+
+static esp_err_t _sink_cb(void *arg, const uint8_t *data, size_t len)
+{
+	sink_t *sink = arg;
+	esp_err_t err;
+
+	while (sink->erased < sink->written + len) {
+		if ((err = esp_partition_erase_range(sink->part, sink->erased, SPI_FLASH_SEC_SIZE)) != ESP_OK) {
+			return err;
+		}
+		sink->erased += SPI_FLASH_SEC_SIZE;
+	}
+	if ((err = esp_partition_write(sink->part, sink->written, data, len)) == ESP_OK) {
+		sink->written += len;
+	}
+	return err;
+}
+
+/*
+* @brief	Old image in the factory partition, as the running firmware
+*/
+static const esp_partition_t *_flash_old(const uint8_t *img, size_t len)
+{
+	const esp_partition_t *factory;
+
+	host_flash_reset();
+	factory = esp_ota_get_running_partition();
+	esp_partition_write(factory, 0, img, len);
+	return factory;
+}
+
+/*
+* @brief	Feed p in random sized pieces, then finish
+*
+* @return	the first error
+*/
+static esp_err_t _apply(const uint8_t *p, size_t len, sink_t *sink)
+{
+	static delta_t d;
+	esp_err_t err = ESP_OK;
+	size_t n;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->part = esp_ota_get_next_update_partition(NULL);
+	DELTA_Begin(&d, esp_ota_get_running_partition(), _sink_cb, sink);
+	for (size_t off = 0; off < len && err == ESP_OK; off += n) {
+		n = 1 + rand_r(&seed) % TEST_MAX_FEED;
+		n = (n > len - off) ? len - off : n;
+		err = DELTA_Feed(&d, p + off, n);
+	}
+	return err != ESP_OK ? err : DELTA_Finish(&d);
+}
+
+/*
+* @brief	What the manifest next to the patch says the new image hashes to
+* 			matches what landed in flash
+*/
+static bool _manifest_matches(const sink_t *sink)
+{
+	static uint8_t buf[TEST_IMAGE_MAX];
+	uint8_t sha[SHA256_HASH_LEN];
+	char hex[2 * SHA256_HASH_LEN + 1];
+	mbedtls_sha256_context ctx;
+	char *manifest;
+	size_t len;
+	bool ok;
+
+	if ((manifest = (char *) _read_file("new.patch.sha256", &len)) == NULL) {
+		return false;
+	}
+	esp_partition_read(sink->part, 0, buf, sink->written);
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	mbedtls_sha256_update_ret(&ctx, buf, sink->written);
+	mbedtls_sha256_finish_ret(&ctx, sha);
+	mbedtls_sha256_free(&ctx);
+	for (int i = 0; i < SHA256_HASH_LEN; i++) {
+		sprintf(hex + 2 * i, "%02x", sha[i]);
+	}
+	ok = strncmp(manifest, hex, 2 * SHA256_HASH_LEN) == 0;
+	free(manifest);
+	return ok;
+}
+
+static int _run(const scenario_t *s, const build_t *base)
+{
+	static uint8_t buf[TEST_IMAGE_MAX];
+	build_t next = *base;
+	host_flash_stats_t st;
+	sink_t sink;
+	esp_err_t err;
+	double ratio;
+	int fails = 0;
+
+	s->edit(&next);
+	new_len = _link(&next, new_img);
+	if (!_mkpatch()) {
+		printf("  FAIL: %s: mkpatch.py failed\n", s->name);
+		return 1;
+	}
+	_flash_old(old_img, old_len);
+	err = _apply(patch, patch_len, &sink);
+	host_flash_stats(&st);
+	ratio = (double) patch_len / new_len;
+	printf("%-22s %7zu %7zu %7zu %6.1f%%\n", s->name, old_len, new_len, patch_len, 100 * ratio);
+
+	if (err != ESP_OK || sink.written != new_len) {
+		printf("  FAIL: %s: %s after %u bytes\n", s->name, esp_err_to_name(err), sink.written);
+		return 1;
+	}
+	esp_partition_read(sink.part, 0, buf, new_len);
+	if (memcmp(buf, new_img, new_len) != 0 || !_manifest_matches(&sink) || st.bad_writes != 0) {
+		printf("  FAIL: %s: rebuilt image differs\n", s->name);
+		fails++;
+	}
+	if (ratio > s->max_ratio) {
+		printf("  FAIL: %s: patch is %.1f%% of the image, at most %.1f%%\n", s->name, 100 * ratio,
+			   100 * s->max_ratio);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	Patches that must not produce an image
+*/
+static int _test_refused(const build_t *base)
+{
+	static uint8_t bad[TEST_IMAGE_MAX + 64];
+	build_t next = *base;
+	sink_t sink;
+	esp_err_t err;
+	int fails = 0;
+	struct {
+		const char *name;
+		size_t len;
+		esp_err_t expect;
+	} cases[] = {
+		{ "made against another image", 0, ESP_ERR_INVALID_VERSION },
+		{ "truncated",                  0, ESP_ERR_INVALID_SIZE },
+		{ "not a patch",                0, ESP_ERR_INVALID_STATE },
+		{ "old image larger than flash",0, ESP_ERR_INVALID_VERSION },
+		{ "record past the new size",   0, ESP_ERR_INVALID_SIZE },
+	};
+
+	_edit_one(&next);
+	new_len = _link(&next, new_img);
+	if (!_mkpatch()) {
+		printf("  FAIL: mkpatch.py failed\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		memcpy(bad, patch, patch_len);
+		cases[i].len = patch_len;
+		switch (i) {
+		case 0:
+			old_img[1000] ^= 1;
+			break;
+		case 1:
+			cases[i].len = patch_len / 2;
+			break;
+		case 2:
+			bad[0] = 'X';
+			break;
+		case 3:
+			bad[8] = bad[9] = bad[10] = bad[11] = 0x7f;
+			break;
+		case 4:
+			bad[DELTA_HEADER_LEN + 4] = bad[DELTA_HEADER_LEN + 5] = 0xff;	/* First record's extra_len */
+			break;
+		}
+		_flash_old(old_img, old_len);
+		err = _apply(bad, cases[i].len, &sink);
+		printf("%-30s %s\n", cases[i].name, esp_err_to_name(err));
+		if (err != cases[i].expect) {
+			printf("  FAIL: %s: %s, expected %s\n", cases[i].name, esp_err_to_name(err),
+				   esp_err_to_name(cases[i].expect));
+			fails++;
+		}
+		if (i == 0) {
+			old_img[1000] ^= 1;
+		}
+	}
+	return fails;
+}
+
+int main(void)
+{
+	build_t base = { .funcs = TEST_FUNCS };
+	char cmd[64];
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (int i = 0; i < TEST_FUNCS; i++) {
+		base.body[i] = rand_r(&seed);
+	}
+	for (int i = 0; i < TEST_STRINGS; i++) {
+		base.strings[i] = rand_r(&seed) % 100000;
+	}
+	old_len = _link(&base, old_img);
+
+	printf("decoder state %zu bytes\n", sizeof(delta_t));
+	printf("%-22s %7s %7s %7s %7s\n", "scenario", "old", "new", "patch", "ratio");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i], &base);
+	}
+	printf("refused patches\n");
+	fails += _test_refused(&base);
+
+	free(patch);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+# test_diagdecode.py
+#
+# Builds diag_rtc_t records the way diag_if.c does (ring[head % RING_LEN],
+# CRC-32 over everything before the crc field) and checks that
+# main/diagdecode.py gets the breadcrumbs back oldest first, including
+# after the ring has wrapped, and refuses damaged records.
+#
+#   python3 test/test_diagdecode.py
+#
+#  Created on: Oct 19, 2026
+#      Author: tombo
+#
+
+import contextlib
+import io
+import os
+import re
+import struct
+import sys
+import unittest
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "main"))
+
+import diagdecode  # noqa: E402
+
+
+def _header_define(name):
+    with open(os.path.join(HERE, "..", "main", "include", "diag_if.h")) as f:
+        m = re.search(r"#define\s+%s\s+(\w+)" % name, f.read())
+    return int(m.group(1), 0)
+
+
+def _record(crumbs, head=None, boots=7, min_heap=51200, task=b"data_task", errs=(0, 0, 0)):
+    """crumbs: (uptime, kind, code) in the order DIAG_Crumb was called"""
+    head = len(crumbs) if head is None else head
+    ring = [(0, 0, 0)] * diagdecode.RING_LEN
+    for i, crumb in enumerate(crumbs):
+        ring[i % diagdecode.RING_LEN] = crumb
+
+    raw = diagdecode.HEADER.pack(diagdecode.MAGIC, boots, head, min_heap, task, *errs)
+    for crumb in ring:
+        raw += diagdecode.CRUMB.pack(*crumb)
+    return raw + struct.pack("<I", zlib.crc32(raw))
+
+
+def _crumbs(n):
+    # A boot, then watchdog crumbs numbered by the order they were written
+    return [(0, 0, 1)] + [(10 * i, 4, i) for i in range(1, n)]
+
+
+class LayoutTest(unittest.TestCase):
+
+    def test_matches_diag_if_h(self):
+        self.assertEqual(diagdecode.MAGIC, _header_define("DIAG_MAGIC"))
+        self.assertEqual(diagdecode.RING_LEN, _header_define("DIAG_RING_LEN"))
+        self.assertEqual(diagdecode.TASK_LEN, _header_define("DIAG_TASK_LEN"))
+
+    def test_record_size(self):
+        # sizeof(diag_rtc_t): 4 words, task name, 3 errors, ring, crc
+        self.assertEqual(len(_record([])), 16 + 12 + 12 + 16 * 12 + 4)
+
+
+class DecodeTest(unittest.TestCase):
+
+    def test_fields(self):
+        rec = diagdecode.decode(_record(_crumbs(3), errs=(-1, 0x107, 2)))
+        self.assertEqual(rec["boots"], 7)
+        self.assertEqual(rec["min_heap"], 51200)
+        self.assertEqual(rec["last_task"], "data_task")
+        self.assertEqual(rec["last_err"], {"mqtt": -1, "sd": 0x107, "wifi": 2})
+
+    def test_empty(self):
+        rec = diagdecode.decode(_record([]))
+        self.assertEqual(rec["crumbs"], [])
+        self.assertEqual(rec["dropped"], 0)
+
+    def test_partial_ring(self):
+        crumbs = _crumbs(5)
+        rec = diagdecode.decode(_record(crumbs))
+        self.assertEqual(rec["crumbs"], crumbs)
+        self.assertEqual(rec["dropped"], 0)
+
+    def test_full_ring(self):
+        crumbs = _crumbs(diagdecode.RING_LEN)
+        rec = diagdecode.decode(_record(crumbs))
+        self.assertEqual(rec["crumbs"], crumbs)
+        self.assertEqual(rec["dropped"], 0)
+
+    def test_wrapped_once(self):
+        crumbs = _crumbs(diagdecode.RING_LEN + 5)
+        rec = diagdecode.decode(_record(crumbs))
+        self.assertEqual(rec["crumbs"], crumbs[-diagdecode.RING_LEN:])
+        self.assertEqual(rec["dropped"], 5)
+
+    def test_wrapped_many_times(self):
+        # head isn't a multiple of RING_LEN, so the oldest crumb is mid-ring
+        crumbs = _crumbs(10 * diagdecode.RING_LEN + 3)
+        rec = diagdecode.decode(_record(crumbs))
+        self.assertEqual(rec["crumbs"], crumbs[-diagdecode.RING_LEN:])
+        self.assertEqual(rec["crumbs"][0][2], 9 * diagdecode.RING_LEN + 3)
+        self.assertEqual(rec["dropped"], 9 * diagdecode.RING_LEN + 3)
+
+    def test_head_at_uint32_max(self):
+        # Only head % RING_LEN matters: the ring holds the last RING_LEN crumbs
+        head = 2 ** 32 - 1
+        crumbs = [(i, 4, i) for i in range(diagdecode.RING_LEN)]
+        raw = _record([], head=head)
+        ring = bytearray(raw)
+        for i, crumb in enumerate(crumbs):
+            slot = (head - diagdecode.RING_LEN + i) % diagdecode.RING_LEN
+            diagdecode.CRUMB.pack_into(ring, diagdecode.HEADER.size + slot * diagdecode.CRUMB.size, *crumb)
+        struct.pack_into("<I", ring, len(ring) - 4, zlib.crc32(bytes(ring[:-4])))
+        rec = diagdecode.decode(bytes(ring))
+        self.assertEqual(rec["crumbs"], crumbs)
+
+
+class DamageTest(unittest.TestCase):
+
+    def test_corrupted_payload(self):
+        raw = bytearray(_record(_crumbs(diagdecode.RING_LEN + 5)))
+        raw[diagdecode.HEADER.size + 3 * diagdecode.CRUMB.size] ^= 0x01
+        with self.assertRaisesRegex(ValueError, "CRC"):
+            diagdecode.decode(bytes(raw))
+
+    def test_corrupted_crc(self):
+        raw = bytearray(_record(_crumbs(3)))
+        raw[-1] ^= 0x80
+        with self.assertRaisesRegex(ValueError, "CRC"):
+            diagdecode.decode(bytes(raw))
+
+    def test_bad_magic(self):
+        raw = bytearray(_record(_crumbs(3)))
+        raw[0] ^= 0xff
+        with self.assertRaisesRegex(ValueError, "magic"):
+            diagdecode.decode(bytes(raw))
+
+    def test_truncated(self):
+        with self.assertRaisesRegex(ValueError, "bytes"):
+            diagdecode.decode(_record(_crumbs(3))[:-1])
+
+
+class MainTest(unittest.TestCase):
+
+    def _run(self, *argv):
+        out = io.StringIO()
+        sys.argv = ["diagdecode.py"] + list(argv)
+        with contextlib.redirect_stdout(out):
+            rc = diagdecode.main()
+        return rc, out.getvalue()
+
+    def test_message(self):
+        raw = _record(_crumbs(diagdecode.RING_LEN + 2))
+        rc, out = self._run("diag 6 " + raw.hex())
+        self.assertEqual(rc, 0)
+        self.assertIn("reset:     task wdt", out)
+        self.assertIn("(2 older breadcrumbs dropped)", out)
+        self.assertIn("watchdog (gps)", out)
+        self.assertEqual(len(re.findall(r"^\s+\d+s  ", out, re.M)), diagdecode.RING_LEN)
+
+    def test_usage(self):
+        rc, out = self._run("nope")
+        self.assertEqual(rc, 1)
+        self.assertIn("usage", out)
+
+
+if __name__ == "__main__":
+    unittest.main()
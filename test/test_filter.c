@@ -0,0 +1,458 @@
+/*
+ * test_filter.c
+ *
+ * Notes:
+ * 		Checks the fixed-point chain against straightforward references:
+ * 		a sorted median of three, a CIC computed as ORDER cascaded moving
+ * 		sums in 64-bit, and an EMA in double. Also drives the CIC
+ * 		integrators through a 64-bit wraparound, and checks that nothing
+ * 		comes out while the filter is still filling.
+ *
+ * 		Then measures the noise floor: RMS of each stage's output on
+ * 		white Gaussian noise around a DC level, against the input's and,
+ * 		for the CIC, against its noise gain worked out from the impulse
+ * 		response. And the cost per input sample of each stage on the
+ * 		host, in ns and, on x86, TSC cycles.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TEST_CYCLES()		((int64_t) __rdtsc())
+#else
+#define TEST_CYCLES()		0LL
+#endif
+#include "../main/filter_if.c"
+
+#define TEST_R			10
+#define TEST_N			(200 * TEST_R)
+#define TEST_NOISE_R	64				/* As CONFIG_MICS4514_DECIMATION */
+#define TEST_NOISE_N	(2000 * TEST_NOISE_R)
+#define TEST_NOISE_DC	2000			/* ADC counts */
+#define TEST_NOISE_SD	200.0
+#define TEST_NOISE_SKIP	16				/* Outputs left out while the EMA settles */
+#define TEST_COST_RUNS	8				/* Passes over the noise for timing */
+
+static int fails = 0;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); fails++; } \
+	} while (0)
+
+
+static int32_t _rand_in(int32_t lo, int32_t hi)
+{
+	return lo + (int32_t) (((uint32_t) rand() << 8 ^ rand()) % (uint32_t) (hi - lo + 1));
+}
+
+static double _gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double _rms(const int32_t *y, int n, int32_t level)
+{
+	double sum = 0;
+
+	for (int i = 0; i < n; i++) {
+		sum += (double) (y[i] - level) * (y[i] - level);
+	}
+	return n ? sqrt(sum / n) : 0;
+}
+
+static int64_t _ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+* @brief	Reference CIC: ORDER moving sums of R, every R-th sum (no
+* 			warm-up suppression), rounded the way FILT_CIC_Push rounds
+*/
+static int _cic_ref(const int32_t *x, int n, int r, int32_t *out)
+{
+	static int64_t stage[FILT_CIC_ORDER + 1][TEST_N];
+	int64_t gain = 1, sum;
+	int count = 0;
+
+	for (int i = 0; i < FILT_CIC_ORDER; i++) {
+		gain *= r;
+	}
+	for (int i = 0; i < n; i++) {
+		stage[0][i] = x[i];
+	}
+	for (int s = 1; s <= FILT_CIC_ORDER; s++) {
+		for (int i = 0; i < n; i++) {
+			sum = 0;
+			for (int k = 0; k < r && k <= i; k++) {
+				sum += stage[s - 1][i - k];
+			}
+			stage[s][i] = sum;
+		}
+	}
+	for (int i = r - 1; i < n; i += r) {
+		sum = stage[FILT_CIC_ORDER][i];
+		out[count++] = (int32_t) ((sum + (sum >= 0 ? gain / 2 : -gain / 2)) / gain);
+	}
+	return count;
+}
+
+static void test_median(void)
+{
+	filt_median3_t f = { 0 };
+	int32_t x[3], s[3], t, y;
+
+	printf("median of 3\n");
+	CHECK(FILT_Median3(&f, 7) == 7 && FILT_Median3(&f, -3) == -3, "first two not passed through");
+
+	// Against sorting, on random input with repeats
+	memset(&f, 0, sizeof(f));
+	for (int i = 0; i < 10000; i++) {
+		x[0] = x[1];
+		x[1] = x[2];
+		x[2] = _rand_in(-5, 5);
+		y = FILT_Median3(&f, x[2]);
+		if (i < 2) {
+			continue;
+		}
+		memcpy(s, x, sizeof(s));
+		for (int a = 0; a < 2; a++) {
+			for (int b = 0; b < 2 - a; b++) {
+				if (s[b] > s[b + 1]) {
+					t = s[b]; s[b] = s[b + 1]; s[b + 1] = t;
+				}
+			}
+		}
+		CHECK(y == s[1], "median(%d, %d, %d) = %d", x[0], x[1], x[2], y);
+		if (y != s[1]) {
+			break;
+		}
+	}
+
+	// A lone spike vanishes, a step survives one sample late
+	memset(&f, 0, sizeof(f));
+	for (int i = 0; i < 10; i++) {
+		y = FILT_Median3(&f, i == 5 ? 1000000 : 100);
+		CHECK(y == 100, "spike at %d let through: %d", i, y);
+	}
+	for (int i = 0; i < 3; i++) {
+		y = FILT_Median3(&f, 200);
+		CHECK(y == (i == 0 ? 100 : 200), "step sample %d: %d", i, y);
+	}
+}
+
+static void test_cic_response(void)
+{
+	static int32_t x[TEST_N], ref[TEST_N / TEST_R];
+	filt_cic_t f = FILT_CIC_INIT(TEST_R);
+	int32_t y;
+	int n_ref, k = 0, worst = 0, first = -1;
+
+	printf("CIC response, R %d\n", TEST_R);
+
+	// Random walk with steps: every output matches the reference
+	x[0] = 1000;
+	for (int i = 1; i < TEST_N; i++) {
+		x[i] = x[i - 1] + _rand_in(-50, 50) + (i % 500 == 0 ? 5000 : 0);
+	}
+	n_ref = _cic_ref(x, TEST_N, TEST_R, ref);
+	for (int i = 0; i < TEST_N; i++) {
+		if (!FILT_CIC_Push(&f, x[i], &y)) {
+			continue;
+		}
+		if (first < 0) {
+			first = i;
+		}
+		// Outputs skip the first ORDER - 1 reference values (warm-up)
+		if (abs(y - ref[k + FILT_CIC_ORDER - 1]) > worst) {
+			worst = abs(y - ref[k + FILT_CIC_ORDER - 1]);
+		}
+		k++;
+	}
+	printf("  %d outputs, worst error %d\n", k, worst);
+	CHECK(k == n_ref - (FILT_CIC_ORDER - 1), "%d outputs, expected %d", k, n_ref - (FILT_CIC_ORDER - 1));
+	CHECK(worst == 0, "output differs from the reference by %d", worst);
+
+	// Warm-up: the first output is R * ORDER inputs in, and already settled
+	CHECK(first == TEST_R * FILT_CIC_ORDER - 1, "first output after %d inputs", first + 1);
+
+	// DC passes exactly, any level, either sign
+	for (int32_t dc = -1000000; dc <= 1000000; dc += 250000) {
+		filt_cic_t g = FILT_CIC_INIT(TEST_R);
+		for (int i = 0; i < 10 * TEST_R; i++) {
+			if (FILT_CIC_Push(&g, dc, &y)) {
+				CHECK(y == dc, "DC %d came out as %d", dc, y);
+			}
+		}
+	}
+
+	// Unit step lined up with an output: settles in ORDER outputs, never overshoots
+	{
+		filt_cic_t g = FILT_CIC_INIT(TEST_R);
+		int32_t prev = 0;
+		int outs = 0, settled = -1;
+
+		for (int i = 0; i < 20 * TEST_R; i++) {
+			if (!FILT_CIC_Push(&g, i < 10 * TEST_R ? 0 : 1000, &y)) {
+				continue;
+			}
+			CHECK(y >= prev && y <= 1000, "step response %d after %d", y, prev);
+			if (i >= 10 * TEST_R && settled < 0 && y == 1000) {
+				settled = outs;
+			}
+			if (i >= 10 * TEST_R) {
+				outs++;
+			}
+			prev = y;
+		}
+		printf("  step settles in %d outputs\n", settled + 1);
+		CHECK(settled == FILT_CIC_ORDER - 1, "step settled after %d outputs", settled + 1);
+	}
+}
+
+static void test_cic_wrap(void)
+{
+	filt_cic_t f = FILT_CIC_INIT(TEST_R);
+	uint64_t start[FILT_CIC_ORDER];
+	bool wrapped = false;
+	int32_t y, x;
+	int bad = 0;
+
+	printf("CIC integrator wraparound\n");
+
+	// Full-scale input: the last integrator wraps within ~1e5 samples
+	for (int i = 0; i < 1000000; i++) {
+		x = (i / 7919) % 2 ? INT32_MAX : INT32_MIN + 1;
+		memcpy(start, f.integ, sizeof(start));
+		if (FILT_CIC_Push(&f, x, &y) && i % 7919 >= TEST_R * FILT_CIC_ORDER &&
+			y != x) {
+			bad++;
+		}
+		wrapped |= f.integ[FILT_CIC_ORDER - 1] < start[FILT_CIC_ORDER - 1] && x > 0;
+	}
+	CHECK(wrapped, "integrators never wrapped");
+	CHECK(bad == 0, "%d wrong outputs at full scale", bad);
+
+	// Integrators started just short of 2^64
+	memset(&f, 0, sizeof(f));
+	f.decim = TEST_R;
+	for (int i = 0; i < FILT_CIC_ORDER; i++) {
+		f.integ[i] = UINT64_MAX - 12345;
+	}
+	for (int i = 0; i < 20 * TEST_R; i++) {
+		if (FILT_CIC_Push(&f, 4242, &y) && i >= 2 * TEST_R * FILT_CIC_ORDER) {
+			CHECK(y == 4242, "after wrap at input %d: %d", i, y);
+		}
+	}
+}
+
+static void test_ema(void)
+{
+	filt_ema_t f = FILT_EMA_INIT(3);
+	filt_ema_t p = FILT_EMA_INIT(0);
+	double ref;
+	int32_t y;
+	int worst = 0;
+
+	printf("EMA\n");
+	CHECK(FILT_EMA(&f, 500) == 500, "not seeded with the first input");
+	CHECK(FILT_EMA(&p, 17) == 17 && FILT_EMA(&p, -4) == -4, "shift 0 doesn't pass through");
+	{
+		filt_ema_t n = FILT_EMA_INIT(3);
+		CHECK(FILT_EMA(&n, -500) == -500 && n.y == -4000, "negative seed: %d", n.y);
+	}
+
+	// Step from 500 to 1500 against the exact recursion
+	ref = 500;
+	for (int i = 0; i < 100; i++) {
+		ref += (1500 - ref) / 8;
+		y = FILT_EMA(&f, 1500);
+		if (abs(y - (int32_t) lround(ref)) > worst) {
+			worst = abs(y - (int32_t) lround(ref));
+		}
+	}
+	printf("  step, worst error %d\n", worst);
+	CHECK(worst <= 1, "off the exact EMA by %d", worst);
+	CHECK(y == 1500, "settled at %d, not 1500", y);
+}
+
+static void test_chain(void)
+{
+	filt_chain_t f = FILT_CHAIN_INIT(TEST_R, 2);
+	int32_t y;
+	int outs = 0;
+
+	printf("chain\n");
+
+	// Nothing while filling, then DC with spikes comes out clean
+	for (int i = 0; i < 50 * TEST_R; i++) {
+		if (!FILT_Chain_Push(&f, i % 37 == 20 ? 900000 : 300, &y)) {
+			continue;
+		}
+		CHECK(outs > 0 || i == TEST_R * FILT_CIC_ORDER - 1, "first output after %d inputs", i + 1);
+		CHECK(y == 300, "spike leaked: %d", y);
+		outs++;
+	}
+	CHECK(outs == 50 - (FILT_CIC_ORDER - 1), "%d outputs", outs);
+}
+
+/*
+* @brief	White noise on DC through each stage: RMS before and after. The
+* 			CIC's noise gain is sqrt(sum h^2) / sum h, h its impulse response
+* 			(three boxcars of R convolved).
+*/
+static void test_noise_floor(int32_t *x, int32_t *y)
+{
+	static double h[FILT_CIC_ORDER * TEST_NOISE_R], t[FILT_CIC_ORDER * TEST_NOISE_R];
+	filt_median3_t m = { 0 };
+	filt_cic_t c = FILT_CIC_INIT(TEST_NOISE_R);
+	filt_ema_t e = FILT_EMA_INIT(2);
+	filt_chain_t f = FILT_CHAIN_INIT(TEST_NOISE_R, 2);
+	double in, med, cic, ema, chain, sum = 0, sq = 0, gain;
+	int len = 1, n, k;
+	int32_t out;
+
+	printf("noise floor, sigma %.0f on %d, R %d\n", TEST_NOISE_SD, TEST_NOISE_DC, TEST_NOISE_R);
+
+	// Expected CIC gain
+	h[0] = 1;
+	for (int s = 0; s < FILT_CIC_ORDER; s++) {
+		memset(t, 0, sizeof(t));
+		for (int i = 0; i < len; i++) {
+			for (int j = 0; j < TEST_NOISE_R; j++) {
+				t[i + j] += h[i];
+			}
+		}
+		len += TEST_NOISE_R - 1;
+		memcpy(h, t, len * sizeof(double));
+	}
+	for (int i = 0; i < len; i++) {
+		sum += h[i];
+		sq += h[i] * h[i];
+	}
+	gain = sqrt(sq) / sum;
+
+	for (int i = 0; i < TEST_NOISE_N; i++) {
+		x[i] = TEST_NOISE_DC + (int32_t) lround(TEST_NOISE_SD * _gauss());
+	}
+	in = _rms(x, TEST_NOISE_N, TEST_NOISE_DC);
+
+	for (int i = 0; i < TEST_NOISE_N; i++) {
+		y[i] = FILT_Median3(&m, x[i]);
+	}
+	med = _rms(y + 2, TEST_NOISE_N - 2, TEST_NOISE_DC);
+
+	for (int i = n = 0; i < TEST_NOISE_N; i++) {
+		if (FILT_CIC_Push(&c, x[i], &out)) {
+			y[n++] = out;
+		}
+	}
+	cic = _rms(y, n, TEST_NOISE_DC);
+
+	// The EMA on the CIC's outputs
+	for (int i = 0; i < n; i++) {
+		y[i] = FILT_EMA(&e, y[i]);
+	}
+	ema = _rms(y + TEST_NOISE_SKIP, n - TEST_NOISE_SKIP, TEST_NOISE_DC);
+
+	for (int i = k = 0; i < TEST_NOISE_N; i++) {
+		if (FILT_Chain_Push(&f, x[i], &out)) {
+			y[k++] = out;
+		}
+	}
+	chain = _rms(y + TEST_NOISE_SKIP, k - TEST_NOISE_SKIP, TEST_NOISE_DC);
+
+	printf("  %-14s %8s %8s %8s\n", "stage", "RMS", "dB", "expected");
+	printf("  %-14s %8.2f %8s\n", "input", in, "");
+	printf("  %-14s %8.2f %8.1f\n", "median of 3", med, 20 * log10(med / in));
+	printf("  %-14s %8.2f %8.1f %8.1f\n", "CIC", cic, 20 * log10(cic / in), 20 * log10(gain));
+	printf("  %-14s %8.2f %8.1f\n", "CIC + EMA", ema, 20 * log10(ema / in));
+	printf("  %-14s %8.2f %8.1f\n", "chain", chain, 20 * log10(chain / in));
+
+	CHECK(fabs(in - TEST_NOISE_SD) < TEST_NOISE_SD * 0.02, "input RMS %.2f", in);
+	CHECK(med < in, "median of 3 doesn't reduce white noise");
+	CHECK(fabs(cic / in - gain) < gain * 0.1, "CIC noise gain %.4f, expected %.4f", cic / in, gain);
+	CHECK(ema < cic, "EMA doesn't reduce the CIC's noise");
+	CHECK(chain < cic, "chain noisier than the CIC alone: %.2f", chain);
+}
+
+/*
+* @brief	Host cost per input sample of each stage, over the same noise
+*/
+static void test_cost(const int32_t *x)
+{
+	filt_median3_t m = { 0 };
+	filt_cic_t c = FILT_CIC_INIT(TEST_NOISE_R);
+	filt_ema_t e = FILT_EMA_INIT(2);
+	filt_chain_t f = FILT_CHAIN_INIT(TEST_NOISE_R, 2);
+	volatile int32_t sink = 0;
+	int64_t ns[4], cyc[4];
+	int32_t out;
+	const char *names[] = { "median of 3", "CIC", "EMA (per call)", "chain" };
+	const int64_t n = (int64_t) TEST_COST_RUNS * TEST_NOISE_N;
+
+	printf("cost per input sample\n");
+	for (int s = 0; s < 4; s++) {
+		ns[s] = _ns();
+		cyc[s] = TEST_CYCLES();
+		for (int r = 0; r < TEST_COST_RUNS; r++) {
+			for (int i = 0; i < TEST_NOISE_N; i++) {
+				switch (s) {
+				case 0:
+					sink += FILT_Median3(&m, x[i]);
+					break;
+				case 1:
+					if (FILT_CIC_Push(&c, x[i], &out)) {
+						sink += out;
+					}
+					break;
+				case 2:
+					sink += FILT_EMA(&e, x[i]);
+					break;
+				default:
+					if (FILT_Chain_Push(&f, x[i], &out)) {
+						sink += out;
+					}
+				}
+			}
+		}
+		ns[s] = _ns() - ns[s];
+		cyc[s] = TEST_CYCLES() - cyc[s];
+	}
+	(void) sink;
+	printf("  %-18s %8s %8s\n", "stage", "ns", "cycles");
+	for (int s = 0; s < 4; s++) {
+		printf("  %-18s %8.2f %8.1f\n", names[s], (double) ns[s] / n, (double) cyc[s] / n);
+	}
+}
+
+int main(void)
+{
+	static int32_t x[TEST_NOISE_N], y[TEST_NOISE_N];
+
+	srand(1);
+
+	test_median();
+	test_cic_response();
+	test_cic_wrap();
+	test_ema();
+	test_chain();
+	test_noise_floor(x, y);
+	test_cost(x);
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+/*
+ * test_gas.c
+ *
+ * Notes:
+ * 		Checks gas_if's mV to ppb conversion against the model it
+ * 		tabulates, worked out in double: Rs from the divider, corrected to
+ * 		20 C / 50 %RH, then a * (Rs / R0)^b.
+ *
+ * 		The table alone is checked on its own Q16 ratios, densely across
+ * 		its range: the default curves must stay within the 0.5% gas_if.c
+ * 		promises, and other curves within the error of a linear step on
+ * 		a power law, about b (b - 1) / 8 * (2^(1 / GAS_LUT_PER_OCTAVE) - 1)^2. Then
+ * 		GAS_Convert is run over every mV for the defaults and for random
+ * 		per-unit calibrations (R0, RL, curve, compensation), within that
+ * 		plus what the integer Rs and ratio give away. Also checks the
+ * 		clamps, that an out of range mV is refused, that a bad calibration
+ * 		is refused and leaves the old one, that a calibration survives a
+ * 		reload from NVS, and "gascal <ch> r0 auto".
+ *
+ * 		Then the cost of a conversion on the host, in ns and, on x86, TSC
+ * 		cycles, against the same conversion with powf, and of rebuilding
+ * 		a table.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TEST_CYCLES()		((int64_t) __rdtsc())
+#else
+#define TEST_CYCLES()		0LL
+#endif
+
+#define CONFIG_MQTT_ACK_QOS			1
+
+#include "../main/gas_if.c"
+
+#define TEST_UNITS			200			/* Random calibrations */
+#define TEST_TABLE_STEP		1.001		/* Ratio step for the table sweep */
+#define TEST_DEFAULT_ERR	0.005		/* gas_if.c's promise for the default curves */
+#define TEST_MIN_PPB		1000		/* Below this the integer ppb's rounding dominates */
+#define TEST_COST_RUNS		200			/* Passes over the mV range for timing */
+
+static int fails = 0;
+static char reply[GAS_REPLY_LEN];
+static const cmd_t *registered;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); fails++; } \
+	} while (0)
+
+
+/* The rest of the firmware, as far as gas_if calls it */
+esp_err_t CMD_Register(const cmd_t *cmd)
+{
+	registered = cmd;
+	return ESP_OK;
+}
+
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg)
+{
+	(void) ctx;
+	(void) qos;
+	strlcpy(reply, msg, sizeof(reply));
+	return 0;
+}
+
+static int32_t _rand_in(int32_t lo, int32_t hi)
+{
+	return lo + (int32_t) (((uint32_t) rand() << 8 ^ rand()) % (uint32_t) (hi - lo + 1));
+}
+
+static int64_t _ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+* @brief	The curve in double, ppb at Rs / R0 = x
+*/
+static double _curve(const gas_cal_t *cal, double x)
+{
+	return cal->a_micro / 1000.0 * pow(x, cal->b_milli / 1000.0);
+}
+
+/*
+* @brief	Bound on the relative error of a linear step on x^b, from x to
+* 			r x with r = 2^(1 / GAS_LUT_PER_OCTAVE): the second derivative
+* 			over the step, at most r^|b - 2| of the curve's at x
+*/
+static double _step_err(const gas_cal_t *cal)
+{
+	double b = cal->b_milli / 1000.0;
+	double r = exp2(1.0 / GAS_LUT_PER_OCTAVE);
+
+	return fabs(b * (b - 1)) / 8 * (r - 1) * (r - 1) * pow(r, fabs(b - 2));
+}
+
+/*
+* @brief	A unit's calibration, anywhere _gas_valid takes it
+*/
+static void _random_cal(gas_cal_t *cal)
+{
+	cal->rl = _rand_in(1000, 100000);
+	cal->r0 = _rand_in(1000, 1000000);
+	cal->vc_mv = _rand_in(3000, 5000);
+	cal->a_micro = _rand_in(10000, 100000000);
+	cal->b_milli = _rand_in(300, 3000) * ((rand() & 1) ? 1 : -1);
+	cal->kt = _rand_in(-20000, 20000);
+	cal->kh = _rand_in(-5000, 5000);
+}
+
+/*
+* @brief	_gas_lookup on its own Q16 ratios; returns the worst error
+* 			relative to the allowed one
+*/
+static double _sweep_table(const gas_cal_t *cal, double allowed, double *worst)
+{
+	gas_lut_t lut;
+	double ref, err, score = 0;
+	uint32_t q, got;
+
+	_gas_build(cal, &lut);
+	*worst = 0;
+	for (double x = exp2(GAS_LUT_MIN_LOG2); x <= exp2(GAS_LUT_MAX_LOG2); x *= TEST_TABLE_STEP) {
+		q = lround(x * (1 << GAS_Q));
+		ref = _curve(cal, (double) q / (1 << GAS_Q));
+		// A step that ends in the clamp is the clamp's error, not the table's
+		if (ref < TEST_MIN_PPB || ref * exp2(fabs(cal->b_milli / 1000.0) / GAS_LUT_PER_OCTAVE) >= GAS_PPB_MAX) {
+			continue;
+		}
+		got = _gas_lookup(&lut, q);
+		// Plus the table's integer ppb, and the integer step
+		err = fabs(got - ref) / ref;
+		*worst = (err > *worst) ? err : *worst;
+		err = fabs(got - ref) / (allowed * ref + 2);
+		score = (err > score) ? err : score;
+	}
+	return score;
+}
+
+static void test_table(void)
+{
+	gas_cal_t cal;
+	double worst, score, max_score = 0;
+
+	printf("table, Rs / R0 from 1/%d to %d\n", 1 << -GAS_LUT_MIN_LOG2, 1 << GAS_LUT_MAX_LOG2);
+	for (int ch = 0; ch < GAS_CHANNELS; ch++) {
+		score = _sweep_table(&gas_defaults[ch], TEST_DEFAULT_ERR, &worst);
+		printf("  %-4s default curve  worst %.3f%% (step bound %.3f%%)\n", gas_names[ch], worst * 100,
+			   _step_err(&gas_defaults[ch]) * 100);
+		CHECK(score <= 1, "%s default curve off by %.3f%%", gas_names[ch], worst * 100);
+	}
+	for (int i = 0; i < TEST_UNITS; i++) {
+		_random_cal(&cal);
+		score = _sweep_table(&cal, _step_err(&cal), &worst);
+		max_score = (score > max_score) ? score : max_score;
+		CHECK(score <= 1, "a=%d b=%d off by %.3f%%, step bound %.3f%%", cal.a_micro, cal.b_milli, worst * 100,
+			  _step_err(&cal) * 100);
+	}
+	printf("  %d random curves: worst error %.2f of the step bound\n", TEST_UNITS, max_score);
+}
+
+/*
+* @brief	GAS_Convert over every mV at temp / hum, against the model in
+* 			double; returns the worst error relative to the allowed one
+*/
+static double _sweep_convert(gas_channel_t ch, const gas_cal_t *cal, int32_t temp, int32_t hum, double *worst)
+{
+	double comp, raw, rs, x, ref, allowed, err, score = 0;
+	double b = fabs(cal->b_milli / 1000.0);
+	uint32_t ppb;
+
+	*worst = 0;
+	comp = 1 + cal->kt / 1e6 * ((double) temp - GAS_REF_TEMP) / HDC1080_SCALE
+			 + cal->kh / 1e6 * ((double) hum - GAS_REF_HUM) / HDC1080_SCALE;
+	for (int mv = 1; mv < cal->vc_mv; mv++) {
+		CHECK(GAS_Convert(ch, mv, temp, hum, &ppb) == ESP_OK, "%d mV refused", mv);
+		raw = (double) cal->rl * (cal->vc_mv - mv) / mv;
+		rs = raw / comp;
+		x = rs / cal->r0;
+		// Off the table it's the end of the table
+		x = fmin(fmax(x, exp2(GAS_LUT_MIN_LOG2)), exp2(GAS_LUT_MAX_LOG2));
+		ref = _curve(cal, x);
+		if (ref < TEST_MIN_PPB || ref * exp2(b / GAS_LUT_PER_OCTAVE) >= GAS_PPB_MAX) {
+			continue;
+		}
+		// The step, Rs truncated before and after compensation, the ratio
+		// truncated and the table's own ratios rounded
+		allowed = _step_err(cal) + b * (1 / raw + 1 / rs + 1.5 / (x * (1 << GAS_Q)));
+		err = fabs(ppb - ref) / ref;
+		*worst = (err > *worst) ? err : *worst;
+		err = fabs(ppb - ref) / (allowed * ref + 2);
+		score = (err > score) ? err : score;
+	}
+	return score;
+}
+
+static void test_convert(void)
+{
+	gas_cal_t cal;
+	double worst, score, max_score = 0;
+	int32_t temp, hum;
+	uint32_t ppb, lo, hi;
+
+	printf("conversion, every mV\n");
+	for (int ch = 0; ch < GAS_CHANNELS; ch++) {
+		score = _sweep_convert(ch, &gas_cal[ch], GAS_REF_TEMP, GAS_REF_HUM, &worst);
+		printf("  %-4s defaults, 20 C 50 %%RH  worst %.3f%%\n", gas_names[ch], worst * 100);
+		CHECK(score <= 1, "%s defaults off by %.3f%%", gas_names[ch], worst * 100);
+
+		// Refused out of range, clamped at the ends of the table
+		CHECK(GAS_Convert(ch, 0, GAS_REF_TEMP, GAS_REF_HUM, &ppb) == ESP_ERR_INVALID_ARG, "%s 0 mV taken",
+			  gas_names[ch]);
+		CHECK(GAS_Convert(ch, gas_cal[ch].vc_mv + 1, GAS_REF_TEMP, GAS_REF_HUM, &ppb) == ESP_ERR_INVALID_ARG,
+			  "%s mV above vc taken", gas_names[ch]);
+		GAS_Convert(ch, 1, GAS_REF_TEMP, GAS_REF_HUM, &lo);
+		GAS_Convert(ch, gas_cal[ch].vc_mv, GAS_REF_TEMP, GAS_REF_HUM, &hi);
+		CHECK(lo == gas_lut[ch].ppb[GAS_LUT_LEN - 1] && hi == gas_lut[ch].ppb[0],
+			  "%s not clamped to the table: %u, %u", gas_names[ch], lo, hi);
+	}
+	CHECK(GAS_Convert(GAS_CHANNELS, 1000, GAS_REF_TEMP, GAS_REF_HUM, &ppb) == ESP_ERR_INVALID_ARG,
+		  "unknown channel taken");
+
+	for (int i = 0; i < TEST_UNITS; i++) {
+		_random_cal(&cal);
+		temp = _rand_in(-10, 40) * HDC1080_SCALE;
+		hum = _rand_in(10, 90) * HDC1080_SCALE;
+		if (GAS_SetCal(i % GAS_CHANNELS, &cal) != ESP_OK) {
+			CHECK(false, "valid calibration refused");
+			continue;
+		}
+		score = _sweep_convert(i % GAS_CHANNELS, &cal, temp, hum, &worst);
+		max_score = (score > max_score) ? score : max_score;
+		CHECK(score <= 1, "unit %d (r0=%d rl=%d b=%d kt=%d kh=%d) off by %.3f%%", i, cal.r0, cal.rl,
+			  cal.b_milli, cal.kt, cal.kh, worst * 100);
+	}
+	printf("  %d random units, -10..40 C, 10..90 %%RH: worst error %.2f of the allowed\n", TEST_UNITS, max_score);
+}
+
+static void test_cal(void)
+{
+	gas_cal_t cal, bad, got;
+	char r0[] = "r0", auto_[] = "auto", ox[] = "ox", name[] = "gascal";
+	char *argv[] = { name, ox, r0, auto_ };
+	uint32_t ppb;
+	const int mv = 1000;
+
+	printf("calibration\n");
+	_random_cal(&cal);
+	CHECK(GAS_SetCal(GAS_OX, &cal) == ESP_OK, "valid calibration refused");
+
+	// Refused, and the old one stays
+	bad = cal;
+	bad.b_milli = 0;
+	CHECK(GAS_SetCal(GAS_OX, &bad) == ESP_ERR_INVALID_ARG, "b = 0 taken");
+	bad = cal;
+	bad.vc_mv = 6000;
+	CHECK(GAS_SetCal(GAS_OX, &bad) == ESP_ERR_INVALID_ARG, "vc = 6000 taken");
+	GAS_GetCal(GAS_OX, &got);
+	CHECK(memcmp(&got, &cal, sizeof(cal)) == 0, "refused calibration changed the old one");
+
+	// Survives a reboot
+	memset(gas_cal, 0, sizeof(gas_cal));
+	_gas_nvs_load();
+	GAS_GetCal(GAS_OX, &got);
+	CHECK(memcmp(&got, &cal, sizeof(cal)) == 0, "calibration not reloaded from NVS");
+
+	// R0 from clean air: the same reading is then Rs / R0 = 1, ppb = a
+	cal.kt = cal.kh = 0;
+	GAS_SetCal(GAS_OX, &cal);
+	GAS_Convert(GAS_OX, mv, GAS_REF_TEMP, GAS_REF_HUM, &ppb);
+	CHECK(registered != NULL && registered->handler(NULL, 4, argv) == ESP_OK, "\"gascal ox r0 auto\" refused");
+	GAS_GetCal(GAS_OX, &got);
+	CHECK(got.r0 == (int64_t) cal.rl * (cal.vc_mv - mv) / mv, "r0 auto set %d", got.r0);
+	GAS_Convert(GAS_OX, mv, GAS_REF_TEMP, GAS_REF_HUM, &ppb);
+	CHECK(fabs(ppb - cal.a_micro / 1000.0) <= cal.a_micro / 1000.0 * 0.001 + 1, "clean air is %u ppb, a is %d",
+		  ppb, cal.a_micro);
+	printf("  %s\n", reply);
+}
+
+/*
+* @brief	Host cost of a conversion, and of a table
+*/
+static void test_cost(void)
+{
+	volatile uint32_t sink = 0;
+	const gas_cal_t *cal = &gas_cal[GAS_RED];
+	int64_t ns[4], cyc[4];
+	uint32_t ppb;
+	float rs;
+	const int64_t n = (int64_t) TEST_COST_RUNS * (cal->vc_mv - 1);
+	const char *names[] = { "GAS_Convert", "  of which lookup", "powf", "table build" };
+
+	GAS_SetCal(GAS_RED, &gas_defaults[GAS_RED]);
+	for (int s = 0; s < 3; s++) {
+		ns[s] = _ns();
+		cyc[s] = TEST_CYCLES();
+		for (int r = 0; r < TEST_COST_RUNS; r++) {
+			for (int mv = 1; mv < cal->vc_mv; mv++) {
+				switch (s) {
+				case 0:
+					GAS_Convert(GAS_RED, mv, GAS_REF_TEMP, GAS_REF_HUM, &ppb);
+					sink += ppb;
+					break;
+				case 1:
+					sink += _gas_lookup(&gas_lut[GAS_RED], ((int64_t) cal->rl * (cal->vc_mv - mv) / mv << GAS_Q) /
+														   cal->r0);
+					break;
+				default:
+					rs = (float) cal->rl * (cal->vc_mv - mv) / mv;
+					sink += lroundf(cal->a_micro / 1000.0f * powf(rs / cal->r0, cal->b_milli / 1000.0f));
+				}
+			}
+		}
+		ns[s] = _ns() - ns[s];
+		cyc[s] = TEST_CYCLES() - cyc[s];
+	}
+	ns[3] = _ns();
+	cyc[3] = TEST_CYCLES();
+	for (int r = 0; r < TEST_COST_RUNS; r++) {
+		_gas_build(cal, &gas_lut[GAS_RED]);
+	}
+	ns[3] = _ns() - ns[3];
+	cyc[3] = TEST_CYCLES() - cyc[3];
+	(void) sink;
+
+	printf("cost on the host\n");
+	printf("  %-18s %8s %8s\n", "per conversion", "ns", "cycles");
+	for (int s = 0; s < 3; s++) {
+		printf("  %-18s %8.2f %8.1f\n", names[s], (double) ns[s] / n, (double) cyc[s] / n);
+	}
+	printf("  %-18s %8.0f %8.0f  (%d entries)\n", names[3], (double) ns[3] / TEST_COST_RUNS,
+		   (double) cyc[3] / TEST_COST_RUNS, GAS_LUT_LEN);
+}
+
+int main(void)
+{
+	host_log_level = ESP_LOG_NONE;
+	srand(1);
+
+	host_nvs_clear();
+	GAS_Initialize();
+
+	test_table();
+	test_convert();
+	test_cal();
+	test_cost();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
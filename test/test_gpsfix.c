@@ -0,0 +1,676 @@
+/*
+ * test_gpsfix.c
+ *
+ * Notes:
+ * 		Tag jitter: how often the reported (quantized) position of a sensor
+ * 		that doesn't move changes over a day of fixes, and how far it ends
+ * 		up from the truth.
+ *
+ * 		The built-in tracks are synthetic: $GPGGA sentences at one fix every
+ * 		CONFIG_GPS_FIX_INTERVAL_S for 24 h around a fixed point, with
+ * 		Gaussian noise, a slowly wandering bias (atmosphere, multipath),
+ * 		multipath jumps and fixes the receiver itself flags as poor. They
+ * 		go through the same degrees-and-minutes to 1e-7 deg conversion as
+ * 		gps_if.c. Real receiver logs can be replayed too:
+ *
+ * 			build/test_gpsfix track.nmea ...
+ *
+ * 		prints the same figures for each file (no pass/fail).
+ *
+ * 		Duty cycle: gps_if itself runs on simulated time against a model
+ * 		of an MTK receiver on a stand-in UART. The receiver sends GGA and
+ * 		RMC once a second, takes TEST_COLD_S to its first fix and
+ * 		TEST_HOT_S after a standby, and answers PMTK161 with a PMTK001
+ * 		ack. One standby command gets no answer three times over, and the
+ * 		next three get a "failed" ack; after that the firmware must give
+ * 		up, wake the receiver and try again later. The receiver must only
+ * 		be asleep when the firmware thinks so, each standby must last
+ * 		CONFIG_GPS_REVALIDATE_S up to two power checks, and each wake only
+ * 		as long as the new fixes take. The watchdog stand-ins judge the
+ * 		receiver as wdt_if does, with a TEST_WDT_S timeout: a sleeping
+ * 		receiver must never be found stalled, and one that no longer
+ * 		wakes (from TEST_DEAD_S) must be found within TEST_WDT_S of its
+ * 		deadline.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#define CONFIG_GPS_FIX_INTERVAL_S	10
+#define CONFIG_GPS_POWER_SAVE		1
+#define CONFIG_GPS_STANDBY			1
+#define CONFIG_GPS_REVALIDATE_S		600
+#define CONFIG_GPS_REVALIDATE_FIXES	6
+#define CONFIG_GPS_TIME_LATENCY_MS	150
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static TaskFunction_t task_fn;				/* What GPS_Initialize started */
+
+/* Run the UART event task on this thread, on simulated time */
+static BaseType_t _test_task_create(TaskFunction_t fn)
+{
+	task_fn = fn;
+	return pdPASS;
+}
+#define xTaskCreate(fn, name, stack, arg, prio, handle)		_test_task_create(fn)
+
+// The NMEA parser keeps every field it reads, used or not
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#include "../main/gps_if.c"
+#pragma GCC diagnostic pop
+#undef xTaskCreate
+#include "../main/gpsfix_if.c"
+#include "../main/clock_if.c"
+
+#define TEST_DAY_S			(24 * 3600)
+#define TEST_FIXES			(TEST_DAY_S / CONFIG_GPS_FIX_INTERVAL_S)
+#define TEST_M_PER_DEG		111319.5
+#define TEST_MIN_GAIN		100			/* Fewer tag changes than rounding each fix */
+#ifndef TEST_SEED
+#define TEST_SEED			1
+#endif
+#define TEST_S				1000000LL
+#define TEST_LAT			40.76660
+#define TEST_LON			-111.84560
+#define TEST_COLD_S			30			/* To the first fix */
+#define TEST_HOT_S			2			/* ... after standby */
+#define TEST_SILENT			2			/* Standby commands 2 to 4 get no ack */
+#define TEST_REFUSED		5			/* ... 5 to 7 a "failed" one */
+#define TEST_DEAD_S			(3 * 3600)	/* Ignores wake commands from here */
+#define TEST_END_S			(4 * 3600)
+#define TEST_WDT_S			60			/* Receiver progress timeout */
+#define TEST_CHECK_S		(GPS_PWR_CHECK_MS / 1000)
+/* Awake after a standby: hot start, the new fixes, then up to two checks */
+#define TEST_AWAKE_MAX_S	(TEST_HOT_S + CONFIG_GPS_REVALIDATE_FIXES * CONFIG_GPS_FIX_INTERVAL_S + 2 * TEST_CHECK_S)
+
+typedef struct {
+	const char *name;
+	double lat, lon;			/* Truth, degrees */
+	double sigma_m;				/* Per-fix noise, each axis */
+	double bias_m;				/* Slow wander: RMS of the bias walk */
+	double jump_pct;			/* Fixes thrown 30-150 m off */
+	double poor_pct;			/* Fixes with < 4 satellites or HDOP > 5 */
+	double hdop;
+	int sats;
+	int max_changes;			/* Tag changes allowed after convergence */
+	double max_err_m;			/* Reported tag to truth */
+} track_t;
+
+/*
+ * 1e-4 deg cells, centred on multiples of 1e-4. "cell edge" sits 0.49 of
+ * a cell from a centre on both axes, the worst case: plain rounding of
+ * every fix flips on about every other one.
+ *
+ * The limits are regression bounds, about 1.5x the worst of seeds 1-20
+ * (build with -DTEST_SEED=n). In the urban tracks most changes follow the
+ * 3 m bias wander, which no averaging window can tell from a real move.
+ */
+static const track_t tracks[] = {
+	{ "open sky",            40.76660,  -111.84560,  2.0, 1.0, 0, 0.5, 0.9, 9, 0,  3 },
+	{ "open sky, cell edge", 40.766549, -111.845549, 2.0, 1.0, 0, 0.5, 0.9, 9, 14, 8 },
+	{ "urban canyon",        40.76660,  -111.84560,  6.0, 3.0, 2, 5.0, 2.2, 6, 33, 16 },
+	{ "urban, cell edge",    40.766549, -111.845549, 6.0, 3.0, 2, 5.0, 2.2, 6, 60, 16 },
+	{ "south-east",         -33.86881,   151.20929,  3.0, 1.5, 1, 1.0, 1.2, 8, 2,  3 },
+};
+
+static unsigned int seed = TEST_SEED;
+
+
+static double _uniform(void)
+{
+	return (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+static double _gauss(void)
+{
+	return sqrt(-2 * log(_uniform())) * cos(2 * M_PI * _uniform());
+}
+
+/*
+* @brief	Append the checksum to the n characters of a sentence in buf
+*/
+static void _nmea_sum(char *buf, size_t len, int n)
+{
+	uint8_t sum = 0;
+
+	for (int i = 1; i < n; i++) {
+		sum ^= buf[i];
+	}
+	snprintf(buf + n, len - n, "*%02X", sum);
+}
+
+/*
+* @brief	One GGA sentence, with checksum, for a position in degrees
+*/
+static void _gga(char *buf, size_t len, int t, double lat, double lon, int quality, int sats,
+				 double hdop, double alt)
+{
+	double alat = fabs(lat), alon = fabs(lon);
+	int dlat = (int) alat, dlon = (int) alon;
+	int n;
+
+	n = snprintf(buf, len, "$GPGGA,%02d%02d%02d.000,%02d%07.4f,%c,%03d%07.4f,%c,%d,%02d,%.2f,%.1f,M,-17.0,M,,",
+				 t / 3600 % 24, t / 60 % 60, t % 60, dlat, (alat - dlat) * 60, lat < 0 ? 'S' : 'N',
+				 dlon, (alon - dlon) * 60, lon < 0 ? 'W' : 'E', quality, sats, hdop, alt);
+	_nmea_sum(buf, len, n);
+}
+
+/*
+* @brief	Degrees and minutes ("ddmm.mmmm") to degrees x 10^7, as gps_if.c
+*/
+static int32_t _nmea_deg(const char *p, int deg_digits)
+{
+	char buf[8];
+	int32_t deg;
+
+	memcpy(buf, p, deg_digits);
+	buf[deg_digits] = '\0';
+	deg = atol(buf) * 10000000;
+	memcpy(buf, p + deg_digits, 2);
+	memcpy(buf + 2, p + deg_digits + 3, 4);
+	buf[6] = '\0';
+	return deg + 50 * atol(buf) / 3;
+}
+
+/*
+* @brief	GGA to gpsfix_t, the way gps_if.c's parser builds one
+*
+* @return	false if it isn't a GGA with a fix
+*/
+static bool _parse(const char *s, gpsfix_t *f)
+{
+	const char *fld[15];
+	int n = 0;
+
+	if (strncmp(s, "$GPGGA,", 7) != 0 && strncmp(s, "$GNGGA,", 7) != 0) {
+		return false;
+	}
+	for (const char *p = s; p != NULL && n < 15; p = strchr(p, ',')) {
+		fld[n++] = (*p == ',') ? ++p : p;
+	}
+	if (n < 10 || atoi(fld[6]) == 0 || *fld[2] == ',' || *fld[4] == ',') {
+		return false;
+	}
+	f->lat = _nmea_deg(fld[2], 2) * (*fld[3] == 'S' ? -1 : 1);
+	f->lon = _nmea_deg(fld[4], 3) * (*fld[5] == 'W' ? -1 : 1);
+	f->sats = atoi(fld[7]);
+	f->hdop = (atof(fld[8]) > 99) ? 9900 : lroundf(atof(fld[8]) * 100);
+	f->alt_dm = lroundf(atof(fld[9]) * 10);
+	return true;
+}
+
+typedef struct {
+	int fixes, used;
+	int changes;				/* Reported cell changed, after convergence */
+	int raw_changes;			/* ... had every fix been rounded to a cell */
+	int converged_at;			/* Fix number, -1: never */
+	double err_m;				/* Worst reported cell to truth, after convergence */
+	double sigma_m;
+	int32_t lat, lon;
+} result_t;
+
+static void _feed(gpsfix_agg_t *a, result_t *r, const char *line, double lat, double lon)
+{
+	static int32_t raw_lat, raw_lon;
+	gpsfix_t f;
+	int32_t qlat, qlon;
+	double dy, dx;
+
+	if (!_parse(line, &f)) {
+		return;
+	}
+	r->fixes++;
+	if (!GPSFIX_Push(a, &f)) {
+		return;
+	}
+	r->used++;
+
+	qlat = _gpsfix_quantize(0, f.lat, GPSFIX_QUANT, false);
+	qlon = _gpsfix_quantize(0, f.lon, GPSFIX_QUANT, false);
+	if (r->converged_at >= 0 && (qlat != raw_lat || qlon != raw_lon)) {
+		r->raw_changes++;
+	}
+	raw_lat = qlat;
+	raw_lon = qlon;
+
+	if (!a->pos.converged) {
+		return;
+	}
+	if (r->converged_at < 0) {
+		r->converged_at = r->fixes;
+	}
+	else if (a->pos.lat != r->lat || a->pos.lon != r->lon) {
+		r->changes++;
+	}
+	r->lat = a->pos.lat;
+	r->lon = a->pos.lon;
+	r->sigma_m = a->pos.sigma_m;
+
+	if (!isnan(lat)) {
+		dy = (a->pos.lat * 1e-7 - lat) * TEST_M_PER_DEG;
+		dx = (a->pos.lon * 1e-7 - lon) * TEST_M_PER_DEG * cos(lat * M_PI / 180);
+		if (sqrt(dx * dx + dy * dy) > r->err_m) {
+			r->err_m = sqrt(dx * dx + dy * dy);
+		}
+	}
+}
+
+static void _print(const char *name, const result_t *r)
+{
+	printf("%-22s %6d %6d %6d %7d %7d %7.1f %7.1f\n", name, r->fixes, r->used, r->converged_at,
+		   r->changes, r->raw_changes, r->sigma_m, r->err_m);
+}
+
+static int _run(const track_t *t)
+{
+	static gpsfix_agg_t a;
+	result_t r = { .converged_at = -1 };
+	char line[128];
+	double bx = 0, by = 0, ex, ey, k = cos(t->lat * M_PI / 180);
+	double walk = 0.01;			/* Bias walk step, as a share of its RMS */
+	int fails = 0, sats;
+	double hdop;
+
+	GPSFIX_Reset(&a);
+	for (int i = 0; i < TEST_FIXES; i++) {
+		// Mean-reverting walk: RMS bias_m, correlated over ~1/walk fixes
+		bx += -walk * bx + sqrt(2 * walk) * t->bias_m * _gauss();
+		by += -walk * by + sqrt(2 * walk) * t->bias_m * _gauss();
+		ex = bx + t->sigma_m * _gauss();
+		ey = by + t->sigma_m * _gauss();
+		if (_uniform() * 100 < t->jump_pct) {
+			ex += (30 + 120 * _uniform()) * (_uniform() < 0.5 ? -1 : 1);
+			ey += (30 + 120 * _uniform()) * (_uniform() < 0.5 ? -1 : 1);
+		}
+		sats = t->sats;
+		hdop = t->hdop * (0.8 + 0.4 * _uniform());
+		if (_uniform() * 100 < t->poor_pct) {
+			if (_uniform() < 0.5) {
+				sats = 3;
+			}
+			else {
+				hdop = 6 + 10 * _uniform();
+			}
+			ex *= 3;
+			ey *= 3;
+		}
+
+		_gga(line, sizeof(line), i * CONFIG_GPS_FIX_INTERVAL_S, t->lat + ey / TEST_M_PER_DEG,
+			 t->lon + ex / (TEST_M_PER_DEG * k), 1, sats, hdop, 1300 + 1.5 * ey);
+		_feed(&a, &r, line, t->lat, t->lon);
+	}
+	_print(t->name, &r);
+
+	if (r.converged_at < 0 || r.converged_at > GPSFIX_WINDOW) {
+		printf("  FAIL: converged at fix %d\n", r.converged_at);
+		fails++;
+	}
+	if (r.changes > t->max_changes) {
+		printf("  FAIL: %d tag changes in a day, at most %d\n", r.changes, t->max_changes);
+		fails++;
+	}
+	if (r.changes * TEST_MIN_GAIN > r.raw_changes) {
+		printf("  FAIL: %d tag changes, not %dx fewer than the %d of raw fixes\n", r.changes,
+			   TEST_MIN_GAIN, r.raw_changes);
+		fails++;
+	}
+	if (r.err_m > t->max_err_m) {
+		printf("  FAIL: reported %.1f m from the truth, at most %.1f\n", r.err_m, t->max_err_m);
+		fails++;
+	}
+	return fails;
+}
+
+static void _replay(const char *path)
+{
+	static gpsfix_agg_t a;
+	result_t r = { .converged_at = -1 };
+	char line[256];
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+	GPSFIX_Reset(&a);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		_feed(&a, &r, line, NAN, NAN);
+	}
+	fclose(f);
+	_print(path, &r);
+	printf("  last tag %.4f, %.4f\n", r.lat * 1e-7, r.lon * 1e-7);
+}
+
+/* The receiver, see Notes */
+static struct {
+	bool standby;
+	int64_t fix_from_us;		/* No fix before: cold or hot start */
+	int64_t standby_us;			/* Last standby started */
+	int64_t woke_us;			/* Last woken */
+	int standby_cmds;			/* PMTK161 received */
+	bool faults;				/* A standby command failed since it woke */
+	int64_t asleep_us, awake_us;	/* Totals since the first standby */
+	int64_t longest_awake_us;	/* Awake after a standby that went through first time */
+	int bad_sleeps, bad_wakes;
+	char log[256];				/* +: standby acked, -: no ack, !: failed ack,
+								   W: woken, w: wake while awake, x: wake ignored */
+	size_t log_n;
+} mtk;
+/* What the firmware did */
+static struct {
+	int mismatches;				/* Receiver and firmware disagree on standby */
+	int far_polls;				/* Converged position off the truth */
+} gps_seen;
+/* wdt_if's view of WDT_GPS */
+static struct {
+	bool armed;
+	int64_t progress_us, quiet_until_us;
+	int64_t fired_us;			/* When it found the receiver stalled, 0: never */
+} wdt;
+static jmp_buf duty_end;
+
+
+/* The rest of the firmware, as far as gps_if calls it */
+void LED_SetEventBit(led_events_t bit) { (void) bit; }
+void TIME_GPS(int64_t mono_us, int64_t utc_us, bool fix) { (void) mono_us; (void) utc_us; (void) fix; }
+void METRICS_WatchTask(TaskHandle_t task) { (void) task; }
+
+metric_t *METRICS_Register(const char *name, metric_type_t type)
+{
+	static metric_t metrics[4];
+	static int n;
+
+	metrics[n].name = name;
+	metrics[n].type = type;
+	return &metrics[n++];
+}
+
+void METRICS_Add(metric_t *m, int32_t n)
+{
+	if (m != NULL) {
+		m->value += n;
+	}
+}
+
+/* Only WDT_GPS is judged, as wdt_task does, on the progress timeout */
+void WDT_Alive(wdt_component_t c)
+{
+	if (c == WDT_GPS && !wdt.armed) {
+		wdt.armed = true;
+		wdt.progress_us = esp_timer_get_time();
+	}
+}
+
+void WDT_Progress(wdt_component_t c)
+{
+	if (c == WDT_GPS) {
+		wdt.armed = true;
+		wdt.progress_us = esp_timer_get_time();
+	}
+}
+
+void WDT_Disarm(wdt_component_t c)
+{
+	if (c == WDT_GPS) {
+		wdt.armed = false;
+	}
+}
+
+void WDT_Expect(wdt_component_t c, uint32_t quiet_s)
+{
+	if (c == WDT_GPS) {
+		wdt.quiet_until_us = esp_timer_get_time() + quiet_s * TEST_S;
+	}
+}
+
+static void _wdt_check(int64_t now)
+{
+	int64_t from = (wdt.progress_us > wdt.quiet_until_us) ? wdt.progress_us : wdt.quiet_until_us;
+
+	if (wdt.armed && now >= wdt.quiet_until_us && now - from > TEST_WDT_S * TEST_S && wdt.fired_us == 0) {
+		wdt.fired_us = now;
+	}
+}
+
+static void _mtk_log(char c)
+{
+	if (mtk.log_n < sizeof(mtk.log) - 1) {
+		mtk.log[mtk.log_n++] = c;
+	}
+}
+
+static void _mtk_send(const char *line)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%s\r\n", line);
+	host_uart_rx(GPS_UART_NUM, (const uint8_t *) buf, strlen(buf));
+}
+
+static void _mtk_ack(int cmd, int flag)
+{
+	char buf[32];
+
+	_nmea_sum(buf, sizeof(buf), snprintf(buf, sizeof(buf), "$PMTK001,%d,%d", cmd, flag));
+	_mtk_send(buf);
+}
+
+/*
+* @brief	host_uart_tx: commands to the receiver. Any byte wakes it from
+* 			standby.
+*/
+static void _mtk_rx(uart_port_t port, const uint8_t *data, size_t len)
+{
+	int64_t now = esp_timer_get_time();
+	int cmd;
+
+	if (port != GPS_UART_NUM || len < 9 || strncmp((const char *) data, "$PMTK", 5) != 0) {
+		return;
+	}
+	if (mtk.standby) {
+		if (now >= TEST_DEAD_S * TEST_S) {
+			_mtk_log('x');
+			return;
+		}
+		_mtk_log('W');
+		mtk.standby = false;
+		mtk.woke_us = now;
+		mtk.faults = false;
+		mtk.fix_from_us = now + TEST_HOT_S * TEST_S;
+		mtk.asleep_us += now - mtk.standby_us;
+		if (now - mtk.standby_us < CONFIG_GPS_REVALIDATE_S * TEST_S ||
+			now - mtk.standby_us > (CONFIG_GPS_REVALIDATE_S + 2 * TEST_CHECK_S) * TEST_S) {
+			printf("  FAIL: standby for %.1f s\n", (now - mtk.standby_us) / (double) TEST_S);
+			mtk.bad_sleeps++;
+		}
+		return;
+	}
+
+	cmd = atoi((const char *) data + 5);
+	switch (cmd) {
+	case 161:
+		mtk.standby_cmds++;
+		if (mtk.standby_cmds >= TEST_SILENT && mtk.standby_cmds < TEST_SILENT + GPS_PWR_TRIES) {
+			_mtk_log('-');
+			mtk.faults = true;
+			break;
+		}
+		if (mtk.standby_cmds >= TEST_REFUSED && mtk.standby_cmds < TEST_REFUSED + GPS_PWR_TRIES) {
+			_mtk_log('!');
+			mtk.faults = true;
+			_mtk_ack(cmd, 2);
+			break;
+		}
+		_mtk_log('+');
+		_mtk_ack(cmd, GPS_PMTK_ACK_OK);
+		if (mtk.woke_us > 0) {
+			mtk.awake_us += now - mtk.woke_us;
+			if (!mtk.faults && now - mtk.woke_us > mtk.longest_awake_us) {
+				mtk.longest_awake_us = now - mtk.woke_us;
+			}
+		}
+		mtk.standby = true;
+		mtk.standby_us = now;
+		break;
+	case 10:
+		_mtk_log('w');
+		break;
+	default:
+		_mtk_ack(cmd, GPS_PMTK_ACK_OK);
+		break;
+	}
+}
+
+/*
+* @brief	Every 100 ms: the watchdog, the receiver's sentences on the
+* 			second, and whether firmware and receiver agree
+*/
+static void _duty_tick(int64_t now)
+{
+	static double k;
+	char line[128];
+	int t = now / TEST_S, n;
+	double lat, lon, dx, dy;
+	bool fix = now >= mtk.fix_from_us;
+	gpsfix_pos_t pos;
+
+	_wdt_check(now);
+	if (now >= TEST_END_S * TEST_S) {
+		longjmp(duty_end, 1);
+	}
+	// Asleep only when the firmware knows; awake only once it's told to
+	if ((gps_pwr_state == GPS_PWR_LOW && !mtk.standby) ||
+		(gps_pwr_state == GPS_PWR_FULL && mtk.standby && now < TEST_DEAD_S * TEST_S)) {
+		gps_seen.mismatches++;
+	}
+	if (mtk.standby || now % TEST_S != 0) {
+		return;
+	}
+
+	k = cos(TEST_LAT * M_PI / 180);
+	lat = TEST_LAT + 2.0 * _gauss() / TEST_M_PER_DEG;
+	lon = TEST_LON + 2.0 * _gauss() / (TEST_M_PER_DEG * k);
+	if (fix) {
+		_gga(line, sizeof(line), t, lat, lon, 1, 9, 0.9, 1300);
+	}
+	else {
+		_nmea_sum(line, sizeof(line), snprintf(line, sizeof(line), "$GPGGA,%02d%02d%02d.000,,,,,0,00,99.99,,M,,M,,",
+											   t / 3600 % 24, t / 60 % 60, t % 60));
+	}
+	_mtk_send(line);
+	n = snprintf(line, sizeof(line), "$GPRMC,%02d%02d%02d.000,%c,,,,,0.00,0.00,191026,,,%c",
+				 t / 3600 % 24, t / 60 % 60, t % 60, fix ? 'A' : 'V', fix ? 'A' : 'N');
+	_nmea_sum(line, sizeof(line), n);
+	_mtk_send(line);
+
+	GPS_GetPosition(&pos);
+	if (pos.converged) {
+		dy = (pos.lat * 1e-7 - TEST_LAT) * TEST_M_PER_DEG;
+		dx = (pos.lon * 1e-7 - TEST_LON) * TEST_M_PER_DEG * k;
+		gps_seen.far_polls += (sqrt(dx * dx + dy * dy) > 15);
+	}
+}
+
+static int _duty(void)
+{
+	const char *faults = "+W---w!!!w+W";
+	int fails = 0, standbys = 0;
+	int64_t deadline;
+
+	printf("duty cycle: standby, revalidate every %d s with %d fixes, %d h\n", CONFIG_GPS_REVALIDATE_S,
+		   CONFIG_GPS_REVALIDATE_FIXES, TEST_END_S / 3600);
+	host_log_level = ESP_LOG_NONE;
+	host_uart_tx = _mtk_rx;
+	host_sim_start(0, _duty_tick);
+	mtk.fix_from_us = TEST_COLD_S * TEST_S;
+
+	if (GPS_Initialize() != ESP_OK) {
+		printf("  FAIL: GPS_Initialize\n");
+		return 1;
+	}
+	if (setjmp(duty_end) == 0 && task_fn != NULL) {
+		task_fn(NULL);
+	}
+	host_uart_tx = NULL;
+
+	for (size_t i = 0; i < mtk.log_n; i++) {
+		standbys += (mtk.log[i] == '+');
+	}
+	// The ack is seen on the next check, the wake is due a check after that
+	deadline = mtk.standby_us + (CONFIG_GPS_REVALIDATE_S + 2 * TEST_CHECK_S + 1) * TEST_S;
+	printf("  commands: %s\n", mtk.log);
+	printf("  %d standbys, tracking %.1f%% of the time, longest wake %.1f s\n", standbys,
+		   100.0 * mtk.awake_us / (mtk.awake_us + mtk.asleep_us), mtk.longest_awake_us / (double) TEST_S);
+	if (wdt.fired_us > 0) {
+		printf("  receiver dead after %d s, found stalled at %.1f s\n", TEST_DEAD_S, wdt.fired_us / (double) TEST_S);
+	}
+
+	if (task_fn != uart_gps_event_mgr) {
+		printf("  FAIL: no UART task started\n");
+		fails++;
+	}
+	// The faults, then standby and wake in turn, until a wake is ignored
+	if (strncmp(mtk.log, faults, strlen(faults)) != 0 || mtk.log_n < strlen(faults) + 2 ||
+		strcmp(mtk.log + mtk.log_n - 2, "+x") != 0) {
+		printf("  FAIL: commands don't follow the faults\n");
+		fails++;
+	}
+	for (size_t i = strlen(faults); i + 2 < mtk.log_n; i += 2) {
+		if (mtk.log[i] != '+' || mtk.log[i + 1] != 'W') {
+			printf("  FAIL: \"%c%c\" at %zu in the commands\n", mtk.log[i], mtk.log[i + 1], i);
+			fails++;
+			break;
+		}
+	}
+	if (m_low_power == NULL || m_low_power->value != standbys) {
+		printf("  FAIL: %d standbys counted, %d taken\n", m_low_power ? m_low_power->value : -1, standbys);
+		fails++;
+	}
+	if (gps_seen.mismatches > 0 || mtk.bad_sleeps > 0) {
+		printf("  FAIL: %d ticks the receiver's standby wasn't the firmware's, %d standbys the wrong length\n",
+			   gps_seen.mismatches, mtk.bad_sleeps);
+		fails++;
+	}
+	if (mtk.longest_awake_us > TEST_AWAKE_MAX_S * TEST_S) {
+		printf("  FAIL: awake %.1f s between standbys, at most %d\n", mtk.longest_awake_us / (double) TEST_S,
+			   TEST_AWAKE_MAX_S);
+		fails++;
+	}
+	if (gps_seen.far_polls > 0) {
+		printf("  FAIL: converged position over 15 m off %d times\n", gps_seen.far_polls);
+		fails++;
+	}
+	// Never found stalled while it works, found once it no longer wakes
+	if (wdt.fired_us < TEST_DEAD_S * TEST_S || wdt.fired_us > deadline + (TEST_WDT_S + 1) * TEST_S) {
+		printf("  FAIL: found stalled at %.1f s (0: never), deadline %.1f s\n", wdt.fired_us / (double) TEST_S,
+			   deadline / (double) TEST_S);
+		fails++;
+	}
+	return fails;
+}
+
+int main(int argc, char **argv)
+{
+	int fails = 0;
+
+	printf("%-22s %6s %6s %6s %7s %7s %7s %7s\n", "track", "fixes", "used", "conv@",
+		   "changes", "raw", "sigma m", "err m");
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			_replay(argv[i]);
+		}
+		return 0;
+	}
+	for (size_t i = 0; i < sizeof(tracks) / sizeof(tracks[0]); i++) {
+		fails += _run(&tracks[i]);
+	}
+	fails += _duty();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
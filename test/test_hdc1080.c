@@ -0,0 +1,499 @@
+/*
+ * test_hdc1080.c
+ *
+ * Notes:
+ * 		Runs the real hdc1080_task on simulated time against a model of the
+ * 		sensor behind the I2C stand-in in host_rtos.c. The model decodes
+ * 		each command link the driver sends (configuration writes, triggers,
+ * 		reads), NACKs a read until the conversion is done, and on request
+ * 		NACKs transactions or holds the bus: every transaction times out
+ * 		and SDA stays low until it has been clocked free and sees a STOP.
+ *
+ * 		Covers the 14 and 11-bit conversions against the sensor's transfer
+ * 		function and the wait before the read, the bus clear after
+ * 		HDC1080_MAX_ERRORS failed transactions in a row (and not before),
+ * 		and the heater going OFF, ON, COOL and OFF again: readings held
+ * 		through the burst and the cool-down, back to back conversions, the
+ * 		interval between bursts, and a heater that has to be reset off.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define CONFIG_HDC1080_SAMPLE_PERIOD_S		10
+#define CONFIG_HDC1080_HEATER_RH			98
+#define CONFIG_HDC1080_HEATER_BURST_S		10
+#define CONFIG_HDC1080_HEATER_INTERVAL_S	600
+
+static TaskFunction_t task_fn;				/* What HDC1080_Initialize started */
+
+/* Run the sampling task on this thread, on simulated time */
+static BaseType_t _test_task_create(TaskFunction_t fn)
+{
+	task_fn = fn;
+	return pdPASS;
+}
+#define xTaskCreate(fn, name, stack, arg, prio, handle)		_test_task_create(fn)
+
+#include "../main/hdc1080_if.c"
+#undef xTaskCreate
+
+#define TEST_S				1000000LL
+#define TEST_TEMP			23.45		/* C, the room the sensor is in */
+#define TEST_DRY			50.0		/* %RH */
+#define TEST_WET			99.0
+#define TEST_STUCK_CLOCKS	5			/* SCL pulses a stuck sensor needs to let go of SDA */
+#define TEST_BURSTS			8
+#define TEST_UPDATES		512
+#define TEST_SWEEP			1000
+
+typedef struct {
+	int64_t on_us, off_us;
+	int conversions;
+} burst_t;
+
+/* The sensor as the bus sees it */
+static struct {
+	double temp, hum;
+	uint16_t conf;
+	uint16_t t_raw, h_raw;			/* Last conversion */
+	int64_t ready_us;				/* It's done at */
+	bool converted;
+	int conversions, early_reads, bad, resets;
+	int nacks;						/* Transactions still to NACK */
+	bool stuck;						/* Every transaction times out until a STOP */
+	int stuck_clocks;				/* SDA held low for this many more SCL pulses */
+	bool fail_heater_off;			/* Refuse a write that turns the heater off */
+	bool stop_seen;
+	int scl_pulses;
+	uint32_t errors_at_clear;		/* stats.errors when the bus clear started */
+	burst_t bursts[TEST_BURSTS];
+	int n_bursts;
+} sensor;
+static int scl, sda;
+
+typedef struct {
+	const char *name;
+	int run_s;
+	int wet_from_s, wet_until_s;	/* At TEST_WET between, else TEST_DRY */
+	int fault_s;					/* When the fault starts, 0 for none */
+	int nacks;
+	bool stuck;
+	bool fail_heater_off;
+	uint32_t errors, recoveries, heats;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "clean",              120,  0,   0,   0,  0, false, false, 0, 0, 0 },
+	{ "two nacks",          120,  0,   0,   50, 2, false, false, 2, 0, 0 },
+	{ "bus stuck",          150,  0,   0,   50, 0, true,  false, HDC1080_MAX_ERRORS, 1, 0 },
+	{ "heater",             1300, 30,  900, 0,  0, false, false, 0, 0, 2 },
+	{ "heater off refused", 300,  30,  200, 0,  0, false, true,  0, 1, 1 },
+	{ "stuck while heating", 300, 30,  200, 35, 0, true,  false, HDC1080_MAX_ERRORS, 1, 1 },
+};
+
+static const scenario_t *scen;
+static jmp_buf end_jmp;
+static struct { int64_t time_us; int32_t temp, hum; } updates[TEST_UPDATES];
+static int n_updates;
+static int not_heating;					/* Ticks inside a burst or cool-down without the flag */
+static bool fault_while_heating;
+
+
+/* The rest of the firmware, as far as hdc1080_if calls it */
+metric_t *METRICS_Register(const char *name, metric_type_t type) { (void) name; (void) type; return NULL; }
+void METRICS_Add(metric_t *m, int32_t n) { (void) m; (void) n; }
+
+/*
+* @brief	Datasheet conversion time for a configuration
+*/
+static int64_t _sensor_conv_us(uint16_t conf)
+{
+	int64_t us = (conf & HDC1080_CONF_TRES_11) ? 3650 : 6350;
+
+	if (conf & HDC1080_CONF_HRES_8) {
+		return us + 2500;
+	}
+	return us + ((conf & HDC1080_CONF_HRES_11) ? 3850 : 6500);
+}
+
+/*
+* @brief	Output code for frac of full scale, at the resolution in mask
+*/
+static uint16_t _sensor_code(double frac, uint16_t mask)
+{
+	long code = lround(frac * 65536);
+
+	code = (code < 0) ? 0 : (code > 0xffff) ? 0xffff : code;
+	return code & mask;
+}
+
+static void _sensor_convert(int64_t now)
+{
+	uint16_t t_mask = (sensor.conf & HDC1080_CONF_TRES_11) ? 0xffe0 : 0xfffc;
+	uint16_t h_mask = (sensor.conf & HDC1080_CONF_HRES_8) ? 0xff00 :
+					  (sensor.conf & HDC1080_CONF_HRES_11) ? 0xffe0 : 0xfffc;
+
+	sensor.t_raw = _sensor_code((sensor.temp + 40) / 165, t_mask);
+	sensor.h_raw = _sensor_code(sensor.hum / 100, h_mask);
+	sensor.ready_us = now + _sensor_conv_us(sensor.conf);
+	sensor.converted = true;
+	sensor.conversions++;
+	if ((sensor.conf & HDC1080_CONF_HEAT) && sensor.n_bursts > 0) {
+		sensor.bursts[sensor.n_bursts - 1].conversions++;
+	}
+}
+
+static esp_err_t _sensor_conf(uint16_t conf, int64_t now)
+{
+	bool heat = (sensor.conf & HDC1080_CONF_HEAT) != 0;
+
+	if (sensor.fail_heater_off && heat && !(conf & (HDC1080_CONF_HEAT | HDC1080_CONF_RST))) {
+		return ESP_FAIL;
+	}
+	if (conf & HDC1080_CONF_RST) {
+		sensor.resets++;
+		conf = HDC1080_CONF_COMB;		/* Power-on value: heater off */
+	}
+	if (!heat && (conf & HDC1080_CONF_HEAT) && sensor.n_bursts < TEST_BURSTS) {
+		sensor.bursts[sensor.n_bursts++] = (burst_t) { now, 0, 0 };
+	}
+	else if (heat && !(conf & HDC1080_CONF_HEAT)) {
+		sensor.bursts[sensor.n_bursts - 1].off_us = now;
+	}
+	sensor.conf = conf;
+	sensor.converted = false;
+	return ESP_OK;
+}
+
+/*
+* @brief	host_i2c_bus: one command link, START to STOP
+*/
+static esp_err_t _bus(i2c_port_t port, const host_i2c_op_t *ops, int n, TickType_t wait)
+{
+	int64_t now = esp_timer_get_time();
+	uint8_t bytes[3];
+	int nb = 0;
+
+	if (sensor.stuck) {
+		vTaskDelay(wait);				/* The driver waits it out */
+		return ESP_ERR_TIMEOUT;
+	}
+	if (sensor.nacks > 0) {
+		sensor.nacks--;
+		return ESP_FAIL;
+	}
+	if (port != I2C_NUM_1 || n < 3 || ops[0].kind != HOST_I2C_START || ops[n - 1].kind != HOST_I2C_STOP ||
+		ops[1].kind != HOST_I2C_WRITE || (ops[1].byte >> 1) != HDC1080_DEV_ADDR || !ops[1].ack) {
+		sensor.bad++;
+		return ESP_FAIL;
+	}
+
+	if (ops[1].byte & I2C_MASTER_READ) {
+		uint8_t out[4] = { sensor.t_raw >> 8, sensor.t_raw & 0xff, sensor.h_raw >> 8, sensor.h_raw & 0xff };
+
+		if (!sensor.converted || now < sensor.ready_us) {
+			sensor.early_reads++;
+			return ESP_FAIL;			/* Address NACKed while converting */
+		}
+		// Temperature and humidity, master NACKs the last byte
+		if (n - 3 != 4) {
+			sensor.bad++;
+			return ESP_FAIL;
+		}
+		for (int i = 0; i < 4; i++) {
+			if (ops[2 + i].kind != HOST_I2C_READ || ops[2 + i].ack != (i < 3)) {
+				sensor.bad++;
+				return ESP_FAIL;
+			}
+			*ops[2 + i].data = out[i];
+		}
+		return ESP_OK;
+	}
+
+	for (int i = 2; i < n - 1; i++) {
+		if (ops[i].kind != HOST_I2C_WRITE || !ops[i].ack || nb == sizeof(bytes)) {
+			sensor.bad++;
+			return ESP_FAIL;
+		}
+		bytes[nb++] = ops[i].byte;
+	}
+	if (nb == 3 && bytes[0] == HDC1080_CONF_ADDR) {
+		return _sensor_conf(bytes[1] << 8 | bytes[2], now);
+	}
+	if (nb == 1 && bytes[0] == HDC1080_TEMP_REG && (sensor.conf & HDC1080_CONF_COMB)) {
+		_sensor_convert(now);
+		return ESP_OK;
+	}
+	sensor.bad++;
+	return ESP_FAIL;
+}
+
+/*
+* @brief	host_gpio_read: a stuck sensor holds SDA low
+*/
+static int _gpio_read(gpio_num_t gpio)
+{
+	return (gpio == I2C_MASTER_SDA_GPIO && sensor.stuck_clocks > 0) ? 0 : 1;
+}
+
+/*
+* @brief	host_gpio_write: SCL pulses clock a stuck sensor on, a STOP frees the bus
+*/
+static void _gpio_write(gpio_num_t gpio, int level)
+{
+	hdc1080_stats_t s;
+
+	if (gpio == I2C_MASTER_SCL_GPIO) {
+		if (scl && !level) {
+			if (sensor.scl_pulses++ == 0) {
+				HDC1080_GetStats(&s);
+				sensor.errors_at_clear = s.errors;
+			}
+			if (sensor.stuck_clocks > 0) {
+				sensor.stuck_clocks--;
+			}
+		}
+		scl = level;
+	}
+	else if (gpio == I2C_MASTER_SDA_GPIO) {
+		if (!sda && level && scl && sensor.stuck_clocks == 0) {
+			sensor.stop_seen = true;
+			sensor.stuck = false;
+		}
+		sda = level;
+	}
+}
+
+/*
+* @brief	Every 100 ms of simulated time: the weather, the fault, and what
+* 			HDC1080_GetSample says
+*/
+static void _tick(int64_t now)
+{
+	hdc1080_sample_t s;
+
+	sensor.hum = (now >= scen->wet_from_s * TEST_S && now < scen->wet_until_s * TEST_S) ? TEST_WET : TEST_DRY;
+	if (scen->fault_s && now >= scen->fault_s * TEST_S && now - 100000 < scen->fault_s * TEST_S) {
+		fault_while_heating = (sensor.conf & HDC1080_CONF_HEAT) != 0;
+		sensor.nacks = scen->nacks;
+		sensor.stuck = scen->stuck;
+		sensor.stuck_clocks = scen->stuck ? TEST_STUCK_CLOCKS : 0;
+	}
+
+	HDC1080_GetSample(&s);
+	if (s.time_us != 0 && (n_updates == 0 || s.time_us != updates[n_updates - 1].time_us) && n_updates < TEST_UPDATES) {
+		updates[n_updates].time_us = s.time_us;
+		updates[n_updates].temp = s.temp;
+		updates[n_updates].hum = s.hum;
+		n_updates++;
+	}
+	for (int i = 0; i < sensor.n_bursts; i++) {
+		burst_t *b = &sensor.bursts[i];
+		if (now > b->on_us + 100000 && b->off_us && now < b->off_us + (HDC1080_COOL_S * TEST_S) - 100000 &&
+			!s.heating) {
+			not_heating++;
+		}
+	}
+	if (now >= scen->run_s * TEST_S) {
+		longjmp(end_jmp, 1);
+	}
+}
+
+static int _run(const scenario_t *s)
+{
+	hdc1080_stats_t st;
+	int32_t temp, hum;
+	int fails = 0;
+	int64_t first_after;
+
+	memset(&sensor, 0, sizeof(sensor));
+	memset(&latest, 0, sizeof(latest));
+	memset(&stats, 0, sizeof(stats));
+	memset(updates, 0, sizeof(updates));
+	sensor.temp = TEST_TEMP;
+	sensor.hum = TEST_DRY;
+	sensor.fail_heater_off = s->fail_heater_off;
+	scl = sda = 1;
+	n_updates = not_heating = 0;
+	fault_while_heating = false;
+	scen = s;
+	task_fn = NULL;
+
+	host_sim_start(TEST_S, _tick);
+	HDC1080_Initialize();
+	if (setjmp(end_jmp) == 0 && task_fn != NULL) {
+		task_fn(NULL);
+	}
+	i2c_driver_delete(I2C_NUM_1);
+	HDC1080_GetStats(&st);
+
+	printf("%-20s %6u %6u %5u %6d %7d %5d\n", s->name, st.errors, st.recoveries, st.heats, sensor.resets,
+		   sensor.conversions, n_updates);
+	if (task_fn != hdc1080_task) {
+		printf("  FAIL: %s: no sampling task started\n", s->name);
+		return 1;
+	}
+	if (st.errors != s->errors || st.recoveries != s->recoveries || st.heats != s->heats ||
+		sensor.n_bursts != (int) s->heats) {
+		printf("  FAIL: %s: expected %u errors, %u bus clears, %u heater bursts (%d seen on the bus)\n", s->name,
+			   s->errors, s->recoveries, s->heats, sensor.n_bursts);
+		fails++;
+	}
+	if (sensor.resets != 1 + (int) st.recoveries || sensor.bad || sensor.early_reads) {
+		printf("  FAIL: %s: %d resets, %d bad transactions, %d reads before the conversion was done\n", s->name,
+			   sensor.resets, sensor.bad, sensor.early_reads);
+		fails++;
+	}
+	if (s->stuck && (sensor.errors_at_clear != HDC1080_MAX_ERRORS || !sensor.stop_seen || sensor.stuck ||
+					 sensor.stuck_clocks)) {
+		printf("  FAIL: %s: bus clear after %u errors, %s\n", s->name, sensor.errors_at_clear,
+			   sensor.stuck ? "still stuck" : "no STOP");
+		fails++;
+	}
+	if (!s->recoveries && sensor.scl_pulses) {
+		printf("  FAIL: %s: bus cleared without cause\n", s->name);
+		fails++;
+	}
+	if (s->stuck && s->heats && !fault_while_heating) {
+		printf("  FAIL: %s: the bus got stuck outside the burst\n", s->name);
+		fails++;
+	}
+
+	for (int i = 0; i < sensor.n_bursts; i++) {
+		burst_t *b = &sensor.bursts[i];
+		int64_t cool_end = b->off_us + HDC1080_COOL_S * TEST_S;
+		// Back to back: a trigger, the conversion wait, a read
+		int expect = CONFIG_HDC1080_HEATER_BURST_S * 1000 / (3 * portTICK_PERIOD_MS) * 9 / 10;
+
+		printf("  burst %d: %.2f s to %.2f s, %d conversions\n", i + 1, (double) b->on_us / TEST_S,
+			   (double) b->off_us / TEST_S, b->conversions);
+		if (b->off_us == 0 || b->off_us - b->on_us > (CONFIG_HDC1080_HEATER_BURST_S + 1) * TEST_S ||
+			(!s->stuck && b->off_us - b->on_us < CONFIG_HDC1080_HEATER_BURST_S * TEST_S)) {
+			printf("  FAIL: %s: heater left on or for the wrong time\n", s->name);
+			fails++;
+		}
+		if (!s->stuck && b->conversions < expect) {
+			printf("  FAIL: %s: %d conversions in the burst, expected at least %d\n", s->name, b->conversions,
+				   expect);
+			fails++;
+		}
+		if (i > 0 && b->on_us - sensor.bursts[i - 1].on_us < CONFIG_HDC1080_HEATER_INTERVAL_S * TEST_S) {
+			printf("  FAIL: %s: bursts %d s apart\n", s->name, (int) ((b->on_us - sensor.bursts[i - 1].on_us) / TEST_S));
+			fails++;
+		}
+		first_after = 0;
+		for (int j = 0; j < n_updates; j++) {
+			if (updates[j].time_us > b->on_us && updates[j].time_us < cool_end - 100000) {
+				printf("  FAIL: %s: reading at %.2f s published while heating or cooling\n", s->name,
+					   (double) updates[j].time_us / TEST_S);
+				fails++;
+				break;
+			}
+			if (updates[j].time_us >= cool_end && first_after == 0) {
+				first_after = updates[j].time_us;
+			}
+		}
+		if (first_after == 0 || first_after > cool_end + (2 * CONFIG_HDC1080_SAMPLE_PERIOD_S + 1) * TEST_S) {
+			printf("  FAIL: %s: readings didn't resume after the cool-down\n", s->name);
+			fails++;
+		}
+	}
+	if (not_heating) {
+		printf("  FAIL: %s: heating flag clear for %d ticks of a burst or cool-down\n", s->name, not_heating);
+		fails++;
+	}
+
+	// Whatever happened, it ends sampling normally
+	if (HDC1080_Poll(&temp, &hum) != ESP_OK || latest.heating || (sensor.conf & HDC1080_CONF_HEAT) ||
+		abs(temp - (int32_t) lround(TEST_TEMP * HDC1080_SCALE)) > 2) {
+		printf("  FAIL: %s: not sampling normally at the end (%d.%02d C)\n", s->name, temp / HDC1080_SCALE,
+			   temp % HDC1080_SCALE);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	Both resolutions across the sensor's range: the driver's wait
+* 			must cover the conversion, the fixed point must be within one
+* 			step of the resolution (plus the 0.01 it truncates to)
+*/
+static int _test_resolution(void)
+{
+	static const struct { const char *name; uint16_t res; int bits; } res[] = {
+		{ "14-bit", 0, 14 },
+		{ "11-bit", HDC1080_CONF_TRES_11 | HDC1080_CONF_HRES_11, 11 },
+	};
+	int fails = 0;
+
+	memset(&sensor, 0, sizeof(sensor));
+	host_sim_start(TEST_S, NULL);
+	_hdc1080_bus_init();
+
+	printf("%-8s %8s %10s %10s %6s\n", "res", "wait ms", "T err max", "RH err max", "early");
+	for (size_t r = 0; r < sizeof(res) / sizeof(res[0]); r++) {
+		uint16_t conf = HDC1080_CONF_COMB | res[r].res;
+		// As hdc1080_task works it out
+		TickType_t conv = (_hdc1080_conv_us(conf) + HDC1080_TICK_US - 1) / HDC1080_TICK_US + 1;
+		double t_step = 165.0 * HDC1080_SCALE / (1 << res[r].bits) + 1;
+		double h_step = 100.0 * HDC1080_SCALE / (1 << res[r].bits) + 1;
+		double t_err = 0, h_err = 0;
+		int32_t temp, hum;
+
+		sensor.early_reads = 0;
+		if (_hdc1080_write_conf(conf) != ESP_OK) {
+			printf("  FAIL: %s: configuration refused\n", res[r].name);
+			fails++;
+			continue;
+		}
+		for (int i = 0; i <= TEST_SWEEP; i++) {
+			sensor.temp = -40 + 165.0 * i / TEST_SWEEP;
+			sensor.hum = 100.0 * ((i * 7) % (TEST_SWEEP + 1)) / TEST_SWEEP;
+			if (_hdc1080_measure(conv, &temp, &hum) != ESP_OK) {
+				printf("  FAIL: %s: measurement failed at %.2f C\n", res[r].name, sensor.temp);
+				fails++;
+				break;
+			}
+			t_err = fmax(t_err, fabs(temp - sensor.temp * HDC1080_SCALE));
+			h_err = fmax(h_err, fabs(hum - sensor.hum * HDC1080_SCALE));
+		}
+		printf("%-8s %8d %8.2f C %7.2f %% %6d\n", res[r].name, conv * portTICK_PERIOD_MS, t_err / HDC1080_SCALE,
+			   h_err / HDC1080_SCALE, sensor.early_reads);
+		if (t_err > t_step || h_err > h_step) {
+			printf("  FAIL: %s: error over one step (%.2f C, %.2f %%RH)\n", res[r].name, t_step / HDC1080_SCALE,
+				   h_step / HDC1080_SCALE);
+			fails++;
+		}
+		if (sensor.early_reads) {
+			printf("  FAIL: %s: read before the conversion was done\n", res[r].name);
+			fails++;
+		}
+	}
+	i2c_driver_delete(I2C_NUM_1);
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	host_i2c_bus = _bus;
+	host_gpio_read = _gpio_read;
+	host_gpio_write = _gpio_write;
+
+	fails += _test_resolution();
+	printf("\n%-20s %6s %6s %5s %6s %7s %5s\n", "scenario", "errors", "clears", "heats", "resets", "convs",
+		   "reads");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i]);
+	}
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
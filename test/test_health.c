@@ -0,0 +1,296 @@
+/*
+ * test_health.c
+ *
+ * Notes:
+ * 		Boots a pending update on the flash emulator in host_rtos.c and runs
+ * 		ota_if's health check on it: ota_boot_check as app_main calls it,
+ * 		then the health task's body on this thread, with the health signals
+ * 		a scenario gets. esp_restart comes back here as a reset, the next
+ * 		boot runs what the boot partition says.
+ *
+ * 		Covers an image that passes, one that misses the MQTT or sensor
+ * 		signal within the budget, one that runs low on heap, one that keeps
+ * 		resetting during init (each boot must be counted before any driver
+ * 		would run), and an image the bootloader never started. Checks where
+ * 		the device boots next, the NVS records, and the reply the request
+ * 		gets once the surviving image is up. Also checks that
+ * 		ota_boot_check doesn't wait for the signals itself and that an
+ * 		update is refused while the running image is still on trial.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define CONFIG_OTA_URL_BASE			"http://files.test/updates/"
+#define CONFIG_OTA_BUF_SIZE			4096
+#define CONFIG_OTA_MAX_RETRIES		5
+#define CONFIG_OTA_HEALTH_BUDGET_S	1
+#define CONFIG_OTA_HEALTH_MIN_HEAP	test_min_heap
+#define CONFIG_OTA_HEALTH_MAX_BOOTS	3
+#define CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2	12
+#define CONFIG_MQTT_ACK_QOS			1
+
+static uint32_t test_min_heap = 20000;
+static const esp_partition_t *factory;
+static TaskFunction_t task_fn;				/* What ota_boot_check started */
+
+/* Run the health task's body on this thread, where esp_restart can land */
+static BaseType_t _test_task_create(TaskFunction_t fn)
+{
+	task_fn = fn;
+	return pdPASS;
+}
+#define xTaskCreate(fn, name, stack, arg, prio, handle)		_test_task_create(fn)
+
+#include "../main/ota_if.c"
+#undef xTaskCreate
+// The stages it feeds, each with a TAG of its own
+#define TAG		delta_tag
+#include "../main/delta_if.c"
+#undef TAG
+#define TAG		unpack_tag
+#include "../main/unpack_if.c"
+#undef TAG
+
+#define TEST_FILE			"airu-v2.bin"
+#define TEST_REQ_ID			"17"
+
+typedef struct {
+	const char *name;
+	EventBits_t bits;			/* Health signals this image sends */
+	uint32_t heap_limit;		/* CONFIG_OTA_HEALTH_MIN_HEAP, the host reports 80000 */
+	int crashes;				/* Resets during init before the check runs */
+	bool skip_new;				/* The bootloader goes back without starting it */
+	const char *reply;			/* For TEST_REQ_ID, once the survivor is up */
+	bool kept;					/* Still running the new image at the end */
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "healthy",              OTA_HEALTH_BITS,     20000, 0, false, "ota valid host",     true },
+	{ "healthy, 2 resets",    OTA_HEALTH_BITS,     20000, 2, false, "ota valid host",     true },
+	{ "no mqtt",              OTA_HEALTH_PM_BIT,   20000, 0, false, "ota rollback mqtt",  false },
+	{ "no sensor",            OTA_HEALTH_MQTT_BIT, 20000, 0, false, "ota rollback sensor", false },
+	{ "low heap",             OTA_HEALTH_BITS,     90000, 0, false, "ota rollback heap",  false },
+	{ "resets during init",   OTA_HEALTH_BITS,     20000, CONFIG_OTA_HEALTH_MAX_BOOTS, false, "ota rollback reboots",
+	  false },
+	{ "bootloader went back", OTA_HEALTH_BITS,     20000, 0, true,  "ota rollback boot",  false },
+};
+
+static struct {
+	char req_id[CMD_REQ_ID_LEN];
+	char msg[64];
+	int n;
+} reply;
+
+char DEVICE_MAC[13] = "f4e5d6c7b8a9";
+
+
+/* The rest of the firmware, as far as ota_if calls it */
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg)
+{
+	(void) qos;
+	strlcpy(reply.req_id, ctx->req_id, sizeof(reply.req_id));
+	strlcpy(reply.msg, msg, sizeof(reply.msg));
+	reply.n++;
+	return 0;
+}
+void CMD_Progress(const cmd_ctx_t *ctx, const char *name, int pct) { (void) ctx; (void) name; (void) pct; }
+void DIAG_Crumb(diag_kind_t kind, int32_t code) { (void) kind; (void) code; }
+void DIAG_Flush(bool force) { (void) force; }
+void print_sha256(const uint8_t *image_hash, const char *label) { (void) image_hash; (void) label; }
+
+/* No server: nothing here should get as far as a download */
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) { (void) config; return NULL; }
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c, const char *key, const char *value)
+{
+	(void) c; (void) key; (void) value;
+	return ESP_FAIL;
+}
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len) { (void) c; (void) write_len; return ESP_FAIL; }
+int esp_http_client_fetch_headers(esp_http_client_handle_t c) { (void) c; return -1; }
+int esp_http_client_get_status_code(esp_http_client_handle_t c) { (void) c; return 0; }
+int esp_http_client_read(esp_http_client_handle_t c, char *buf, int len) { (void) c; (void) buf; (void) len; return -1; }
+esp_err_t esp_http_client_close(esp_http_client_handle_t c) { (void) c; return ESP_OK; }
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c) { (void) c; return ESP_OK; }
+
+/*
+* @brief	What _ota_commence leaves behind for the next boot: a new image
+* 			in ota_0, booted next, and the "pending" record
+*/
+static void _install(void)
+{
+	const esp_partition_t *update;
+	uint8_t hdr[SPI_FLASH_SEC_SIZE];
+	ota_pending_t pending = { .boots = 0 };
+
+	host_flash_reset();
+	host_nvs_clear();
+	factory = esp_ota_get_running_partition();
+	update = esp_ota_get_next_update_partition(NULL);
+	memset(hdr, 0x5a, sizeof(hdr));
+	hdr[0] = ESP_IMAGE_HEADER_MAGIC;
+	esp_partition_erase_range(update, 0, SPI_FLASH_SEC_SIZE);
+	esp_partition_write(update, 0, hdr, sizeof(hdr));
+	esp_partition_write(factory, 0, hdr, sizeof(hdr));
+	esp_ota_set_boot_partition(update);
+
+	pending.prev_addr = factory->address;
+	strlcpy(pending.req_id, TEST_REQ_ID, CMD_REQ_ID_LEN);
+	strlcpy(pending.file, TEST_FILE, OTA_FILE_BN_LEN);
+	_ota_nvs_save("pending", &pending, sizeof(pending));
+}
+
+/*
+* @brief	One power-on: app_main's ota_boot_check, a crash in driver init
+* 			if crash, else the health task with the signals in bits
+*
+* @return	true if the firmware restarted itself
+*/
+static bool _boot(bool crash, EventBits_t bits, int64_t *boot_check_us)
+{
+	jmp_buf restart;
+	volatile bool restarted = false;
+	int64_t t;
+
+	host_flash_boot();
+	ota_health_running = false;
+	task_fn = NULL;
+	if (ota_event_group != NULL) {
+		xEventGroupClearBits(ota_event_group, OTA_HEALTH_BITS);
+	}
+
+	host_restart = &restart;
+	if (setjmp(restart) == 0) {
+		t = esp_timer_get_time();
+		ota_boot_check();
+		if (boot_check_us) {
+			*boot_check_us = esp_timer_get_time() - t;
+		}
+		if (!crash && task_fn != NULL) {
+			xEventGroupSetBits(ota_event_group, bits);
+			_ota_health_gate();
+		}
+	}
+	else {
+		restarted = true;
+	}
+	host_restart = NULL;
+	return restarted;
+}
+
+static int _run(const scenario_t *s)
+{
+	ota_pending_t pending;
+	int64_t boot_check_us = 0;
+	bool restarted;
+	int fails = 0, boots = 0;
+
+	_install();
+	if (s->skip_new) {
+		esp_ota_set_boot_partition(factory);
+	}
+	memset(&reply, 0, sizeof(reply));
+
+	// Each reset during init has to be counted before it happens
+	for (int i = 0; i < s->crashes; i++) {
+		restarted = _boot(true, 0, NULL);
+		boots++;
+		if (restarted || !_ota_nvs_load("pending", &pending, sizeof(pending)) || pending.boots != (uint32_t) i + 1) {
+			printf("  FAIL: %s: boot %d not counted before init (%u counted)\n", s->name, i + 1, pending.boots);
+			return 1;
+		}
+	}
+
+	test_min_heap = s->heap_limit;
+	restarted = _boot(false, s->bits, &boot_check_us);
+	boots++;
+	if (boot_check_us > 100000) {
+		printf("  FAIL: %s: ota_boot_check waited %lld ms\n", s->name, (long long) boot_check_us / 1000);
+		fails++;
+	}
+
+	// A rolled back image reports from the one it went back to
+	if (restarted) {
+		if (esp_ota_get_boot_partition() != factory) {
+			printf("  FAIL: %s: restarted without going back to the factory app\n", s->name);
+			fails++;
+		}
+		_boot(false, OTA_HEALTH_MQTT_BIT, NULL);
+		boots++;
+	}
+
+	printf("%-22s %5d %9s %-8s %s\n", s->name, boots, restarted ? "yes" : "no",
+		   esp_ota_get_running_partition() == factory ? "factory" : "ota_0", reply.msg);
+	if ((esp_ota_get_running_partition() != factory) != s->kept) {
+		printf("  FAIL: %s: expected to be running %s\n", s->name, s->kept ? "the update" : "the factory app");
+		fails++;
+	}
+	if (reply.n != 1 || strcmp(reply.msg, s->reply) != 0 || strcmp(reply.req_id, TEST_REQ_ID) != 0) {
+		printf("  FAIL: %s: %d replies, last \"%s\" for \"%s\", expected \"%s\"\n", s->name, reply.n, reply.msg,
+			   reply.req_id, s->reply);
+		fails++;
+	}
+	if (_ota_nvs_load("pending", &pending, sizeof(pending)) || _ota_nvs_load("result", &pending, sizeof(pending)) ||
+		ota_health_running) {
+		printf("  FAIL: %s: health check records left behind\n", s->name);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	ota_task must keep taking commands while the health task waits,
+* 			but not update away from an image that's still on trial
+*/
+static int _test_on_trial(void)
+{
+	int fails = 0;
+	esp_err_t err;
+
+	_install();
+	host_flash_boot();
+	task_fn = NULL;
+	ota_boot_check();
+	if (task_fn != _ota_health_task || !ota_health_running) {
+		printf("  FAIL: no health task started for a pending update\n");
+		return 1;
+	}
+	strlcpy(ota_file_basename, TEST_FILE, OTA_FILE_BN_LEN);
+	err = _ota_commence();
+	printf("update while on trial: %s\n", esp_err_to_name(err));
+	if (err != ESP_ERR_INVALID_STATE) {
+		printf("  FAIL: expected ESP_ERR_INVALID_STATE\n");
+		fails++;
+	}
+
+	// No update pending: nothing to start, nothing held up
+	host_nvs_clear();
+	host_flash_reset();
+	ota_health_running = false;
+	task_fn = NULL;
+	ota_boot_check();
+	if (task_fn != NULL || ota_health_running) {
+		printf("  FAIL: health task started with no update pending\n");
+		fails++;
+	}
+	ota_health_running = false;
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	printf("%-22s %5s %9s %-8s %s\n", "scenario", "boots", "restarted", "running", "reply");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i]);
+	}
+	fails += _test_on_trial();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
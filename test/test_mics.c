@@ -0,0 +1,474 @@
+/*
+ * test_mics.c
+ *
+ * Notes:
+ * 		Runs the real mics_task on a virtual clock (simulated time) with a
+ * 		model of the sensor behind the GPIO and ADC stand-ins in
+ * 		host_rtos.c. The heater warms the sensing layer with a first order
+ * 		response while the board is enabled and the heater pin is high,
+ * 		and cools it otherwise. The signal is a slow ramp on each channel
+ * 		(so an output's timestamp can be checked against its value), noise
+ * 		and the odd single-sample spike, pulled off by TEST_COLD counts
+ * 		while the sensing layer is below temperature.
+ *
+ * 		The heater schedule is a pure function of the time since power-up,
+ * 		so _mics_phase is checked against the schedule walked segment by
+ * 		segment, and the heater pin must switch within a sample period of
+ * 		each boundary. No ADC read may happen outside a stable phase or on
+ * 		a sensor that hasn't reached temperature. Within each stable phase
+ * 		an output must come every CONFIG_MICS4514_DECIMATION samples,
+ * 		calibrated, with the spikes gone, and match a reference chain (the
+ * 		ramp at its timestamp, through an EMA in double) to a few mV.
+ * 		MICS4514_Poll must never read the ADC, and only return ESP_OK for
+ * 		a current output while the heater is stable.
+ *
+ * 		Then benchmarks, on the host's clock and the same source, the CPU
+ * 		time behind one published value (a window through both chains and
+ * 		two calibrations) against one call of the blocking 64-read poll it
+ * 		replaced, and how much of each is the source itself.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <math.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define CONFIG_MICS4514_SAMPLE_HZ		20
+#define CONFIG_MICS4514_DECIMATION		64
+#define CONFIG_MICS4514_EMA_SHIFT		2
+#define CONFIG_MICS4514_WARMUP_S		180
+#define CONFIG_MICS4514_HEATER_ON_S		60
+#define CONFIG_MICS4514_HEATER_OFF_S	120
+#define CONFIG_MICS4514_REWARM_S		30
+
+static TaskFunction_t task_fn;				/* What MICS4514_Initialize started */
+
+/* Run the sampler on this thread, on simulated time */
+static BaseType_t _test_task_create(TaskFunction_t fn)
+{
+	task_fn = fn;
+	return pdPASS;
+}
+#define xTaskCreate(fn, name, stack, arg, prio, handle)		_test_task_create(fn)
+
+#include "../main/mics4514_if.c"
+#undef xTaskCreate
+#include "../main/filter_if.c"
+
+#define TEST_S				1000000LL
+#define TEST_CYCLE_S		(CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_HEATER_OFF_S + CONFIG_MICS4514_REWARM_S)
+#define TEST_CYCLES			3
+/* Ends in the re-warm after the last stable phase */
+#define TEST_RUN_S			(CONFIG_MICS4514_WARMUP_S + TEST_CYCLES * TEST_CYCLE_S)
+#define TEST_OX_RAW			1200.0		/* Counts at t = 0 */
+#define TEST_RED_RAW		2600.0
+#define TEST_SLOPE			2.0			/* Counts per second, up for OX, down for RED */
+#define TEST_NOISE			8			/* Counts, four uniforms this wide: sigma about 5 */
+#define TEST_SPIKE_EVERY	97			/* ADC reads between spikes */
+#define TEST_SPIKE			1500
+#define TEST_COLD			600.0		/* Counts off, cold */
+#define TEST_TAU_S			5.0			/* Sensing layer's thermal time constant */
+#define TEST_HOT			0.99		/* Fraction of the way to temperature to read it */
+#define TEST_MAX_ERR_MV		3
+#define TEST_MAX_EDGES		16
+#define TEST_BENCH_OUTPUTS	2000
+
+static jmp_buf end_jmp;
+static uint32_t rng = 1;
+static uint32_t reads, poll_reads, cold_reads, unstable_reads, spikes;
+static bool in_poll;
+static bool synthetic = true;			/* Else the source returns a constant, for timing it alone */
+/* The sensor */
+static struct {
+	int enable, heater;					/* Pin levels, enable is active low */
+	double heat;						/* 0 cold, 1 at temperature */
+	int64_t at_us;						/* When heat was worked out */
+	int64_t heated_us;					/* Heater time after the warm-up */
+	int64_t edges[TEST_MAX_EDGES];		/* Heater switched on or off */
+	int n_edges;
+} sensor;
+static struct {
+	int outputs, phases, bad_spacing, short_phase, phase_outputs;
+	int64_t last_us;
+	double ref_ox, ref_red;				/* Reference EMA of the ramp */
+	int ox_err, red_err;				/* Worst, mV */
+	int poll[4];						/* ESP_OK, NOT_FOUND, INVALID_STATE, TIMEOUT */
+	int bad_ok;							/* ESP_OK for what isn't a current stable output */
+} seen;
+
+
+static uint32_t _rand(void)
+{
+	rng = rng * 1664525 + 1013904223;
+	return rng >> 8;
+}
+
+/*
+* @brief	Sum of four uniforms: close enough to Gaussian, and cheap
+*/
+static int _noise(void)
+{
+	int n = 0;
+
+	for (int i = 0; i < 4; i++) {
+		n += (int) (_rand() % (TEST_NOISE + 1)) - TEST_NOISE / 2;
+	}
+	return n;
+}
+
+/*
+* @brief	The signal on a channel at t, in counts
+*/
+static double _level(adc1_channel_t channel, int64_t t_us)
+{
+	double t = (double) t_us / TEST_S;
+
+	return (channel == ADC_CHANNEL_6) ? TEST_OX_RAW + TEST_SLOPE * t : TEST_RED_RAW - TEST_SLOPE * t;
+}
+
+/*
+* @brief	Bring the sensing layer's temperature up to now
+*/
+static void _sensor_at(int64_t now)
+{
+	bool on = (sensor.enable == 0 && sensor.heater == 1);
+	double target = on ? 1.0 : 0.0;
+
+	sensor.heat = target + (sensor.heat - target) * exp(-(double) (now - sensor.at_us) / (TEST_TAU_S * TEST_S));
+	if (on && now > CONFIG_MICS4514_WARMUP_S * TEST_S) {
+		sensor.heated_us += now - ((sensor.at_us > CONFIG_MICS4514_WARMUP_S * TEST_S) ? sensor.at_us :
+								   CONFIG_MICS4514_WARMUP_S * TEST_S);
+	}
+	sensor.at_us = now;
+}
+
+/*
+* @brief	host_gpio_write
+*/
+static void _gpio(gpio_num_t gpio, int level)
+{
+	int64_t now = esp_timer_get_time();
+	bool was;
+
+	_sensor_at(now);
+	was = (sensor.enable == 0 && sensor.heater == 1);
+	if (gpio == GPIO_MICS_ENABLE) {
+		sensor.enable = level;
+	}
+	else if (gpio == GPIO_MICS_HEATER) {
+		sensor.heater = level;
+	}
+	if (was != (sensor.enable == 0 && sensor.heater == 1) && sensor.n_edges < TEST_MAX_EDGES) {
+		sensor.edges[sensor.n_edges++] = now;
+	}
+}
+
+/*
+* @brief	host_adc1_read
+*/
+static int _adc(adc1_channel_t channel)
+{
+	int64_t now = esp_timer_get_time();
+	int raw;
+
+	reads++;
+	if (in_poll) {
+		poll_reads++;
+	}
+	if (!synthetic) {
+		return 2048;
+	}
+	_sensor_at(now);
+	if (sensor.heat < TEST_HOT) {
+		cold_reads++;
+	}
+	if (phase != MICS4514_STABLE) {
+		unstable_reads++;
+	}
+	raw = (int) lround(_level(channel, now) + TEST_COLD * (1 - sensor.heat)) + _noise();
+	if (reads % TEST_SPIKE_EVERY == 0) {
+		raw += TEST_SPIKE;
+		spikes++;
+	}
+	return raw;
+}
+
+/*
+* @brief	The schedule, walked segment by segment
+*/
+static mics4514_phase_t _schedule(uint32_t t)
+{
+	static const struct { mics4514_phase_t phase; uint32_t s; } cycle[] = {
+		{ MICS4514_STABLE, CONFIG_MICS4514_HEATER_ON_S },
+		{ MICS4514_OFF, CONFIG_MICS4514_HEATER_OFF_S },
+		{ MICS4514_WARMUP, CONFIG_MICS4514_REWARM_S },
+	};
+	uint32_t end = CONFIG_MICS4514_WARMUP_S;
+
+	if (t < end) {
+		return MICS4514_WARMUP;
+	}
+	for (;;) {
+		for (int i = 0; i < 3; i++) {
+			end += cycle[i].s;
+			if (t < end) {
+				return cycle[i].phase;
+			}
+		}
+	}
+}
+
+static void _output(const mics4514_sample_t *s)
+{
+	double alpha = 1.0 / (1 << CONFIG_MICS4514_EMA_SHIFT);
+	// The CIC of a ramp is the ramp at the window's middle, one sample
+	// back for the median
+	double ox = _level(ADC_CHANNEL_6, s->time_us - MICS_PERIOD_US);
+	double red = _level(ADC_CHANNEL_7, s->time_us - MICS_PERIOD_US);
+	int err;
+
+	if (seen.outputs > 0 && s->time_us - seen.last_us == MICS_WINDOW_US) {
+		seen.ref_ox += (ox - seen.ref_ox) * alpha;
+		seen.ref_red += (red - seen.ref_red) * alpha;
+		seen.phase_outputs++;
+	}
+	else {
+		// First output of a stable phase: filters start over
+		if (seen.outputs > 0 && s->time_us - seen.last_us < CONFIG_MICS4514_HEATER_OFF_S * TEST_S) {
+			seen.bad_spacing++;
+		}
+		if (seen.phases > 0 && seen.phase_outputs + 1 < (CONFIG_MICS4514_HEATER_ON_S * TEST_S / MICS_WINDOW_US) -
+			(FILT_CIC_ORDER - 1) - 1) {
+			seen.short_phase++;
+		}
+		seen.ref_ox = ox;
+		seen.ref_red = red;
+		seen.phase_outputs = 0;
+		seen.phases++;
+	}
+	seen.last_us = s->time_us;
+	seen.outputs++;
+
+	err = abs(s->ox_mv - (int) esp_adc_cal_raw_to_voltage(lround(seen.ref_ox), adc_chars));
+	seen.ox_err = (err > seen.ox_err) ? err : seen.ox_err;
+	err = abs(s->red_mv - (int) esp_adc_cal_raw_to_voltage(lround(seen.ref_red), adc_chars));
+	seen.red_err = (err > seen.red_err) ? err : seen.red_err;
+}
+
+/*
+* @brief	Every 100 ms of simulated time: the sensor, and what
+* 			MICS4514_GetSample and MICS4514_Poll say
+*/
+static void _tick(int64_t now)
+{
+	mics4514_sample_t s;
+	int ox, red;
+	esp_err_t err;
+
+	_sensor_at(now);
+	MICS4514_GetSample(&s);
+	if (s.time_us != 0 && s.time_us != seen.last_us) {
+		_output(&s);
+	}
+
+	in_poll = true;
+	err = MICS4514_Poll(&ox, &red);
+	in_poll = false;
+	switch (err) {
+	case ESP_OK:
+		seen.poll[0]++;
+		// Only a current output, from a sensor at temperature (the sampler
+		// sees a phase change up to a sample period late)
+		if (_schedule((now - MICS_PERIOD_US) / TEST_S) != MICS4514_STABLE || now - s.time_us > MICS_DELAY_US + 2 * MICS_WINDOW_US ||
+			sensor.heat < TEST_HOT || ox != s.ox_mv || red != s.red_mv) {
+			seen.bad_ok++;
+		}
+		break;
+	case ESP_ERR_NOT_FOUND:
+		seen.poll[1]++;
+		break;
+	case ESP_ERR_INVALID_STATE:
+		seen.poll[2]++;
+		break;
+	case ESP_ERR_TIMEOUT:
+		seen.poll[3]++;
+		break;
+	}
+
+	if (now >= TEST_RUN_S * TEST_S) {
+		longjmp(end_jmp, 1);
+	}
+}
+
+/*
+* @brief	_mics_phase against the schedule, second by second
+*/
+static int _test_schedule(void)
+{
+	int bad = 0;
+
+	for (uint32_t t = 0; t < CONFIG_MICS4514_WARMUP_S + 10 * TEST_CYCLE_S; t++) {
+		if (_mics_phase(t) != _schedule(t)) {
+			if (bad++ == 0) {
+				printf("  FAIL: phase %d at %u s, expected %d\n", _mics_phase(t), t, _schedule(t));
+			}
+		}
+	}
+	printf("schedule: warm-up %d s, then stable %d s, off %d s, re-warm %d s: %s\n", CONFIG_MICS4514_WARMUP_S,
+		   CONFIG_MICS4514_HEATER_ON_S, CONFIG_MICS4514_HEATER_OFF_S, CONFIG_MICS4514_REWARM_S, bad ? "FAIL" : "ok");
+	return bad ? 1 : 0;
+}
+
+static int _run(void)
+{
+	int fails = 0, n_edges;
+	int64_t edge;
+	double duty;
+	int expect = TEST_CYCLES * (CONFIG_MICS4514_HEATER_ON_S * TEST_S / MICS_WINDOW_US - (FILT_CIC_ORDER - 1));
+
+	host_sim_start(0, _tick);
+	MICS4514_Initialize();
+	// Not the busy loop Initialize times
+	reads = cold_reads = unstable_reads = 0;
+	if (setjmp(end_jmp) == 0 && task_fn != NULL) {
+		task_fn(NULL);
+	}
+	_sensor_at(TEST_RUN_S * TEST_S);
+
+	// Heater edges: on at power-up, then off and on again once per cycle
+	n_edges = 2 * TEST_CYCLES;
+	duty = (double) sensor.heated_us / ((TEST_RUN_S - CONFIG_MICS4514_WARMUP_S) * TEST_S);
+	printf("%d outputs in %d stable phases, worst error OX %d mV, RED %d mV, %u spikes\n", seen.outputs,
+		   seen.phases, seen.ox_err, seen.red_err, spikes);
+	printf("heater on %.1f%% of the time after the warm-up (schedule %.1f%%), %d switches\n", duty * 100,
+		   100.0 * (CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_REWARM_S) / TEST_CYCLE_S, sensor.n_edges);
+	printf("poll: %d ok, %d not found, %d heater not stable, %d overdue\n", seen.poll[0], seen.poll[1],
+		   seen.poll[2], seen.poll[3]);
+
+	if (task_fn != mics_task) {
+		printf("  FAIL: no sampler task started\n");
+		return 1;
+	}
+	if (sensor.n_edges != 1 + n_edges) {
+		printf("  FAIL: heater switched %d times, expected %d\n", sensor.n_edges, 1 + n_edges);
+		fails++;
+	}
+	for (int i = 1; i < sensor.n_edges && i <= n_edges; i++) {
+		// Off at the end of each stable phase, on again after the off phase
+		edge = (CONFIG_MICS4514_WARMUP_S + CONFIG_MICS4514_HEATER_ON_S + (i - 1) / 2 * TEST_CYCLE_S +
+				((i - 1) % 2) * CONFIG_MICS4514_HEATER_OFF_S) * TEST_S;
+		if (sensor.edges[i] < edge || sensor.edges[i] > edge + MICS_PERIOD_US) {
+			printf("  FAIL: heater switch %d at %.3f s, expected %.3f s\n", i, (double) sensor.edges[i] / TEST_S,
+				   (double) edge / TEST_S);
+			fails++;
+		}
+	}
+	if (fabs(duty - (double) (CONFIG_MICS4514_HEATER_ON_S + CONFIG_MICS4514_REWARM_S) / TEST_CYCLE_S) > 0.01) {
+		printf("  FAIL: heater duty %.1f%% off the schedule\n", duty * 100);
+		fails++;
+	}
+	if (cold_reads || unstable_reads) {
+		printf("  FAIL: %u ADC reads below temperature, %u outside a stable phase\n", cold_reads, unstable_reads);
+		fails++;
+	}
+	// The last window of a phase may or may not close before the heater goes off
+	if (seen.phases != TEST_CYCLES || seen.outputs < expect - TEST_CYCLES || seen.outputs > expect ||
+		seen.bad_spacing || seen.short_phase) {
+		printf("  FAIL: expected about %d outputs in %d phases, one window apart (%d off, %d phases short)\n",
+			   expect, TEST_CYCLES, seen.bad_spacing, seen.short_phase);
+		fails++;
+	}
+	if (seen.ox_err > TEST_MAX_ERR_MV || seen.red_err > TEST_MAX_ERR_MV) {
+		printf("  FAIL: outputs more than %d mV off the reference\n", TEST_MAX_ERR_MV);
+		fails++;
+	}
+	if (poll_reads || seen.bad_ok || !seen.poll[0] || !seen.poll[1] || !seen.poll[2] || !seen.poll[3]) {
+		printf("  FAIL: MICS4514_Poll read the ADC %u times, said ESP_OK %d times when it shouldn't have, "
+			   "or never gave one of its results\n", poll_reads, seen.bad_ok);
+		fails++;
+	}
+	return fails;
+}
+
+static int64_t _host_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+* @brief	One published value: what mics_task does for a window, against
+* 			one call of the blocking poll (_mics_busy_loop_bench runs it)
+*/
+static double _bench_sampler(void)
+{
+	filt_chain_t ox = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, CONFIG_MICS4514_EMA_SHIFT);
+	filt_chain_t red = FILT_CHAIN_INIT(CONFIG_MICS4514_DECIMATION, CONFIG_MICS4514_EMA_SHIFT);
+	volatile uint32_t sink = 0;
+	int32_t o, r;
+	bool have_ox, have_red;
+	int outs = 0;
+	int64_t t = _host_ns();
+
+	while (outs < TEST_BENCH_OUTPUTS) {
+		have_ox = FILT_Chain_Push(&ox, adc1_get_raw(ADC_CHANNEL_6), &o);
+		have_red = FILT_Chain_Push(&red, adc1_get_raw(ADC_CHANNEL_7), &r);
+		if (have_ox && have_red) {
+			sink += esp_adc_cal_raw_to_voltage(o, adc_chars) + esp_adc_cal_raw_to_voltage(r, adc_chars);
+			outs++;
+		}
+	}
+	(void) sink;
+	return (double) (_host_ns() - t) / outs / 1000;
+}
+
+static double _bench_poll(void)
+{
+	int64_t t = _host_ns();
+
+	for (int i = 0; i < TEST_BENCH_OUTPUTS; i++) {
+		_mics_busy_loop_bench();
+	}
+	return (double) (_host_ns() - t) / TEST_BENCH_OUTPUTS / 1000;
+}
+
+static void _bench(void)
+{
+	double sampler, poll, source;
+
+	sampler = _bench_sampler();
+	poll = _bench_poll();
+	synthetic = false;
+	source = _bench_poll();
+	synthetic = true;
+
+	printf("\nper published value     host us\n");
+	printf("sampler (%d x 2 reads) %8.2f\n", CONFIG_MICS4514_DECIMATION, sampler);
+	printf("blocking poll (%d x 2) %8.2f\n", NO_OF_SAMPLES, poll);
+	printf("  of which the source   %8.2f  (constant source: %.2f)\n", poll - source, source);
+	printf("filter + calibration    %8.3f  (%.1f ns per sample)\n", sampler - poll,
+		   (sampler - poll) * 1000 / (2 * CONFIG_MICS4514_DECIMATION));
+	printf("data_task blocked       %8.2f -> 0 (MICS4514_Poll copies the cached value)\n", poll);
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	host_adc1_read = _adc;
+
+	host_gpio_write = _gpio;
+
+	fails += _test_schedule();
+	fails += _run();
+	_bench();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
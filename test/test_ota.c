@@ -0,0 +1,481 @@
+/*
+ * test_ota.c
+ *
+ * Notes:
+ * 		Runs ota_if's download against the flash emulator in host_rtos.c
+ * 		and a file server that drops connections: a set number of them are
+ * 		cut a set number of bytes in (reset or early close, either), it can
+ * 		go away for good after some connections, ignore Range, flip a byte
+ * 		in transit or have no manifest. Reads come back in random sizes.
+ *
+ * 		Checks that a dropped download resumes with Range from the last
+ * 		byte written and fetches nothing twice, that a download that runs
+ * 		out of retries resumes from the NVS "ckpt" blob after a reboot
+ * 		(and only for the same build), that the flash holds the image and
+ * 		was never written without an erase, and that the boot partition is
+ * 		only switched after the SHA-256 manifest matched what's in flash.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#define CONFIG_OTA_URL_BASE			"http://files.test/updates/"
+#define CONFIG_OTA_BUF_SIZE			4096
+#define CONFIG_OTA_MAX_RETRIES		5
+#define CONFIG_OTA_HEALTH_BUDGET_S	600
+#define CONFIG_OTA_HEALTH_MIN_HEAP	20000
+#define CONFIG_OTA_HEALTH_MAX_BOOTS	3
+#define CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2	12
+#define CONFIG_MQTT_ACK_QOS			1
+
+#include "../main/ota_if.c"
+// The stages it feeds, each with a TAG of its own
+#define TAG		delta_tag
+#include "../main/delta_if.c"
+#undef TAG
+#define TAG		unpack_tag
+#include "../main/unpack_if.c"
+#undef TAG
+
+#define TEST_FILE			"airu-v2.bin"
+#define TEST_IMAGE_LEN		300000			/* Not sector aligned */
+#define TEST_DROP_AT		70000
+#define TEST_MAX_RANGES		32
+#ifndef TEST_SEED
+#define TEST_SEED			1
+#endif
+
+typedef struct {
+	const char *name;
+	int drops;					/* Connections cut TEST_DROP_AT bytes in */
+	int conns;					/* Image connections before the server goes away, 0: never */
+	bool no_range;				/* Answers Range with the whole file */
+	int corrupt_at;				/* Byte flipped in transit, -1: none */
+	bool no_manifest;
+} server_t;
+
+struct esp_http_client {
+	char url[OTA_URL_LEN + 16];
+	long range;					/* -1: no Range header */
+	bool manifest;
+	const uint8_t *data;
+	long len, pos, cut_at;
+	int status;
+};
+
+static server_t srv;
+static uint8_t image[TEST_IMAGE_LEN];
+static char manifest[OTA_MANIFEST_LEN];
+static unsigned int seed = TEST_SEED;
+static long fetched;						/* Image bytes the server sent */
+static int conns;							/* Image connections opened */
+static long ranges[TEST_MAX_RANGES];		/* Range offsets asked for, in order */
+static int ranges_n;
+
+char DEVICE_MAC[13] = "f4e5d6c7b8a9";
+
+
+/* The rest of the firmware, as far as ota_if calls it */
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg) { (void) ctx; (void) qos; (void) msg; return 0; }
+void CMD_Progress(const cmd_ctx_t *ctx, const char *name, int pct) { (void) ctx; (void) name; (void) pct; }
+void DIAG_Crumb(diag_kind_t kind, int32_t code) { (void) kind; (void) code; }
+void DIAG_Flush(bool force) { (void) force; }
+void print_sha256(const uint8_t *image_hash, const char *label) { (void) image_hash; (void) label; }
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+	esp_http_client_handle_t c = calloc(1, sizeof(struct esp_http_client));
+
+	strlcpy(c->url, config->url, sizeof(c->url));
+	c->range = -1;
+	return c;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c, const char *key, const char *value)
+{
+	if (strcmp(key, "Range") == 0 && sscanf(value, "bytes=%ld-", &c->range) == 1 && ranges_n < TEST_MAX_RANGES) {
+		ranges[ranges_n++] = c->range;
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len)
+{
+	const char *file = c->url + strlen(CONFIG_OTA_URL_BASE);
+
+	(void) write_len;
+	c->manifest = _ota_has_ext(file, strlen(file), ".sha256");
+	if (c->manifest) {
+		c->status = srv.no_manifest ? 404 : 200;
+		c->data = (const uint8_t *) manifest;
+		c->len = srv.no_manifest ? 0 : strlen(manifest);
+		c->cut_at = -1;
+		return ESP_OK;
+	}
+	if (srv.conns > 0 && conns >= srv.conns) {
+		return ESP_FAIL;				/* Gone: connection refused */
+	}
+	conns++;
+	if (strcmp(file, TEST_FILE) != 0) {
+		c->status = 404;
+		return ESP_OK;
+	}
+	c->data = image;
+	c->len = TEST_IMAGE_LEN;
+	if (c->range >= 0 && !srv.no_range) {
+		c->status = 206;
+		c->pos = c->range;
+	}
+	else {
+		c->status = 200;
+	}
+	c->cut_at = (srv.drops-- > 0) ? c->pos + TEST_DROP_AT : -1;
+	return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t c)
+{
+	return c->status < 300 ? c->len - c->pos : 0;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c)
+{
+	return c->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buffer, int len)
+{
+	long n;
+
+	if (c->cut_at >= 0 && c->pos >= c->cut_at) {
+		return rand_r(&seed) % 2 ? -1 : 0;		/* Reset, or closed early */
+	}
+	n = c->len - c->pos;
+	if (c->cut_at >= 0 && c->cut_at - c->pos < n) {
+		n = c->cut_at - c->pos;
+	}
+	if (n > len) {
+		n = len;
+	}
+	if (n > 1) {
+		n = 1 + rand_r(&seed) % n;
+	}
+	memcpy(buffer, c->data + c->pos, n);
+	if (!c->manifest) {
+		if (srv.corrupt_at >= c->pos && srv.corrupt_at < c->pos + n) {
+			buffer[srv.corrupt_at - c->pos] ^= 0x10;
+		}
+		fetched += n;
+	}
+	c->pos += n;
+	return n;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c)
+{
+	(void) c;
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c)
+{
+	free(c);
+	return ESP_OK;
+}
+
+/*
+* @brief	A new build on the server: random bytes behind an image header,
+* 			and its sha256sum line
+*/
+static void _build(void)
+{
+	uint8_t sha[SHA256_HASH_LEN];
+	mbedtls_sha256_context ctx;
+	int n;
+
+	for (int i = 0; i < TEST_IMAGE_LEN; i++) {
+		image[i] = rand_r(&seed);
+	}
+	image[0] = ESP_IMAGE_HEADER_MAGIC;
+
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	mbedtls_sha256_update_ret(&ctx, image, TEST_IMAGE_LEN);
+	mbedtls_sha256_finish_ret(&ctx, sha);
+	mbedtls_sha256_free(&ctx);
+	for (n = 0; n < SHA256_HASH_LEN; n++) {
+		sprintf(manifest + 2 * n, "%02x", sha[n]);
+	}
+	sprintf(manifest + 2 * n, "  %s\n", TEST_FILE);
+}
+
+/*
+* @brief	"ota <file>" on a device that just booted
+*
+* @return	true if it rebooted into the update
+*/
+static bool _ota(const server_t *s, esp_err_t *err)
+{
+	jmp_buf restart;
+	volatile bool restarted = false;
+
+	srv = *s;
+	fetched = 0;
+	conns = ranges_n = 0;
+	strlcpy(ota_file_basename, TEST_FILE, OTA_FILE_BN_LEN);
+	*err = ESP_FAIL;
+	host_restart = &restart;
+	if (setjmp(restart) == 0) {
+		*err = _ota_commence();
+	}
+	else {
+		restarted = true;
+	}
+	host_restart = NULL;
+	return restarted;
+}
+
+static bool _flash_holds_image(const esp_partition_t *part)
+{
+	static uint8_t buf[TEST_IMAGE_LEN];
+
+	return esp_partition_read(part, 0, buf, TEST_IMAGE_LEN) == ESP_OK && memcmp(buf, image, TEST_IMAGE_LEN) == 0;
+}
+
+/*
+* @brief	The download went through: image in ota_0, boot switched,
+* 			checkpoint gone, the health gate's record written
+*/
+static int _check_updated(const char *name, bool restarted)
+{
+	const esp_partition_t *ota0 = esp_ota_get_next_update_partition(NULL);
+	host_flash_stats_t st;
+	ota_checkpoint_t ckpt;
+	ota_pending_t pending;
+	int fails = 0;
+
+	host_flash_stats(&st);
+	if (!restarted || esp_ota_get_boot_partition() != ota0) {
+		printf("  FAIL: %s: didn't switch to the update\n", name);
+		fails++;
+	}
+	if (!_flash_holds_image(ota0)) {
+		printf("  FAIL: %s: flash doesn't hold the image\n", name);
+		fails++;
+	}
+	if (st.bad_writes != 0) {
+		printf("  FAIL: %s: %u writes without an erase\n", name, st.bad_writes);
+		fails++;
+	}
+	if (_ota_nvs_load("ckpt", &ckpt, sizeof(ckpt))) {
+		printf("  FAIL: %s: checkpoint left behind\n", name);
+		fails++;
+	}
+	if (!_ota_nvs_load("pending", &pending, sizeof(pending)) || pending.prev_addr != esp_ota_get_running_partition()->address ||
+		pending.boots != 0 || strcmp(pending.file, TEST_FILE) != 0) {
+		printf("  FAIL: %s: no health gate record\n", name);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	The download was refused: still booting the factory app, and
+* 			nothing the health gate would act on
+*/
+static int _check_refused(const char *name, bool restarted, esp_err_t err)
+{
+	ota_pending_t pending;
+
+	if (restarted || err == ESP_OK || esp_ota_get_boot_partition() != esp_ota_get_running_partition() ||
+		_ota_nvs_load("pending", &pending, sizeof(pending))) {
+		printf("  FAIL: %s: switched to a bad image\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+static void _fresh_device(void)
+{
+	host_flash_reset();
+	host_nvs_clear();
+}
+
+static void _report(const char *name, long fetched_total, int conns_total, const char *ranges_s)
+{
+	printf("%-28s %8ld %5d  %s\n", name, fetched_total, conns_total, ranges_s);
+}
+
+static const char *_ranges(void)
+{
+	static char s[TEST_MAX_RANGES * 8];
+	int len = 0;
+
+	s[0] = '\0';
+	for (int i = 0; i < ranges_n && len < (int) sizeof(s) - 8; i++) {
+		len += snprintf(s + len, sizeof(s) - len, "%s%ld", i ? " " : "", ranges[i]);
+	}
+	return s;
+}
+
+/*
+* @brief	Dropped connections within one attempt: Range from the last byte
+*/
+static int _test_retries(void)
+{
+	const server_t s = { "4 drops", 4, 0, false, -1, false };
+	esp_err_t err;
+	bool restarted;
+	int fails = 0;
+
+	_fresh_device();
+	restarted = _ota(&s, &err);
+	_report(s.name, fetched, conns, _ranges());
+	fails += _check_updated(s.name, restarted);
+	if (fetched != TEST_IMAGE_LEN || conns != 5 || ranges_n != 4) {
+		printf("  FAIL: %s: %ld bytes over %d connections, expected %d over 5\n", s.name, fetched, conns,
+			   TEST_IMAGE_LEN);
+		fails++;
+	}
+	for (int i = 0; i < ranges_n; i++) {
+		if (ranges[i] != (i + 1) * (long) TEST_DROP_AT) {
+			printf("  FAIL: %s: Range %d from %ld, expected %d\n", s.name, i, ranges[i], (i + 1) * TEST_DROP_AT);
+			fails++;
+		}
+	}
+	return fails;
+}
+
+/*
+* @brief	Out of retries, then a reboot: resume from the NVS checkpoint.
+* 			With a new build on the server instead, start over.
+*/
+static int _test_checkpoint(bool new_build)
+{
+	const server_t dying = { "server goes away", 2, 2, false, -1, false };
+	const server_t back = { new_build ? "new build after reboot" : "resume after reboot", 0, 0, false, -1, false };
+	ota_checkpoint_t ckpt;
+	long first;
+	esp_err_t err;
+	bool restarted;
+	int fails = 0;
+
+	_fresh_device();
+	restarted = _ota(&dying, &err);
+	_report(dying.name, fetched, conns, _ranges());
+	first = fetched;
+	fails += _check_refused(dying.name, restarted, err);
+	if (!_ota_nvs_load("ckpt", &ckpt, sizeof(ckpt)) || ckpt.offset == 0 || ckpt.offset % OTA_SECTOR_SIZE != 0 ||
+		ckpt.offset > first || first - ckpt.offset >= OTA_SECTOR_SIZE + CONFIG_OTA_BUF_SIZE ||
+		strcmp(ckpt.file, TEST_FILE) != 0) {
+		printf("  FAIL: %s: checkpoint at %u after %ld bytes\n", dying.name, ckpt.offset, first);
+		return fails + 1;
+	}
+
+	host_flash_boot();
+	if (new_build) {
+		_build();
+	}
+	restarted = _ota(&back, &err);
+	_report(back.name, fetched, conns, _ranges());
+	fails += _check_updated(back.name, restarted);
+	if (!new_build && (ranges_n < 1 || ranges[0] != ckpt.offset || fetched != TEST_IMAGE_LEN - ckpt.offset)) {
+		printf("  FAIL: %s: fetched %ld from %ld, checkpoint at %u\n", back.name, fetched,
+			   ranges_n ? ranges[0] : 0, ckpt.offset);
+		fails++;
+	}
+	if (new_build && (ranges_n != 0 || fetched != TEST_IMAGE_LEN)) {
+		printf("  FAIL: %s: resumed a different build's download\n", back.name);
+		fails++;
+	}
+	return fails;
+}
+
+static int _test_no_range(void)
+{
+	const server_t s = { "server ignores Range", 1, 0, true, -1, false };
+	esp_err_t err;
+	bool restarted;
+	int fails = 0;
+
+	_fresh_device();
+	restarted = _ota(&s, &err);
+	_report(s.name, fetched, conns, _ranges());
+	fails += _check_updated(s.name, restarted);
+	if (fetched != TEST_DROP_AT + TEST_IMAGE_LEN) {
+		printf("  FAIL: %s: fetched %ld, expected a restart from 0\n", s.name, fetched);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	The manifest guards the boot switch
+*/
+static int _test_refused(void)
+{
+	const server_t bad[] = {
+		{ "byte flipped in transit", 1, 0, false, 123456, false },
+		{ "no manifest", 0, 0, false, -1, true },
+	};
+	host_flash_stats_t st;
+	ota_checkpoint_t ckpt;
+	esp_err_t err;
+	bool restarted;
+	int fails = 0;
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		_fresh_device();
+		restarted = _ota(&bad[i], &err);
+		_report(bad[i].name, fetched, conns, _ranges());
+		fails += _check_refused(bad[i].name, restarted, err);
+		if (_ota_nvs_load("ckpt", &ckpt, sizeof(ckpt))) {
+			printf("  FAIL: %s: checkpoint kept for a bad image\n", bad[i].name);
+			fails++;
+		}
+	}
+	host_flash_stats(&st);
+	if (fetched != 0 || st.writes != 0) {
+		printf("  FAIL: no manifest: downloaded %ld bytes anyway\n", fetched);
+		fails++;
+	}
+	return fails;
+}
+
+/*
+* @brief	The same build as the one running: downloaded, checked, not booted
+*/
+static int _test_same_image(void)
+{
+	const server_t s = { "already running", 0, 0, false, -1, false };
+	const esp_partition_t *factory = esp_ota_get_running_partition();
+	esp_err_t err;
+	bool restarted;
+
+	_fresh_device();
+	esp_partition_erase_range(factory, 0, factory->size);
+	esp_partition_write(factory, 0, image, TEST_IMAGE_LEN);
+	restarted = _ota(&s, &err);
+	_report(s.name, fetched, conns, _ranges());
+	return _check_refused(s.name, restarted, err);
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	host_sim_start(0, NULL);			/* OTA_RETRY_DELAY without the wait */
+	_build();
+
+	printf("%-28s %8s %5s  %s\n", "scenario", "fetched", "conns", "Range from");
+	fails += _test_retries();
+	fails += _test_checkpoint(false);
+	fails += _test_checkpoint(true);
+	fails += _test_no_range();
+	fails += _test_refused();
+	fails += _test_same_image();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,560 @@
+/*
+ * test_pm.c
+ *
+ * Notes:
+ * 		Checks the PM sensor's sleep arithmetic at its edges, then runs
+ * 		the real pm_if on simulated time against a model of a PMS5003 on
+ * 		the UART stand-in in host_rtos.c. The fan runs while the SET pin
+ * 		is high, and for the first TEST_SETTLE_S after it starts sends
+ * 		frames far off the true values. In active mode it sends a frame
+ * 		a second, in passive mode one per read request, and it acks a
+ * 		mode change. The stand-in data_task polls every upload period.
+ *
+ * 		Every poll must average exactly the true values: any frame from a
+ * 		settling fan that gets in shows. Frames sent during warm-up must
+ * 		all be counted as dropped. The fan must be off for exactly what
+ * 		_pms_sleep_ms says, and back on in time for the next window. When
+ * 		the wake timer can't be set the sensor must stay awake, and the
+ * 		next poll must still have its frames.
+ *
+ * 		The WDT_ stand-ins judge the sensor as wdt_if does, with a
+ * 		TEST_WDT_S timeout: shorter than any quiet spell, so a spell the
+ * 		firmware doesn't announce with WDT_Expect shows. Each poll must
+ * 		announce when frames are due again, and nothing may disarm the
+ * 		sensor. It must never be found stalled while it works. After
+ * 		poll TEST_DEAD it stops answering, and must be found within
+ * 		TEST_WDT_S of the last deadline, which must fall before the next
+ * 		poll.
+ *
+ * 		The load on the ESP32 is counted over the polls from TEST_LOAD_FROM
+ * 		to TEST_LOAD_TO, when the sensor only sleeps and samples: frames
+ * 		and bytes on the UART, UART events, vPM_task wake-ups and timer
+ * 		callbacks, scaled to an hour.
+ *
+ * 		Built twice: as test_pm in active mode and with TEST_PASSIVE as
+ * 		test_pm_passive.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define CONFIG_DATA_UPLOAD_PERIOD	60
+#define CONFIG_PMS_SLEEP			1
+#define CONFIG_PMS_WARMUP_S			30
+#define CONFIG_PMS_SAMPLE_S			10
+#ifdef TEST_PASSIVE
+#define CONFIG_PMS_PASSIVE			1
+#define CONFIG_PMS_PASSIVE_FRAMES	10
+#endif
+
+static TaskFunction_t task_fn;				/* What PMS_Initialize started */
+
+/* Run the UART event task on this thread, on simulated time */
+static BaseType_t _test_task_create(TaskFunction_t fn)
+{
+	task_fn = fn;
+	return pdPASS;
+}
+static BaseType_t _test_change_period(TimerHandle_t timer, TickType_t period, TickType_t wait);
+static TimerHandle_t _test_timer_create(const char *name, TickType_t period, UBaseType_t reload, void *id,
+										TimerCallbackFunction_t cb);
+static BaseType_t _test_queue_receive(QueueHandle_t q, void *item, TickType_t wait);
+#define xTaskCreate(fn, name, stack, arg, prio, handle)		_test_task_create(fn)
+#define xTimerChangePeriod(timer, period, wait)				_test_change_period(timer, period, wait)
+#define xTimerCreate(name, period, reload, id, cb)			_test_timer_create(name, period, reload, id, cb)
+#define xQueueReceive(q, item, wait)						_test_queue_receive(q, item, wait)
+
+#include "../main/pm_if.c"
+#include "../main/pmsframe_if.c"
+#undef xTaskCreate
+#undef xTimerChangePeriod
+#undef xTimerCreate
+#undef xQueueReceive
+
+#define TEST_S				1000000LL
+#define TEST_PERIOD_US		(CONFIG_DATA_UPLOAD_PERIOD * TEST_S)
+#define TEST_POLLS			10
+#define TEST_TIMER_FULL		5			/* Poll at which the wake timer can't be set */
+#define TEST_DEAD			8			/* Poll after which the sensor stops answering */
+#define TEST_LOAD_FROM		1			/* Polls the load is counted between */
+#define TEST_LOAD_TO		4
+#define TEST_WDT_S			15			/* Sensor progress timeout */
+#define TEST_SETTLE_S		20			/* Fan settling, frames off */
+#define TEST_PM1			12			/* True values, ug/m3 */
+#define TEST_PM2_5			25
+#define TEST_PM10			40
+#define TEST_OFF			500			/* Added while settling */
+#define TEST_MAX_METRICS	8
+#define TEST_MAX_TIMERS		4
+
+typedef struct {
+	uint32_t frames, bytes;				/* On the UART, both ways */
+	uint32_t events;					/* UART events queued */
+	uint32_t wakes;						/* vPM_task returns from its queue */
+	uint32_t callbacks;					/* Timer callbacks */
+} load_t;
+
+static int fails = 0;
+static bool wake_timer_full = false;		/* The wake timer can't be set */
+static jmp_buf end_jmp;
+static metric_t metrics[TEST_MAX_METRICS];
+static int metrics_n;
+static struct {
+	TimerHandle_t timer;
+	TimerCallbackFunction_t cb;
+} timers_cb[TEST_MAX_TIMERS];
+static int timers_cb_n;
+static load_t load, load_from, load_to;
+/* The sensor */
+static struct {
+	bool on, passive, dead;
+	int64_t on_us;						/* Fan started */
+	int64_t off_us;						/* Fan stopped */
+	uint32_t powerups;
+	uint32_t frames, settling_frames;	/* Sent, sent while settling */
+	uint32_t early_frames;				/* Sent in the firmware's warm-up */
+	uint32_t requests, acks;
+	uint32_t requests_warm;				/* Requests outside SAMPLING */
+} pms;
+/* What the firmware did */
+static struct {
+	int polls, bad_polls, short_polls;
+	int sleeps, bad_sleeps, late_wakes;
+	int bad_expects, stayed_off, disarms;
+	int64_t last_poll_us;
+	int64_t expect_us;					/* Last WDT_Expect */
+	uint32_t expect_s;
+	int64_t dead_until_us;				/* Deadline given at poll TEST_DEAD */
+} seen;
+/* wdt_if's view of WDT_PM */
+static struct {
+	bool armed;
+	int64_t progress_us, quiet_until_us;
+	int64_t fired_us;					/* When it found the sensor stalled, 0: never */
+} wdt;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); fails++; } \
+	} while (0)
+
+
+/* As with a full timer command queue, for the wake timer only */
+static BaseType_t _test_change_period(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	if (wake_timer_full && timer == pm_wake_timer) {
+		return pdFAIL;
+	}
+	return xTimerChangePeriod(timer, period, wait);
+}
+
+/* Count the callbacks of the timers pm_if creates */
+static void _test_timer_cb(TimerHandle_t timer)
+{
+	load.callbacks++;
+	for (int i = 0; i < timers_cb_n; i++) {
+		if (timers_cb[i].timer == timer) {
+			timers_cb[i].cb(timer);
+		}
+	}
+}
+
+static TimerHandle_t _test_timer_create(const char *name, TickType_t period, UBaseType_t reload, void *id,
+										TimerCallbackFunction_t cb)
+{
+	TimerHandle_t timer = xTimerCreate(name, period, reload, id, _test_timer_cb);
+
+	timers_cb[timers_cb_n].timer = timer;
+	timers_cb[timers_cb_n++].cb = cb;
+	return timer;
+}
+
+/* vPM_task waking up */
+static BaseType_t _test_queue_receive(QueueHandle_t q, void *item, TickType_t wait)
+{
+	BaseType_t got = xQueueReceive(q, item, wait);
+
+	load.wakes += (got == pdTRUE);
+	return got;
+}
+
+/* The rest of the firmware, as far as pm_if calls it. Only WDT_PM is
+ * judged, as wdt_task does, on the progress timeout. */
+void WDT_Alive(wdt_component_t c)
+{
+	if (c == WDT_PM && !wdt.armed) {
+		wdt.armed = true;
+		wdt.progress_us = esp_timer_get_time();
+	}
+}
+
+void WDT_Progress(wdt_component_t c)
+{
+	if (c == WDT_PM) {
+		wdt.armed = true;
+		wdt.progress_us = esp_timer_get_time();
+	}
+}
+
+void WDT_Disarm(wdt_component_t c)
+{
+	if (c == WDT_PM) {
+		wdt.armed = false;
+		seen.disarms++;
+	}
+}
+
+void WDT_Expect(wdt_component_t c, uint32_t quiet_s)
+{
+	if (c == WDT_PM) {
+		wdt.quiet_until_us = esp_timer_get_time() + quiet_s * TEST_S;
+		seen.expect_us = esp_timer_get_time();
+		seen.expect_s = quiet_s;
+	}
+}
+
+static void _wdt_check(int64_t now)
+{
+	int64_t from = (wdt.progress_us > wdt.quiet_until_us) ? wdt.progress_us : wdt.quiet_until_us;
+
+	if (wdt.armed && now >= wdt.quiet_until_us && now - from > TEST_WDT_S * TEST_S && wdt.fired_us == 0) {
+		wdt.fired_us = now;
+	}
+}
+
+metric_t *METRICS_Register(const char *name, metric_type_t type)
+{
+	metric_t *m = &metrics[metrics_n++];
+
+	m->name = name;
+	m->type = type;
+	return m;
+}
+
+void METRICS_Add(metric_t *m, int32_t n)
+{
+	if (m != NULL) {
+		m->value += n;
+	}
+}
+
+void METRICS_WatchTask(TaskHandle_t task)
+{
+	(void) task;
+}
+
+static int32_t _metric(const char *name)
+{
+	for (int i = 0; i < metrics_n; i++) {
+		if (strcmp(metrics[i].name, name) == 0) {
+			return metrics[i].value;
+		}
+	}
+	return -1;
+}
+
+/*
+* @brief	Bytes from the sensor, in one UART event
+*/
+static void _uart_rx(const uint8_t *data, size_t len)
+{
+	host_uart_rx(PM_UART_CH, data, len);
+	load.events++;
+	load.bytes += len;
+}
+
+/*
+* @brief	One frame from the sensor, PMS5003 layout
+*/
+static void _send_frame(int64_t now)
+{
+	uint8_t f[PMS5003_FRAME_LEN] = { 'B', 'M', 0, PMS5003_FRAME_LEN - PMS_HDR_LEN };
+	bool settling = now - pms.on_us < TEST_SETTLE_S * TEST_S;
+	uint16_t pm[3] = { TEST_PM1, TEST_PM2_5, TEST_PM10 };
+	uint16_t sum;
+
+	for (int i = 0; i < 6; i++) {
+		// CF=1 then atmospheric
+		f[PMS_HDR_LEN + 2 * i + 1] = pm[i % 3] + (settling ? TEST_OFF : 0);
+		f[PMS_HDR_LEN + 2 * i] = (pm[i % 3] + (settling ? TEST_OFF : 0)) >> 8;
+	}
+	sum = PMS_Sum(f, PMS5003_FRAME_LEN - 2);
+	f[PMS5003_FRAME_LEN - 2] = sum >> 8;
+	f[PMS5003_FRAME_LEN - 1] = sum & 0xff;
+
+	pms.frames++;
+	pms.settling_frames += settling;
+	pms.early_frames += (now - pms.on_us < CONFIG_PMS_WARMUP_S * TEST_S);
+	_uart_rx(f, sizeof(f));
+	load.frames++;
+}
+
+/*
+* @brief	Active mode: a frame every second the fan runs
+*/
+static void _active_frame(int64_t now)
+{
+	int64_t since = now - pms.on_us;
+
+	if (pms.on && !pms.dead && !pms.passive && since > 0 && since % TEST_S == 0) {
+		_send_frame(now);
+	}
+}
+
+/*
+* @brief	host_uart_tx: commands to the sensor
+*/
+static void _pms_rx(uart_port_t port, const uint8_t *data, size_t len)
+{
+	uint8_t ack[PMS_ACK_FRAME_LEN] = { 'B', 'M', 0, 4 };
+	uint16_t sum;
+
+	load.bytes += len;
+	if (port != PM_UART_CH || len != PMS_CMD_LEN || !pms.on || pms.dead ||
+		PMS_Sum(data, PMS_CMD_LEN - 2) != ((data[PMS_CMD_LEN - 2] << 8) | data[PMS_CMD_LEN - 1])) {
+		return;
+	}
+	switch (data[2]) {
+	case PMS_CMD_MODE:
+		pms.passive = (data[4] == 0);
+		ack[4] = data[2];
+		ack[5] = data[4];
+		sum = PMS_Sum(ack, PMS_ACK_FRAME_LEN - 2);
+		ack[6] = sum >> 8;
+		ack[7] = sum & 0xff;
+		_uart_rx(ack, sizeof(ack));
+		pms.acks++;
+		break;
+	case PMS_CMD_READ:
+		pms.requests++;
+		pms.requests_warm += (PMS_GetState() != PMS_SAMPLING);
+		if (pms.passive) {
+			_send_frame(esp_timer_get_time());
+		}
+		break;
+	}
+}
+
+/*
+* @brief	host_gpio_write: the SET pin runs the fan
+*/
+static void _gpio(gpio_num_t gpio, int level)
+{
+	int64_t now = esp_timer_get_time();
+	uint32_t ms;
+
+	if (gpio != GPIO_PM_SET || level == pms.on) {
+		return;
+	}
+	pms.on = level;
+	if (pms.on) {
+		// Starts in active mode, and must be back by the next window
+		pms.on_us = now;
+		pms.passive = false;
+		pms.powerups += !pms.dead;
+		ms = _pms_sleep_ms(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+		if (pms.off_us > 0 && now - pms.off_us != ms * 1000LL) {
+			seen.bad_sleeps++;
+		}
+		if (seen.last_poll_us > 0 &&
+			seen.last_poll_us + TEST_PERIOD_US - now < (CONFIG_PMS_WARMUP_S + CONFIG_PMS_SAMPLE_S) * TEST_S) {
+			seen.late_wakes++;
+		}
+	}
+	else {
+		pms.off_us = now;
+		seen.sleeps++;
+	}
+}
+
+/*
+* @brief	Frames the firmware should have averaged since the last poll
+*/
+static uint32_t _expected_frames(int64_t now)
+{
+#ifdef CONFIG_PMS_PASSIVE
+	(void) now;
+	return CONFIG_PMS_PASSIVE_FRAMES;
+#else
+	int64_t from = pms.on_us + CONFIG_PMS_WARMUP_S * TEST_S;
+
+	from = (from > seen.last_poll_us) ? from : seen.last_poll_us;
+	return (now - from) / TEST_S;
+#endif
+}
+
+/*
+* @brief	When the sensor is due to send frames again after a poll
+*/
+static uint32_t _quiet_ms(void)
+{
+#ifdef CONFIG_PMS_PASSIVE
+	return _pms_read_delay_ms(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+#else
+	return (seen.polls == TEST_TIMER_FULL) ? 0 : _pms_sleep_ms(CONFIG_DATA_UPLOAD_PERIOD * 1000);
+#endif
+}
+
+/*
+* @brief	Every 100 ms: the watchdog, data_task's poll, and the sensor's
+* 			active mode frames
+*/
+static void _tick(int64_t now)
+{
+	pm_data_t dat;
+	uint32_t n;
+	esp_err_t err;
+
+	_wdt_check(now);
+	if (now % TEST_PERIOD_US != 0) {
+		_active_frame(now);
+		return;
+	}
+
+	seen.polls++;
+	wake_timer_full = (seen.polls == TEST_TIMER_FULL);
+	n = pm_accum.sample_count;
+	err = PMS_Poll(&dat);
+	wake_timer_full = false;
+	if (seen.polls == TEST_LOAD_FROM) {
+		load_from = load;
+	}
+	if (seen.polls == TEST_LOAD_TO) {
+		load_to = load;
+	}
+	if (seen.polls > TEST_DEAD) {
+		if (seen.polls == TEST_POLLS) {
+			longjmp(end_jmp, 1);
+		}
+		return;
+	}
+
+	if (err != ESP_OK || dat.pm1 != TEST_PM1 || dat.pm2_5 != TEST_PM2_5 || dat.pm10 != TEST_PM10) {
+		printf("  FAIL: poll %d at %lld s: %s, %.1f %.1f %.1f from %u frames\n", seen.polls,
+			   (long long) (now / TEST_S), esp_err_to_name(err), dat.pm1, dat.pm2_5, dat.pm10, n);
+		seen.bad_polls++;
+	}
+	if (n != _expected_frames(now)) {
+		printf("  FAIL: poll %d averaged %u frames, expected %u\n", seen.polls, n, _expected_frames(now));
+		seen.short_polls++;
+	}
+	// The watchdog is told when frames are due again, to the second
+	if (_quiet_ms() == 0) {
+		seen.bad_expects += (seen.expect_us == now);
+	}
+	else {
+		seen.bad_expects += (seen.expect_us != now || seen.expect_s * 1000 < _quiet_ms() ||
+							 seen.expect_s * 1000 > _quiet_ms() + 1000);
+	}
+	seen.stayed_off += (seen.polls == TEST_TIMER_FULL && !pms.on);
+	seen.last_poll_us = now;
+	if (seen.polls == TEST_DEAD) {
+		seen.dead_until_us = wdt.quiet_until_us;
+		pms.dead = true;
+	}
+
+	// This second's frame comes after the poll, if the fan is still on
+	_active_frame(now);
+}
+
+static void test_sleep_ms(void)
+{
+	const uint32_t lead = (CONFIG_PMS_WARMUP_S + CONFIG_PMS_SAMPLE_S) * 1000;
+
+	printf("sleep: lead %u ms, shortest %u ms\n", lead, PM_SLEEP_MIN_MS);
+	CHECK(_pms_sleep_ms(0) == 0, "sleeps with no period");
+	CHECK(_pms_sleep_ms(lead) == 0, "sleeps with only the lead");
+	CHECK(_pms_sleep_ms(lead + PM_SLEEP_MIN_MS - 1) == 0, "sleeps for less than %u ms", PM_SLEEP_MIN_MS);
+	CHECK(_pms_sleep_ms(lead + PM_SLEEP_MIN_MS) == PM_SLEEP_MIN_MS, "%u ms, not %u", _pms_sleep_ms(lead + PM_SLEEP_MIN_MS),
+		  PM_SLEEP_MIN_MS);
+	CHECK(_pms_sleep_ms(3600 * 1000) == 3600 * 1000 - lead, "an hour's period: %u ms", _pms_sleep_ms(3600 * 1000));
+	CHECK(_pms_sleep_ms(UINT32_MAX) == UINT32_MAX - lead, "longest period wraps: %u ms", _pms_sleep_ms(UINT32_MAX));
+
+#ifdef CONFIG_PMS_PASSIVE
+	printf("read delay\n");
+	CHECK(_pms_read_delay_ms(0) == PM_READ_INTERVAL_MS, "no period: %u ms", _pms_read_delay_ms(0));
+	CHECK(_pms_read_delay_ms(CONFIG_PMS_SAMPLE_S * 1000) == PM_READ_INTERVAL_MS,
+		  "period of one window: %u ms", _pms_read_delay_ms(CONFIG_PMS_SAMPLE_S * 1000));
+	CHECK(_pms_read_delay_ms(CONFIG_PMS_SAMPLE_S * 1000 + 1) == 1,
+		  "a ms over one window: %u ms", _pms_read_delay_ms(CONFIG_PMS_SAMPLE_S * 1000 + 1));
+	CHECK(_pms_read_delay_ms(UINT32_MAX) == UINT32_MAX - CONFIG_PMS_SAMPLE_S * 1000,
+		  "longest period wraps: %u ms", _pms_read_delay_ms(UINT32_MAX));
+
+	// Either way the window opens CONFIG_PMS_SAMPLE_S before the next
+	// poll, and a sleeping sensor wakes CONFIG_PMS_WARMUP_S before that
+	for (uint32_t p = CONFIG_PMS_SAMPLE_S * 1000 + 1; p <= 2 * (lead + PM_SLEEP_MIN_MS); p++) {
+		if (_pms_read_delay_ms(p) != p - CONFIG_PMS_SAMPLE_S * 1000 ||
+			(_pms_sleep_ms(p) > 0 && _pms_read_delay_ms(p) - _pms_sleep_ms(p) != CONFIG_PMS_WARMUP_S * 1000)) {
+			CHECK(false, "period %u ms: sleep %u ms, read after %u ms", p, _pms_sleep_ms(p), _pms_read_delay_ms(p));
+			break;
+		}
+	}
+#endif
+}
+
+static void test_run(void)
+{
+	const double hour = 3600.0 / ((TEST_LOAD_TO - TEST_LOAD_FROM) * CONFIG_DATA_UPLOAD_PERIOD);
+	int32_t drops;
+
+#ifdef CONFIG_PMS_PASSIVE
+	printf("passive mode, %d polls %d s apart\n", TEST_POLLS, CONFIG_DATA_UPLOAD_PERIOD);
+#else
+	printf("active mode, %d polls %d s apart\n", TEST_POLLS, CONFIG_DATA_UPLOAD_PERIOD);
+#endif
+	host_gpio_write = _gpio;
+	host_uart_tx = _pms_rx;
+	host_sim_start(0, _tick);
+
+	CHECK(PMS_Initialize() == ESP_OK, "PMS_Initialize failed");
+	if (setjmp(end_jmp) == 0 && task_fn != NULL) {
+		task_fn(NULL);
+	}
+	host_gpio_write = NULL;
+	host_uart_tx = NULL;
+
+	drops = _metric("pm_warmup_drop");
+	printf("  %u frames, %u while settling, %d dropped in warm-up\n", pms.frames, pms.settling_frames, drops);
+	printf("  %d sleeps, %u read requests, %u acks\n", seen.sleeps, pms.requests, pms.acks);
+	printf("  sensor dead after %lld s, deadline %lld s, found stalled at %.1f s\n",
+		   (long long) (TEST_DEAD * TEST_PERIOD_US / TEST_S), (long long) (seen.dead_until_us / TEST_S),
+		   wdt.fired_us / (double) TEST_S);
+	printf("  per hour: %.0f frames, %.0f bytes, %.0f UART events, %.0f task wake-ups, %.0f timer callbacks\n",
+		   (load_to.frames - load_from.frames) * hour, (load_to.bytes - load_from.bytes) * hour,
+		   (load_to.events - load_from.events) * hour, (load_to.wakes - load_from.wakes) * hour,
+		   (load_to.callbacks - load_from.callbacks) * hour);
+
+	CHECK(task_fn == uart_pm_event_mgr, "no UART task started");
+	CHECK(seen.polls == TEST_POLLS, "%d polls", seen.polls);
+	CHECK(seen.bad_polls == 0 && seen.short_polls == 0, "%d polls off, %d short", seen.bad_polls, seen.short_polls);
+	CHECK(drops == (int32_t) pms.early_frames, "%d frames dropped, %u sent in warm-up", drops, pms.early_frames);
+	// Every poll with frames sleeps, but the one whose wake timer couldn't be set
+	CHECK(seen.sleeps == TEST_DEAD - 1 && seen.bad_sleeps == 0 && seen.late_wakes == 0 && seen.stayed_off == 0,
+		  "%d sleeps, %d the wrong length, %d woke late, %d failed asleep", seen.sleeps, seen.bad_sleeps,
+		  seen.late_wakes, seen.stayed_off);
+	CHECK(seen.bad_expects == 0, "%d polls without the watchdog told when frames are due", seen.bad_expects);
+	CHECK(seen.disarms == 0, "watchdog disarmed %d times", seen.disarms);
+	CHECK(wdt.fired_us > TEST_DEAD * TEST_PERIOD_US, "sensor found stalled at %.1f s while it worked",
+		  wdt.fired_us / (double) TEST_S);
+	CHECK(seen.dead_until_us < (TEST_DEAD + 1) * TEST_PERIOD_US &&
+		  wdt.fired_us <= seen.dead_until_us + (TEST_WDT_S + 1) * TEST_S,
+		  "dead sensor: deadline %lld s, found at %.1f s", (long long) (seen.dead_until_us / TEST_S),
+		  wdt.fired_us / (double) TEST_S);
+#ifdef CONFIG_PMS_PASSIVE
+	CHECK(pms.requests_warm == 0, "%u read requests outside a window", pms.requests_warm);
+	CHECK(pms.acks == pms.powerups, "passive mode set %u times in %u power-ups", pms.acks, pms.powerups);
+#endif
+}
+
+int main(void)
+{
+	host_log_level = ESP_LOG_NONE;
+
+	test_sleep_ms();
+	test_run();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * test_pmsframe.c
+ *
+ * Notes:
+ * 		Decodes frames written out byte for byte as the sensors send them,
+ * 		checksum included: 32 byte PMS5003 frames in clean air, in smoke
+ * 		(atmospheric values under CF=1, counts over 255) and with an
+ * 		error code set, and a 24 byte PMS3003 frame with its reserved
+ * 		words not 0. Every field must come out with its own word, most
+ * 		significant byte first, and the words a frame doesn't have must be
+ * 		0.
+ *
+ * 		Then, for each frame, every single bit flipped must be refused,
+ * 		every truncation must be refused as too short, and trailing bytes
+ * 		must not matter. A command ack, a wrong header and a length field
+ * 		that doesn't match the frame are refused as not data frames.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../main/pmsframe_if.c"
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); fails++; } \
+	} while (0)
+
+typedef struct {
+	const char *name;
+	uint8_t len;
+	uint8_t buf[PMS_FRAME_MAX];
+	pms_frame_t want;
+} recorded_t;
+
+static const recorded_t frames[] = {
+	{ "PMS5003 clean air", 32,
+	  { 0x42, 0x4d, 0x00, 0x1c, 0x00, 0x03, 0x00, 0x05, 0x00, 0x06, 0x00, 0x03, 0x00, 0x05, 0x00, 0x06,
+		0x02, 0xb2, 0x00, 0xc9, 0x00, 0x24, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x97, 0x00, 0x03, 0x03 },
+	  { 3, 5, 6, 3, 5, 6, 690, 201, 36, 4, 0, 0, 0x97, 0, PMS5003_FRAME_LEN } },
+	{ "PMS5003 smoke", 32,
+	  { 0x42, 0x4d, 0x00, 0x1c, 0x00, 0x6c, 0x00, 0xac, 0x00, 0xc7, 0x00, 0x48, 0x00, 0x73, 0x00, 0x85,
+		0x3d, 0xbc, 0x12, 0x3f, 0x03, 0xea, 0x00, 0x61, 0x00, 0x0c, 0x00, 0x03, 0x97, 0x00, 0x07, 0x08 },
+	  { 108, 172, 199, 72, 115, 133, 15804, 4671, 1002, 97, 12, 3, 0x97, 0, PMS5003_FRAME_LEN } },
+	{ "PMS5003 error code", 32,
+	  { 0x42, 0x4d, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x91, 0x02, 0x01, 0x3e },
+	  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x91, 0x02, PMS5003_FRAME_LEN } },
+	{ "PMS3003", 24,
+	  { 0x42, 0x4d, 0x00, 0x14, 0x00, 0x0e, 0x00, 0x16, 0x00, 0x19, 0x00, 0x0e, 0x00, 0x16, 0x00, 0x19,
+		0x0a, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x01, 0x32 },
+	  { 14, 22, 25, 14, 22, 25, 0, 0, 0, 0, 0, 0, 0, 0, PMS3003_FRAME_LEN } },
+};
+
+/* Reply to a passive mode command */
+static const uint8_t ack[PMS_ACK_FRAME_LEN] = { 0x42, 0x4d, 0x00, 0x04, 0xe1, 0x00, 0x01, 0x74 };
+
+static int fails = 0;
+
+static void _test_frame(const recorded_t *r)
+{
+	uint8_t buf[PMS_FRAME_MAX + 4];
+	pms_frame_t f;
+	esp_err_t err;
+	int flips = 0;
+
+	printf("%s\n", r->name);
+	err = PMS_ParseFrame(r->buf, r->len, &f);
+	CHECK(err == ESP_OK, "error 0x%x", err);
+	CHECK(PMS_Sum(r->buf, r->len - 2) == ((r->buf[r->len - 2] << 8) | r->buf[r->len - 1]), "checksum");
+	CHECK(memcmp(&f, &r->want, sizeof(f)) == 0,
+		  "got %u %u %u / %u %u %u / %u %u %u %u %u %u, version 0x%02x, error 0x%02x, len %u",
+		  f.pm1_cf1, f.pm2_5_cf1, f.pm10_cf1, f.pm1_atm, f.pm2_5_atm, f.pm10_atm,
+		  f.cnt_0_3, f.cnt_0_5, f.cnt_1_0, f.cnt_2_5, f.cnt_5_0, f.cnt_10, f.version, f.error, f.len);
+
+	// A single bit changes the sum or the checksum by less than 256
+	for (int i = 0; i < r->len * 8; i++) {
+		memcpy(buf, r->buf, r->len);
+		buf[i / 8] ^= 1 << (i % 8);
+		if (PMS_ParseFrame(buf, r->len, &f) == ESP_OK) {
+			flips++;
+		}
+	}
+	CHECK(flips == 0, "%d single bit errors decoded", flips);
+
+	for (int n = 0; n < r->len; n++) {
+		err = PMS_ParseFrame(r->buf, n, &f);
+		if (err != ESP_ERR_INVALID_SIZE) {
+			CHECK(false, "%d of %u bytes: error 0x%x", n, r->len, err);
+			break;
+		}
+	}
+
+	// The next frame's "BM" right behind it
+	memcpy(buf, r->buf, r->len);
+	memcpy(buf + r->len, "BM\x00\x1c", 4);
+	CHECK(PMS_ParseFrame(buf, r->len + 4, &f) == ESP_OK && memcmp(&f, &r->want, sizeof(f)) == 0,
+		  "trailing bytes changed it");
+}
+
+static void _test_not_data(void)
+{
+	uint8_t buf[PMS_FRAME_MAX];
+	pms_frame_t f;
+
+	printf("not data frames\n");
+	CHECK(PMS_ParseFrame(ack, sizeof(ack), &f) == ESP_ERR_INVALID_SIZE, "command ack decoded");
+	CHECK(PMS_Sum(ack, sizeof(ack) - 2) == ((ack[6] << 8) | ack[7]), "ack checksum");
+
+	memcpy(buf, frames[0].buf, PMS5003_FRAME_LEN);
+	buf[1] = 'N';
+	CHECK(PMS_ParseFrame(buf, PMS5003_FRAME_LEN, &f) == ESP_ERR_INVALID_SIZE, "\"BN\" header decoded");
+
+	// A 24 byte length on a 32 byte frame, and the other way round
+	memcpy(buf, frames[0].buf, PMS5003_FRAME_LEN);
+	buf[3] = PMS3003_FRAME_LEN - PMS_HDR_LEN;
+	CHECK(PMS_ParseFrame(buf, PMS5003_FRAME_LEN, &f) == ESP_ERR_INVALID_CRC, "32 byte frame read as 24");
+	memcpy(buf, frames[3].buf, PMS3003_FRAME_LEN);
+	buf[3] = PMS5003_FRAME_LEN - PMS_HDR_LEN;
+	CHECK(PMS_ParseFrame(buf, PMS3003_FRAME_LEN, &f) == ESP_ERR_INVALID_SIZE, "24 byte frame read as 32");
+	buf[2] = 0x01;
+	CHECK(PMS_ParseFrame(buf, PMS3003_FRAME_LEN, &f) == ESP_ERR_INVALID_SIZE, "length 0x11c decoded");
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+		_test_frame(&frames[i]);
+	}
+	_test_not_data();
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
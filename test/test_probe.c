@@ -0,0 +1,373 @@
+/*
+ * test_probe.c
+ *
+ * Notes:
+ * 		Runs the real probes against stand-in servers on 127.0.0.1: a
+ * 		broker (TCP accept), a DNS server and a generate_204 web server.
+ * 		host_connect and host_sendto route the probes' fixed ports to them
+ * 		and drop connections and queries at a set rate. A dropped TCP
+ * 		connection goes to a listener with a full backlog, whose SYNs are
+ * 		never answered.
+ *
+ * 		Reports PROBE_Check latency and the false-negative rate for each
+ * 		scenario, and fails if they are out of bounds or a probe task
+ * 		lives on past its run's timeout.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#define CONFIG_MQTT_HOST			"127.0.0.1"
+#define CONFIG_PROBE_TIMEOUT_MS		500
+#define CONFIG_PROBE_CACHE_TTL_S	30
+#define CONFIG_PROBE_TCP_PORT		"8883"
+#define CONFIG_PROBE_DNS_HOST		"pool.ntp.org"
+#define CONFIG_PROBE_HTTP_HOST		"connectivitycheck.gstatic.com"
+#define CONFIG_PROBE_HTTP_PATH		"/generate_204"
+
+#include "../main/probe_if.c"
+
+#define TEST_MAX_RUNS		100
+#define TEST_MARGIN_MS		100		/* Thread wake-up, socket close */
+
+typedef enum {
+	SVC_BROKER = 0,
+	SVC_DNS,
+	SVC_HTTP,
+	SVC_COUNT,
+} svc_t;
+
+typedef struct {
+	const char *name;
+	int loss_pct[SVC_COUNT];	/* Connections / queries dropped */
+	bool broker_up;				/* Otherwise refused */
+	int dns_rcode;
+	int dns_delay_ms;
+	int http_status;
+	int http_delay_ms;
+	bool reachable;				/* Ground truth: some path works in time */
+	int runs;
+	int max_p50_ms;				/* Bounds on PROBE_Check latency, 0: none */
+	int min_p50_ms;
+	double max_fn;				/* Bound on the false-negative rate */
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "all up", { 0, 0, 0 }, true, 0, 0, 204, 0, true, 20, 50, 0, 0 },
+	{ "broker port blocked", { 100, 0, 0 }, true, 0, 0, 204, 0, true, 20, 50, 0, 0 },
+	{ "dns blocked", { 0, 100, 0 }, true, 0, 0, 204, 0, true, 20, 50, 0, 0 },
+	{ "slow dns and http", { 100, 0, 0 }, true, 0, 200, 204, 100, true, 20, 300, 200, 0 },
+	{ "30% loss everywhere", { 30, 30, 30 }, true, 0, 0, 204, 0, true, TEST_MAX_RUNS, 50, 0, 0.15 },
+	{ "offline, refused", { 0, 0, 0 }, false, 2, 0, 204, 0, false, 20, 50, 0, 0 },
+	{ "offline, silent", { 100, 100, 100 }, true, 0, 0, 204, 0, false, 10, 0, 0, 0 },
+};
+
+static const scenario_t *cur;
+static uint16_t port[SVC_COUNT];
+static uint16_t closed_port, blackhole_port;
+static unsigned int loss_seed = 1;
+static pthread_mutex_t loss_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static bool _lost(svc_t svc)
+{
+	bool lost;
+
+	pthread_mutex_lock(&loss_lock);
+	lost = rand_r(&loss_seed) % 100 < (unsigned) cur->loss_pct[svc];
+	pthread_mutex_unlock(&loss_lock);
+	return lost;
+}
+
+int host_connect(int sock, const struct sockaddr *addr, socklen_t len)
+{
+	struct sockaddr_in to = *(const struct sockaddr_in *) addr;
+
+	switch (ntohs(to.sin_port)) {
+	case 8883:
+		to.sin_port = htons(_lost(SVC_BROKER) ? blackhole_port : cur->broker_up ? port[SVC_BROKER] : closed_port);
+		break;
+	case HTTP_PORT:
+		to.sin_port = htons(_lost(SVC_HTTP) ? blackhole_port : port[SVC_HTTP]);
+		break;
+	default:
+		break;
+	}
+	return (connect)(sock, (struct sockaddr *) &to, sizeof(to));
+}
+
+ssize_t host_sendto(int sock, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t alen)
+{
+	struct sockaddr_in to = *(const struct sockaddr_in *) addr;
+
+	if (ntohs(to.sin_port) == DNS_PORT) {
+		if (_lost(SVC_DNS)) {
+			return len;
+		}
+		to.sin_port = htons(port[SVC_DNS]);
+	}
+	return (sendto)(sock, buf, len, flags, (struct sockaddr *) &to, sizeof(to));
+}
+
+const ip_addr_t *dns_getserver(uint8_t idx)
+{
+	static ip_addr_t server;
+
+	server.addr = htonl(INADDR_LOOPBACK);
+	return &server;
+}
+
+static int _listener(int type, int backlog, uint16_t *bound)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t len = sizeof(addr);
+	int sock = socket(AF_INET, type, 0);
+
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+		(type == SOCK_STREAM && listen(sock, backlog) != 0)) {
+		perror("listener");
+		exit(2);
+	}
+	getsockname(sock, (struct sockaddr *) &addr, &len);
+	*bound = ntohs(addr.sin_port);
+	return sock;
+}
+
+static void *_broker(void *arg)
+{
+	int sock = *(int *) arg;
+
+	for (;;) {
+		int conn = accept(sock, NULL, NULL);
+		if (conn >= 0) {
+			close(conn);
+		}
+	}
+	return NULL;
+}
+
+typedef struct {
+	int sock;
+	struct sockaddr_in from;
+	uint8_t buf[DNS_BUF_LEN];
+	int len;
+} dns_req_t;
+
+/*
+ * Answers every A query with a CNAME and then 127.0.0.1, like a CDN name
+ */
+static void *_dns_reply(void *arg)
+{
+	dns_req_t *req = arg;
+	uint8_t *b = req->buf;
+	int n = req->len;
+	static const uint8_t cname[] = { 0xc0, 0x0c, 0, 5, 0, 1, 0, 0, 0, 60, 0, 7, 4, 'e', 'd', 'g', 'e', 0xc0, 0x0c };
+	uint8_t a[] = { 0xc0, 0, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 127, 0, 0, 1 };
+
+	usleep(cur->dns_delay_ms * 1000);
+	b[2] |= 0x80;
+	b[3] = 0x80 | cur->dns_rcode;
+	if (cur->dns_rcode == 0 && n + (int) sizeof(cname) + (int) sizeof(a) <= DNS_BUF_LEN) {
+		b[7] = 2;
+		memcpy(&b[n], cname, sizeof(cname));
+		a[1] = n + 12;				/* The CNAME's target */
+		n += sizeof(cname);
+		memcpy(&b[n], a, sizeof(a));
+		n += sizeof(a);
+	}
+	(sendto)(req->sock, b, n, 0, (struct sockaddr *) &req->from, sizeof(req->from));
+	free(req);
+	return NULL;
+}
+
+static void *_dns(void *arg)
+{
+	int sock = *(int *) arg;
+	pthread_t t;
+
+	for (;;) {
+		dns_req_t *req = calloc(1, sizeof(dns_req_t));
+		socklen_t len = sizeof(req->from);
+
+		req->sock = sock;
+		req->len = recvfrom(sock, req->buf, DNS_BUF_LEN, 0, (struct sockaddr *) &req->from, &len);
+		if (req->len < DNS_HDR_LEN || pthread_create(&t, NULL, _dns_reply, req) != 0) {
+			free(req);
+			continue;
+		}
+		pthread_detach(t);
+	}
+	return NULL;
+}
+
+static void *_http_reply(void *arg)
+{
+	int conn = (intptr_t) arg;
+	char buf[512], rsp[64];
+	int len;
+
+	len = read(conn, buf, sizeof(buf));
+	usleep(cur->http_delay_ms * 1000);
+	if (len > 0) {
+		len = snprintf(rsp, sizeof(rsp), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n\r\n",
+					   cur->http_status, cur->http_status == 204 ? "No Content" : "OK");
+		if (write(conn, rsp, len) != len) {
+			perror("http");
+		}
+	}
+	close(conn);
+	return NULL;
+}
+
+static void *_http(void *arg)
+{
+	int sock = *(int *) arg;
+	pthread_t t;
+
+	for (;;) {
+		intptr_t conn = accept(sock, NULL, NULL);
+		if (conn < 0 || pthread_create(&t, NULL, _http_reply, (void *) conn) != 0) {
+			close(conn);
+			continue;
+		}
+		pthread_detach(t);
+	}
+	return NULL;
+}
+
+static void _serve(void *(*fn)(void *), int type, svc_t svc)
+{
+	static int socks[SVC_COUNT];
+	pthread_t t;
+
+	socks[svc] = _listener(type, 16, &port[svc]);
+	pthread_create(&t, NULL, fn, &socks[svc]);
+	pthread_detach(t);
+}
+
+static int _cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+static int64_t _ms(void)
+{
+	return esp_timer_get_time() / 1000;
+}
+
+/*
+* @return	number of bounds broken
+*/
+static int _run(const scenario_t *s)
+{
+	int lat[TEST_MAX_RUNS], max_life, yes = 0, fails = 0;
+	int64_t start;
+	double fn;
+	bool ok;
+
+	cur = s;
+	for (int i = 0; i < s->runs; i++) {
+		PROBE_Invalidate();
+		start = _ms();
+		ok = PROBE_Check();
+		lat[i] = _ms() - start;
+		yes += ok;
+	}
+
+	/* Stragglers overlap the next run, as on the device. All of them have to
+	 * be gone by the end of their timeout. */
+	start = _ms();
+	while (host_tasks_alive() > 0 && _ms() - start < 4 * CONFIG_PROBE_TIMEOUT_MS) {
+		usleep(1000);
+	}
+	max_life = host_task_longest_us() / 1000;
+	if (host_tasks_alive() > 0) {
+		max_life = 4 * CONFIG_PROBE_TIMEOUT_MS;
+	}
+	qsort(lat, s->runs, sizeof(int), _cmp);
+	fn = s->reachable ? (double)(s->runs - yes) / s->runs : 0;
+
+	printf("%-22s %4d %5s %5d %7.1f%% %6d %6d %6d %8d\n", s->name, s->runs,
+		   s->reachable ? "yes" : "no", yes, 100 * fn, lat[s->runs / 2],
+		   lat[s->runs * 95 / 100], lat[s->runs - 1], max_life);
+
+	if (fn > s->max_fn) {
+		printf("  FAIL: false negatives %.1f%% > %.1f%%\n", 100 * fn, 100 * s->max_fn);
+		fails++;
+	}
+	if (!s->reachable && yes > 0) {
+		printf("  FAIL: %d false positives\n", yes);
+		fails++;
+	}
+	if (s->max_p50_ms && lat[s->runs / 2] > s->max_p50_ms) {
+		printf("  FAIL: median latency %d ms > %d ms\n", lat[s->runs / 2], s->max_p50_ms);
+		fails++;
+	}
+	if (lat[s->runs / 2] < s->min_p50_ms) {
+		printf("  FAIL: median latency %d ms < %d ms\n", lat[s->runs / 2], s->min_p50_ms);
+		fails++;
+	}
+	if (lat[s->runs - 1] > CONFIG_PROBE_TIMEOUT_MS + TEST_MARGIN_MS) {
+		printf("  FAIL: PROBE_Check took %d ms\n", lat[s->runs - 1]);
+		fails++;
+	}
+	if (max_life > CONFIG_PROBE_TIMEOUT_MS + TEST_MARGIN_MS) {
+		printf("  FAIL: a probe task lived %d ms\n", max_life);
+		fails++;
+	}
+	return fails;
+}
+
+int main(void)
+{
+	int blackhole, fill, fails = 0, sock;
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	probe_t st;
+
+	_serve(_broker, SOCK_STREAM, SVC_BROKER);
+	_serve(_dns, SOCK_DGRAM, SVC_DNS);
+	_serve(_http, SOCK_STREAM, SVC_HTTP);
+
+	/* Nothing listens here after the close: connections are refused */
+	sock = _listener(SOCK_STREAM, 1, &closed_port);
+	close(sock);
+
+	/* Backlog of one, filled and never accepted: further SYNs are dropped */
+	blackhole = _listener(SOCK_STREAM, 0, &blackhole_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(blackhole_port);
+	fill = socket(AF_INET, SOCK_STREAM, 0);
+	(connect)(fill, (struct sockaddr *) &addr, sizeof(addr));
+
+	// Before init: refuse at once, without starting a run
+	host_log_level = ESP_LOG_NONE;
+	if (PROBE_Check() || PROBE_Register("early", NULL) != ESP_ERR_INVALID_STATE || host_tasks_alive() != 0) {
+		printf("FAIL: probes usable before PROBE_Initialize\n");
+		fails++;
+	}
+	host_log_level = ESP_LOG_ERROR;
+	PROBE_Initialize();
+	PROBE_Initialize();
+	if (PROBE_GetStats(3, &st)) {
+		printf("FAIL: PROBE_Initialize registered the defaults twice\n");
+		fails++;
+	}
+
+	printf("PROBE_TIMEOUT_MS %d\n\n", CONFIG_PROBE_TIMEOUT_MS);
+	printf("%-22s %4s %5s %5s %8s %6s %6s %6s %8s\n", "scenario", "runs", "truth", "said",
+		   "fn", "p50", "p95", "max", "task max");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i]);
+	}
+
+	printf("\n%-12s %8s %8s %10s\n", "probe", "ok", "failed", "last ms");
+	for (int i = 0; PROBE_GetStats(i, &st); i++) {
+		printf("%-12s %8u %8u %10u\n", st.name, st.successes, st.failures, st.last_latency_ms);
+	}
+
+	close(fill);
+	close(blackhole);
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
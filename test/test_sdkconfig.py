@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# test_sdkconfig.py
+#
+# sdkconfig.defaults is where project options are set; sdkconfig.old is
+# the full configuration menuconfig wrote for the same build. A fresh
+# sdkconfig starts from the first, a copied one from the second, so every
+# option in sdkconfig.defaults must have the same value in sdkconfig.old.
+# Also checks that the options the firmware's #if blocks depend on are set
+# where they need to be.
+#
+#   python3 test/test_sdkconfig.py
+#
+#  Created on: Oct 19, 2026
+#      Author: tombo
+#
+
+import os
+import re
+import unittest
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.join(HERE, "..")
+
+# Compiled out without these (see the notes in each file)
+REQUIRED = {
+    "CONFIG_FREERTOS_USE_TRACE_FACILITY": "y",          # metrics_if.c
+    "CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS": "y",     # metrics_if.c
+}
+
+
+def _parse(name):
+    """{option: value}, "" for an option that's off, and the duplicates"""
+    options, dups = {}, []
+    with open(os.path.join(ROOT, name)) as f:
+        for line in f:
+            line = line.strip()
+            m = re.match(r"# (CONFIG_\w+) is not set$", line) or re.match(r"(CONFIG_\w+)=(.*)$", line)
+            if not m:
+                continue
+            key = m.group(1)
+            value = m.group(2) if m.lastindex == 2 else ""
+            if key in options:
+                dups.append(key)
+            options[key] = value
+    return options, dups
+
+
+class SdkconfigTest(unittest.TestCase):
+
+    def setUp(self):
+        self.defaults, self.defaults_dups = _parse("sdkconfig.defaults")
+        self.old, self.old_dups = _parse("sdkconfig.old")
+
+    def test_no_duplicates(self):
+        self.assertEqual(self.defaults_dups, [])
+        self.assertEqual(self.old_dups, [])
+
+    def test_defaults_match_old(self):
+        for key, value in self.defaults.items():
+            with self.subTest(option=key):
+                self.assertIn(key, self.old, "%s is set in sdkconfig.defaults only" % key)
+                self.assertEqual(self.old[key], value, "%s differs from sdkconfig.old" % key)
+
+    def test_required(self):
+        for key, value in REQUIRED.items():
+            with self.subTest(option=key):
+                self.assertEqual(self.defaults.get(key), value)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,472 @@
+/*
+ * test_unpack.c
+ *
+ * Notes:
+ * 		Packs data with main/mkpack.py and unpacks it with unpack_if, the
+ * 		packed file fed in random sized pieces as it would arrive over
+ * 		HTTP, for each window the device may be sent. The data is a
+ * 		synthetic firmware image, log text, erased flash and random bytes,
+ * 		so the packer's literal and copy paths both get used, as well as an
+ * 		empty file. Checks the output is the input byte for byte, that the
+ * 		.sha256 mkpack.py writes is the input's, and that broken files and
+ * 		windows larger than CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2 are refused.
+ *
+ * 		Also measures what unpacking costs: output MB/s fed in
+ * 		CONFIG_OTA_BUF_SIZE pieces as ota_task does (the host's speed, not
+ * 		the ESP32's; the ratio between data sets is what carries over),
+ * 		and the peak heap, counted by wrapping the decoder's calloc/free.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbedtls/sha256.h"
+
+#define CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2	12
+#define CONFIG_OTA_BUF_SIZE					4096
+
+static size_t heap_now, heap_peak;
+static void *_test_calloc(size_t n, size_t size);
+static void _test_free(void *p);
+
+#define calloc(n, size)		_test_calloc(n, size)
+#define free(p)				_test_free(p)
+#include "../main/unpack_if.c"
+#undef calloc
+#undef free
+
+#define TEST_DATA_LEN		(64 * 1024)
+#define TEST_MAX_FEED		4096
+#define TEST_BENCH_MS		200
+#ifndef TEST_SEED
+#define TEST_SEED			1
+#endif
+
+typedef struct {
+	const char *name;
+	size_t (*make)(uint8_t *out);
+	double max_ratio;			/* Packed size / data size, default window */
+} dataset_t;
+
+typedef struct {
+	uint8_t window_sz2, lookahead_sz2;
+} window_t;
+
+typedef struct {
+	const uint8_t *expect;
+	size_t len;
+	size_t at;
+	int mismatches;
+	int batches_too_big;
+	esp_err_t fail_with;		/* Returned by the sink once at > fail_at */
+	size_t fail_at;
+} sink_t;
+
+static const window_t windows[] = {
+	{ 8, 4 },
+	{ 11, 4 },					/* What mkpack.py uses */
+	{ 12, 5 },
+};
+
+static unsigned int seed = TEST_SEED;
+static char dir[] = "/tmp/test_unpack.XXXXXX";
+static uint8_t data[TEST_DATA_LEN];
+
+
+static void *_test_calloc(size_t n, size_t size)
+{
+	size_t *p = (calloc)(1, sizeof(size_t) + n * size);
+
+	if (p == NULL) {
+		return NULL;
+	}
+	*p = n * size;
+	heap_now += *p;
+	heap_peak = (heap_now > heap_peak) ? heap_now : heap_peak;
+	return p + 1;
+}
+
+static void _test_free(void *p)
+{
+	if (p != NULL) {
+		heap_now -= ((size_t *) p)[-1];
+		(free)((size_t *) p - 1);
+	}
+}
+
+/*
+* @brief	Code-like bytes: a few opcodes with near operands, calls to a
+* 			handful of addresses, and a string table
+*/
+static size_t _make_firmware(uint8_t *b)
+{
+	static const char *words[] = { "sensor", "reading", "timeout", "mqtt", "publish", "failed", "ok", "%d" };
+	size_t n = 0;
+
+	while (n < TEST_DATA_LEN * 3 / 4) {
+		b[n++] = 0x20 + (rand_r(&seed) % 16) * 4;
+		b[n++] = rand_r(&seed) % 32;
+		b[n++] = rand_r(&seed) % 4;
+		if (rand_r(&seed) % 8 == 0) {
+			uint32_t to = 0x400d0000 + (rand_r(&seed) % 64) * 0x100;
+
+			memcpy(&b[n], &to, 4);
+			n += 4;
+		}
+	}
+	while (n < TEST_DATA_LEN - 16) {
+		n += sprintf((char *) &b[n], "%s %s", words[rand_r(&seed) % 8], words[rand_r(&seed) % 8]) + 1;
+	}
+	return n;
+}
+
+static size_t _make_text(uint8_t *b)
+{
+	size_t n = 0;
+	char line[96];
+	int len;
+
+	for (uint32_t t = 0; ; t += 1 + rand_r(&seed) % 5) {
+		len = snprintf(line, sizeof(line), "I (%u) PM: pm1 %u pm2.5 %u pm10 %u\n", t * 1000, rand_r(&seed) % 40,
+					   rand_r(&seed) % 60, rand_r(&seed) % 90);
+		if (n + len > TEST_DATA_LEN) {
+			return n;
+		}
+		memcpy(&b[n], line, len);
+		n += len;
+	}
+}
+
+static size_t _make_erased(uint8_t *b)
+{
+	memset(b, 0xff, TEST_DATA_LEN);
+	return TEST_DATA_LEN;
+}
+
+static size_t _make_random(uint8_t *b)
+{
+	for (size_t i = 0; i < TEST_DATA_LEN; i++) {
+		b[i] = rand_r(&seed);
+	}
+	return TEST_DATA_LEN;
+}
+
+static size_t _make_empty(uint8_t *b)
+{
+	(void) b;
+	return 0;
+}
+
+static const dataset_t datasets[] = {
+	{ "firmware",     _make_firmware, 0.80 },
+	{ "log text",     _make_text,     0.60 },
+	// Copies of at most 16 bytes, 16 bits each
+	{ "erased flash", _make_erased,   0.13 },
+	// 9 bits a literal, plus the header
+	{ "random",       _make_random,   1.13 },
+	{ "empty",        _make_empty,    0 },
+};
+
+static bool _write_file(const char *name, const uint8_t *buf, size_t len)
+{
+	char path[64];
+	FILE *f;
+	bool ok;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "wb")) == NULL) {
+		return false;
+	}
+	ok = fwrite(buf, 1, len, f) == len;
+	return fclose(f) == 0 && ok;
+}
+
+static uint8_t *_read_file(const char *name, size_t *len)
+{
+	char path[64];
+	uint8_t *buf = NULL;
+	FILE *f;
+	long n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "rb")) == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	rewind(f);
+	if ((buf = malloc(n + 1)) != NULL && fread(buf, 1, n, f) == (size_t) n) {
+		buf[n] = '\0';
+		*len = n;
+	}
+	fclose(f);
+	return buf;
+}
+
+/*
+* @brief	mkpack.py in.bin in.bin.hs for its own window, pack() for others
+*/
+static uint8_t *_mkpack(const uint8_t *buf, size_t len, const window_t *w, size_t *packed_len)
+{
+	char cmd[512];
+
+	if (!_write_file("in.bin", buf, len)) {
+		return NULL;
+	}
+	if (w->window_sz2 == 11 && w->lookahead_sz2 == 4) {
+		snprintf(cmd, sizeof(cmd), "%s %s/mkpack.py %s/in.bin %s/in.bin.hs >/dev/null", HOST_PYTHON, HOST_MAIN_DIR,
+				 dir, dir);
+	}
+	else {
+		snprintf(cmd, sizeof(cmd), "%s -c 'import sys; sys.path.insert(0, \"%s\"); import mkpack; "
+				 "open(\"%s/in.bin.hs\", \"wb\").write(mkpack.pack(open(\"%s/in.bin\", \"rb\").read(), %u, %u))'",
+				 HOST_PYTHON, HOST_MAIN_DIR, dir, dir, w->window_sz2, w->lookahead_sz2);
+	}
+	return (system(cmd) == 0) ? _read_file("in.bin.hs", packed_len) : NULL;
+}
+
+static esp_err_t _sink_cb(void *arg, const uint8_t *buf, size_t len)
+{
+	sink_t *sink = arg;
+
+	if (sink->fail_with != ESP_OK && sink->at + len > sink->fail_at) {
+		return sink->fail_with;
+	}
+	sink->batches_too_big += len > UNPACK_OUT_LEN;
+	if (sink->at + len > sink->len || memcmp(buf, sink->expect + sink->at, len) != 0) {
+		sink->mismatches++;
+	}
+	sink->at += len;
+	return ESP_OK;
+}
+
+/*
+* @brief	Unpack a file, fed in random pieces (feed 0) or feed bytes at a
+* 			time
+*
+* @return	first error from Feed, else Finish's
+*/
+static esp_err_t _unpack(const uint8_t *packed, size_t packed_len, sink_t *sink, size_t feed)
+{
+	unpack_t u;
+	esp_err_t err = ESP_OK;
+	size_t n;
+
+	UNPACK_Begin(&u, _sink_cb, sink);
+	for (size_t at = 0; at < packed_len && err == ESP_OK; at += n) {
+		n = feed ? feed : 1 + rand_r(&seed) % TEST_MAX_FEED;
+		n = (n > packed_len - at) ? packed_len - at : n;
+		err = UNPACK_Feed(&u, packed + at, n);
+	}
+	if (err == ESP_OK) {
+		err = UNPACK_Finish(&u);
+	}
+	UNPACK_End(&u);
+	return err;
+}
+
+static bool _sha_matches(const uint8_t *buf, size_t len)
+{
+	mbedtls_sha256_context ctx;
+	uint8_t sha[32];
+	char hex[65];
+	uint8_t *manifest;
+	size_t manifest_len;
+	bool ok;
+
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts_ret(&ctx, 0);
+	mbedtls_sha256_update_ret(&ctx, buf, len);
+	mbedtls_sha256_finish_ret(&ctx, sha);
+	mbedtls_sha256_free(&ctx);
+	for (int i = 0; i < 32; i++) {
+		sprintf(&hex[2 * i], "%02x", sha[i]);
+	}
+	if ((manifest = _read_file("in.bin.hs.sha256", &manifest_len)) == NULL) {
+		return false;
+	}
+	ok = manifest_len > 64 && memcmp(manifest, hex, 64) == 0;
+	free(manifest);
+	return ok;
+}
+
+/*
+* @brief	Output MB/s over at least TEST_BENCH_MS of unpacking
+*/
+static double _bench(const uint8_t *packed, size_t packed_len, size_t len)
+{
+	struct timespec t0, t1;
+	sink_t sink;
+	double s;
+	int runs = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		sink = (sink_t) { .expect = data, .len = len };
+		_unpack(packed, packed_len, &sink, CONFIG_OTA_BUF_SIZE);
+		runs++;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (s * 1000 < TEST_BENCH_MS);
+	return len * (double) runs / s / 1e6;
+}
+
+static int _test_dataset(const dataset_t *d)
+{
+	size_t len = d->make(data), packed_len = 0;
+	int fails = 0;
+
+	for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+		const window_t *w = &windows[i];
+		uint8_t *packed = _mkpack(data, len, w, &packed_len);
+		sink_t sink = { .expect = data, .len = len };
+		bool own = w->window_sz2 == 11 && w->lookahead_sz2 == 4;
+		double ratio, mbs = 0;
+		esp_err_t err;
+
+		if (packed == NULL) {
+			printf("  FAIL: %s: mkpack.py failed\n", d->name);
+			return fails + 1;
+		}
+		heap_peak = 0;
+		err = _unpack(packed, packed_len, &sink, 0);
+		ratio = len ? (double) packed_len / len : 0;
+		if (len > 0) {
+			mbs = _bench(packed, packed_len, len);
+		}
+		printf("%-13s %2u/%u %6zu %6zu %5.1f%% %7.1f %6zu\n", d->name, w->window_sz2, w->lookahead_sz2, len,
+			   packed_len, 100 * ratio, mbs, heap_peak + sizeof(unpack_t));
+
+		if (err != ESP_OK || sink.mismatches || sink.at != len || sink.batches_too_big) {
+			printf("  FAIL: %s: %s, %zu of %zu bytes out, %d mismatched, %d batches over %d bytes\n", d->name,
+				   esp_err_to_name(err), sink.at, len, sink.mismatches, sink.batches_too_big, UNPACK_OUT_LEN);
+			fails++;
+		}
+		// The window is all the decoder allocates, and it's given back
+		if (heap_peak != (1u << w->window_sz2) || heap_now != 0) {
+			printf("  FAIL: %s: peak heap %zu for a %u byte window, %zu left\n", d->name, heap_peak,
+				   1u << w->window_sz2, heap_now);
+			fails++;
+		}
+		if (own && !_sha_matches(data, len)) {
+			printf("  FAIL: %s: mkpack.py's .sha256 isn't the input's\n", d->name);
+			fails++;
+		}
+		if (own && len > 0 && ratio > d->max_ratio) {
+			printf("  FAIL: %s: packed to %.1f%%, expected at most %.0f%%\n", d->name, 100 * ratio,
+				   100 * d->max_ratio);
+			fails++;
+		}
+		free(packed);
+	}
+	return fails;
+}
+
+static int _expect(const char *what, esp_err_t err, esp_err_t expected)
+{
+	printf("%-32s %s\n", what, esp_err_to_name(err));
+	if (err != expected) {
+		printf("  FAIL: expected %s\n", esp_err_to_name(expected));
+		return 1;
+	}
+	if (heap_now != 0) {
+		printf("  FAIL: %zu bytes not freed\n", heap_now);
+		return 1;
+	}
+	return 0;
+}
+
+static void _set_size(uint8_t *hdr, uint32_t size)
+{
+	for (int i = 0; i < 4; i++) {
+		hdr[8 + i] = size >> (8 * i);
+	}
+}
+
+static int _test_refused(void)
+{
+	static const window_t too_big = { CONFIG_OTA_UNPACK_MAX_WINDOW_SZ2 + 1, 4 };
+	static const window_t own = { 11, 4 };
+	size_t len = _make_text(data), packed_len;
+	uint8_t *packed, *bad;
+	sink_t sink;
+	int fails = 0;
+
+	if ((packed = _mkpack(data, len, &too_big, &packed_len)) == NULL) {
+		return 1;
+	}
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("window over the maximum", _unpack(packed, packed_len, &sink, 0), ESP_ERR_INVALID_STATE);
+	free(packed);
+
+	if ((packed = _mkpack(data, len, &own, &packed_len)) == NULL) {
+		return fails + 1;
+	}
+	bad = malloc(packed_len + 8);
+
+	memcpy(bad, packed, packed_len);
+	bad[0] = 'X';
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("bad magic", _unpack(bad, packed_len, &sink, 0), ESP_ERR_INVALID_STATE);
+
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("truncated", _unpack(packed, packed_len / 2, &sink, 0), ESP_ERR_INVALID_SIZE);
+
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("header only", _unpack(packed, UNPACK_HEADER_LEN - 1, &sink, 0), ESP_ERR_INVALID_SIZE);
+
+	// Bytes after the end of the stream, in the same piece as its last byte
+	memcpy(bad, packed, packed_len);
+	memset(bad + packed_len, 0x55, 8);
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("trailing bytes", _unpack(bad, packed_len + 8, &sink, packed_len + 8), ESP_ERR_INVALID_SIZE);
+
+	// Header says less than the stream holds
+	memcpy(bad, packed, packed_len);
+	_set_size(bad, len - 100);
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("size too small", _unpack(bad, packed_len, &sink, packed_len), ESP_ERR_INVALID_SIZE);
+
+	// And more
+	memcpy(bad, packed, packed_len);
+	_set_size(bad, len + 100);
+	sink = (sink_t) { .expect = data, .len = len };
+	fails += _expect("size too big", _unpack(bad, packed_len, &sink, 0), ESP_ERR_INVALID_SIZE);
+
+	// A flash write failing stops the unpacking
+	sink = (sink_t) { .expect = data, .len = len, .fail_with = ESP_ERR_TIMEOUT, .fail_at = len / 2 };
+	fails += _expect("sink error", _unpack(packed, packed_len, &sink, 0), ESP_ERR_TIMEOUT);
+
+	free(bad);
+	free(packed);
+	return fails;
+}
+
+int main(void)
+{
+	char cmd[64];
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	printf("decoder state %zu bytes\n", sizeof(unpack_t));
+	printf("%-13s %4s %6s %6s %6s %7s %6s\n", "data", "win", "in", "packed", "ratio", "MB/s", "heap");
+	for (size_t i = 0; i < sizeof(datasets) / sizeof(datasets[0]); i++) {
+		fails += _test_dataset(&datasets[i]);
+	}
+	printf("refused files\n");
+	fails += _test_refused();
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * test_wdt.c
+ *
+ * Notes:
+ * 		Runs the real wdt_task on simulated time. Every 100 ms of it the
+ * 		stand-in components check in on their usual schedule, until the
+ * 		scenario stalls one of them. esp_restart longjmps back here.
+ *
+ * 		Fails unless a stalled component resets the device within its
+ * 		timeout plus one check period (and not before), with the right
+ * 		reason in NVS, and a healthy, unfitted or standby one never does.
+ * 		One asleep on purpose (WDT_Expect) must not reset it while it
+ * 		sleeps, however long, but must once it's overdue to wake.
+ *
+ * 		When wdt_task itself stalls, the IDF task watchdog stand-in in
+ * 		host_rtos.c has to reset the device within its timeout. MQTT at
+ * 		QoS 0 never gets an ack, so there its progress comes from the
+ * 		real mqtt_if publish path: a publish the client takes must count,
+ * 		one it refuses must not.
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: tombo
+ */
+
+#define CONFIG_DATA_UPLOAD_PERIOD		60
+#define CONFIG_WDT_SENSOR_TIMEOUT_S		300
+#define CONFIG_WDT_MQTT_TIMEOUT_S		3600
+#define CONFIG_TASK_WDT_TIMEOUT_S		5
+#define CONFIG_MQTT_HOST				"127.0.0.1"
+#define CONFIG_MQTT_USERNAME			"test"
+#define CONFIG_MQTT_PASSWORD			"test"
+#define CONFIG_MQTT_KEEPALIVE_S			120
+#define CONFIG_MQTT_ROOT_TOPIC			"airu"
+#define CONFIG_MQTT_DATA_PUB_TOPIC		"pollution"
+#define CONFIG_MQTT_SUB_ALL_TOPIC		"all"
+#define CONFIG_MQTT_INFLIGHT_WINDOW		8
+#define CONFIG_MQTT_DATA_QOS			0
+#define CONFIG_MQTT_ACK_QOS				1
+#define CONFIG_MQTT_PONG_QOS			0
+#define CONFIG_INFLUX_MEASUREMENT_NAME	"airQuality"
+
+#include "../main/wdt_if.c"
+// Its QoS 0 publish path, with a TAG of its own
+#define TAG		mqtt_tag
+#include "../main/mqtt_if.c"
+#undef TAG
+
+#define TEST_S				1000000LL
+#define TEST_STALL_S		600			/* Everyone is armed and settled by then */
+#define TEST_RUN_S			(2 * 3600)	/* Give up (no reset) after */
+#define TEST_CHECK_US		(WDT_CHECK_PERIOD * portTICK_PERIOD_MS * 1000LL)
+#define TEST_STEP_US		100000LL
+#define TEST_SLEEP_S		(3 * CONFIG_WDT_SENSOR_TIMEOUT_S)	/* Longer than any timeout */
+#define TEST_TWDT_REASON	"task watchdog"		/* Panics, no reason in NVS */
+
+typedef enum {
+	STALL_NONE = 0,
+	STALL_ALL,			/* Loop hung: no reports at all */
+	STALL_PROGRESS,		/* Loop turns, no useful work */
+	STALL_STANDBY,		/* Disarmed on purpose, then quiet */
+	STALL_ASLEEP,		/* Quiet on purpose for TEST_SLEEP_S (WDT_Expect) */
+	STALL_MONITOR,		/* wdt_task itself stops */
+} stall_t;
+
+typedef struct {
+	const char *name;
+	wdt_component_t comp;
+	stall_t stall;
+	int64_t stall_s;
+	int64_t resume_s;			/* Standby or asleep: reports again at, 0: never */
+	const char *reason;			/* Expected reason prefix, NULL: no reset */
+	bool qos0;					/* MQTT progress only from QoS 0 publishes */
+} scenario_t;
+
+/* How each component checks in when healthy, in seconds. 0: never */
+static const struct {
+	int64_t alive_s;
+	int64_t progress_s;
+} schedule[WDT_COMPONENT_COUNT] = {
+	[WDT_DATA] = { CONFIG_DATA_UPLOAD_PERIOD, 0 },
+	[WDT_PM]   = { 0, 1 },
+	[WDT_GPS]  = { 0, 1 },
+	[WDT_MQTT] = { 5, 60 },
+	[WDT_WIFI] = { 10, 0 },
+};
+
+static const scenario_t scenarios[] = {
+	{ "all healthy",			WDT_DATA, STALL_NONE,     0,            0, NULL },
+	{ "gps not fitted",			WDT_GPS,  STALL_ALL,      0,            0, NULL },
+	{ "pm frames stop",			WDT_PM,   STALL_PROGRESS, TEST_STALL_S, 0, "pm progress" },
+	{ "pm task hangs",			WDT_PM,   STALL_ALL,      TEST_STALL_S, 0, "pm progress" },
+	{ "gps sentences stop",		WDT_GPS,  STALL_ALL,      TEST_STALL_S, 0, "gps progress" },
+	{ "data task hangs",		WDT_DATA, STALL_ALL,      TEST_STALL_S, 0, "data alive" },
+	{ "mqtt acks stop",			WDT_MQTT, STALL_PROGRESS, TEST_STALL_S, 0, "mqtt progress" },
+	{ "mqtt task hangs",		WDT_MQTT, STALL_ALL,      TEST_STALL_S, 0, "mqtt alive" },
+	{ "wifi task hangs",		WDT_WIFI, STALL_ALL,      TEST_STALL_S, 0, "wifi alive" },
+	{ "pm standby, back",		WDT_PM,   STALL_STANDBY,  TEST_STALL_S, TEST_STALL_S + 3 * CONFIG_WDT_SENSOR_TIMEOUT_S, NULL },
+	{ "pm standby, stays",		WDT_PM,   STALL_STANDBY,  TEST_STALL_S, 0, NULL },
+	{ "pm asleep, wakes",		WDT_PM,   STALL_ASLEEP,   TEST_STALL_S, TEST_STALL_S + TEST_SLEEP_S, NULL },
+	{ "pm asleep, no wake",		WDT_PM,   STALL_ASLEEP,   TEST_STALL_S, 0, "pm progress" },
+	{ "monitor stalls",			WDT_DATA, STALL_MONITOR,  TEST_STALL_S, 0, TEST_TWDT_REASON },
+	{ "mqtt at qos 0",			WDT_MQTT, STALL_NONE,     0,            0, NULL, true },
+	{ "mqtt qos 0 refused",		WDT_MQTT, STALL_PROGRESS, TEST_STALL_S, 0, "mqtt progress", true },
+};
+
+static const scenario_t *cur;
+static int64_t start_us;
+static int64_t last_us;			/* Last report the stalled component's timeout runs from */
+static int crumb = -1;
+static bool monitor_stuck;
+static bool publish_refused;	/* What esp_mqtt_client_publish does now */
+static jmp_buf reset_jmp, end_jmp;
+
+struct esp_mqtt_client {
+	int unused;
+};
+static struct esp_mqtt_client fake;
+
+const uint8_t ca_pem[] asm("_binary_ca_airu_pem_start") = "";
+char DEVICE_MAC[13] = "f4e5d6c7b8a9";
+int WIFI_MANAGER_STA_DISCONNECT_BIT = BIT4;
+
+
+void DIAG_Crumb(diag_kind_t kind, int32_t code)
+{
+	if (kind == DIAG_WDT) {
+		crumb = code;
+	}
+}
+
+void DIAG_Flush(bool force)
+{
+	(void) force;
+}
+
+/* The rest of the firmware, as far as mqtt_if calls it */
+void CMD_Initialize(void) {}
+esp_err_t CMD_Register(const cmd_t *cmd) { (void) cmd; return ESP_OK; }
+esp_err_t CMD_Submit(const char *data, int len) { (void) data; (void) len; return ESP_OK; }
+int CMD_Reply(const cmd_ctx_t *ctx, int qos, const char *msg) { (void) ctx; (void) qos; (void) msg; return 0; }
+void ota_set_request(const cmd_ctx_t *ctx, const char *fn) { (void) ctx; (void) fn; }
+void ota_trigger(void) {}
+bool ota_in_rollout(int pct) { (void) pct; return true; }
+void ota_health_report(EventBits_t bit) { (void) bit; }
+void DIAG_SetError(diag_src_t src, int32_t code) { (void) src; (void) code; }
+void DIAG_TaskRun(const char *name) { (void) name; }
+void DIAG_Publish(void) {}
+metric_t *METRICS_Register(const char *name, metric_type_t type) { (void) name; (void) type; return NULL; }
+void METRICS_Observe(metric_t *m, uint32_t value) { (void) m; (void) value; }
+void wifi_manager_check_connection_async(void) {}
+bool wifi_manager_have_internet(void) { return true; }
+EventBits_t wifi_manager_wait_internet_access(void) { return 0; }
+esp_err_t http_get_isp_info(char *json_buf, size_t len) { (void) json_buf; (void) len; return ESP_OK; }
+
+/* A connected client that takes QoS 0 publishes (msg_id 0) or refuses them */
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) { (void) config; return &fake; }
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t c) { (void) c; return ESP_OK; }
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t c) { (void) c; return ESP_OK; }
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t c, const char *topic, int qos)
+{
+	(void) c; (void) topic; (void) qos;
+	return 0;
+}
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t c, const char *topic, const char *data, int len, int qos,
+							int retain)
+{
+	(void) c; (void) topic; (void) data; (void) len; (void) qos; (void) retain;
+	return publish_refused ? -1 : 0;
+}
+
+/*
+* @brief	A component's useful work. MQTT at QoS 0 goes through mqtt_if,
+* 			which is what has to count it.
+*
+* @return	true if it counted as progress
+*/
+static bool _progress(wdt_component_t c, bool stalled)
+{
+	if (c == WDT_MQTT && cur->qos0) {
+		publish_refused = stalled;
+		return MQTT_Publish_General("airu/pollution/f4e5d6c7b8a9", "airQuality pm25=1", 0) >= 0;
+	}
+	if (stalled) {
+		return false;
+	}
+	WDT_Progress(c);
+	return true;
+}
+
+static bool _due(int64_t t, int64_t period_s)
+{
+	return period_s > 0 && t % (period_s * TEST_S) == 0;
+}
+
+/*
+* @brief	One 100 ms step of every component
+*/
+static void _tick(int64_t now_us)
+{
+	int64_t t = now_us - start_us;
+	bool stalled;
+
+	if (t >= TEST_RUN_S * TEST_S) {
+		longjmp(end_jmp, 1);
+	}
+
+	// wdt_task is in its vTaskDelay; stuck: it never comes back out
+	if (cur->stall == STALL_MONITOR && t >= cur->stall_s * TEST_S && !monitor_stuck) {
+		monitor_stuck = true;
+		last_us = now_us;
+		vTaskDelay(TEST_RUN_S * ONE_SECOND_DELAY);
+	}
+
+	for (int c = 0; c < WDT_COMPONENT_COUNT; c++) {
+		stalled = c == cur->comp && cur->stall != STALL_NONE && cur->stall != STALL_MONITOR &&
+				  t >= cur->stall_s * TEST_S;
+		if (stalled && cur->stall == STALL_STANDBY) {
+			if (t == cur->stall_s * TEST_S) {
+				WDT_Disarm(c);
+			}
+			stalled = cur->resume_s == 0 || t < cur->resume_s * TEST_S;
+		}
+		if (stalled && cur->stall == STALL_ASLEEP) {
+			// Its timeouts run from when it's due to wake
+			if (t == cur->stall_s * TEST_S) {
+				WDT_Expect(c, TEST_SLEEP_S);
+				last_us = now_us + TEST_SLEEP_S * TEST_S;
+			}
+			stalled = cur->resume_s == 0 || t < cur->resume_s * TEST_S;
+		}
+
+		if (_due(t, schedule[c].progress_s) && _progress(c, stalled)) {
+			last_us = (c == cur->comp && cur->stall != STALL_MONITOR) ? now_us : last_us;
+		}
+		else if (_due(t, schedule[c].alive_s ? schedule[c].alive_s : schedule[c].progress_s) &&
+				 (!stalled || cur->stall == STALL_PROGRESS)) {
+			WDT_Alive(c);
+			if (c == cur->comp && cur->stall != STALL_PROGRESS) {
+				last_us = now_us;
+			}
+		}
+	}
+}
+
+/*
+* @brief	The timeout a stall of this kind should trip, in seconds
+*/
+static uint32_t _timeout_s(const scenario_t *s)
+{
+	const wdt_entry_t *e = &entries[s->comp];
+
+	if (s->stall == STALL_MONITOR) {
+		return CONFIG_TASK_WDT_TIMEOUT_S;
+	}
+	if (s->stall == STALL_PROGRESS || e->alive_timeout_s == 0) {
+		return e->progress_timeout_s;
+	}
+	if (e->progress_timeout_s == 0 || e->alive_timeout_s < e->progress_timeout_s) {
+		return e->alive_timeout_s;
+	}
+	return e->progress_timeout_s;
+}
+
+static int _run(const scenario_t *s)
+{
+	static volatile bool reset;
+	static volatile int64_t reset_us;
+	char reason[WDT_REASON_LEN] = "";
+	size_t len = sizeof(reason);
+	nvs_handle handle;
+	int64_t lat_us = 0, min_us, max_us;
+	uint32_t timeout_s = 0;
+	int fails = 0, fired = host_twdt_fired;
+
+	for (int c = 0; c < WDT_COMPONENT_COUNT; c++) {
+		entries[c].armed = false;
+		entries[c].alive = entries[c].progress = 0;
+		entries[c].quiet_until_us = 0;
+	}
+	cur = s;
+	crumb = -1;
+	last_us = 0;
+	monitor_stuck = false;
+	publish_refused = false;
+	client = &fake;
+	client_connected = true;
+	reset = false;
+	start_us = esp_timer_get_time();
+
+	host_restart = &reset_jmp;
+	if (setjmp(reset_jmp)) {
+		reset = true;
+		reset_us = esp_timer_get_time();
+	}
+	else if (setjmp(end_jmp) == 0) {
+		wdt_task(NULL);
+	}
+	host_restart = NULL;
+
+	if (nvs_open(wdt_nvs_namespace, NVS_READWRITE, &handle) == ESP_OK) {
+		nvs_get_str(handle, "reason", reason, &len);
+		nvs_erase_key(handle, "reason");
+		nvs_close(handle);
+	}
+
+	if (reset && s->reason != NULL) {
+		timeout_s = _timeout_s(s);
+		lat_us = reset_us - last_us;
+	}
+	if (reset && host_twdt_fired > fired) {
+		strlcpy(reason, TEST_TWDT_REASON, sizeof(reason));
+	}
+	printf("%-20s %-14s %-22s %8.1f %8u\n", s->name, s->reason ? s->reason : "-",
+		   reset ? reason : "-", lat_us / (double) TEST_S, timeout_s);
+
+	if (s->reason == NULL) {
+		if (reset) {
+			printf("  FAIL: reset after %.1f s\n", (reset_us - start_us) / (double) TEST_S);
+			fails++;
+		}
+		return fails;
+	}
+	if (!reset) {
+		printf("  FAIL: no reset in %d s\n", TEST_RUN_S);
+		return 1;
+	}
+	if (strncmp(reason, s->reason, strlen(s->reason)) != 0) {
+		printf("  FAIL: reason \"%s\" in NVS\n", reason);
+		fails++;
+	}
+	if (s->stall == STALL_MONITOR) {
+		// Fed last at most one check period before it stuck, then the timer's next step
+		min_us = timeout_s * TEST_S - TEST_CHECK_US;
+		max_us = timeout_s * TEST_S + TEST_STEP_US;
+	}
+	else {
+		if (crumb != s->comp) {
+			printf("  FAIL: crumb %d, not %d\n", crumb, s->comp);
+			fails++;
+		}
+		// idle_s is whole seconds and has to exceed the timeout, then the next check sees it
+		min_us = timeout_s * TEST_S;
+		max_us = (timeout_s + 1) * TEST_S + TEST_CHECK_US;
+	}
+	if (lat_us <= min_us || lat_us > max_us) {
+		printf("  FAIL: detected after %.1f s, expected (%.1f, %.1f]\n", lat_us / (double) TEST_S,
+			   min_us / (double) TEST_S, max_us / (double) TEST_S);
+		fails++;
+	}
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+
+	host_log_level = ESP_LOG_NONE;
+	host_sim_start(TEST_S, _tick);
+
+	printf("%-20s %-14s %-22s %8s %8s\n", "scenario", "expected", "reason", "latency", "timeout");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		fails += _run(&scenarios[i]);
+	}
+
+	printf("\n%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}